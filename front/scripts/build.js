@@ -18,6 +18,7 @@ require('../config/env');
 const path = require('path');
 const chalk = require('react-dev-utils/chalk');
 const fs = require('fs-extra');
+const zlib = require('zlib');
 const bfj = require('bfj');
 const webpack = require('webpack');
 const configFactory = require('../config/webpack.config');
@@ -33,6 +34,9 @@ const measureFileSizesBeforeBuild =
 const printFileSizesAfterBuild = FileSizeReporter.printFileSizesAfterBuild;
 const useYarn = fs.existsSync(paths.yarnLockFile);
 
+// Assets the car serves gzipped, the others are already compressed
+const GZIP_EXTENSIONS = ['.html', '.js', '.css', '.json', '.svg', '.txt', '.ico'];
+
 // These sizes are pretty large. We'll warn for bundles exceeding them.
 const WARN_AFTER_BUNDLE_GZIP_SIZE = 512 * 1024;
 const WARN_AFTER_CHUNK_GZIP_SIZE = 1024 * 1024;
@@ -97,6 +101,8 @@ checkBrowsers(paths.appPath, isInteractive)
       );
       console.log();
 
+      compressBuildFolder(paths.appBuild);
+
       const appPackage = require(paths.appPackageJson);
       const publicUrl = paths.publicUrlOrPath;
       const publicPath = config.output.publicPath;
@@ -210,3 +216,26 @@ function copyPublicFolder() {
     filter: file => file !== paths.appHtml,
   });
 }
+
+// Write a .gz next to every compressible asset, the car serves it to the browsers accepting gzip
+function compressBuildFolder(folder) {
+  let before = 0;
+  let after = 0;
+  for (const name of fs.readdirSync(folder)) {
+    const file = path.join(folder, name);
+    if (!fs.statSync(file).isFile() || !GZIP_EXTENSIONS.includes(path.extname(name))) {
+      continue;
+    }
+    const content = fs.readFileSync(file);
+    const compressed = zlib.gzipSync(content, { level: zlib.constants.Z_BEST_COMPRESSION });
+    if (compressed.length >= content.length) {
+      continue;
+    }
+    fs.writeFileSync(file + '.gz', compressed);
+    before += content.length;
+    after += compressed.length;
+  }
+  console.log(
+    'Precompressed assets: ' + before + ' bytes, ' + after + ' bytes gzipped.\n'
+  );
+}
@@ -10,6 +10,9 @@ function App(){
           <li>
             <Link  to="/">Home</Link>
           </li>
+          <li>
+            <Link to="/drive">Drive</Link>
+          </li>
           <li>
             <Link to="/main_config">Main configuration</Link>
           </li>
@@ -7,6 +7,7 @@ import { BrowserRouter, Route, Routes } from 'react-router-dom';
 import { SupercarConfigForm } from './routes/main_config';
 import { MotorConfigForm } from './routes/motor_config';
 import { SupercarInfo } from './routes/main_info';
+import { Drive } from './routes/drive';
 
 ReactDOM.render(
   <React.StrictMode>
@@ -19,6 +20,7 @@ ReactDOM.render(
                   <SupercarInfo />
                 }
               />
+          <Route path="drive" element={<Drive />} />
           <Route path="main_config" element={<SupercarConfigForm />} />
           <Route path="motor_config" >
             <Route
@@ -38,7 +40,16 @@ ReactDOM.render(
   document.getElementById('root')
 );
 
-// If you want to start measuring performance in your app, pass a function
-// to log results (for example: reportWebVitals(console.log))
-// or send to an analytics endpoint. Learn more: https://bit.ly/CRA-vitals
-reportWebVitals();
+// Page load timings, to compare the gzipped and cached assets with the plain ones
+// (the car counts its side at /api/supercar/static). Learn more: https://bit.ly/CRA-vitals
+reportWebVitals(console.log);
+window.addEventListener('load', () => {
+  // loadEventEnd is only set once the load handlers returned
+  setTimeout(() => {
+    const [navigation] = performance.getEntriesByType('navigation');
+    if (navigation) {
+      console.log('Page load', Math.round(navigation.loadEventEnd), 'ms,',
+        navigation.transferSize, 'bytes transferred');
+    }
+  });
+});
@@ -0,0 +1,69 @@
+import { useForm } from "react-hook-form";
+import { useEffect, useState } from 'react';
+// Served by the car, whichever network it is on, npm start proxies them to it
+const BASE_URL = "/api/"
+
+/* Form of a configuration section, built from the field table of the car (supercar_config.def) */
+export function ConfigForm({ section, path }) {
+  const { register, handleSubmit, reset } = useForm();
+  const [schema, setSchema] = useState(null);
+  const url = BASE_URL + path;
+
+  const onSubmit = async (data) => {
+    try{
+      const result = await fetch(url, {
+        method: 'PUT',
+        headers: { 'Content-Type': 'application/json' },
+        body: JSON.stringify(data)
+      })
+      if(!result.ok){
+        console.error("The submit of the form data returned an error", result.status)
+        return
+      }
+      const answer = await result.json();
+      if(answer.invalid.length){
+        console.error("Rejected values, they were left unchanged", answer.invalid)
+      }
+      reset(answer.applied);
+    }catch(e){
+      console.error("Could not send form data", e);
+    }
+  }
+
+  useEffect(
+    () => {
+      async function fetchData () {
+        try{
+          const [schemaResult, result] = await Promise.all([fetch(BASE_URL + 'supercar/config/schema'), fetch(url)]);
+          if(!schemaResult.ok || !result.ok){
+            console.error("The response has an error", schemaResult.status, result.status)
+            return
+          }
+          const schemas = await schemaResult.json();
+          setSchema(schemas[section]);
+          reset(await result.json()); // asynchronously reset your form values
+        }catch(e){
+          console.error("Unable to get supercar " + section + " configuration")
+        }
+    }
+    fetchData()
+  }, [reset, section, url])
+
+  if(!schema){
+    return null;
+  }
+  return (
+    <form onSubmit={handleSubmit(onSubmit)}>
+      <fieldset>
+        {Object.entries(schema.properties).map(([name, field]) => (
+          <div key={name}>
+            <label>{field.title}{field.units ? " (" + field.units + ")" : ""}</label>
+            <input type="number" step={field.type === "integer" ? 1 : "any"} {...register(name, {
+              required: true, valueAsNumber: true, min: field.minimum, max: field.maximum })} />
+          </div>
+        ))}
+      </fieldset>
+      <input type="submit" />
+    </form>
+  );
+}
@@ -0,0 +1,136 @@
+
+import { useEffect, useRef, useState } from 'react';
+// Served by the car, whichever network it is on, npm start proxies them to it
+const DRIVE_URL = (window.location.protocol === "https:" ? "wss://" : "ws://") + window.location.host + "/ws/drive"
+const COMMAND_PERIOD = 50 // ms while the stick is held
+const IDLE_PERIOD = 500 // ms otherwise, keeps the round trip time fresh
+const RECONNECT_DELAY = 1000
+const PAD_SIZE = 240
+
+// Frames of supercar_drive.h, little endian
+const DRIVE_COMMAND = 1
+const DRIVE_ACK = 2
+const STATUS_NAMES = ["OK", "STALE", "BUSY", "INVALID"]
+
+function encodeCommand(seq, throttle, steer, sent) {
+  const view = new DataView(new ArrayBuffer(12))
+  view.setUint8(0, DRIVE_COMMAND)
+  view.setUint16(2, seq, true)
+  view.setInt8(4, throttle)
+  view.setInt8(5, steer)
+  view.setUint32(8, sent, true)
+  return view.buffer
+}
+
+function clamp(value) {
+  return Math.max(-100, Math.min(100, Math.round(value)))
+}
+
+export function Drive() {
+  const [stick, setStick] = useState({ throttle: 0, steer: 0 })
+  const [rtt, setRtt] = useState(null)
+  const [status, setStatus] = useState("DISCONNECTED")
+  const command = useRef({ throttle: 0, steer: 0, held: false })
+  const pad = useRef(null)
+  const releaseTimer = useRef(null)
+
+  useEffect(() => {
+    let socket
+    let reconnect
+    let timer
+    let closed = false
+    let seq = 0
+    let lastSent = 0
+
+    function send() {
+      const now = performance.now()
+      const { throttle, steer, held } = command.current
+      if (!socket || socket.readyState !== WebSocket.OPEN || (!held && now - lastSent < IDLE_PERIOD)) {
+        return
+      }
+      seq = (seq + 1) & 0xffff
+      lastSent = now
+      socket.send(encodeCommand(seq, throttle, steer, Math.floor(now) >>> 0))
+    }
+
+    function connect() {
+      socket = new WebSocket(DRIVE_URL)
+      socket.binaryType = "arraybuffer"
+      socket.onopen = () => setStatus("OK")
+      socket.onmessage = (event) => {
+        const view = new DataView(event.data)
+        if (view.byteLength < 12 || view.getUint8(0) !== DRIVE_ACK) {
+          return
+        }
+        const sent = view.getUint32(8, true)
+        const elapsed = ((Math.floor(performance.now()) >>> 0) - sent) >>> 0
+        // Smoothed, the readout would be unreadable otherwise
+        setRtt((current) => current === null ? elapsed : Math.round(current * 0.8 + elapsed * 0.2))
+        setStatus(STATUS_NAMES[view.getUint8(1)] || "UNKNOWN")
+      }
+      socket.onclose = () => {
+        setStatus("DISCONNECTED")
+        if (!closed) {
+          reconnect = setTimeout(connect, RECONNECT_DELAY)
+        }
+      }
+    }
+    connect()
+    timer = setInterval(send, COMMAND_PERIOD)
+
+    return () => {
+      closed = true
+      clearInterval(timer)
+      clearTimeout(reconnect)
+      socket.close()
+    }
+  }, [])
+
+  function move(event) {
+    if (!command.current.held) {
+      return
+    }
+    const rect = pad.current.getBoundingClientRect()
+    const x = (event.clientX - rect.left) / rect.width * 2 - 1
+    const y = (event.clientY - rect.top) / rect.height * 2 - 1
+    const next = { throttle: clamp(-y * 100), steer: clamp(x * 100) }
+    command.current = { ...next, held: true }
+    setStick(next)
+  }
+
+  function grab(event) {
+    pad.current.setPointerCapture(event.pointerId)
+    clearTimeout(releaseTimer.current)
+    command.current.held = true
+    move(event)
+  }
+
+  function release() {
+    // One last neutral command goes out with the next tick
+    command.current = { throttle: 0, steer: 0, held: true }
+    setStick({ throttle: 0, steer: 0 })
+    releaseTimer.current = setTimeout(() => { command.current.held = false }, COMMAND_PERIOD * 2)
+  }
+
+  const knob = {
+    left: (stick.steer / 100 + 1) / 2 * PAD_SIZE - 20,
+    top: (-stick.throttle / 100 + 1) / 2 * PAD_SIZE - 20,
+  }
+
+  return (
+    <div>
+      <div
+        ref={pad}
+        onPointerDown={grab}
+        onPointerMove={move}
+        onPointerUp={release}
+        onPointerCancel={release}
+        style={{ position: "relative", width: PAD_SIZE, height: PAD_SIZE, margin: "1rem auto",
+          borderRadius: "50%", background: "#ddd", touchAction: "none" }}>
+        <div style={{ position: "absolute", width: 40, height: 40, borderRadius: "50%", background: "#282c34", ...knob }} />
+      </div>
+      <p>Throttle {stick.throttle} / Steering {stick.steer}</p>
+      <p>{status} {rtt === null ? "" : `- round trip ${rtt} ms`}</p>
+    </div>
+  );
+}
@@ -1,6 +1,25 @@
 
 import { useEffect, useState } from 'react';
-const BASE_URL = "http://10.0.0.120/api/"
+// Served by the car, whichever network it is on, npm start proxies them to it
+const TELEMETRY_URL = (window.location.protocol === "https:" ? "wss://" : "ws://") + window.location.host + "/ws/telemetry"
+const TELEMETRY_RATE = 10 // Hz
+const RECONNECT_DELAY = 1000
+
+// The server only sends the members that changed
+function mergeDelta(state, delta) {
+  const merged = delta.full ? {} : { ...state }
+  for (const [key, value] of Object.entries(delta)) {
+    if (key === "full") {
+      continue
+    }
+    if (value !== null && typeof value === "object" && !Array.isArray(value)) {
+      merged[key] = mergeDelta(merged[key] || {}, value)
+    } else {
+      merged[key] = value
+    }
+  }
+  return merged
+}
 
 export function SupercarInfo() {
 
@@ -8,22 +27,35 @@ export function SupercarInfo() {
 
   useEffect(
     () => {
-      async function fetchData () {
-        try{
-          const result = await fetch(BASE_URL +'supercar');
-          if(!result.ok){
-            console.error("The response has an error", result.status)
-            return
-          }
-          const json = await result.json();
+      let socket
+      let reconnect
+      let closed = false
 
-          setSupercar(json); // asynchronously reset your form values
-        }catch(e){
-          console.error("Unable to get supercar configuration")
+      function connect() {
+        socket = new WebSocket(TELEMETRY_URL)
+        socket.onopen = () => socket.send(JSON.stringify({ rate: TELEMETRY_RATE }))
+        socket.onmessage = (event) => {
+          try{
+            const delta = JSON.parse(event.data)
+            setSupercar((current) => mergeDelta(current, delta))
+          }catch(e){
+            console.error("Unable to parse the supercar telemetry")
+          }
         }
-    }
-    fetchData()
-  }, [supercar])
+        socket.onclose = () => {
+          if(!closed){
+            reconnect = setTimeout(connect, RECONNECT_DELAY)
+          }
+        }
+      }
+      connect()
+
+      return () => {
+        closed = true
+        clearTimeout(reconnect)
+        socket.close()
+      }
+  }, [])
 
   return (
 
@@ -31,4 +63,4 @@ export function SupercarInfo() {
       {supercar.power ? "ON" : "OFF"}
     </div>
   );
-}
\ No newline at end of file
+}
@@ -15,6 +15,7 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "esp_bt.h"
 #include "esp_bt_defs.h"
@@ -28,10 +29,14 @@
 #include "esp_hidh.h"
 #include "esp_hid_gap.h"
 #include "esp_hid_host.h"
+#include "supercar_coex.h"
+#include "supercar_tasks.h"
+#include "supercar_rtc.h"
 
 static const char *TAG = "ESP_HIDH";
 
-const char *dpad_input_names[] = { "none", "up", "up-right", "right", "down-right", "down","down-left","left","up-left" };
+/* Gamepad being opened, kept for a warm reset once it is connected */
+static supercar_rtc_controller_t opening;
 
 void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id, void *event_data)
 {
@@ -39,9 +44,10 @@ void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id, void *
     esp_hidh_event_t event = (esp_hidh_event_t)id;
     esp_hidh_event_data_t *param = (esp_hidh_event_data_t *)event_data;
     
-    xbox_input_event_t xbox_event = {
+    gamepad_input_event_t gamepad_event = {
         .report = {0},
-        .type = event
+        .type = event,
+        .timestamp = esp_timer_get_time()
     };
 
     switch (event) {
@@ -49,6 +55,11 @@ void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id, void *
         if (param->open.status == ESP_OK) {
             const uint8_t *bda = esp_hidh_dev_bda_get(param->open.dev);
             ESP_LOGI(TAG, ESP_BD_ADDR_STR " OPEN: %s", ESP_BD_ADDR_HEX(bda), esp_hidh_dev_name_get(param->open.dev));
+            gamepad_open(param->open.dev);
+            if (memcmp(opening.bda, bda, sizeof(opening.bda)) == 0) {
+                supercar_rtc_set_controller(&opening);
+            }
+            supercar_rtc_controller_opened();
         } else {
             esp_hidh_dev_dump(param->open.dev, stdout);
             ESP_LOGE(TAG, " OPEN failed!");
@@ -61,43 +72,12 @@ void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id, void *
         break;
     }
     case ESP_HIDH_INPUT_EVENT: {
+        supercar_coex_hid_report();
         const uint8_t *bda = esp_hidh_dev_bda_get(param->input.dev);
         ESP_LOGV(TAG, ESP_BD_ADDR_STR " INPUT: %8s, MAP: %2u, ID: %3u, Len: %d, Data:", ESP_BD_ADDR_HEX(bda), esp_hid_usage_str(param->input.usage), param->input.map_index, param->input.report_id, param->input.length);
-        if(param->input.report_id == 1 && param->input.length == 15){
-            xbox_input_report_t* xbox = (xbox_input_report_t*) param->input.data;
-            /*char* buttons = calloc(64, sizeof(char));
-            strcat(buttons, "[");
-            if(xbox->a){
-                strcat(buttons, "a");
-            }
-            if(xbox->b){
-                strcat(buttons, "b");
-            }
-            if(xbox->x){
-                strcat(buttons, "x");
-            }
-            if(xbox->y){
-                strcat(buttons, "y");
-            }
-            if(xbox->lb){
-                strcat(buttons, "lb");
-            }
-            if(xbox->rb){
-                strcat(buttons, "rb");
-            }
-            if(xbox->select){
-                strcat(buttons, "select");
-            }
-            if(xbox->menu){
-                strcat(buttons, "menu");
-            }
-            strcat(buttons, "]");
-            ESP_LOGI(TAG, "LX : %d, LY : %d, RX : %d, RY : %d, RT : %d, LT : %d, DPad : %s, Buttons : %s\n", 
-                xbox->lx, xbox->ly, xbox->rx, xbox->ry, xbox->rt, xbox->lt, dpad_input_names[xbox->dpad], buttons);
-            free(buttons);*/
-            xbox_event.report = *xbox;
-        }else{
-            //ESP_LOG_BUFFER_HEX(TAG, param->input.data, param->input.length);
+        if(!gamepad_decode(param->input.dev, param->input.map_index, param->input.report_id, param->input.data, param->input.length, &gamepad_event.report)){
+            // Not a gamepad report (battery, vendor...), nothing for the car
+            return;
         }
         break;
     }
@@ -112,21 +92,38 @@ void hidh_callback(void *handler_args, esp_event_base_t base, int32_t id, void *
     case ESP_HIDH_CLOSE_EVENT: {
         const uint8_t *bda = esp_hidh_dev_bda_get(param->close.dev);
         ESP_LOGI(TAG, ESP_BD_ADDR_STR " CLOSE: %s", ESP_BD_ADDR_HEX(bda), esp_hidh_dev_name_get(param->close.dev));
+        gamepad_close(param->close.dev);
         break;
     }
     default:
         ESP_LOGI(TAG, "EVENT: %d", event);
         break;
     }
-    xQueueSend(car->remote_events, &xbox_event, 100 / portTICK_PERIOD_MS);
+    xQueueSend(car->remote_events, &gamepad_event, 100 / portTICK_PERIOD_MS);
 }
 
 #define SCAN_DURATION_SECONDS 5
 
+static bool hid_open(const supercar_rtc_controller_t* controller)
+{
+    opening = *controller;
+    return esp_hidh_dev_open(opening.bda, opening.transport, opening.addr_type) != NULL;
+}
+
 void hid_task(void* param)
 {
     size_t results_len = 0;
     esp_hid_scan_result_t *results = NULL;
+    supercar_rtc_controller_t known;
+    if (supercar_rtc_warm() && supercar_rtc_get_controller(&known)) {
+        // Connected before the reset, no need to scan for it again
+        ESP_LOGI(TAG, "Reopening " ESP_BD_ADDR_STR, ESP_BD_ADDR_HEX(known.bda));
+        if (hid_open(&known)) {
+            supercar_task_exit(SUPERCAR_TASK_HID);
+            return;
+        }
+        ESP_LOGW(TAG, "Could not reopen the gamepad, scanning");
+    }
     ESP_LOGI(TAG, "SCAN...");
     //start scan for HID devices
     esp_hid_scan(SCAN_DURATION_SECONDS, &results_len, &results);
@@ -161,27 +158,22 @@ void hid_task(void* param)
         }
         if (cr) {
             //open the last result
-            esp_hidh_dev_open(cr->bda, cr->transport, cr->ble.addr_type);
+            supercar_rtc_controller_t controller = { .transport = cr->transport, .addr_type = cr->ble.addr_type };
+            memcpy(controller.bda, cr->bda, sizeof(controller.bda));
+            hid_open(&controller);
         }
         //free the results
         esp_hid_scan_results_free(results);
     }
-    vTaskDelete(NULL);
+    supercar_task_exit(SUPERCAR_TASK_HID);
 }
 
 void init_hid_host(supercar_t* car)
 {
-    esp_err_t ret;
 #if HID_HOST_MODE == HIDH_IDLE_MODE
     ESP_LOGE(TAG, "Please turn on BT HID host or BLE!");
     return;
 #endif
-    ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK( ret );
     ESP_LOGI(TAG, "setting hid gap, mode:%d", HID_HOST_MODE);
     ESP_ERROR_CHECK( esp_hid_gap_init(HID_HOST_MODE) );
 #if CONFIG_BT_BLE_ENABLED
@@ -194,5 +186,5 @@ void init_hid_host(supercar_t* car)
     };
     ESP_ERROR_CHECK( esp_hidh_init(&config) );
 
-    xTaskCreate(&hid_task, "hid_task", 6 * 1024, car, 2, NULL);
+    supercar_task_create(SUPERCAR_TASK_HID, &hid_task, car, NULL);
 }
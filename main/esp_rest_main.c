@@ -12,14 +12,17 @@
 #include "esp_vfs_fat.h"
 #include "esp_spiffs.h"
 #include "sdmmc_cmd.h"
-#include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "mdns.h"
 #include "lwip/apps/netbiosns.h"
 #include "protocol_examples_common.h"
 #include "supercar_main.h"
+#include "supercar_www.h"
+#include "supercar_wifi.h"
+#include "supercar_snapshot.h"
 #if CONFIG_EXAMPLE_WEB_DEPLOY_SD
 #include "driver/sdmmc_host.h"
 #endif
@@ -28,7 +31,7 @@
 
 static const char *TAG = "example";
 
-esp_err_t start_rest_server(const char *base_path, supercar_t* car);
+esp_err_t start_rest_server(const char *base_path, uint32_t mount_us, supercar_t* car);
 
 static void initialise_mdns(void)
 {
@@ -124,16 +127,48 @@ esp_err_t init_fs(void)
 }
 #endif
 
-void start_rest_main(supercar_t* car)
+#if CONFIG_EXAMPLE_WEB_DEPLOY_ARCHIVE
+esp_err_t init_fs(void)
+{
+    /* No filesystem, the archive index is read where it lies in flash */
+    return supercar_www_mount();
+}
+#endif
+
+esp_err_t supercar_network_start(supercar_t* car)
 {
-    ESP_ERROR_CHECK(nvs_flash_init());
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    esp_err_t err = esp_netif_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK) {
+        return err;
+    }
     initialise_mdns();
     netbiosns_init();
     netbiosns_set_name(CONFIG_EXAMPLE_MDNS_HOST_NAME);
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    // A station blocks until the access point gives an address, the car already drives
+    return supercar_wifi_start(snapshot.cfg.wifi_mode);
+}
 
-    ESP_ERROR_CHECK(example_connect());
-    ESP_ERROR_CHECK(init_fs());
-    ESP_ERROR_CHECK(start_rest_server(CONFIG_EXAMPLE_WEB_MOUNT_POINT, car));
+static uint32_t www_mount_us;
+
+esp_err_t supercar_www_start(supercar_t* car)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = init_fs();
+    if (err != ESP_OK) {
+        return err;
+    }
+    www_mount_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "Web files ready in %u us", www_mount_us);
+    return ESP_OK;
+}
+
+esp_err_t supercar_web_start(supercar_t* car)
+{
+    return start_rest_server(CONFIG_EXAMPLE_WEB_MOUNT_POINT, www_mount_us, car);
 }
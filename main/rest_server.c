@@ -7,14 +7,31 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 #include <string.h>
+#include <stdlib.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <sys/stat.h>
 #include "esp_http_server.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_vfs.h"
-#include "cJSON.h"
+#include "esp_timer.h"
 #include "supercar_main.h"
 #include "supercar_config.h"
+#include "supercar_coex.h"
+#include "supercar_sched.h"
+#include "supercar_tasks.h"
+#include "supercar_persist.h"
+#include "supercar_boot.h"
+#include "supercar_rtc.h"
+#include "supercar_bench.h"
+#include "supercar_snapshot.h"
+#include "supercar_telemetry.h"
+#include "supercar_json.h"
+#include "supercar_www.h"
+#include "supercar_http.h"
+#include "supercar_drive.h"
+#include "supercar_wifi.h"
 
 static const char *REST_TAG = "esp-rest";
 #define REST_CHECK(a, str, goto_tag, ...)                                              \
@@ -28,18 +45,37 @@ static const char *REST_TAG = "esp-rest";
     } while (0)
 
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
-#define SCRATCH_BUFSIZE (10240)
+#define QUERY_MAX 128
+#define ASSET_HASH_LEN 8            // The build appends [contenthash:8] to the names of the bundles and media
+
+/* The server needs 3 sockets of its own, the captive portal DNS and the benchmarks one each */
+_Static_assert(CONFIG_SUPERCAR_HTTP_MAX_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS - 5, "Raise LWIP_MAX_SOCKETS or lower SUPERCAR_HTTP_MAX_SOCKETS");
+
+/* What the static files cost, to compare page loads */
+typedef struct {
+    uint32_t requests;
+    uint32_t not_modified;          // Answered with a 304 without opening the file
+    uint32_t gzip;                  // Served from the precompressed variant
+    uint64_t bytes;                 // Body bytes sent
+    uint64_t send_us;               // Time from the request to the end of the body, lookup included
+    uint32_t max_send_us;
+    uint32_t mount_us;              // Time the web files took to be available at boot
+} rest_static_stats_t;
 
 typedef struct rest_server_context {
     char base_path[ESP_VFS_PATH_MAX + 1];
-    char scratch[SCRATCH_BUFSIZE];
+    char scratch[SUPERCAR_HTTP_BUFSIZE];   // When the pool is empty, only used from the handlers which run one at a time
+    supercar_config_load_t load;        // PUT body being parsed, the handlers run one at a time
+    char query[QUERY_MAX];
+    char fields[QUERY_MAX];             // Split in place, the selection points into it
+    uint32_t boot_id;                   // Keeps the ETags of a previous boot from matching
+    rest_static_stats_t statics;
     supercar_t* car;
 } rest_server_context_t;
 
 #define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
 
-/* Set HTTP response content type according to file extension */
-static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepath)
+static const char* rest_content_type(const char *filepath)
 {
     const char *type = "text/plain";
     if (CHECK_FILE_EXTENSION(filepath, ".html")) {
@@ -55,43 +91,292 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
     } else if (CHECK_FILE_EXTENSION(filepath, ".svg")) {
         type = "image/svg+xml";
     }
-    return httpd_resp_set_type(req, type);
+    return type;
+}
+
+/* Set HTTP response content type according to file extension */
+static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepath)
+{
+    return httpd_resp_set_type(req, rest_content_type(filepath));
+}
+
+/* The connection buffer, or the shared one when the pool is empty so the API keeps answering */
+static char* rest_buffer(httpd_req_t *req)
+{
+    rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+    char* buf = supercar_http_buffer(req);
+    return buf ? buf : rest_context->scratch;
+}
+
+/* Ask the client to come back later, the radio is busy with the gamepad */
+static esp_err_t rest_send_deferred(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+}
+
+/* Whether the client already has this version, a list of tags or * may be sent */
+static bool rest_etag_matches(httpd_req_t *req, const char* etag)
+{
+    char value[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    return strstr(value, etag) != NULL || strcmp(value, "*") == 0;
 }
 
-/* Send HTTP response with the contents of the requested file */
+/* The bundles and media carry a content hash in their name ("main.1a2b3c4d.chunk.js"), they never change */
+static bool rest_is_hashed_asset(const char *filepath)
+{
+    const char *segment = strrchr(filepath, '/');
+    segment = segment ? segment + 1 : filepath;
+    while ((segment = strchr(segment, '.')) != NULL) {
+        segment++;
+        int len = 0;
+        while (isxdigit((unsigned char)segment[len])) {
+            len++;
+        }
+        if (len == ASSET_HASH_LEN && segment[len] == '.') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool rest_accepts_gzip(httpd_req_t *req)
+{
+    char value[64];
+    /* A truncated value still holds the first encodings, where gzip is */
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept-Encoding", value, sizeof(value));
+    return (err == ESP_OK || err == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(value, "gzip") != NULL;
+}
+
+/* Cache headers of a static file, true once the 304 went out because the client copy is current */
+static bool rest_static_not_modified(httpd_req_t *req, bool hashed, const char* etag)
+{
+    rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+    if (hashed) {
+        httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
+        return false;
+    }
+    /* index.html names the bundles of the current build, the browser revalidates it every time */
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (!rest_etag_matches(req, etag)) {
+        return false;
+    }
+    rest_context->statics.not_modified++;
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
+
+/* httpd_resp_set_hdr only applies to responses sent from the handler, the sender task gets them written out */
+static size_t rest_static_header(char *buf, const char *filepath, size_t size, bool hashed, const char *etag, bool vary, bool gzip)
+{
+    return snprintf(buf, SUPERCAR_HTTP_BUFSIZE,
+                    "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\nCache-Control: %s\r\n%s%s%s%s%s\r\n",
+                    rest_content_type(filepath), (unsigned)size,
+                    hashed ? "public, max-age=31536000, immutable" : "no-cache",
+                    hashed ? "" : "ETag: ", hashed ? "" : etag, hashed ? "" : "\r\n",
+                    vary ? "Vary: Accept-Encoding\r\n" : "", gzip ? "Content-Encoding: gzip\r\n" : "");
+}
+
+static void rest_static_sent(rest_static_stats_t *stats, int64_t start)
+{
+    uint32_t elapsed = esp_timer_get_time() - start;
+    stats->send_us += elapsed;
+    if (elapsed > stats->max_send_us) {
+        stats->max_send_us = elapsed;
+    }
+}
+
+/* The phones probe a page of their vendor when they join the access point, the redirect makes them show the web UI */
+static bool rest_redirect_portal(httpd_req_t *req)
+{
+    if (!supercar_wifi_captive()) {
+        return false;
+    }
+    httpd_resp_set_status(req, "302 Found");
+    httpd_resp_set_hdr(req, "Location", supercar_wifi_portal_url());
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
+
+#if CONFIG_EXAMPLE_WEB_DEPLOY_ARCHIVE
+/* Send the file straight from the mapped archive, in one piece with its length */
+static esp_err_t rest_common_get_handler(httpd_req_t *req)
+{
+    char path[FILE_PATH_MAX];
+    char etag[24];
+    supercar_www_file_t file;
+
+    if (!supercar_coex_http_admit()) {
+        return rest_send_deferred(req);
+    }
+
+    rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+    rest_static_stats_t *stats = &rest_context->statics;
+    int64_t start = esp_timer_get_time();
+    stats->requests++;
+    strlcpy(path, req->uri, sizeof(path));
+    path[strcspn(path, "?#")] = '\0';
+    if (path[strlen(path) - 1] == '/') {
+        strlcat(path, "index.html", sizeof(path));
+    }
+    if (!supercar_www_find(path, &file)) {
+        supercar_coex_http_done();
+        if (rest_redirect_portal(req)) {
+            return ESP_OK;
+        }
+        ESP_LOGE(REST_TAG, "No such file : %s", path);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such file");
+        return ESP_FAIL;
+    }
+
+    set_content_type_from_file(req, path);
+    bool hashed = rest_is_hashed_asset(path);
+    const void* data = file.data;
+    size_t size = file.size;
+    bool gzip = false;
+    if (file.gz_data) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        gzip = rest_accepts_gzip(req);
+    }
+    snprintf(etag, sizeof(etag), "\"%08x%s\"", file.crc, gzip ? "-gz" : "");
+    if (rest_static_not_modified(req, hashed, etag)) {
+        supercar_coex_http_done();
+        return ESP_OK;
+    }
+    if (gzip) {
+        stats->gzip++;
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        data = file.gz_data;
+        size = file.gz_size;
+    }
+
+    /* The bundles go out from the sender task, the server task stays free for the API */
+    char* buf;
+    if (size >= CONFIG_SUPERCAR_HTTP_ASYNC_MIN_SIZE && (buf = supercar_http_buffer(req)) != NULL) {
+        size_t header_len = rest_static_header(buf, path, size, hashed, etag, file.gz_data != NULL, gzip);
+        if (supercar_http_send_async(req, header_len, data, size, -1) != ESP_OK) {
+            /* The sender did not take it, the admission ends here */
+            supercar_coex_http_done();
+            return rest_send_deferred(req);
+        }
+        stats->bytes += size;
+        return ESP_OK;
+    }
+
+    supercar_coex_http_sent(size);
+    esp_err_t err = httpd_resp_send(req, data, size);
+    supercar_coex_http_done();
+    if (err == ESP_OK) {
+        stats->bytes += size;
+        rest_static_sent(stats, start);
+    }
+    return err;
+}
+#else
+/* Send HTTP response with the contents of the requested file, the .gz variant when the build made one */
 static esp_err_t rest_common_get_handler(httpd_req_t *req)
 {
     char filepath[FILE_PATH_MAX];
+    char etag[24];
+    struct stat st;
+
+    if (!supercar_coex_http_admit()) {
+        return rest_send_deferred(req);
+    }
 
     rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+    rest_static_stats_t *stats = &rest_context->statics;
+    int64_t start = esp_timer_get_time();
+    stats->requests++;
     strlcpy(filepath, rest_context->base_path, sizeof(filepath));
     if (req->uri[strlen(req->uri) - 1] == '/') {
         strlcat(filepath, "/index.html", sizeof(filepath));
     } else {
         strlcat(filepath, req->uri, sizeof(filepath));
     }
-    
+
+    /* Typed and cached after the original name, the variant only changes the encoding */
+    set_content_type_from_file(req, filepath);
+    bool hashed = rest_is_hashed_asset(filepath);
+
+    size_t len = strlen(filepath);
+    bool gzip = false;
+    bool vary = false;
+    if (len + 3 < sizeof(filepath)) {
+        strcpy(filepath + len, ".gz");
+        if (stat(filepath, &st) == 0) {
+            vary = true;
+            httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+            gzip = rest_accepts_gzip(req);
+        }
+        if (!gzip) {
+            filepath[len] = '\0';
+        }
+    }
+    if (!gzip && stat(filepath, &st) != 0) {
+        supercar_coex_http_done();
+        if (rest_redirect_portal(req)) {
+            return ESP_OK;
+        }
+        ESP_LOGE(REST_TAG, "Failed to open file : %s", filepath);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+        return ESP_FAIL;
+    }
+
+    snprintf(etag, sizeof(etag), "\"%lx-%lx%s\"", (unsigned long)st.st_size, (unsigned long)st.st_mtime, gzip ? "-gz" : "");
+    if (rest_static_not_modified(req, hashed, etag)) {
+        supercar_coex_http_done();
+        return ESP_OK;
+    }
+    if (gzip) {
+        stats->gzip++;
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+
     int fd = open(filepath, O_RDONLY, 0);
     if (fd == -1) {
         ESP_LOGE(REST_TAG, "Failed to open file : %s", filepath);
+        supercar_coex_http_done();
         /* Respond with 500 Internal Server Error */
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
         return ESP_FAIL;
     }
 
-    set_content_type_from_file(req, filepath);
-
-    char *chunk = rest_context->scratch;
+    /* Large files are read and sent by the sender task, through the connection buffer */
+    char *chunk = supercar_http_buffer(req);
+    if (chunk && st.st_size >= CONFIG_SUPERCAR_HTTP_ASYNC_MIN_SIZE) {
+        size_t header_len = rest_static_header(chunk, filepath, st.st_size, hashed, etag, vary, gzip);
+        if (supercar_http_send_async(req, header_len, NULL, st.st_size, fd) != ESP_OK) {
+            close(fd);
+            supercar_coex_http_done();
+            return rest_send_deferred(req);
+        }
+        stats->bytes += st.st_size;
+        return ESP_OK;
+    }
+    if (!chunk) {
+        chunk = rest_context->scratch;
+    }
     ssize_t read_bytes;
     do {
-        /* Read file in chunks into the scratch buffer */
-        read_bytes = read(fd, chunk, SCRATCH_BUFSIZE);
+        /* Read file in chunks into the buffer */
+        read_bytes = read(fd, chunk, SUPERCAR_HTTP_BUFSIZE);
         if (read_bytes == -1) {
             ESP_LOGE(REST_TAG, "Failed to read file : %s", filepath);
         } else if (read_bytes > 0) {
+            supercar_coex_http_sent(read_bytes);
             /* Send the buffer contents as HTTP response chunk */
             if (httpd_resp_send_chunk(req, chunk, read_bytes) != ESP_OK) {
                 close(fd);
+                supercar_coex_http_done();
                 ESP_LOGE(REST_TAG, "File sending failed!");
                 /* Abort sending file */
                 httpd_resp_sendstr_chunk(req, NULL);
@@ -99,143 +384,438 @@ static esp_err_t rest_common_get_handler(httpd_req_t *req)
                 httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
                 return ESP_FAIL;
             }
+            stats->bytes += read_bytes;
         }
     } while (read_bytes > 0);
     /* Close file after sending complete */
     close(fd);
+    supercar_coex_http_done();
     ESP_LOGI(REST_TAG, "File sending complete");
     /* Respond with an empty chunk to signal HTTP response completion */
     httpd_resp_send_chunk(req, NULL, 0);
+    rest_static_sent(stats, start);
     return ESP_OK;
 }
+#endif
+
+static void supercar_add_motor_json(supercar_json_t* node, const char* name, const char* motor_name, supercar_motor_snapshot_t* mctl){
+    supercar_json_begin_object(node, name);
+    supercar_json_int(node, "start_time", mctl->start_time);
+    supercar_json_bool(node, "start_flag", mctl->start_flag);
+    supercar_json_number(node, "duty_cycle", mctl->duty_cycle);
+    supercar_json_string(node, "direction", mctl->direction == MOTOR_LEFT ? "LEFT" : "RIGHT");
+    supercar_json_number(node, "expt", mctl->expt);
+    supercar_json_string(node, "name", motor_name);
+    supercar_json_begin_object(node, "cfg");
+    supercar_serialize_motor_config(node, &mctl->cfg);
+    supercar_json_end_object(node);
+    supercar_json_begin_object(node, "reconfig");
+    supercar_json_bool(node, "pending", mctl->reconfiguring);
+    supercar_json_int(node, "count", mctl->reconfig.count);
+    supercar_json_int(node, "ramp_us", mctl->reconfig.ramp_us);
+    supercar_json_int(node, "reprogram_us", mctl->reconfig.reprogram_us);
+    supercar_json_int(node, "downtime_us", mctl->reconfig.downtime_us);
+    supercar_json_int(node, "max_downtime_us", mctl->reconfig.max_downtime_us);
+    supercar_json_end_object(node);
+    supercar_json_end_object(node);
+}
+
 
-static void supercar_add_motor_json(cJSON* node, const char* name, supercar_motor_control_t* mctl){
-    cJSON* motor_json = cJSON_AddObjectToObject(node, name);
-    cJSON_AddNumberToObject(motor_json, "start_time", mctl->start_time);
-    cJSON_AddBoolToObject(motor_json, "start_flag", mctl->start_flag);
-    cJSON_AddNumberToObject(motor_json, "duty_cycle", mctl->duty_cycle);
-    cJSON_AddStringToObject(motor_json, "direction", mctl->direction == MOTOR_LEFT ? "LEFT" : "RIGHT");
-    cJSON_AddNumberToObject(motor_json, "expt", mctl->expt);
-    cJSON_AddStringToObject(motor_json, "name", mctl->name);
-    cJSON* cfg = cJSON_AddObjectToObject(motor_json, "cfg");
-   supercar_serialize_motor_config(cfg, mctl);
+/* Simple handler for getting system handler, works on a snapshot so the state is never torn */
+static void supercar_serialize(supercar_json_t* node, supercar_t* car)
+{
+    supercar_snapshot_t snap;
+    supercar_snapshot_read(&snap);
+    supercar_json_int(node, "version", snap.version);
+    supercar_json_bool(node, "power", snap.power);
+    if (supercar_json_wants(node, "propulsion_motor_ctrl")) {
+        supercar_add_motor_json(node, "propulsion_motor_ctrl", car->propulsion_motor_ctrl.name, &snap.propulsion);
+    }
+    if (supercar_json_wants(node, "steering_motor_ctrl")) {
+        supercar_add_motor_json(node, "steering_motor_ctrl", car->steering_motor_ctrl.name, &snap.steering_motor);
+    }
+    supercar_json_string(node, "mode", snap.mode == MOTION ? "MOTION" : "SWAY");
+    supercar_json_string(node, "applied_mode", snap.applied_mode == MOTION ? "MOTION" : "SWAY");
+    supercar_json_string(node, "state", snap.state_name);
+    supercar_json_string(node, "profile", supercar_profile_name(snap.profile));
+    supercar_json_int(node, "max_speed", snap.max_speed);
+    supercar_json_string(node, "control_type", snap.control_type == LOCAL ? "LOCAL" : "REMOTE");
+    supercar_json_string(node, "steering", snap.steering == STEER_NONE ? "NONE" : (snap.steering == STEER_LEFT ? "LEFT" : "RIGHT"));
+    supercar_json_bool(node, "reverse_direction", snap.reverse_direction);
+    supercar_json_bool(node, "reverse_mode", snap.reverse_mode);
+    supercar_json_string(node, "running", snap.running == DIRECTION_NONE ? "NONE" : (snap.running == DIRECTION_FORWARD ? "FORWARD" : "BACKWARD"));
+    if (supercar_json_wants(node, "distance")) {
+        supercar_json_begin_object(node, "distance");
+        supercar_json_number(node, "front_left", snap.distance.front_left);
+        supercar_json_number(node, "front_right", snap.distance.front_right);
+        supercar_json_number(node, "back_left", snap.distance.back_left);
+        supercar_json_number(node, "back_right", snap.distance.back_right);
+        supercar_json_end_object(node);
+    }
+    if (supercar_json_wants(node, "cfg")) {
+        supercar_json_begin_object(node, "cfg");
+        supercar_serialize_config_values(node, &snap.cfg);
+        supercar_json_end_object(node);
+    }
 }
 
+/* Sends what the writer produced so far as one chunk, only when the document is larger than the buffer */
+static esp_err_t rest_send_json_chunk(void* arg, const char* data, size_t len)
+{
+    httpd_req_t* req = arg;
+    supercar_coex_http_sent(len);
+    return httpd_resp_send_chunk(req, data, len);
+}
 
-/* Simple handler for getting system handler */
-static void supercar_serialize(cJSON* node, supercar_t* car)
+/* The JSON writer of a response, straight into the connection buffer so no heap allocation on this path */
+static void rest_json_begin(httpd_req_t *req, supercar_json_t* json)
 {
-    cJSON_AddBoolToObject(node, "power", car->power);
-    supercar_add_motor_json(node, "propulsion_motor_ctrl", &car->propulsion_motor_ctrl);
-    supercar_add_motor_json(node, "steering_motor_ctrl", &car->steering_motor_ctrl);
-    cJSON_AddStringToObject(node, "mode", supercar_get_mode(car) == MOTION ? "MOTION" : "SWAY");
-    cJSON_AddStringToObject(node, "applied_mode", car->applied_mode == MOTION ? "MOTION" : "SWAY");
-    cJSON_AddStringToObject(node, "control_type", car->control_type == LOCAL ? "LOCAL" : "REMOTE");
-    cJSON_AddStringToObject(node, "steering", car->steering == STEER_NONE ? "NONE" : (car->steering == STEER_LEFT ? "LEFT" : "RIGHT"));
-    cJSON_AddBoolToObject(node, "reverse_direction", car->reverse_direction);
-    cJSON_AddBoolToObject(node, "reverse_mode", car->reverse_mode);
-    cJSON_AddStringToObject(node, "running", car->running == DIRECTION_NONE ? "NONE" : (car->running == DIRECTION_FORWARD ? "FORWARD" : "BACKWARD"));
-    cJSON* distance = cJSON_AddObjectToObject(node, "distance");
-    cJSON_AddNumberToObject(distance, "front_left", car->distance.front_left);
-    cJSON_AddNumberToObject(distance, "front_right", car->distance.front_right);
-    cJSON_AddNumberToObject(distance, "back_left", car->distance.back_left);
-    cJSON_AddNumberToObject(distance, "back_right", car->distance.back_right);
-    cJSON* cfg = cJSON_AddObjectToObject(node, "cfg");
-    supercar_serialize_config(cfg, car);
-}
-
-static esp_err_t supercar_generic_get_handler(httpd_req_t *req, void (*serialize)(cJSON*, supercar_t*)){
-    rest_server_context_t* ctx = req->user_ctx;
-    supercar_t* car = ctx->car;
     httpd_resp_set_type(req, "application/json");
-    cJSON* cfg = cJSON_CreateObject();
-    
-    serialize(cfg, car);
-    const char *config_json = cJSON_Print(cfg);
-    httpd_resp_sendstr(req, config_json);
-    free((void *)config_json);
-    cJSON_Delete(cfg);
-    return ESP_OK;
+    supercar_json_init(json, rest_buffer(req), SUPERCAR_HTTP_BUFSIZE, rest_send_json_chunk, req);
+    supercar_json_begin_object(json, NULL);
 }
 
-static esp_err_t supercar_generic_put_handler(httpd_req_t *req, void (*deserialize)(cJSON*, supercar_t*), esp_err_t (*save)(supercar_t*)){
+static esp_err_t rest_json_end(httpd_req_t *req, supercar_json_t* json)
+{
+    supercar_json_end_object(json);
+    if (json->total == json->len) {
+        /* Never flushed, the whole document goes out with a Content-Length */
+        supercar_coex_http_sent(json->len);
+        return httpd_resp_send(req, json->buf, json->len);
+    }
+    esp_err_t err = supercar_json_finish(json);
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return err;
+}
 
-       /* Destination buffer for content of HTTP POST request.
-     * httpd_req_recv() accepts char* only, but content could
-     * as well be any binary data (needs type casting).
-     * In case of string data, null termination will be absent, and
-     * content length would give length of string */
-    char content[256];
+static esp_err_t supercar_generic_get_handler(httpd_req_t *req, void (*serialize)(supercar_json_t*, supercar_t*)){
+    if (!supercar_coex_http_admit()) {
+        return rest_send_deferred(req);
+    }
+    rest_server_context_t* ctx = req->user_ctx;
+    supercar_json_t json;
+    rest_json_begin(req, &json);
+    serialize(&json, ctx->car);
+    esp_err_t err = rest_json_end(req, &json);
+    supercar_coex_http_done();
+    return err;
+}
 
-    /* Truncate if content length larger than the buffer */
-    size_t recv_size = req->content_len < sizeof(content) ? req->content_len : sizeof(content);
+/* Documents built from the state snapshot, tagged with its version and limited to ?fields= when given */
+static esp_err_t supercar_versioned_get_handler(httpd_req_t *req, void (*serialize)(supercar_json_t*, supercar_t*)){
+    if (!supercar_coex_http_admit()) {
+        return rest_send_deferred(req);
+    }
+    rest_server_context_t* ctx = req->user_ctx;
 
-    int ret = httpd_req_recv(req, content, recv_size);
-    if (ret <= 0) {  /* 0 return value indicates connection closed */
-        /* Check if timeout occurred */
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-            /* In case of timeout one can choose to retry calling
-             * httpd_req_recv(), but to keep it simple, here we
-             * respond with an HTTP 408 (Request Timeout) error */
-            httpd_resp_send_408(req);
-        }
-        /* In case of error, returning ESP_FAIL will
-         * ensure that the underlying socket is closed */
+    /* Taken before serializing, the document is never older than its tag */
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%08x-%u\"", ctx->boot_id, supercar_snapshot_version());
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (rest_etag_matches(req, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        esp_err_t err = httpd_resp_send(req, NULL, 0);
+        supercar_coex_http_done();
+        return err;
+    }
+
+    supercar_json_fields_t fields = { 0 };
+    if (httpd_req_get_url_query_str(req, ctx->query, sizeof(ctx->query)) == ESP_OK
+        && httpd_query_key_value(ctx->query, "fields", ctx->fields, sizeof(ctx->fields)) == ESP_OK
+        && supercar_json_fields_parse(&fields, ctx->fields) != ESP_OK) {
+        supercar_coex_http_done();
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Too many fields");
         return ESP_FAIL;
     }
 
+    supercar_json_t json;
+    rest_json_begin(req, &json);
+    supercar_json_select(&json, &fields);
+    serialize(&json, ctx->car);
+    esp_err_t err = rest_json_end(req, &json);
+    supercar_coex_http_done();
+    return err;
+}
+
+/* The body is parsed as it arrives through the connection buffer, whatever its size */
+static esp_err_t supercar_generic_put_handler(httpd_req_t *req, const supercar_section_t* section){
     rest_server_context_t* ctx = req->user_ctx;
     supercar_t* car = ctx->car;
-    httpd_resp_set_type(req, "application/json");
-    cJSON* cfg = cJSON_Parse(content);
-    if(cfg == NULL){
+    supercar_config_load_t* load = &ctx->load;
+    char* buf = rest_buffer(req);
+
+    supercar_config_load_begin(load, section, car);
+    size_t remaining = req->content_len;
+    esp_err_t err = ESP_OK;
+    while (remaining > 0 && err == ESP_OK) {
+        int ret = httpd_req_recv(req, buf, remaining < SUPERCAR_HTTP_BUFSIZE ? remaining : SUPERCAR_HTTP_BUFSIZE);
+        if (ret <= 0) {  /* 0 return value indicates connection closed */
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            /* In case of error, returning ESP_FAIL will
+             * ensure that the underlying socket is closed */
+            return ESP_FAIL;
+        }
+        remaining -= ret;
+        err = supercar_config_load_feed(load, buf, ret);
+    }
+    if (err == ESP_OK) {
+        err = supercar_config_load_end(load);
+    }
+    if (err != ESP_OK) {
+        /* Nothing was applied, the rest of the body may be unread so the socket is closed */
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Could not parse the request");
-
         return ESP_FAIL;
     }
-    
-    deserialize(cfg, car);
-    esp_err_t save_res = save(car);
-    if(save_res != ESP_OK){
-        cJSON_Delete(cfg);
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Could not save the new parameters");
-        return save_res;
-    }
-    const char *config_json = cJSON_Print(cfg);
-    httpd_resp_sendstr(req, config_json);
-    free((void *)config_json);
-    cJSON_Delete(cfg);
-    return ESP_OK;
+
+    supercar_config_load_apply(load, car);
+    /* Saved by the persistence task, flash writes would stall the control loop if the car is moving */
+    supercar_persist_mark(section);
+    supercar_rtc_capture(car, section);
+
+    supercar_json_t json;
+    rest_json_begin(req, &json);
+    supercar_json_begin_object(&json, "applied");
+    section->serialize(&json, car);
+    supercar_json_end_object(&json);
+    supercar_config_load_serialize(&json, load);
+    return rest_json_end(req, &json);
 }
 
 static esp_err_t supercar_get_handler(httpd_req_t* req){
-    return supercar_generic_get_handler(req, supercar_serialize);
+    return supercar_versioned_get_handler(req, supercar_serialize);
 }
 
 static esp_err_t supercar_get_config_handler(httpd_req_t *req)
 {
-    return supercar_generic_get_handler(req, supercar_serialize_config);
+    return supercar_versioned_get_handler(req, supercar_serialize_config);
 }
 
 static esp_err_t supercar_put_config_handler(httpd_req_t* req){
-    return supercar_generic_put_handler(req, supercar_deserialize_config, supercar_config_save);
+    return supercar_generic_put_handler(req, &supercar_config_section);
 }
 
 static esp_err_t supercar_get_propulsion_config_handler(httpd_req_t *req)
 {
-    return supercar_generic_get_handler(req, supercar_serialize_propulsion_config);
+    return supercar_versioned_get_handler(req, supercar_serialize_propulsion_config);
 }
 
 static esp_err_t supercar_put_propulsion_config_handler(httpd_req_t* req){
-    return supercar_generic_put_handler(req, supercar_deserialize_propulsion_config, supercar_propulsion_config_save);
+    return supercar_generic_put_handler(req, &supercar_propulsion_section);
+}
+
+static void supercar_serialize_event_stats(supercar_json_t* node, supercar_t* car)
+{
+    static const char* names[SUPERCAR_EVENT_MAX] = { "safety", "pedal", "remote", "config" };
+    supercar_event_stats_t stats[SUPERCAR_EVENT_MAX];
+    supercar_get_event_stats(stats);
+    for (int i = 0; i < SUPERCAR_EVENT_MAX; i++) {
+        supercar_json_begin_object(node, names[i]);
+        supercar_json_int(node, "count", stats[i].count);
+        supercar_json_int(node, "wait_avg_us", stats[i].count ? stats[i].wait_total_us / stats[i].count : 0);
+        supercar_json_int(node, "wait_max_us", stats[i].wait_max_us);
+        supercar_json_int(node, "process_avg_us", stats[i].count ? stats[i].process_total_us / stats[i].count : 0);
+        supercar_json_int(node, "process_max_us", stats[i].process_max_us);
+        supercar_json_end_object(node);
+    }
+    supercar_frame_stats_t frames;
+    supercar_get_frame_stats(&frames);
+    supercar_json_begin_object(node, "frames");
+    supercar_json_int(node, "committed", frames.committed);
+    supercar_json_int(node, "elided", frames.elided);
+    supercar_json_end_object(node);
+    supercar_snapshot_stats_t snapshots;
+    supercar_snapshot_get_stats(&snapshots);
+    supercar_json_begin_object(node, "snapshots");
+    supercar_json_int(node, "published", snapshots.published);
+    supercar_json_int(node, "reads", snapshots.reads);
+    supercar_json_int(node, "retries", snapshots.retries);
+    supercar_json_end_object(node);
+}
+
+static esp_err_t supercar_get_events_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_serialize_event_stats);
+}
+
+static esp_err_t supercar_get_schedule_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_sched_serialize);
+}
+
+static esp_err_t supercar_get_tasks_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_serialize_tasks);
+}
+
+static esp_err_t supercar_put_tasks_handler(httpd_req_t* req){
+    return supercar_generic_put_handler(req, &supercar_tasks_section);
+}
+
+#if CONFIG_SUPERCAR_BENCHMARKS
+static esp_err_t supercar_get_bench_tasks_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_bench_tasks_serialize);
+}
+
+/* Start the contention benchmark, ?duration=<ms> per phase */
+static esp_err_t supercar_post_bench_tasks_handler(httpd_req_t* req){
+    char query[32];
+    char value[8];
+    uint32_t duration = 5000;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+        && httpd_query_key_value(query, "duration", value, sizeof(value)) == ESP_OK) {
+        duration = atoi(value);
+    }
+    if (supercar_bench_tasks_start(duration) != ESP_OK) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "Benchmark already running");
+        return ESP_OK;
+    }
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_sendstr(req, "Benchmark started");
+    return ESP_OK;
+}
+
+static esp_err_t supercar_get_bench_json_handler(httpd_req_t* req){
+    char value[8];
+    uint32_t runs = 100;
+    rest_server_context_t* ctx = req->user_ctx;
+    strlcpy(ctx->fields, "distance", sizeof(ctx->fields));
+    if (httpd_req_get_url_query_str(req, ctx->query, sizeof(ctx->query)) == ESP_OK) {
+        if (httpd_query_key_value(ctx->query, "runs", value, sizeof(value)) == ESP_OK) {
+            runs = atoi(value);
+        }
+        httpd_query_key_value(ctx->query, "fields", ctx->fields, sizeof(ctx->fields));
+    }
+    supercar_json_fields_t fields;
+    supercar_json_fields_parse(&fields, ctx->fields);
+    supercar_bench_json_run(supercar_serialize, ctx->car, runs, &fields);
+    return supercar_generic_get_handler(req, supercar_bench_json_serialize);
+}
+
+static esp_err_t supercar_get_bench_config_handler(httpd_req_t* req){
+    char value[8];
+    uint32_t runs = 100;
+    rest_server_context_t* ctx = req->user_ctx;
+    if (httpd_req_get_url_query_str(req, ctx->query, sizeof(ctx->query)) == ESP_OK
+        && httpd_query_key_value(ctx->query, "runs", value, sizeof(value)) == ESP_OK) {
+        runs = atoi(value);
+    }
+    supercar_bench_config_run(ctx->car, runs);
+    return supercar_generic_get_handler(req, supercar_bench_config_serialize);
+}
+#endif
+
+static void supercar_serialize_boot(supercar_json_t* node, supercar_t* car){
+    supercar_boot_serialize(node, car);
+    supercar_json_begin_object(node, "restart");
+    supercar_rtc_serialize(node, car);
+    supercar_json_end_object(node);
+}
+
+static esp_err_t supercar_get_boot_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_serialize_boot);
+}
+
+static esp_err_t supercar_get_network_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_wifi_serialize);
+}
+
+static esp_err_t supercar_get_persist_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_persist_serialize);
+}
+
+static esp_err_t supercar_get_config_schema_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_serialize_config_schema);
+}
+
+static esp_err_t supercar_get_config_records_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_serialize_config_records);
+}
+
+static esp_err_t supercar_get_telemetry_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_telemetry_serialize);
+}
+
+static esp_err_t supercar_get_arbiter_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_serialize_arbiter);
+}
+
+static esp_err_t supercar_put_arbiter_handler(httpd_req_t* req){
+    return supercar_generic_put_handler(req, &supercar_arbiter_section);
+}
+
+static esp_err_t supercar_get_profiles_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_serialize_profiles);
+}
+
+static esp_err_t supercar_put_profiles_handler(httpd_req_t* req){
+    return supercar_generic_put_handler(req, &supercar_profiles_section);
+}
+
+static void supercar_serialize_active_profile(supercar_json_t* node, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_json_string(node, "active", supercar_profile_name(snapshot.profile));
+    supercar_json_int(node, "max_speed", snapshot.max_speed);
+}
+
+/* Switch the driver profile, ?name=<profile>, answers once the control task drives with it */
+static esp_err_t supercar_post_profile_handler(httpd_req_t* req){
+    char query[32];
+    char name[16];
+    rest_server_context_t* ctx = req->user_ctx;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || httpd_query_key_value(query, "name", name, sizeof(name)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing profile name");
+        return ESP_FAIL;
+    }
+    if (supercar_request_profile(ctx->car, name) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown profile");
+        return ESP_FAIL;
+    }
+    return supercar_generic_get_handler(req, supercar_serialize_active_profile);
+}
+
+static esp_err_t supercar_get_drive_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_drive_serialize);
+}
+
+static esp_err_t supercar_get_coex_handler(httpd_req_t* req){
+    return supercar_generic_get_handler(req, supercar_coex_serialize);
 }
 
 static esp_err_t supercar_get_steering_config_handler(httpd_req_t* req){
-    return supercar_generic_get_handler(req, supercar_serialize_steering_config);
+    return supercar_versioned_get_handler(req, supercar_serialize_steering_config);
 }
 
 static esp_err_t supercar_put_steering_config_handler(httpd_req_t* req){
-    return supercar_generic_put_handler(req, supercar_deserialize_steering_config, supercar_steering_config_save);
+    return supercar_generic_put_handler(req, &supercar_steering_section);
+}
+
+/* Counters of the static file handler, reset with each boot */
+static esp_err_t supercar_get_static_handler(httpd_req_t* req){
+    rest_server_context_t* ctx = req->user_ctx;
+    rest_static_stats_t stats = ctx->statics;
+    supercar_json_t json;
+    rest_json_begin(req, &json);
+    supercar_json_int(&json, "requests", stats.requests);
+    supercar_json_int(&json, "not_modified", stats.not_modified);
+    supercar_json_int(&json, "gzip", stats.gzip);
+    supercar_json_int(&json, "bytes", stats.bytes);
+    supercar_json_int(&json, "send_us", stats.send_us);
+    supercar_json_int(&json, "max_send_us", stats.max_send_us);
+    supercar_json_int(&json, "mount_us", stats.mount_us);
+#if CONFIG_EXAMPLE_WEB_DEPLOY_ARCHIVE
+    supercar_json_string(&json, "backend", "archive");
+#else
+    supercar_json_string(&json, "backend", "vfs");
+#endif
+    supercar_json_begin_object(&json, "pool");
+    supercar_http_serialize(&json);
+    supercar_json_end_object(&json);
+    return rest_json_end(req, &json);
 }
 
 static void register_generic(httpd_handle_t server, const char* url, esp_err_t (*handler)(httpd_req_t* req), 
@@ -250,28 +830,104 @@ rest_server_context_t *rest_context, httpd_method_t method){
     httpd_register_uri_handler(server, &supercar_info_get_uri);
 }
 
-esp_err_t start_rest_server(const char *base_path, supercar_t* car)
+static esp_err_t rest_session_open(httpd_handle_t hd, int sockfd)
+{
+    supercar_coex_client_attached();
+    return ESP_OK;
+}
+
+static void rest_session_close(httpd_handle_t hd, int sockfd)
+{
+    supercar_coex_client_detached();
+    supercar_telemetry_session_closed(sockfd);
+    supercar_drive_session_closed(sockfd);
+    /* The server leaves closing the socket to the close callback, or the sender task once done with it */
+    if (supercar_http_session_closed(sockfd)) {
+        close(sockfd);
+    }
+}
+
+esp_err_t start_rest_server(const char *base_path, uint32_t mount_us, supercar_t* car)
 {
     REST_CHECK(base_path, "wrong base path", err);
     rest_server_context_t *rest_context = calloc(1, sizeof(rest_server_context_t));
     REST_CHECK(rest_context, "No memory for rest context", err);
     strlcpy(rest_context->base_path, base_path, sizeof(rest_context->base_path));
     rest_context->car = car;
+    rest_context->boot_id = esp_random();
+    rest_context->statics.mount_us = mount_us;
 
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
-
+    config.max_uri_handlers = 36;
+    /* Enough sockets for a page load and the telemetry, the least recently used one makes room for a new client */
+    config.max_open_sockets = CONFIG_SUPERCAR_HTTP_MAX_SOCKETS;
+    config.backlog_conn = CONFIG_SUPERCAR_HTTP_MAX_SOCKETS;
+    config.lru_purge_enable = true;
+    const supercar_task_t* task = supercar_task_get(SUPERCAR_TASK_HTTPD);
+    config.task_priority = task->priority;
+    config.stack_size = task->stack;
+    config.core_id = task->core < 0 ? tskNO_AFFINITY : task->core;
+    config.open_fn = rest_session_open;
+    config.close_fn = rest_session_close;
+
+    REST_CHECK(supercar_http_start() == ESP_OK, "Start sender failed", err_start);
     ESP_LOGI(REST_TAG, "Starting HTTP Server");
     REST_CHECK(httpd_start(&server, &config) == ESP_OK, "Start server failed", err_start);
 
     register_generic(server, "/api/supercar", supercar_get_handler, rest_context, HTTP_GET);
     register_generic(server, "/api/supercar/config", supercar_get_config_handler, rest_context, HTTP_GET);
     register_generic(server, "/api/supercar/config", supercar_put_config_handler, rest_context, HTTP_PUT);
+    register_generic(server, "/api/supercar/config/nvs", supercar_get_config_records_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/config/persist", supercar_get_persist_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/config/schema", supercar_get_config_schema_handler, rest_context, HTTP_GET);
     register_generic(server, "/api/supercar/propulsion/config", supercar_get_propulsion_config_handler, rest_context, HTTP_GET);
     register_generic(server, "/api/supercar/propulsion/config", supercar_put_propulsion_config_handler, rest_context, HTTP_PUT);
     register_generic(server, "/api/supercar/steering/config", supercar_get_steering_config_handler, rest_context, HTTP_GET);
     register_generic(server, "/api/supercar/steering/config", supercar_put_steering_config_handler, rest_context, HTTP_PUT);
+    register_generic(server, "/api/supercar/boot", supercar_get_boot_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/network", supercar_get_network_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/coex", supercar_get_coex_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/events", supercar_get_events_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/schedule", supercar_get_schedule_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/tasks", supercar_get_tasks_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/telemetry", supercar_get_telemetry_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/static", supercar_get_static_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/drive", supercar_get_drive_handler, rest_context, HTTP_GET);
+
+    /* State deltas pushed over a WebSocket */
+    httpd_uri_t telemetry_ws_uri = {
+        .uri = "/ws/telemetry",
+        .method = HTTP_GET,
+        .handler = supercar_telemetry_ws_handler,
+        .user_ctx = rest_context,
+        .is_websocket = true
+    };
+    httpd_register_uri_handler(server, &telemetry_ws_uri);
+    supercar_telemetry_start(server);
+
+    /* Virtual joystick of the web UI */
+    httpd_uri_t drive_ws_uri = {
+        .uri = "/ws/drive",
+        .method = HTTP_GET,
+        .handler = supercar_drive_ws_handler,
+        .user_ctx = rest_context,
+        .is_websocket = true
+    };
+    httpd_register_uri_handler(server, &drive_ws_uri);
+    register_generic(server, "/api/supercar/tasks", supercar_put_tasks_handler, rest_context, HTTP_PUT);
+    register_generic(server, "/api/supercar/arbiter", supercar_get_arbiter_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/arbiter", supercar_put_arbiter_handler, rest_context, HTTP_PUT);
+    register_generic(server, "/api/supercar/profiles", supercar_get_profiles_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/profiles", supercar_put_profiles_handler, rest_context, HTTP_PUT);
+    register_generic(server, "/api/supercar/profile", supercar_post_profile_handler, rest_context, HTTP_POST);
+#if CONFIG_SUPERCAR_BENCHMARKS
+    register_generic(server, "/api/supercar/bench/tasks", supercar_get_bench_tasks_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/bench/tasks", supercar_post_bench_tasks_handler, rest_context, HTTP_POST);
+    register_generic(server, "/api/supercar/bench/json", supercar_get_bench_json_handler, rest_context, HTTP_GET);
+    register_generic(server, "/api/supercar/bench/config", supercar_get_bench_config_handler, rest_context, HTTP_GET);
+#endif
 
     /* URI handler for getting web server files */
     httpd_uri_t common_get_uri = {
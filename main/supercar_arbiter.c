@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "supercar_arbiter.h"
+
+static const char* TAG = "ARBITER";
+
+
+typedef struct {
+    supercar_arbiter_output_t outputs[SUPERCAR_AXIS_MAX];
+    uint32_t handovers[SUPERCAR_AXIS_MAX];
+    uint32_t expired[SUPERCAR_SOURCE_MAX];     // Intents dropped because their source went silent
+    uint32_t resolutions;
+    uint32_t max_resolve_us;
+} arbiter_stats_t;
+
+static const char* source_names[SUPERCAR_SOURCE_MAX] = {
+#define SUPERCAR_SOURCE(id, name, priority, timeout_ms, forward, backward, release) [SUPERCAR_SOURCE_##id] = name,
+#include "supercar_arbiter.def"
+};
+
+static const char* axis_names[SUPERCAR_AXIS_MAX] = {
+#define SUPERCAR_AXIS(id, name) [SUPERCAR_AXIS_##id] = name,
+#include "supercar_arbiter.def"
+};
+
+/* Generated from supercar_arbiter.def */
+static supercar_arbiter_rule_t rules[SUPERCAR_SOURCE_MAX] = {
+#define SUPERCAR_SOURCE(id, name, source_priority, source_timeout_ms, forward, backward, release) \
+    [SUPERCAR_SOURCE_##id] = { .priority = source_priority, .timeout_ms = source_timeout_ms },
+#include "supercar_arbiter.def"
+};
+
+/* A source with a default timeout has a deadman, it cannot be turned off */
+static const int min_timeouts_ms[SUPERCAR_SOURCE_MAX] = {
+#define SUPERCAR_SOURCE(id, name, source_priority, source_timeout_ms, forward, backward, release) \
+    [SUPERCAR_SOURCE_##id] = (source_timeout_ms) ? SUPERCAR_ARBITER_MIN_DEADMAN_MS : 0,
+#include "supercar_arbiter.def"
+};
+
+/* Owned by the control task */
+static supercar_intent_t intents[SUPERCAR_SOURCE_MAX][SUPERCAR_AXIS_MAX];
+static bool enabled[SUPERCAR_SOURCE_MAX];
+static supercar_source_t order[SUPERCAR_SOURCE_MAX];   // By decreasing priority
+static supercar_arbiter_output_t outputs[SUPERCAR_AXIS_MAX];
+
+static arbiter_stats_t arbiter_stats;
+static portMUX_TYPE arbiter_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Insertion sort of a handful of sources, equal priorities keep the table order */
+static void supercar_arbiter_sort(void)
+{
+    for (int i = 0; i < SUPERCAR_SOURCE_MAX; i++) {
+        supercar_source_t source = i;
+        int j = i;
+        for (; j > 0 && rules[order[j - 1]].priority < rules[source].priority; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = source;
+    }
+}
+
+void supercar_arbiter_set(supercar_source_t source, supercar_axis_t axis, float value, int64_t timestamp)
+{
+    intents[source][axis] = (supercar_intent_t){ .kind = SUPERCAR_INTENT_SET, .value = value, .timestamp = timestamp };
+}
+
+void supercar_arbiter_limit(supercar_source_t source, supercar_axis_t axis, float min, float max, int64_t timestamp)
+{
+    intents[source][axis] = (supercar_intent_t){ .kind = SUPERCAR_INTENT_LIMIT, .min = min, .max = max, .timestamp = timestamp };
+}
+
+void supercar_arbiter_release(supercar_source_t source, supercar_axis_t axis)
+{
+    intents[source][axis].kind = SUPERCAR_INTENT_NONE;
+}
+
+void supercar_arbiter_enable(supercar_source_t source, bool enable)
+{
+    enabled[source] = enable;
+}
+
+/* Highest priority intent that wants a value, bounded by the limits of the sources above it */
+static void supercar_arbiter_resolve_axis(supercar_axis_t axis, int64_t now, arbiter_stats_t* stats)
+{
+    float min = -INFINITY;
+    float max = INFINITY;
+    supercar_source_t limiter = SUPERCAR_SOURCE_NONE;
+    supercar_source_t owner = SUPERCAR_SOURCE_NONE;
+    float value = 0;
+
+    for (int i = 0; i < SUPERCAR_SOURCE_MAX; i++) {
+        supercar_source_t source = order[i];
+        supercar_intent_t* intent = &intents[source][axis];
+        if (intent->kind == SUPERCAR_INTENT_NONE) {
+            continue;
+        }
+        int timeout_ms = rules[source].timeout_ms;
+        if (timeout_ms && now - intent->timestamp > timeout_ms * 1000LL) {
+            intent->kind = SUPERCAR_INTENT_NONE;
+            stats->expired[source]++;
+            continue;
+        }
+        if (!enabled[source]) {
+            continue;
+        }
+        if (intent->kind == SUPERCAR_INTENT_LIMIT) {
+            if (intent->min > min) min = intent->min;
+            if (intent->max < max) max = intent->max;
+            limiter = source;
+            continue;
+        }
+        value = fminf(fmaxf(intent->value, min), max);
+        // Held back, the car does what the limiting source says
+        owner = value != intent->value ? limiter : source;
+        break;
+    }
+
+    supercar_arbiter_output_t* output = &outputs[axis];
+    output->changed = owner != output->owner || value != output->value;
+    if (output->changed) {
+        if (owner != output->owner) {
+            ESP_LOGD(TAG, "%s: %s -> %s", axis_names[axis],
+                supercar_arbiter_source_name(output->owner), supercar_arbiter_source_name(owner));
+            stats->handovers[axis]++;
+        }
+        output->previous = output->owner;
+        output->owner = owner;
+        output->value = value;
+    }
+}
+
+void supercar_arbiter_resolve(int64_t now)
+{
+    int64_t start = esp_timer_get_time();
+    arbiter_stats_t stats = {0};
+    bool changed = false;
+    for (int axis = 0; axis < SUPERCAR_AXIS_MAX; axis++) {
+        supercar_arbiter_resolve_axis(axis, now, &stats);
+        changed |= outputs[axis].changed;
+    }
+    uint32_t elapsed = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&arbiter_lock);
+    arbiter_stats.resolutions++;
+    if (elapsed > arbiter_stats.max_resolve_us) {
+        arbiter_stats.max_resolve_us = elapsed;
+    }
+    for (int axis = 0; axis < SUPERCAR_AXIS_MAX; axis++) {
+        arbiter_stats.handovers[axis] += stats.handovers[axis];
+    }
+    for (int source = 0; source < SUPERCAR_SOURCE_MAX; source++) {
+        arbiter_stats.expired[source] += stats.expired[source];
+    }
+    if (changed) {
+        memcpy(arbiter_stats.outputs, outputs, sizeof(outputs));
+    }
+    portEXIT_CRITICAL(&arbiter_lock);
+}
+
+const supercar_arbiter_output_t* supercar_arbiter_output(supercar_axis_t axis)
+{
+    return &outputs[axis];
+}
+
+const char* supercar_arbiter_source_name(supercar_source_t source)
+{
+    return source < SUPERCAR_SOURCE_MAX ? source_names[source] : "none";
+}
+
+int supercar_arbiter_timeout_ms(supercar_source_t source)
+{
+    portENTER_CRITICAL(&arbiter_lock);
+    int timeout_ms = rules[source].timeout_ms;
+    portEXIT_CRITICAL(&arbiter_lock);
+    return timeout_ms;
+}
+
+void supercar_arbiter_init(void)
+{
+    for (int source = 0; source < SUPERCAR_SOURCE_MAX; source++) {
+        enabled[source] = true;
+    }
+    for (int axis = 0; axis < SUPERCAR_AXIS_MAX; axis++) {
+        outputs[axis] = (supercar_arbiter_output_t){ .owner = SUPERCAR_SOURCE_NONE, .previous = SUPERCAR_SOURCE_NONE };
+    }
+    supercar_arbiter_sort();
+    memcpy(arbiter_stats.outputs, outputs, sizeof(outputs));
+}
+
+void supercar_arbiter_serialize(supercar_json_t* node)
+{
+    portENTER_CRITICAL(&arbiter_lock);
+    arbiter_stats_t stats = arbiter_stats;
+    supercar_arbiter_rule_t current[SUPERCAR_SOURCE_MAX];
+    memcpy(current, rules, sizeof(rules));
+    portEXIT_CRITICAL(&arbiter_lock);
+
+    for (int source = 0; source < SUPERCAR_SOURCE_MAX; source++) {
+        supercar_json_begin_object(node, source_names[source]);
+        supercar_json_int(node, "priority", current[source].priority);
+        supercar_json_int(node, "timeout_ms", current[source].timeout_ms);
+        supercar_json_int(node, "expired", stats.expired[source]);
+        supercar_json_end_object(node);
+    }
+    supercar_json_begin_object(node, "axes");
+    for (int axis = 0; axis < SUPERCAR_AXIS_MAX; axis++) {
+        supercar_json_begin_object(node, axis_names[axis]);
+        supercar_json_string(node, "owner", supercar_arbiter_source_name(stats.outputs[axis].owner));
+        supercar_json_number(node, "value", stats.outputs[axis].value);
+        supercar_json_int(node, "handovers", stats.handovers[axis]);
+        supercar_json_end_object(node);
+    }
+    supercar_json_end_object(node);
+    supercar_json_int(node, "resolutions", stats.resolutions);
+    supercar_json_int(node, "max_resolve_us", stats.max_resolve_us);
+}
+
+void supercar_arbiter_stage(supercar_arbiter_rule_t staged[SUPERCAR_SOURCE_MAX])
+{
+    portENTER_CRITICAL(&arbiter_lock);
+    memcpy(staged, rules, sizeof(rules));
+    portEXIT_CRITICAL(&arbiter_lock);
+}
+
+bool supercar_arbiter_rule_valid(supercar_source_t source, const supercar_arbiter_rule_t* rule)
+{
+    return rule->priority >= 0 && rule->priority <= SUPERCAR_ARBITER_MAX_PRIORITY
+        && rule->timeout_ms >= min_timeouts_ms[source] && rule->timeout_ms <= SUPERCAR_ARBITER_MAX_TIMEOUT_MS;
+}
+
+esp_err_t supercar_arbiter_stage_field(supercar_arbiter_rule_t staged[SUPERCAR_SOURCE_MAX], const char* path, const supercar_json_value_t* value)
+{
+    const char* member = strrchr(path, '.');
+    if (member == NULL) {
+        // The counters are reported by GET, sent back as is by clients editing the document
+        return !strcmp(path, "resolutions") || !strcmp(path, "max_resolve_us") ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+    size_t name_len = member++ - path;
+    for (int source = 0; source < SUPERCAR_SOURCE_MAX; source++) {
+        if (strlen(source_names[source]) != name_len || strncmp(source_names[source], path, name_len)) {
+            continue;
+        }
+        int number;
+        if (!strcmp(member, "priority")) {
+            if (!supercar_json_get_int(value, 0, SUPERCAR_ARBITER_MAX_PRIORITY, &number)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            staged[source].priority = number;
+        } else if (!strcmp(member, "timeout_ms")) {
+            if (!supercar_json_get_int(value, min_timeouts_ms[source], SUPERCAR_ARBITER_MAX_TIMEOUT_MS, &number)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            staged[source].timeout_ms = number;
+        } else if (!strcmp(member, "expired")) {
+            return ESP_OK;
+        } else {
+            return ESP_ERR_NOT_FOUND;
+        }
+        return ESP_OK;
+    }
+    // Members of "axes"
+    return strncmp(path, "axes.", 5) ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+void supercar_arbiter_apply(const supercar_arbiter_rule_t staged[SUPERCAR_SOURCE_MAX])
+{
+    portENTER_CRITICAL(&arbiter_lock);
+    memcpy(rules, staged, sizeof(rules));
+    portEXIT_CRITICAL(&arbiter_lock);
+    supercar_arbiter_sort();
+    for (int source = 0; source < SUPERCAR_SOURCE_MAX; source++) {
+        ESP_LOGI(TAG, "%s: priority %d, timeout %d ms", source_names[source], rules[source].priority, rules[source].timeout_ms);
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef _SUPERCAR_ARBITER_H_
+#define _SUPERCAR_ARBITER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "supercar_json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+#define SUPERCAR_SOURCE(id, name, priority, timeout_ms, forward, backward, release) SUPERCAR_SOURCE_##id,
+#include "supercar_arbiter.def"
+    SUPERCAR_SOURCE_MAX,
+    SUPERCAR_SOURCE_NONE = SUPERCAR_SOURCE_MAX
+} supercar_source_t;
+
+typedef enum {
+#define SUPERCAR_AXIS(id, name) SUPERCAR_AXIS_##id,
+#include "supercar_arbiter.def"
+    SUPERCAR_AXIS_MAX
+} supercar_axis_t;
+
+typedef enum {
+    SUPERCAR_INTENT_NONE,
+    SUPERCAR_INTENT_SET,                // The source wants the axis at a value
+    SUPERCAR_INTENT_LIMIT,              // The source bounds what the lower priority sources get
+} supercar_intent_kind_t;
+
+typedef struct {
+    supercar_intent_kind_t kind;
+    float value;
+    float min;                          // Bounds of a limit
+    float max;
+    int64_t timestamp;
+} supercar_intent_t;
+
+/* Rule of one source, as staged from a request before it is applied */
+typedef struct {
+    int priority;                       // Higher wins
+    int timeout_ms;                     // 0 for no timeout
+} supercar_arbiter_rule_t;
+
+#define SUPERCAR_ARBITER_MAX_PRIORITY 100
+#define SUPERCAR_ARBITER_MAX_TIMEOUT_MS 10000
+#define SUPERCAR_ARBITER_MIN_DEADMAN_MS 50      // Shortest timeout of a source with a deadman, same as menuconfig
+
+/* Outcome of the arbitration of one axis */
+typedef struct {
+    supercar_source_t owner;            // SUPERCAR_SOURCE_NONE when nobody wants the axis
+    supercar_source_t previous;         // Owner before the last change, the same one if only the value changed
+    float value;
+    bool changed;                       // Owner or value changed with the last resolution
+} supercar_arbiter_output_t;
+
+/**
+ * @brief Want the axis at a value, until released or timed out
+ *
+ * All the intent functions and the resolution are for the control task only.
+ */
+void supercar_arbiter_set(supercar_source_t source, supercar_axis_t axis, float value, int64_t timestamp);
+
+/**
+ * @brief Bound the value the lower priority sources get on the axis
+ */
+void supercar_arbiter_limit(supercar_source_t source, supercar_axis_t axis, float min, float max, int64_t timestamp);
+
+void supercar_arbiter_release(supercar_source_t source, supercar_axis_t axis);
+
+/**
+ * @brief A disabled source keeps its intents but never wins
+ */
+void supercar_arbiter_enable(supercar_source_t source, bool enabled);
+
+/**
+ * @brief Resolve every axis, the cost only depends on the number of sources and axes
+ */
+void supercar_arbiter_resolve(int64_t now);
+
+const supercar_arbiter_output_t* supercar_arbiter_output(supercar_axis_t axis);
+
+const char* supercar_arbiter_source_name(supercar_source_t source);
+
+int supercar_arbiter_timeout_ms(supercar_source_t source);
+
+void supercar_arbiter_init(void);
+
+void supercar_arbiter_serialize(supercar_json_t* node);
+
+/**
+ * @brief Current rule of every source
+ */
+void supercar_arbiter_stage(supercar_arbiter_rule_t rules[SUPERCAR_SOURCE_MAX]);
+
+/**
+ * @brief The rule is in the bounds the stage accepts, for the records read from NVS or RTC memory
+ *
+ * The sources with a default timeout are dropped when they go silent, their timeout is never 0.
+ */
+bool supercar_arbiter_rule_valid(supercar_source_t source, const supercar_arbiter_rule_t* rule);
+
+/**
+ * @brief Stage one "<source name>.<priority|timeout_ms>" member
+ *
+ * @return ESP_ERR_NOT_FOUND for an unknown source or member, ESP_ERR_INVALID_ARG for a value out of bounds
+ */
+esp_err_t supercar_arbiter_stage_field(supercar_arbiter_rule_t rules[SUPERCAR_SOURCE_MAX], const char* path, const supercar_json_value_t* value);
+
+/**
+ * @brief Replace the rules, from the control task
+ */
+void supercar_arbiter_apply(const supercar_arbiter_rule_t rules[SUPERCAR_SOURCE_MAX]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "cJSON.h"
+#include "lwip/sockets.h"
+#include "esp_hid_gap.h"
+#include "supercar_bench.h"
+#include "supercar_sched.h"
+#include "supercar_tasks.h"
+#include "supercar_snapshot.h"
+#include "supercar_config.h"
+
+static const char* TAG = "BENCH";
+
+#define BENCH_LOAD_PRIORITY 4
+#define BENCH_WIFI_PACKET_SIZE 1024
+#define BENCH_WIFI_BURST 8
+#define BENCH_BT_SCAN_SECONDS 2
+#define BENCH_JSON_BUFSIZE 2048
+#define BENCH_HTTP_REQUEST "GET /api/supercar HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+
+static supercar_bench_tasks_t bench;
+static portMUX_TYPE bench_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool bench_load;
+static volatile int bench_load_tasks;
+
+static void supercar_bench_count(uint32_t* counter)
+{
+    portENTER_CRITICAL(&bench_lock);
+    (*counter)++;
+    portEXIT_CRITICAL(&bench_lock);
+}
+
+static void supercar_bench_load_done(void)
+{
+    portENTER_CRITICAL(&bench_lock);
+    bench_load_tasks--;
+    portEXIT_CRITICAL(&bench_lock);
+    vTaskDelete(NULL);
+}
+
+/* Broadcast UDP bursts to keep the Wi-Fi side of the radio busy */
+static void supercar_bench_wifi_load(void* arg)
+{
+    static char packet[BENCH_WIFI_PACKET_SIZE];
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock >= 0) {
+        int broadcast = 1;
+        setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+        struct sockaddr_in dest = {
+            .sin_family = AF_INET,
+            .sin_port = htons(9),                   // Discard protocol
+            .sin_addr.s_addr = htonl(INADDR_BROADCAST)
+        };
+        while (bench_load) {
+            for (int i = 0; i < BENCH_WIFI_BURST; i++) {
+                if (sendto(sock, packet, sizeof(packet), 0, (struct sockaddr*)&dest, sizeof(dest)) > 0) {
+                    supercar_bench_count(&bench.wifi_packets);
+                }
+            }
+            vTaskDelay(1);
+        }
+        close(sock);
+    } else {
+        ESP_LOGE(TAG, "Could not create the UDP socket");
+    }
+    supercar_bench_load_done();
+}
+
+/* Inquiry and scanning keep the Bluetooth side of the radio busy */
+static void supercar_bench_bt_load(void* arg)
+{
+    while (bench_load) {
+        size_t num_results = 0;
+        esp_hid_scan_result_t* results = NULL;
+        esp_hid_scan(BENCH_BT_SCAN_SECONDS, &num_results, &results);
+        esp_hid_scan_results_free(results);
+        supercar_bench_count(&bench.bt_scans);
+    }
+    supercar_bench_load_done();
+}
+
+/* Loopback requests to our own REST API */
+static void supercar_bench_http_load(void* arg)
+{
+    static char response[512];
+    struct sockaddr_in server = {
+        .sin_family = AF_INET,
+        .sin_port = htons(80),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    while (bench_load) {
+        int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (sock < 0) {
+            vTaskDelay(1);
+            continue;
+        }
+        if (connect(sock, (struct sockaddr*)&server, sizeof(server)) == 0
+            && send(sock, BENCH_HTTP_REQUEST, strlen(BENCH_HTTP_REQUEST), 0) > 0) {
+            while (recv(sock, response, sizeof(response), 0) > 0) {
+            }
+            supercar_bench_count(&bench.http_requests);
+        }
+        close(sock);
+    }
+    supercar_bench_load_done();
+}
+
+static void supercar_bench_phase(supercar_bench_phase_t* phase, uint32_t duration_ms)
+{
+    supercar_sched_stats_t stats;
+    supercar_sched_reset_stats();
+    vTaskDelay(pdMS_TO_TICKS(duration_ms));
+    supercar_sched_get_stats(&stats);
+
+    supercar_bench_phase_t result = {
+        .frames = stats.frames,
+        .overruns = stats.overruns,
+        .missed = stats.missed,
+        .wcet_us = stats.wcet_us,
+        .latency_avg_us = stats.frames ? stats.latency_total_us / stats.frames : 0,
+        .latency_max_us = stats.latency_max_us
+    };
+    portENTER_CRITICAL(&bench_lock);
+    *phase = result;
+    portEXIT_CRITICAL(&bench_lock);
+}
+
+static void supercar_bench_start_load(TaskFunction_t fn, const char* name)
+{
+    if (xTaskCreate(fn, name, 4096, NULL, BENCH_LOAD_PRIORITY, NULL) == pdPASS) {
+        portENTER_CRITICAL(&bench_lock);
+        bench_load_tasks++;
+        portEXIT_CRITICAL(&bench_lock);
+    }
+}
+
+static void supercar_bench_thread(void* arg)
+{
+    ESP_LOGI(TAG, "Measuring the control loop without load");
+    supercar_bench_phase(&bench.idle, bench.duration_ms);
+
+    ESP_LOGI(TAG, "Measuring the control loop with BT, Wi-Fi and HTTP load");
+    bench_load = true;
+    supercar_bench_start_load(supercar_bench_wifi_load, "bench_wifi_load");
+    supercar_bench_start_load(supercar_bench_bt_load, "bench_bt_load");
+    supercar_bench_start_load(supercar_bench_http_load, "bench_http_load");
+    supercar_bench_phase(&bench.loaded, bench.duration_ms);
+    bench_load = false;
+    while (bench_load_tasks) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    ESP_LOGI(TAG, "Latency avg/max: idle %u/%u us, loaded %u/%u us", bench.idle.latency_avg_us, bench.idle.latency_max_us,
+        bench.loaded.latency_avg_us, bench.loaded.latency_max_us);
+    portENTER_CRITICAL(&bench_lock);
+    bench.running = false;
+    portEXIT_CRITICAL(&bench_lock);
+    supercar_task_exit(SUPERCAR_TASK_BENCH);
+}
+
+esp_err_t supercar_bench_tasks_start(uint32_t duration_ms)
+{
+    portENTER_CRITICAL(&bench_lock);
+    if (bench.running) {
+        portEXIT_CRITICAL(&bench_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(&bench, 0, sizeof(bench));
+    bench.running = true;
+    bench.duration_ms = duration_ms;
+    portEXIT_CRITICAL(&bench_lock);
+
+    if (supercar_task_create(SUPERCAR_TASK_BENCH, supercar_bench_thread, NULL, NULL) != pdPASS) {
+        bench.running = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void supercar_bench_add_phase(supercar_json_t* node, const char* name, supercar_bench_phase_t* phase)
+{
+    supercar_json_begin_object(node, name);
+    supercar_json_int(node, "frames", phase->frames);
+    supercar_json_int(node, "overruns", phase->overruns);
+    supercar_json_int(node, "missed", phase->missed);
+    supercar_json_int(node, "wcet_us", phase->wcet_us);
+    supercar_json_int(node, "latency_avg_us", phase->latency_avg_us);
+    supercar_json_int(node, "latency_max_us", phase->latency_max_us);
+    supercar_json_end_object(node);
+}
+
+void supercar_bench_tasks_serialize(supercar_json_t* node, supercar_t* car)
+{
+    supercar_bench_tasks_t result;
+    portENTER_CRITICAL(&bench_lock);
+    result = bench;
+    portEXIT_CRITICAL(&bench_lock);
+
+    supercar_json_bool(node, "running", result.running);
+    supercar_json_int(node, "duration_ms", result.duration_ms);
+    supercar_bench_add_phase(node, "idle", &result.idle);
+    supercar_bench_add_phase(node, "loaded", &result.loaded);
+    supercar_json_begin_object(node, "load");
+    supercar_json_int(node, "wifi_packets", result.wifi_packets);
+    supercar_json_int(node, "bt_scans", result.bt_scans);
+    supercar_json_int(node, "http_requests", result.http_requests);
+    supercar_json_end_object(node);
+    supercar_json_begin_object(node, "placement");
+    supercar_serialize_tasks(node, car);
+    supercar_json_end_object(node);
+}
+
+static supercar_bench_json_t bench_json;
+
+static void supercar_bench_json_add_motor(cJSON* node, const char* name, const char* motor_name, supercar_motor_snapshot_t* mctl)
+{
+    cJSON* motor_json = cJSON_AddObjectToObject(node, name);
+    cJSON_AddNumberToObject(motor_json, "start_time", mctl->start_time);
+    cJSON_AddBoolToObject(motor_json, "start_flag", mctl->start_flag);
+    cJSON_AddNumberToObject(motor_json, "duty_cycle", mctl->duty_cycle);
+    cJSON_AddStringToObject(motor_json, "direction", mctl->direction == MOTOR_LEFT ? "LEFT" : "RIGHT");
+    cJSON_AddNumberToObject(motor_json, "expt", mctl->expt);
+    cJSON_AddStringToObject(motor_json, "name", motor_name);
+    cJSON* cfg = cJSON_AddObjectToObject(motor_json, "cfg");
+    cJSON_AddNumberToObject(cfg, "acceleration", mctl->cfg.acceleration);
+    cJSON_AddNumberToObject(cfg, "ctrl_period", mctl->cfg.ctrl_period);
+    cJSON_AddNumberToObject(cfg, "pwm_freq", mctl->cfg.pwm_freq);
+    cJSON_AddNumberToObject(cfg, "pwm_pin", mctl->cfg.pwm_pin);
+    cJSON_AddNumberToObject(cfg, "direction_pin", mctl->cfg.direction_pin);
+}
+
+/* The /api/supercar document as it was built before the streaming writer */
+static cJSON* supercar_bench_json_cjson(supercar_t* car)
+{
+    supercar_snapshot_t snap;
+    supercar_snapshot_read(&snap);
+    cJSON* node = cJSON_CreateObject();
+    cJSON_AddNumberToObject(node, "version", snap.version);
+    cJSON_AddBoolToObject(node, "power", snap.power);
+    supercar_bench_json_add_motor(node, "propulsion_motor_ctrl", car->propulsion_motor_ctrl.name, &snap.propulsion);
+    supercar_bench_json_add_motor(node, "steering_motor_ctrl", car->steering_motor_ctrl.name, &snap.steering_motor);
+    cJSON_AddStringToObject(node, "mode", snap.mode == MOTION ? "MOTION" : "SWAY");
+    cJSON_AddStringToObject(node, "applied_mode", snap.applied_mode == MOTION ? "MOTION" : "SWAY");
+    cJSON_AddStringToObject(node, "state", snap.state_name);
+    cJSON_AddStringToObject(node, "control_type", snap.control_type == LOCAL ? "LOCAL" : "REMOTE");
+    cJSON_AddStringToObject(node, "steering", snap.steering == STEER_NONE ? "NONE" : (snap.steering == STEER_LEFT ? "LEFT" : "RIGHT"));
+    cJSON_AddBoolToObject(node, "reverse_direction", snap.reverse_direction);
+    cJSON_AddBoolToObject(node, "reverse_mode", snap.reverse_mode);
+    cJSON_AddStringToObject(node, "running", snap.running == DIRECTION_NONE ? "NONE" : (snap.running == DIRECTION_FORWARD ? "FORWARD" : "BACKWARD"));
+    cJSON* distance = cJSON_AddObjectToObject(node, "distance");
+    cJSON_AddNumberToObject(distance, "front_left", snap.distance.front_left);
+    cJSON_AddNumberToObject(distance, "front_right", snap.distance.front_right);
+    cJSON_AddNumberToObject(distance, "back_left", snap.distance.back_left);
+    cJSON_AddNumberToObject(distance, "back_right", snap.distance.back_right);
+    cJSON_AddStringToObject(node, "profile", supercar_profile_name(snap.profile));
+    cJSON_AddNumberToObject(node, "max_speed", snap.max_speed);
+    cJSON* cfg = cJSON_AddObjectToObject(node, "cfg");
+    cJSON_AddNumberToObject(cfg, "mode_input_pin", snap.cfg.mode_input_pin);
+    cJSON_AddNumberToObject(cfg, "mode_output_pin", snap.cfg.mode_output_pin);
+    cJSON_AddNumberToObject(cfg, "power_output_pin", snap.cfg.power_output_pin);
+    return node;
+}
+
+/* cJSON keeps its global hooks, the heap held by one document and its text tells its allocations.
+   The other tasks allocate meanwhile too, the figures are only exact with the server idle */
+static void supercar_bench_json_cjson_heap(supercar_t* car, supercar_bench_json_side_t* side)
+{
+    multi_heap_info_t before;
+    multi_heap_info_t after;
+    heap_caps_get_info(&before, MALLOC_CAP_DEFAULT);
+    cJSON* node = supercar_bench_json_cjson(car);
+    char* json = cJSON_Print(node);
+    heap_caps_get_info(&after, MALLOC_CAP_DEFAULT);
+    cJSON_free(json);
+    cJSON_Delete(node);
+    side->allocations = after.allocated_blocks > before.allocated_blocks ? after.allocated_blocks - before.allocated_blocks : 0;
+    side->heap_bytes = after.total_allocated_bytes > before.total_allocated_bytes ? after.total_allocated_bytes - before.total_allocated_bytes : 0;
+}
+
+static void supercar_bench_json_writer(void (*serialize)(supercar_json_t*, supercar_t*), supercar_t* car, uint32_t runs,
+    const supercar_json_fields_t* fields, char* buf, supercar_bench_json_side_t* side)
+{
+    uint64_t cycles = 0;
+    for (uint32_t i = 0; i < runs; i++) {
+        uint32_t start = esp_cpu_get_ccount();
+        supercar_json_t json;
+        supercar_json_init(&json, buf, BENCH_JSON_BUFSIZE, NULL, NULL);
+        supercar_json_select(&json, fields);
+        supercar_json_begin_object(&json, NULL);
+        serialize(&json, car);
+        supercar_json_end_object(&json);
+        supercar_json_finish(&json);
+        cycles += esp_cpu_get_ccount() - start;
+        side->bytes = json.total;
+    }
+    side->cycles = cycles / runs;
+    side->allocations = 0;
+    side->heap_bytes = 0;
+}
+
+void supercar_bench_json_run(void (*serialize)(supercar_json_t*, supercar_t*), supercar_t* car, uint32_t runs,
+    const supercar_json_fields_t* fields)
+{
+    char* buf = malloc(BENCH_JSON_BUFSIZE);
+    if (buf == NULL || runs == 0) {
+        free(buf);
+        return;
+    }
+    supercar_bench_json_side_t writer;
+    supercar_bench_json_side_t selected;
+    uint64_t cjson_cycles = 0;
+    size_t cjson_bytes = 0;
+
+    supercar_bench_json_writer(serialize, car, runs, NULL, buf, &writer);
+    supercar_bench_json_writer(serialize, car, runs, fields, buf, &selected);
+
+    for (uint32_t i = 0; i < runs; i++) {
+        uint32_t start = esp_cpu_get_ccount();
+        cJSON* node = supercar_bench_json_cjson(car);
+        char* json = cJSON_Print(node);
+        cJSON_Delete(node);
+        cjson_cycles += esp_cpu_get_ccount() - start;
+        if (json) {
+            cjson_bytes = strlen(json);
+            cJSON_free(json);
+        }
+    }
+    supercar_bench_json_side_t cjson;
+    supercar_bench_json_cjson_heap(car, &cjson);
+    free(buf);
+
+    portENTER_CRITICAL(&bench_lock);
+    bench_json.runs = runs;
+    bench_json.writer = writer;
+    bench_json.selected = selected;
+    bench_json.cjson = cjson;
+    bench_json.cjson.bytes = cjson_bytes;
+    bench_json.cjson.cycles = cjson_cycles / runs;
+    portEXIT_CRITICAL(&bench_lock);
+    ESP_LOGI(TAG, "JSON writer %u bytes %u cycles, selected %u bytes %u cycles, cJSON %u bytes %u cycles",
+        writer.bytes, writer.cycles, selected.bytes, selected.cycles, bench_json.cjson.bytes, bench_json.cjson.cycles);
+}
+
+static void supercar_bench_json_add_side(supercar_json_t* node, const char* name, supercar_bench_json_side_t* side)
+{
+    supercar_json_begin_object(node, name);
+    supercar_json_int(node, "bytes", side->bytes);
+    supercar_json_int(node, "cycles", side->cycles);
+    supercar_json_int(node, "allocations", side->allocations);
+    supercar_json_int(node, "heap_bytes", side->heap_bytes);
+    supercar_json_end_object(node);
+}
+
+void supercar_bench_json_serialize(supercar_json_t* node, supercar_t* car)
+{
+    supercar_bench_json_t result;
+    portENTER_CRITICAL(&bench_lock);
+    result = bench_json;
+    portEXIT_CRITICAL(&bench_lock);
+
+    supercar_json_int(node, "runs", result.runs);
+    supercar_bench_json_add_side(node, "writer", &result.writer);
+    supercar_bench_json_add_side(node, "selected", &result.selected);
+    supercar_bench_json_add_side(node, "cjson", &result.cjson);
+}
+
+static supercar_bench_config_t bench_config;
+
+void supercar_bench_config_run(supercar_t* car, uint32_t runs)
+{
+    char* buf = malloc(BENCH_JSON_BUFSIZE);
+    supercar_config_load_t* load = malloc(sizeof(supercar_config_load_t));
+    if (buf == NULL || load == NULL || runs == 0) {
+        free(load);
+        free(buf);
+        return;
+    }
+    supercar_bench_config_t result = { .runs = runs };
+    uint64_t json_save = 0, json_load = 0, binary_save = 0, binary_load = 0;
+
+    for (uint32_t i = 0; i < runs; i++) {
+        result.json.bytes = 0;
+        result.binary.bytes = 0;
+        for (size_t s = 0; s < supercar_sections_count; s++) {
+            const supercar_section_t* section = supercar_sections[s];
+
+            uint32_t start = esp_cpu_get_ccount();
+            supercar_json_t json;
+            supercar_json_init(&json, buf, BENCH_JSON_BUFSIZE, NULL, NULL);
+            supercar_json_begin_object(&json, NULL);
+            section->serialize(&json, car);
+            supercar_json_end_object(&json);
+            supercar_json_finish(&json);
+            uint32_t saved = esp_cpu_get_ccount();
+            supercar_config_load_begin(load, section, car);
+            supercar_config_load_feed(load, buf, json.total);
+            supercar_config_load_end(load);
+            json_load += esp_cpu_get_ccount() - saved;
+            json_save += saved - start;
+            result.json.bytes += json.total;
+
+            start = esp_cpu_get_ccount();
+            section->stage(&load->staging, car);
+            size_t len = supercar_section_encode(section, &load->staging, (uint8_t*) buf, BENCH_JSON_BUFSIZE);
+            saved = esp_cpu_get_ccount();
+            section->stage(&load->staging, car);
+            supercar_section_decode(section, (uint8_t*) buf, len, &load->staging);
+            binary_load += esp_cpu_get_ccount() - saved;
+            binary_save += saved - start;
+            result.binary.bytes += len;
+        }
+    }
+    free(load);
+    free(buf);
+
+    result.json.save_cycles = json_save / runs;
+    result.json.load_cycles = json_load / runs;
+    result.binary.save_cycles = binary_save / runs;
+    result.binary.load_cycles = binary_load / runs;
+    portENTER_CRITICAL(&bench_lock);
+    bench_config = result;
+    portEXIT_CRITICAL(&bench_lock);
+    ESP_LOGI(TAG, "Config JSON %u bytes, load %u cycles, binary %u bytes, load %u cycles",
+        result.json.bytes, result.json.load_cycles, result.binary.bytes, result.binary.load_cycles);
+}
+
+static void supercar_bench_config_add_side(supercar_json_t* node, const char* name, supercar_bench_config_side_t* side)
+{
+    supercar_json_begin_object(node, name);
+    supercar_json_int(node, "bytes", side->bytes);
+    supercar_json_int(node, "save_cycles", side->save_cycles);
+    supercar_json_int(node, "load_cycles", side->load_cycles);
+    supercar_json_end_object(node);
+}
+
+void supercar_bench_config_serialize(supercar_json_t* node, supercar_t* car)
+{
+    supercar_bench_config_t result;
+    portENTER_CRITICAL(&bench_lock);
+    result = bench_config;
+    portEXIT_CRITICAL(&bench_lock);
+
+    supercar_json_int(node, "runs", result.runs);
+    supercar_bench_config_add_side(node, "json", &result.json);
+    supercar_bench_config_add_side(node, "binary", &result.binary);
+    // The boot measured the real thing, flash reads included
+    supercar_json_begin_object(node, "boot");
+    supercar_serialize_config_records(node, car);
+    supercar_json_end_object(node);
+}
@@ -0,0 +1,94 @@
+#ifndef _SUPERCAR_BENCH_H_
+#define _SUPERCAR_BENCH_H_
+
+#include "esp_system.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Control loop timing over one phase of the contention benchmark */
+typedef struct {
+    uint32_t frames;
+    uint32_t overruns;
+    uint32_t missed;
+    uint32_t wcet_us;
+    uint32_t latency_avg_us;            // Timer tick to frame start
+    uint32_t latency_max_us;
+} supercar_bench_phase_t;
+
+typedef struct {
+    bool running;
+    uint32_t duration_ms;               // Length of each phase
+    supercar_bench_phase_t idle;
+    supercar_bench_phase_t loaded;
+    uint32_t wifi_packets;              // Synthetic load generated during the loaded phase
+    uint32_t bt_scans;
+    uint32_t http_requests;
+} supercar_bench_tasks_t;
+
+/**
+ * @brief Measure the control loop without and then with synthetic BT, Wi-Fi and HTTP load
+ *
+ * The benchmark runs in the background with the current task placement.
+ *
+ * @return ESP_ERR_INVALID_STATE if a benchmark is already running
+ */
+esp_err_t supercar_bench_tasks_start(uint32_t duration_ms);
+
+void supercar_bench_tasks_serialize(supercar_json_t* node, supercar_t* car);
+
+/* One serializer in the JSON benchmark, averaged over the runs */
+typedef struct {
+    uint32_t bytes;
+    uint32_t cycles;
+    uint32_t allocations;               // Heap blocks held by one document and its text
+    uint32_t heap_bytes;                // Heap they take, the writer side prints into a caller buffer
+} supercar_bench_json_side_t;
+
+typedef struct {
+    uint32_t runs;
+    supercar_bench_json_side_t writer;
+    supercar_bench_json_side_t selected;    // Writer limited to a ?fields= selection
+    supercar_bench_json_side_t cjson;
+} supercar_bench_json_t;
+
+/**
+ * @brief Serialize the state document with the streaming writer, whole and with a field selection, and with cJSON
+ *
+ * serialize is the writer side, the cJSON side is a reference copy of the same document.
+ */
+void supercar_bench_json_run(void (*serialize)(supercar_json_t*, supercar_t*), supercar_t* car, uint32_t runs,
+    const supercar_json_fields_t* fields);
+
+void supercar_bench_json_serialize(supercar_json_t* node, supercar_t* car);
+
+/* One format in the configuration benchmark, all the sections together, averaged over the runs */
+typedef struct {
+    uint32_t bytes;
+    uint32_t save_cycles;               // Values to the bytes stored in NVS
+    uint32_t load_cycles;               // Bytes back to staged values, what the boot pays
+} supercar_bench_config_side_t;
+
+typedef struct {
+    uint32_t runs;
+    supercar_bench_config_side_t json;
+    supercar_bench_config_side_t binary;
+} supercar_bench_config_t;
+
+/**
+ * @brief Save and load every configuration section as JSON text, as older firmwares did, and as binary records
+ *
+ * Only the encoding is measured, not the flash accesses which are the same for both.
+ */
+void supercar_bench_config_run(supercar_t* car, uint32_t runs);
+
+void supercar_bench_config_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "supercar_boot.h"
+
+static const char* TAG = "BOOT";
+
+typedef struct {
+    supercar_boot_state_t state;
+    esp_err_t err;
+    int64_t start_us;
+    int64_t end_us;
+    int core;
+} boot_timeline_t;
+
+static const supercar_boot_stage_t* boot_stages;
+static int boot_num_stages;
+static supercar_t* boot_car;
+static int64_t boot_start_us;
+static EventGroupHandle_t boot_done;
+static uint32_t boot_failed;        // Failed or skipped stages, their bit is also set in boot_done
+static boot_timeline_t boot_timeline[SUPERCAR_BOOT_MAX_STAGES];
+static portMUX_TYPE boot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* boot_state_names[] = { "pending", "running", "done", "failed", "skipped" };
+
+static void supercar_boot_finish(int index, supercar_boot_state_t state, esp_err_t err)
+{
+    portENTER_CRITICAL(&boot_lock);
+    boot_timeline[index].state = state;
+    boot_timeline[index].err = err;
+    boot_timeline[index].end_us = esp_timer_get_time();
+    if (state != SUPERCAR_BOOT_DONE) {
+        boot_failed |= (1u << index);
+    }
+    portEXIT_CRITICAL(&boot_lock);
+    xEventGroupSetBits(boot_done, 1u << index);
+}
+
+static void supercar_boot_thread(void* arg)
+{
+    int index = (intptr_t) arg;
+    const supercar_boot_stage_t* stage = &boot_stages[index];
+    if (stage->after) {
+        xEventGroupWaitBits(boot_done, stage->after, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+    portENTER_CRITICAL(&boot_lock);
+    bool blocked = (boot_failed & stage->after) != 0;
+    boot_timeline[index].start_us = esp_timer_get_time();
+    boot_timeline[index].state = SUPERCAR_BOOT_RUNNING;
+    boot_timeline[index].core = xPortGetCoreID();
+    portEXIT_CRITICAL(&boot_lock);
+
+    if (blocked) {
+        ESP_LOGW(TAG, "Skipping %s, a stage it comes after failed", stage->name);
+        supercar_boot_finish(index, SUPERCAR_BOOT_SKIPPED, ESP_ERR_INVALID_STATE);
+    } else {
+        esp_err_t err = stage->run(boot_car);
+        supercar_boot_finish(index, err == ESP_OK ? SUPERCAR_BOOT_DONE : SUPERCAR_BOOT_FAILED, err);
+        int64_t elapsed = boot_timeline[index].end_us - boot_timeline[index].start_us;
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "%s failed after %lld us: %s", stage->name, elapsed, esp_err_to_name(err));
+        } else if (stage->milestone) {
+            ESP_LOGI(TAG, "%s done in %lld us, %s ready at %lld us", stage->name, elapsed, stage->milestone, boot_timeline[index].end_us);
+        } else {
+            ESP_LOGI(TAG, "%s done in %lld us", stage->name, elapsed);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t supercar_boot_run(const supercar_boot_stage_t* stages, int num_stages, supercar_t* car)
+{
+    if (num_stages > SUPERCAR_BOOT_MAX_STAGES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    boot_stages = stages;
+    boot_num_stages = num_stages;
+    boot_car = car;
+    boot_start_us = esp_timer_get_time();
+    boot_done = xEventGroupCreate();
+    if (boot_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    // The stages waiting for others only cost their stack until they end
+    for (int i = 0; i < num_stages; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "boot_%s", stages[i].name);
+        if (xTaskCreate(supercar_boot_thread, name, CONFIG_SUPERCAR_BOOT_STACK, (void*) (intptr_t) i, uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Could not start %s", stages[i].name);
+            supercar_boot_finish(i, SUPERCAR_BOOT_FAILED, ESP_ERR_NO_MEM);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t supercar_boot_wait(uint32_t stages)
+{
+    xEventGroupWaitBits(boot_done, stages, pdFALSE, pdTRUE, portMAX_DELAY);
+    portENTER_CRITICAL(&boot_lock);
+    bool failed = (boot_failed & stages) != 0;
+    portEXIT_CRITICAL(&boot_lock);
+    return failed ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
+void supercar_boot_serialize(supercar_json_t* node, supercar_t* car)
+{
+    boot_timeline_t timeline[SUPERCAR_BOOT_MAX_STAGES];
+    portENTER_CRITICAL(&boot_lock);
+    memcpy(timeline, boot_timeline, sizeof(timeline));
+    portEXIT_CRITICAL(&boot_lock);
+
+    int64_t end = boot_start_us;
+    supercar_json_int(node, "start_us", boot_start_us);
+    supercar_json_begin_array(node, "stages");
+    for (int i = 0; i < boot_num_stages; i++) {
+        const supercar_boot_stage_t* stage = &boot_stages[i];
+        supercar_json_begin_object(node, NULL);
+        supercar_json_string(node, "name", stage->name);
+        supercar_json_begin_array(node, "after");
+        for (int j = 0; j < boot_num_stages; j++) {
+            if (stage->after & (1u << j)) {
+                supercar_json_string(node, NULL, boot_stages[j].name);
+            }
+        }
+        supercar_json_end_array(node);
+        supercar_json_string(node, "state", boot_state_names[timeline[i].state]);
+        if (timeline[i].state == SUPERCAR_BOOT_FAILED) {
+            supercar_json_string(node, "error", esp_err_to_name(timeline[i].err));
+        }
+        if (timeline[i].state != SUPERCAR_BOOT_PENDING) {
+            supercar_json_int(node, "core", timeline[i].core);
+            supercar_json_int(node, "start_us", timeline[i].start_us);
+        }
+        if (timeline[i].end_us) {
+            supercar_json_int(node, "end_us", timeline[i].end_us);
+            supercar_json_int(node, "duration_us", timeline[i].end_us - timeline[i].start_us);
+            if (timeline[i].end_us > end) {
+                end = timeline[i].end_us;
+            }
+        }
+        supercar_json_end_object(node);
+    }
+    supercar_json_end_array(node);
+    supercar_json_begin_object(node, "milestones");
+    for (int i = 0; i < boot_num_stages; i++) {
+        if (boot_stages[i].milestone && timeline[i].state == SUPERCAR_BOOT_DONE) {
+            supercar_json_int(node, boot_stages[i].milestone, timeline[i].end_us);
+        }
+    }
+    supercar_json_end_object(node);
+    supercar_json_int(node, "total_us", end - boot_start_us);
+}
@@ -0,0 +1,55 @@
+#ifndef _SUPERCAR_BOOT_H_
+#define _SUPERCAR_BOOT_H_
+
+#include "esp_system.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUPERCAR_BOOT_MAX_STAGES 12
+
+/* One step of the start up, it runs in its own task once the stages it comes after are done */
+typedef struct {
+    const char* name;
+    esp_err_t (*run)(supercar_t* car);
+    uint32_t after;                     // Mask of the stages, by index in the table, that must be done first
+    const char* milestone;              // Optional name of what the car can do once the stage is done
+} supercar_boot_stage_t;
+
+typedef enum {
+    SUPERCAR_BOOT_PENDING,
+    SUPERCAR_BOOT_RUNNING,
+    SUPERCAR_BOOT_DONE,
+    SUPERCAR_BOOT_FAILED,
+    SUPERCAR_BOOT_SKIPPED,              // A stage it comes after failed
+} supercar_boot_state_t;
+
+/**
+ * @brief Start every stage, the ones without pending dependencies run in parallel
+ *
+ * Returns at once, a failed stage only stops the stages that come after it.
+ *
+ * @param stages Stage table, it must outlive the boot
+ */
+esp_err_t supercar_boot_run(const supercar_boot_stage_t* stages, int num_stages, supercar_t* car);
+
+/**
+ * @brief Wait, from a stage, for stages it only needs on some boots
+ *
+ * @return ESP_ERR_INVALID_STATE if one of them failed
+ */
+esp_err_t supercar_boot_wait(uint32_t stages);
+
+/**
+ * @brief Timeline of the stages, in microseconds since the start of the firmware
+ */
+void supercar_boot_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
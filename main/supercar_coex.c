@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_coexist.h"
+#include "supercar_coex.h"
+
+#define COEX_WINDOW_US (1000 * 1000)
+#define COEX_WEB_LOAD_HOLD_US (1000 * 1000)
+#define COEX_HTTP_BUDGET_BYTES (CONFIG_SUPERCAR_COEX_HTTP_MAX_KBPS * 1024)
+
+static const char* TAG = "coex";
+
+static portMUX_TYPE coex_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static supercar_coex_stats_t coex;
+
+/* HTTP accounting, window based */
+static int64_t window_start;
+static uint32_t window_requests;
+static uint32_t window_bytes;
+static int active_requests;
+static int64_t last_http_activity;
+static int64_t throttle_start;          // First refused send, 0 while the budget lasts
+
+/* HID accounting */
+static int64_t last_report;
+static int64_t last_interval;
+
+static void supercar_coex_apply_preference(void){
+#if CONFIG_SUPERCAR_COEX_CONTROL_PRIORITY
+    esp_coex_prefer_t prefer = coex.moving ? ESP_COEX_PREFER_BT : ESP_COEX_PREFER_BALANCE;
+    esp_err_t err = esp_coex_preference_set(prefer);
+    if(err != ESP_OK){
+        ESP_LOGW(TAG, "Could not set coexistence preference (%s)", esp_err_to_name(err));
+        return;
+    }
+    coex.control_priority = coex.moving;
+    ESP_LOGD(TAG, "Coexistence preference: %s", coex.moving ? "BT" : "BALANCE");
+#endif
+}
+
+static void supercar_coex_apply_power_save(void){
+#if CONFIG_SUPERCAR_COEX_NO_PS_WITH_CLIENT
+    bool power_save = coex.clients == 0;
+    if(power_save == coex.power_save)
+        return;
+    esp_err_t err = esp_wifi_set_ps(power_save ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE);
+    portENTER_CRITICAL(&coex_lock);
+    coex.power_save_error = err;
+    if(err == ESP_OK)
+        coex.power_save = power_save;
+    portEXIT_CRITICAL(&coex_lock);
+    if(err != ESP_OK){
+        // Modem sleep is mandatory with Bluetooth coexistence, the status shows it stayed on
+        ESP_LOGW(TAG, "Could not change Wi-Fi power save (%s)", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "Wi-Fi modem power save %s", power_save ? "enabled" : "disabled");
+#endif
+}
+
+void supercar_coex_init(void){
+    memset(&coex, 0, sizeof(coex));
+    coex.power_save = true;
+    window_start = esp_timer_get_time();
+    supercar_coex_apply_preference();
+}
+
+void supercar_coex_set_moving(bool moving){
+    if(coex.moving == moving)
+        return;
+    coex.moving = moving;
+    supercar_coex_apply_preference();
+}
+
+void supercar_coex_client_attached(void){
+    portENTER_CRITICAL(&coex_lock);
+    coex.clients++;
+    portEXIT_CRITICAL(&coex_lock);
+    supercar_coex_apply_power_save();
+}
+
+void supercar_coex_client_detached(void){
+    portENTER_CRITICAL(&coex_lock);
+    if(coex.clients > 0)
+        coex.clients--;
+    portEXIT_CRITICAL(&coex_lock);
+    supercar_coex_apply_power_save();
+}
+
+static void supercar_coex_update_jitter(supercar_coex_jitter_t* bucket, int64_t interval){
+    bucket->reports++;
+    // Exponential smoothing with a 1/16 gain, same as the RTP interarrival jitter
+    bucket->interval_avg_us += ((int32_t) interval - (int32_t) bucket->interval_avg_us) / 16;
+    if(!last_interval)
+        return;
+    int64_t deviation = interval - last_interval;
+    if(deviation < 0)
+        deviation = -deviation;
+    bucket->jitter_avg_us += ((int32_t) deviation - (int32_t) bucket->jitter_avg_us) / 16;
+    if(deviation > bucket->jitter_max_us)
+        bucket->jitter_max_us = deviation;
+}
+
+void supercar_coex_hid_report(void){
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&coex_lock);
+    if(last_report){
+        int64_t interval = now - last_report;
+        bool loaded = active_requests > 0 || now - last_http_activity < COEX_WEB_LOAD_HOLD_US;
+        supercar_coex_update_jitter(loaded ? &coex.loaded : &coex.idle, interval);
+        last_interval = interval;
+    }
+    last_report = now;
+    portEXIT_CRITICAL(&coex_lock);
+}
+
+static void supercar_coex_roll_window(int64_t now){
+    if(now - window_start >= COEX_WINDOW_US){
+        window_start = now;
+        window_requests = 0;
+        window_bytes = 0;
+    }
+}
+
+bool supercar_coex_http_admit(void){
+    int64_t now = esp_timer_get_time();
+    bool admitted = true;
+    portENTER_CRITICAL(&coex_lock);
+    supercar_coex_roll_window(now);
+    last_http_activity = now;
+    if(coex.control_priority && window_requests >= CONFIG_SUPERCAR_COEX_HTTP_MAX_RPS){
+        coex.deferred_requests++;
+        admitted = false;
+    }else{
+        window_requests++;
+        active_requests++;
+    }
+    portEXIT_CRITICAL(&coex_lock);
+    return admitted;
+}
+
+uint32_t supercar_coex_http_reserve(size_t bytes){
+    int64_t now = esp_timer_get_time();
+    uint32_t wait_us = 0;
+    portENTER_CRITICAL(&coex_lock);
+    supercar_coex_roll_window(now);
+    last_http_activity = now;
+    if(!coex.control_priority || window_bytes + bytes <= COEX_HTTP_BUDGET_BYTES || window_bytes == 0){
+        window_bytes += bytes;
+        if(throttle_start){
+            coex.throttled_ms += (now - throttle_start) / 1000;
+            throttle_start = 0;
+        }
+    }else{
+        wait_us = COEX_WINDOW_US - (now - window_start);
+        if(!throttle_start)
+            throttle_start = now;
+    }
+    portEXIT_CRITICAL(&coex_lock);
+    return wait_us;
+}
+
+void supercar_coex_http_sent(size_t bytes){
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&coex_lock);
+    supercar_coex_roll_window(now);
+    last_http_activity = now;
+    window_bytes += bytes;
+    portEXIT_CRITICAL(&coex_lock);
+}
+
+void supercar_coex_http_done(void){
+    portENTER_CRITICAL(&coex_lock);
+    if(active_requests > 0)
+        active_requests--;
+    last_http_activity = esp_timer_get_time();
+    portEXIT_CRITICAL(&coex_lock);
+}
+
+void supercar_coex_get_stats(supercar_coex_stats_t* stats){
+    portENTER_CRITICAL(&coex_lock);
+    *stats = coex;
+    portEXIT_CRITICAL(&coex_lock);
+}
+
+static void supercar_coex_add_jitter_json(supercar_json_t* node, const char* name, supercar_coex_jitter_t* jitter){
+    supercar_json_begin_object(node, name);
+    supercar_json_int(node, "reports", jitter->reports);
+    supercar_json_int(node, "interval_avg_us", jitter->interval_avg_us);
+    supercar_json_int(node, "jitter_avg_us", jitter->jitter_avg_us);
+    supercar_json_int(node, "jitter_max_us", jitter->jitter_max_us);
+    supercar_json_end_object(node);
+}
+
+void supercar_coex_serialize(supercar_json_t* node, supercar_t* car){
+    supercar_coex_stats_t stats;
+    supercar_coex_get_stats(&stats);
+    supercar_json_bool(node, "moving", stats.moving);
+    supercar_json_bool(node, "control_priority", stats.control_priority);
+    supercar_json_bool(node, "power_save", stats.power_save);
+    supercar_json_string(node, "power_save_error", esp_err_to_name(stats.power_save_error));
+    supercar_json_int(node, "clients", stats.clients);
+    supercar_json_int(node, "deferred_requests", stats.deferred_requests);
+    supercar_json_int(node, "throttled_ms", stats.throttled_ms);
+    supercar_coex_add_jitter_json(node, "jitter_idle", &stats.idle);
+    supercar_coex_add_jitter_json(node, "jitter_loaded", &stats.loaded);
+}
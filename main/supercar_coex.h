@@ -0,0 +1,76 @@
+#ifndef _SUPERCAR_COEX_H_
+#define _SUPERCAR_COEX_H_
+
+#include "esp_system.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t reports;                   // Number of reports received in this bucket
+    uint32_t interval_avg_us;           // Smoothed interval between two reports
+    uint32_t jitter_avg_us;             // Smoothed deviation between two consecutive intervals
+    uint32_t jitter_max_us;             // Worst deviation seen
+} supercar_coex_jitter_t;
+
+typedef struct {
+    bool moving;
+    bool control_priority;              // BT preferred over Wi-Fi
+    bool power_save;                    // Wi-Fi modem power save enabled
+    esp_err_t power_save_error;         // Result of the last change, ESP_OK unless the driver kept modem sleep
+    int clients;                        // Open HTTP sessions
+    uint32_t deferred_requests;         // Requests refused while driving
+    uint32_t throttled_ms;              // Time HTTP sends were held back while driving
+    supercar_coex_jitter_t idle;        // Gamepad jitter without web traffic
+    supercar_coex_jitter_t loaded;      // Gamepad jitter with web traffic
+} supercar_coex_stats_t;
+
+void supercar_coex_init(void);
+
+/**
+ * @brief Switch the radio arbitration depending on whether the car is moving
+ */
+void supercar_coex_set_moving(bool moving);
+
+void supercar_coex_client_attached(void);
+
+void supercar_coex_client_detached(void);
+
+/**
+ * @brief Record the arrival of a gamepad report for the jitter statistics
+ */
+void supercar_coex_hid_report(void);
+
+/**
+ * @brief Check whether a new HTTP request may be served now
+ *
+ * @return false if the request should be deferred by the client (503 + Retry-After)
+ */
+bool supercar_coex_http_admit(void);
+
+/**
+ * @brief Take bytes about to be sent by the sender task out of the driving budget, never blocks
+ *
+ * @return 0 once taken, otherwise the time in us before the budget is renewed, nothing is taken
+ */
+uint32_t supercar_coex_http_reserve(size_t bytes);
+
+/**
+ * @brief Account for bytes sent from the server task, which is never held back
+ */
+void supercar_coex_http_sent(size_t bytes);
+
+void supercar_coex_http_done(void);
+
+void supercar_coex_get_stats(supercar_coex_stats_t* stats);
+
+void supercar_coex_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,110 +1,959 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
 #include "driver/gpio.h"
 #include "supercar_config.h"
+#include "supercar_tasks.h"
+#include "supercar_snapshot.h"
+#include "supercar_wifi.h"
+#include "supercar_rtc.h"
 #include "math.h"
 
 #define STORAGE_NAMESPACE "storage"
 #define TAG "supercar_config"
-#define MAX_LEN 2048
 
-static double supercar_get_number(cJSON* cfg, char* name){
-    ESP_LOGD(TAG, "Trying to get value of %s", name);
-    cJSON* item = cJSON_GetObjectItem(cfg, name);
-    if(!item){
-        ESP_LOGW(TAG, "Variable %s not found", name);
-        return NAN;
+/* The ESP32 is little endian, the fields are copied as they are in memory */
+static void supercar_record_put(supercar_record_t* record, const void* value, size_t len){
+    if(record->offset + len > record->size){
+        record->overflow = true;
+        return;
     }
+    memcpy(record->data + record->offset, value, len);
+    record->offset += len;
+}
 
-    double val = cJSON_GetNumberValue(item);
-    return val;
+static void supercar_record_put_int(supercar_record_t* record, int value){
+    int32_t field = value;
+    supercar_record_put(record, &field, sizeof(field));
 }
 
-static void supercar_update_int(cJSON* cfg, char* name, int* value){
-    double val = supercar_get_number(cfg, name);
-    if(val == NAN){
-        ESP_LOGW(TAG, "Variable %s is not a number", name);
-        return;
+static void supercar_record_put_float(supercar_record_t* record, float value){
+    supercar_record_put(record, &value, sizeof(value));
+}
+
+static bool supercar_record_get(supercar_record_t* record, void* value, size_t len){
+    if(record->offset + len > record->size){
+        // Appended by a later version, the field keeps its value
+        record->overflow = true;
+        return false;
+    }
+    memcpy(value, record->data + record->offset, len);
+    record->offset += len;
+    return true;
+}
+
+static void supercar_record_get_int(supercar_record_t* record, int* field){
+    int32_t value;
+    if(supercar_record_get(record, &value, sizeof(value))){
+        *field = value;
+    }
+}
+
+static void supercar_record_get_float(supercar_record_t* record, float* field){
+    float value;
+    if(supercar_record_get(record, &value, sizeof(value)) && isfinite(value)){
+        *field = value;
+    }
+}
+
+/* FNV-1a of a table entry name, adding a task or an input source does not shift the entries of the others */
+static int supercar_record_key(const char* name){
+    uint32_t hash = 2166136261u;
+    while(*name){
+        hash = (hash ^ (uint8_t) *name++) * 16777619u;
+    }
+    return (int) hash;
+}
+
+#define SUPERCAR_FIELD_ENTRY(type_name, field, field_type, field_min, field_max, field_units, field_title) { \
+    .name = #field, \
+    .type = SUPERCAR_FIELD_##field_type, \
+    .offset = offsetof(type_name, field), \
+    .min = field_min, \
+    .max = field_max, \
+    .units = field_units, \
+    .title = field_title }
+
+#define SUPERCAR_FIELD_RETIRED(field, field_type) { \
+    .name = #field, \
+    .type = SUPERCAR_FIELD_##field_type, \
+    .retired = true }
+
+/* Open addressing by the hash of the name, built once at boot */
+static void supercar_fields_index(supercar_field_table_t* table){
+    memset(table->slots, 0, sizeof(table->slots));
+    for(int i = 0; i < table->count; i++){
+        if(table->fields[i].retired){
+            continue;
+        }
+        uint32_t hash = supercar_record_key(table->fields[i].name);
+        uint32_t slot = hash & (SUPERCAR_FIELD_SLOTS - 1);
+        while(table->slots[slot]){
+            slot = (slot + 1) & (SUPERCAR_FIELD_SLOTS - 1);
+        }
+        table->slots[slot] = i + 1;
+        table->hashes[slot] = hash;
+    }
+}
+
+static const supercar_field_t* supercar_fields_find(const supercar_field_table_t* table, const char* name){
+    uint32_t hash = supercar_record_key(name);
+    for(uint32_t slot = hash & (SUPERCAR_FIELD_SLOTS - 1); table->slots[slot]; slot = (slot + 1) & (SUPERCAR_FIELD_SLOTS - 1)){
+        const supercar_field_t* field = &table->fields[table->slots[slot] - 1];
+        if(table->hashes[slot] == hash && !strcmp(field->name, name)){
+            return field;
+        }
+    }
+    return NULL;
+}
+
+static void supercar_fields_serialize(supercar_json_t* node, const supercar_field_table_t* table, const void* values){
+    for(int i = 0; i < table->count; i++){
+        const supercar_field_t* field = &table->fields[i];
+        const void* member = (const uint8_t*) values + field->offset;
+        if(field->retired){
+            continue;
+        }
+        if(field->type == SUPERCAR_FIELD_INT){
+            supercar_json_int(node, field->name, *(const int*) member);
+        }else{
+            supercar_json_number(node, field->name, *(const float*) member);
+        }
+    }
+}
+
+static bool supercar_field_in_bounds(const supercar_field_t* field, double value){
+    return value >= field->min && value <= field->max;
+}
+
+/* Out of bounds values are rejected, the staged value is left as it was */
+static esp_err_t supercar_fields_stage(const supercar_field_table_t* table, void* values, const char* path, const supercar_json_value_t* value){
+    const supercar_field_t* field = supercar_fields_find(table, path);
+    if(field == NULL){
+        return ESP_ERR_NOT_FOUND;
+    }
+    if(value->type != SUPERCAR_JSON_NUMBER || !supercar_field_in_bounds(field, value->number)){
+        return ESP_ERR_INVALID_ARG;
+    }
+    void* member = (uint8_t*) values + field->offset;
+    if(field->type == SUPERCAR_FIELD_INT){
+        if(value->number != (int) value->number){
+            return ESP_ERR_INVALID_ARG;
+        }
+        *(int*) member = (int) value->number;
+    }else{
+        *(float*) member = (float) value->number;
+    }
+    return ESP_OK;
+}
+
+static void supercar_fields_encode(supercar_record_t* record, const supercar_field_table_t* table, const void* values){
+    for(int i = 0; i < table->count; i++){
+        const supercar_field_t* field = &table->fields[i];
+        const void* member = (const uint8_t*) values + field->offset;
+        if(field->retired){
+            supercar_record_put_int(record, 0);
+        }else if(field->type == SUPERCAR_FIELD_INT){
+            supercar_record_put_int(record, *(const int*) member);
+        }else{
+            supercar_record_put_float(record, *(const float*) member);
+        }
+    }
+}
+
+/* A value out of the bounds of this firmware keeps the staged one */
+static void supercar_fields_decode(supercar_record_t* record, const supercar_field_table_t* table, void* values){
+    for(int i = 0; i < table->count; i++){
+        const supercar_field_t* field = &table->fields[i];
+        void* member = (uint8_t*) values + field->offset;
+        if(field->retired){
+            int ignored;
+            supercar_record_get_int(record, &ignored);
+        }else if(field->type == SUPERCAR_FIELD_INT){
+            int value = *(int*) member;
+            supercar_record_get_int(record, &value);
+            if(supercar_field_in_bounds(field, value)){
+                *(int*) member = value;
+            }
+        }else{
+            float value = *(float*) member;
+            supercar_record_get_float(record, &value);
+            if(supercar_field_in_bounds(field, value)){
+                *(float*) member = value;
+            }
+        }
+    }
+}
+
+static void supercar_fields_schema(supercar_json_t* node, const supercar_field_table_t* table){
+    supercar_json_string(node, "type", "object");
+    supercar_json_begin_object(node, "properties");
+    for(int i = 0; i < table->count; i++){
+        const supercar_field_t* field = &table->fields[i];
+        if(field->retired){
+            continue;
+        }
+        supercar_json_begin_object(node, field->name);
+        supercar_json_string(node, "type", field->type == SUPERCAR_FIELD_INT ? "integer" : "number");
+        supercar_json_string(node, "title", field->title);
+        supercar_json_number(node, "minimum", field->min);
+        supercar_json_number(node, "maximum", field->max);
+        if(field->units[0]){
+            supercar_json_string(node, "units", field->units);
+        }
+        supercar_json_end_object(node);
+    }
+    supercar_json_end_object(node);
+}
+
+/* Generated from supercar_config.def */
+static const supercar_field_t supercar_motor_field_list[] = {
+#define SUPERCAR_MOTOR_FIELD(field, type, min, max, units, title) \
+    SUPERCAR_FIELD_ENTRY(supercar_motor_config_t, field, type, min, max, units, title),
+#include "supercar_config.def"
+};
+
+/* The table and the hand written motor structure must agree on the C types */
+#define SUPERCAR_MOTOR_FIELD(field, type, min, max, units, title) \
+    _Static_assert(__builtin_types_compatible_p(__typeof__(((supercar_motor_config_t*) 0)->field), SUPERCAR_FIELD_CTYPE_##type), #field);
+#include "supercar_config.def"
+
+static supercar_field_table_t supercar_motor_fields = {
+    .fields = supercar_motor_field_list,
+    .count = sizeof(supercar_motor_field_list) / sizeof(supercar_motor_field_list[0])
+};
+
+void supercar_serialize_motor_config(supercar_json_t* cfg, const supercar_motor_config_t* mcfg){
+    supercar_fields_serialize(cfg, &supercar_motor_fields, mcfg);
+}
+
+/* Motor record, version 1 */
+static void supercar_encode_motor(supercar_record_t* record, const supercar_staging_t* staging){
+    supercar_fields_encode(record, &supercar_motor_fields, &staging->motor);
+}
+
+static void supercar_decode_motor(supercar_record_t* record, supercar_staging_t* staging, uint8_t version){
+    supercar_fields_decode(record, &supercar_motor_fields, &staging->motor);
+}
+
+static esp_err_t supercar_stage_motor_field(supercar_staging_t* staging, const char* path, const supercar_json_value_t* value){
+    return supercar_fields_stage(&supercar_motor_fields, &staging->motor, path, value);
+}
+
+/* Generated from supercar_config.def */
+static const supercar_field_t supercar_main_field_list[] = {
+#define SUPERCAR_MAIN_FIELD(field, type, min, max, units, title) \
+    SUPERCAR_FIELD_ENTRY(supercar_config_t, field, type, min, max, units, title),
+#define SUPERCAR_MAIN_RETIRED(field, type) SUPERCAR_FIELD_RETIRED(field, type),
+#include "supercar_config.def"
+};
+
+static supercar_field_table_t supercar_main_fields = {
+    .fields = supercar_main_field_list,
+    .count = sizeof(supercar_main_field_list) / sizeof(supercar_main_field_list[0])
+};
+
+void supercar_serialize_config_values(supercar_json_t* cfg, const supercar_config_t* values){
+    supercar_fields_serialize(cfg, &supercar_main_fields, values);
+}
+
+/* The serializers run outside of the control task, they read the published snapshot */
+void supercar_serialize_config(supercar_json_t* cfg, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_serialize_config_values(cfg, &snapshot.cfg);
+}
+
+static void supercar_stage_config(supercar_staging_t* staging, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    staging->cfg = snapshot.cfg;
+}
+
+static esp_err_t supercar_stage_config_field(supercar_staging_t* staging, const char* path, const supercar_json_value_t* value){
+    return supercar_fields_stage(&supercar_main_fields, &staging->cfg, path, value);
+}
+
+static void supercar_config_legacy_record(supercar_record_t record);
+
+/* Main record, version 2: same fields as version 1, whose speeds and thresholds go to the default profile */
+static void supercar_encode_config(supercar_record_t* record, const supercar_staging_t* staging){
+    supercar_fields_encode(record, &supercar_main_fields, &staging->cfg);
+}
+
+static void supercar_decode_config(supercar_record_t* record, supercar_staging_t* staging, uint8_t version){
+    if(version < 2){
+        supercar_config_legacy_record(*record);
+    }
+    supercar_fields_decode(record, &supercar_main_fields, &staging->cfg);
+}
+
+/* Runs in the control task */
+static void supercar_apply_config_section(const void* staging, supercar_t* car){
+    const supercar_config_t* cfg = &((const supercar_staging_t*) staging)->cfg;
+    if(cfg->wifi_mode != car->cfg.wifi_mode){
+        // Switched by its own task, the answer to the request goes out first
+        supercar_wifi_request_mode(cfg->wifi_mode);
+    }
+    car->cfg = *cfg;
+}
+
+void supercar_serialize_propulsion_config(supercar_json_t* node, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_serialize_motor_config(node, &snapshot.propulsion.cfg);
+}
+
+static void supercar_stage_propulsion(supercar_staging_t* staging, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    staging->motor = snapshot.propulsion.cfg;
+}
+
+static void supercar_apply_propulsion_section(const void* staging, supercar_t* car){
+    brushed_motor_configure(&car->propulsion_motor_ctrl, &((const supercar_staging_t*) staging)->motor);
+}
+
+void supercar_serialize_steering_config(supercar_json_t* node, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_serialize_motor_config(node, &snapshot.steering_motor.cfg);
+}
+
+static void supercar_stage_steering(supercar_staging_t* staging, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    staging->motor = snapshot.steering_motor.cfg;
+}
+
+static void supercar_apply_steering_section(const void* staging, supercar_t* car){
+    brushed_motor_configure(&car->steering_motor_ctrl, &((const supercar_staging_t*) staging)->motor);
+}
+
+static void supercar_stage_tasks(supercar_staging_t* staging, supercar_t* car){
+    supercar_tasks_stage(staging->tasks);
+}
+
+static esp_err_t supercar_stage_tasks_field(supercar_staging_t* staging, const char* path, const supercar_json_value_t* value){
+    return supercar_tasks_stage_field(staging->tasks, path, value);
+}
+
+static void supercar_apply_tasks_section(const void* staging, supercar_t* car){
+    supercar_tasks_apply(((const supercar_staging_t*) staging)->tasks);
+}
+
+/* Tasks record, version 1: count, then key, core, priority and stack of each task */
+_Static_assert(SUPERCAR_RTC_RECORD_MAX >= sizeof(supercar_record_header_t) + 4 + 16 * SUPERCAR_TASK_MAX,
+    "The tasks record no longer fits in its RTC memory slot");
+static void supercar_encode_tasks(supercar_record_t* record, const supercar_staging_t* staging){
+    supercar_record_put_int(record, SUPERCAR_TASK_MAX);
+    for(int i = 0; i < SUPERCAR_TASK_MAX; i++){
+        supercar_record_put_int(record, supercar_record_key(supercar_task_get(i)->name));
+        supercar_record_put_int(record, staging->tasks[i].core);
+        supercar_record_put_int(record, staging->tasks[i].priority);
+        supercar_record_put_int(record, staging->tasks[i].stack);
+    }
+}
+
+static void supercar_decode_tasks(supercar_record_t* record, supercar_staging_t* staging, uint8_t version){
+    int count = 0;
+    supercar_record_get_int(record, &count);
+    for(int n = 0; n < count && !record->overflow; n++){
+        int key = 0;
+        supercar_task_placement_t placement = {0};
+        int stack = 0;
+        supercar_record_get_int(record, &key);
+        supercar_record_get_int(record, &placement.core);
+        supercar_record_get_int(record, &placement.priority);
+        supercar_record_get_int(record, &stack);
+        placement.stack = stack;
+        for(int i = 0; i < SUPERCAR_TASK_MAX && !record->overflow; i++){
+            if(supercar_record_key(supercar_task_get(i)->name) != key){
+                continue;
+            }
+            // The CRC only says the record is intact, it may come from another firmware
+            if(!supercar_task_placement_valid(&placement)){
+                ESP_LOGW(TAG, "Invalid placement of %s in the record, keeping %d/%d/%u", supercar_task_get(i)->name,
+                    staging->tasks[i].core, staging->tasks[i].priority, staging->tasks[i].stack);
+                continue;
+            }
+            staging->tasks[i] = placement;
+        }
+    }
+}
+
+void supercar_serialize_arbiter(supercar_json_t* node, supercar_t* car){
+    supercar_arbiter_serialize(node);
+}
+
+static void supercar_stage_arbiter(supercar_staging_t* staging, supercar_t* car){
+    supercar_arbiter_stage(staging->arbiter);
+}
+
+static esp_err_t supercar_stage_arbiter_field(supercar_staging_t* staging, const char* path, const supercar_json_value_t* value){
+    return supercar_arbiter_stage_field(staging->arbiter, path, value);
+}
+
+static void supercar_apply_arbiter_section(const void* staging, supercar_t* car){
+    supercar_arbiter_apply(((const supercar_staging_t*) staging)->arbiter);
+}
+
+/* Arbiter record, version 1: count, then key, priority and timeout of each source */
+_Static_assert(SUPERCAR_RTC_RECORD_MAX >= sizeof(supercar_record_header_t) + 4 + 12 * SUPERCAR_SOURCE_MAX,
+    "The arbiter record no longer fits in its RTC memory slot");
+static void supercar_encode_arbiter(supercar_record_t* record, const supercar_staging_t* staging){
+    supercar_record_put_int(record, SUPERCAR_SOURCE_MAX);
+    for(int i = 0; i < SUPERCAR_SOURCE_MAX; i++){
+        supercar_record_put_int(record, supercar_record_key(supercar_arbiter_source_name(i)));
+        supercar_record_put_int(record, staging->arbiter[i].priority);
+        supercar_record_put_int(record, staging->arbiter[i].timeout_ms);
     }
-    int old_value = *value;
-    *value = (int) val;
-    ESP_LOGD(TAG, "Setting value %s=%d (%d)", name, *value, old_value);
 }
 
-static void supercar_update_float(cJSON* cfg, char* name, float* value){
-    double val = supercar_get_number(cfg, name);
-    if(val || val == NAN)
+static void supercar_decode_arbiter(supercar_record_t* record, supercar_staging_t* staging, uint8_t version){
+    int count = 0;
+    supercar_record_get_int(record, &count);
+    for(int n = 0; n < count && !record->overflow; n++){
+        int key = 0;
+        supercar_arbiter_rule_t rule = {0};
+        supercar_record_get_int(record, &key);
+        supercar_record_get_int(record, &rule.priority);
+        supercar_record_get_int(record, &rule.timeout_ms);
+        for(int i = 0; i < SUPERCAR_SOURCE_MAX && !record->overflow; i++){
+            if(supercar_record_key(supercar_arbiter_source_name(i)) != key){
+                continue;
+            }
+            if(!supercar_arbiter_rule_valid(i, &rule)){
+                ESP_LOGW(TAG, "Invalid rule of %s in the record, keeping %d/%d ms", supercar_arbiter_source_name(i),
+                    staging->arbiter[i].priority, staging->arbiter[i].timeout_ms);
+                continue;
+            }
+            staging->arbiter[i] = rule;
+        }
+    }
+}
+
+static void supercar_config_report(char keys[SUPERCAR_CONFIG_MAX_REPORTED][SUPERCAR_JSON_MAX_PATH], uint32_t* count, const char* path){
+    if(*count < SUPERCAR_CONFIG_MAX_REPORTED){
+        strlcpy(keys[*count], path, SUPERCAR_JSON_MAX_PATH);
+    }
+    (*count)++;
+}
+
+typedef struct {
+    int pin;
+    const char* owner;
+} supercar_pin_use_t;
+
+/* SPI flash (6 to 11) and UART0 console (1 and 3), GPIO_IS_VALID_OUTPUT_GPIO accepts them */
+#define SUPERCAR_RESERVED_PINS ((1ULL << 1) | (1ULL << 3) | (0x3fULL << 6))
+
+/* A pin that did not change is not checked again, the board may be wired that way */
+static void supercar_validate_pin(supercar_config_load_t* load, const char* path, int* pin, int current,
+    bool output, const supercar_pin_use_t* used, size_t count){
+    if(*pin == current){
         return;
+    }
+    const char* owner = NULL;
+    if(*pin < 0 || *pin >= 64 || ((SUPERCAR_RESERVED_PINS >> *pin) & 1)){
+        owner = "reserved";
+    } else if(output ? !GPIO_IS_VALID_OUTPUT_GPIO(*pin) : !GPIO_IS_VALID_GPIO(*pin)){
+        owner = output ? "no output" : "no input";
+    }
+    for(size_t i = 0; i < count && owner == NULL; i++){
+        if(used[i].pin == *pin){
+            owner = used[i].owner;
+        }
+    }
+    if(owner != NULL){
+        ESP_LOGW(TAG, "Invalid %s %s: GPIO %d is %s", load->section->name, path, *pin, owner);
+        supercar_config_report(load->invalid_keys, &load->invalid, path);
+        *pin = current;
+    }
+}
+
+/* Checked before the motor is ramped down, a rejected change never stops it */
+static void supercar_validate_motor(supercar_config_load_t* load, const supercar_snapshot_t* snapshot,
+    const supercar_motor_config_t* other){
+    supercar_motor_config_t* mcfg = &load->staging.motor;
+    const supercar_motor_config_t* current = &load->current.motor;
+    // The ramp steps on frames of the control loop
+    if(mcfg->ctrl_period <= 0 || (mcfg->ctrl_period * 1000) % CONFIG_SUPERCAR_SCHED_PERIOD_US){
+        ESP_LOGW(TAG, "Invalid %s ctrl_period: %d ms", load->section->name, mcfg->ctrl_period);
+        supercar_config_report(load->invalid_keys, &load->invalid, "ctrl_period");
+        mcfg->ctrl_period = current->ctrl_period;
+    }
 
-    float old_value = *value;
-    *value = (float) val;
-    ESP_LOGD(TAG, "Setting value %s=%f (%f)", name, *value, old_value);
+    const supercar_pin_use_t used[] = {
+        { other->pwm_pin, "the other motor PWM" },
+        { other->direction_pin, "the other motor direction" },
+        { snapshot->cfg.mode_input_pin, "the mode input" },
+        { snapshot->cfg.mode_output_pin, "the mode output" },
+        { snapshot->cfg.power_output_pin, "the power output" },
+        { GPIO_ACCELERATOR_FWD_IN, "the accelerator" },
+        { GPIO_ACCELERATOR_BWD_IN, "the accelerator" },
+        { GPIO_DISTANCE_SENSOR_IN, "the distance sensor" },
+    };
+    size_t count = sizeof(used) / sizeof(used[0]);
+    supercar_validate_pin(load, "pwm_pin", &mcfg->pwm_pin, current->pwm_pin, true, used, count);
+    supercar_validate_pin(load, "direction_pin", &mcfg->direction_pin, current->direction_pin, true, used, count);
+    if(mcfg->pwm_pin == mcfg->direction_pin){
+        ESP_LOGW(TAG, "Invalid %s pins: GPIO %d for both PWM and direction", load->section->name, mcfg->pwm_pin);
+        supercar_config_report(load->invalid_keys, &load->invalid, "direction_pin");
+        mcfg->pwm_pin = current->pwm_pin;
+        mcfg->direction_pin = current->direction_pin;
+    }
 }
 
-void supercar_serialize_motor_config(cJSON* cfg, supercar_motor_control_t* mctl){
-    cJSON_AddNumberToObject(cfg, "acceleration", mctl->cfg.acceleration);
-    cJSON_AddNumberToObject(cfg, "ctrl_period", mctl->cfg.ctrl_period);
-    cJSON_AddNumberToObject(cfg, "pwm_freq", mctl->cfg.pwm_freq);
-    cJSON_AddNumberToObject(cfg, "pwm_pin", mctl->cfg.pwm_pin);
-    cJSON_AddNumberToObject(cfg, "direction_pin", mctl->cfg.direction_pin);
+/* The main pins are configured at boot, a reserved one would crash every boot */
+static void supercar_validate_config(supercar_config_load_t* load){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_config_t* cfg = &load->staging.cfg;
+    const supercar_config_t* current = &load->current.cfg;
+    const supercar_pin_use_t used[] = {
+        { snapshot.propulsion.cfg.pwm_pin, "the propulsion PWM" },
+        { snapshot.propulsion.cfg.direction_pin, "the propulsion direction" },
+        { snapshot.steering_motor.cfg.pwm_pin, "the steering PWM" },
+        { snapshot.steering_motor.cfg.direction_pin, "the steering direction" },
+        { GPIO_ACCELERATOR_FWD_IN, "the accelerator" },
+        { GPIO_ACCELERATOR_BWD_IN, "the accelerator" },
+        { GPIO_DISTANCE_SENSOR_IN, "the distance sensor" },
+    };
+    size_t count = sizeof(used) / sizeof(used[0]);
+    supercar_validate_pin(load, "mode_input_pin", &cfg->mode_input_pin, current->mode_input_pin, false, used, count);
+    supercar_validate_pin(load, "mode_output_pin", &cfg->mode_output_pin, current->mode_output_pin, true, used, count);
+    supercar_validate_pin(load, "power_output_pin", &cfg->power_output_pin, current->power_output_pin, true, used, count);
 }
 
-void supercar_deserialize_motor_config(cJSON* cfg, supercar_motor_control_t* mctl){
-    supercar_update_float(cfg, "acceleration", &mctl->cfg.acceleration);
-    supercar_update_int(cfg, "ctrl_period", &mctl->cfg.ctrl_period);
-    supercar_update_int(cfg, "pwm_freq", &mctl->cfg.pwm_freq);
-    supercar_update_int(cfg, "pwm_pin", &mctl->cfg.pwm_pin);
-    supercar_update_int(cfg, "direction_pin", &mctl->cfg.direction_pin);
+static void supercar_validate_propulsion(supercar_config_load_t* load){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_validate_motor(load, &snapshot, &snapshot.steering_motor.cfg);
 }
 
-void supercar_serialize_config(cJSON* cfg, supercar_t* car){
-    cJSON_AddNumberToObject(cfg, "max_speed", car->cfg.max_speed);
-    cJSON_AddNumberToObject(cfg, "delta_speed", car->cfg.delta_speed);
-    cJSON_AddNumberToObject(cfg, "mode_input_pin", car->cfg.mode_input_pin);
-    cJSON_AddNumberToObject(cfg, "mode_output_pin", car->cfg.mode_output_pin);
-    cJSON_AddNumberToObject(cfg, "power_output_pin", car->cfg.power_output_pin);
-    cJSON_AddNumberToObject(cfg, "distance_threshold_forward", car->cfg.distance_threshold_forward);
-    cJSON_AddNumberToObject(cfg, "distance_threshold_backward", car->cfg.distance_threshold_backward);
+static void supercar_validate_steering(supercar_config_load_t* load){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_validate_motor(load, &snapshot, &snapshot.propulsion.cfg);
 }
 
-void supercar_deserialize_config(cJSON* cfg, supercar_t* car){
-    supercar_update_int(cfg, "max_speed", &car->cfg.max_speed);
-    supercar_update_int(cfg, "delta_speed", &car->cfg.delta_speed);
-    supercar_update_int(cfg, "mode_input_pin", &car->cfg.mode_input_pin);
-    supercar_update_int(cfg, "mode_output_pin", &car->cfg.mode_output_pin);
-    supercar_update_int(cfg, "power_output_pin", &car->cfg.power_output_pin);
-    supercar_update_int(cfg, "distance_threshold_forward", &car->cfg.distance_threshold_forward);
-    supercar_update_int(cfg, "distance_threshold_backward", &car->cfg.distance_threshold_backward);
+/* Generated from supercar_config.def */
+static const supercar_field_t supercar_profile_field_list[] = {
+#define SUPERCAR_PROFILE_FIELD(field, type, min, max, units, title) \
+    SUPERCAR_FIELD_ENTRY(supercar_profile_t, field, type, min, max, units, title),
+#include "supercar_config.def"
+};
+
+static supercar_field_table_t supercar_profile_fields = {
+    .fields = supercar_profile_field_list,
+    .count = sizeof(supercar_profile_field_list) / sizeof(supercar_profile_field_list[0])
+};
+
+void supercar_serialize_profiles(supercar_json_t* node, supercar_t* car){
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    supercar_profile_t profiles[SUPERCAR_PROFILE_MAX];
+    supercar_profiles_stage(profiles);
+    supercar_json_string(node, "active", supercar_profile_name(snapshot.profile));
+    supercar_json_int(node, "max_speed", snapshot.max_speed);
+    for(int i = 0; i < SUPERCAR_PROFILE_MAX; i++){
+        supercar_json_begin_object(node, supercar_profile_name(i));
+        supercar_fields_serialize(node, &supercar_profile_fields, &profiles[i]);
+        supercar_json_end_object(node);
+    }
 }
 
-void supercar_serialize_propulsion_config(cJSON* node, supercar_t* car){
-    supercar_serialize_motor_config(node, &car->propulsion_motor_ctrl);
+static void supercar_stage_profiles(supercar_staging_t* staging, supercar_t* car){
+    supercar_profiles_stage(staging->profiles);
 }
 
-void supercar_deserialize_propulsion_config(cJSON* node, supercar_t* car){
-    supercar_deserialize_motor_config(node, &car->propulsion_motor_ctrl);
+static esp_err_t supercar_stage_profiles_field(supercar_staging_t* staging, const char* path, const supercar_json_value_t* value){
+    const char* member = strchr(path, '.');
+    if(member == NULL){
+        // Reported by GET, the profile is switched with /api/supercar/profile
+        return !strcmp(path, "active") || !strcmp(path, "max_speed") ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+    supercar_profile_id_t id = supercar_profile_find(path, member - path);
+    if(id == SUPERCAR_PROFILE_MAX){
+        return ESP_ERR_NOT_FOUND;
+    }
+    return supercar_fields_stage(&supercar_profile_fields, &staging->profiles[id], member + 1, value);
 }
 
-void supercar_serialize_steering_config(cJSON* node, supercar_t* car){
-    supercar_serialize_motor_config(node, &car->steering_motor_ctrl);
+static void supercar_apply_profiles_section(const void* staging, supercar_t* car){
+    supercar_profiles_apply(((const supercar_staging_t*) staging)->profiles);
+    // The values of the active profile may have changed
+    supercar_select_profile(car, car->profile_id);
 }
 
-void supercar_deserialize_steering_config(cJSON* node, supercar_t* car){
-    supercar_deserialize_motor_config(node, &car->steering_motor_ctrl);
+/* Profiles record, version 1: count, then key, field count and fields of each profile */
+static void supercar_encode_profiles(supercar_record_t* record, const supercar_staging_t* staging){
+    supercar_record_put_int(record, SUPERCAR_PROFILE_MAX);
+    for(int i = 0; i < SUPERCAR_PROFILE_MAX; i++){
+        supercar_record_put_int(record, supercar_record_key(supercar_profile_name(i)));
+        supercar_record_put_int(record, supercar_profile_fields.count);
+        supercar_fields_encode(record, &supercar_profile_fields, &staging->profiles[i]);
+    }
+}
+
+static void supercar_decode_profiles(supercar_record_t* record, supercar_staging_t* staging, uint8_t version){
+    int count = 0;
+    supercar_record_get_int(record, &count);
+    for(int n = 0; n < count && !record->overflow; n++){
+        int key = 0;
+        int fields = 0;
+        supercar_record_get_int(record, &key);
+        supercar_record_get_int(record, &fields);
+        // All the fields take 4 bytes, those appended by a newer firmware are skipped
+        size_t len = fields * sizeof(int32_t);
+        if(fields < 0 || record->offset + len > record->size){
+            record->overflow = true;
+            break;
+        }
+        for(int i = 0; i < SUPERCAR_PROFILE_MAX; i++){
+            if(supercar_record_key(supercar_profile_name(i)) == key){
+                supercar_record_t entry = { .data = record->data + record->offset, .size = len };
+                supercar_fields_decode(&entry, &supercar_profile_fields, &staging->profiles[i]);
+            }
+        }
+        record->offset += len;
+    }
 }
 
 #define MAIN_CONFIG "main"
 #define PROPULSION_CONFIG "propulsion"
 #define STEERING_CONFIG "steering"
+#define TASKS_CONFIG "tasks"
+#define ARBITER_CONFIG "arbiter"
+#define PROFILES_CONFIG "profiles"
 
-static esp_err_t supercar_nvs_read(supercar_t* car, void (*deserialize)(cJSON*, supercar_t*), const char* name){
-    ESP_LOGD(TAG, "Saving configuration");
+const supercar_section_t supercar_config_section = {
+    .name = MAIN_CONFIG,
+    .version = 2,
+    .stage = supercar_stage_config,
+    .stage_field = supercar_stage_config_field,
+    .apply = supercar_apply_config_section,
+    .serialize = supercar_serialize_config,
+    .encode = supercar_encode_config,
+    .decode = supercar_decode_config,
+    .validate = supercar_validate_config,
+    .fields = &supercar_main_fields
+};
+
+const supercar_section_t supercar_propulsion_section = {
+    .name = PROPULSION_CONFIG,
+    .version = 1,
+    .stage = supercar_stage_propulsion,
+    .stage_field = supercar_stage_motor_field,
+    .apply = supercar_apply_propulsion_section,
+    .serialize = supercar_serialize_propulsion_config,
+    .encode = supercar_encode_motor,
+    .decode = supercar_decode_motor,
+    .validate = supercar_validate_propulsion,
+    .fields = &supercar_motor_fields
+};
+
+const supercar_section_t supercar_steering_section = {
+    .name = STEERING_CONFIG,
+    .version = 1,
+    .stage = supercar_stage_steering,
+    .stage_field = supercar_stage_motor_field,
+    .apply = supercar_apply_steering_section,
+    .serialize = supercar_serialize_steering_config,
+    .encode = supercar_encode_motor,
+    .decode = supercar_decode_motor,
+    .validate = supercar_validate_steering,
+    .fields = &supercar_motor_fields
+};
+
+const supercar_section_t supercar_tasks_section = {
+    .name = TASKS_CONFIG,
+    .version = 1,
+    .stage = supercar_stage_tasks,
+    .stage_field = supercar_stage_tasks_field,
+    .apply = supercar_apply_tasks_section,
+    .serialize = supercar_serialize_tasks,
+    .encode = supercar_encode_tasks,
+    .decode = supercar_decode_tasks
+};
+
+const supercar_section_t supercar_arbiter_section = {
+    .name = ARBITER_CONFIG,
+    .version = 1,
+    .stage = supercar_stage_arbiter,
+    .stage_field = supercar_stage_arbiter_field,
+    .apply = supercar_apply_arbiter_section,
+    .serialize = supercar_serialize_arbiter,
+    .encode = supercar_encode_arbiter,
+    .decode = supercar_decode_arbiter
+};
+
+const supercar_section_t supercar_profiles_section = {
+    .name = PROFILES_CONFIG,
+    .version = 1,
+    .stage = supercar_stage_profiles,
+    .stage_field = supercar_stage_profiles_field,
+    .apply = supercar_apply_profiles_section,
+    .serialize = supercar_serialize_profiles,
+    .encode = supercar_encode_profiles,
+    .decode = supercar_decode_profiles
+};
+
+const supercar_section_t* const supercar_sections[] = {
+    &supercar_config_section,
+    &supercar_propulsion_section,
+    &supercar_steering_section,
+    &supercar_tasks_section,
+    &supercar_arbiter_section,
+    &supercar_profiles_section,
+};
+const size_t supercar_sections_count = sizeof(supercar_sections) / sizeof(supercar_sections[0]);
+
+void supercar_config_init(void){
+    supercar_fields_index(&supercar_main_fields);
+    supercar_fields_index(&supercar_motor_fields);
+    supercar_fields_index(&supercar_profile_fields);
+}
+
+void supercar_serialize_config_schema(supercar_json_t* node, supercar_t* car){
+    for(size_t i = 0; i < supercar_sections_count; i++){
+        const supercar_section_t* section = supercar_sections[i];
+        if(section->fields){
+            supercar_json_begin_object(node, section->name);
+            supercar_fields_schema(node, section->fields);
+            supercar_json_end_object(node);
+        }
+    }
+    // Each of the profiles
+    supercar_json_begin_object(node, PROFILES_CONFIG);
+    supercar_fields_schema(node, &supercar_profile_fields);
+    supercar_json_end_object(node);
+}
+
+static supercar_section_load_t section_loads[sizeof(supercar_sections) / sizeof(supercar_sections[0])];
+
+/* Called by the parser for every member, the document goes on whatever happens to one member */
+static esp_err_t supercar_config_load_field(void* ctx, const char* path, const supercar_json_value_t* value){
+    supercar_config_load_t* load = ctx;
+    esp_err_t err = load->section->stage_field(&load->staging, path, value);
+    if(err == ESP_ERR_NOT_FOUND){
+        ESP_LOGW(TAG, "Unknown %s member %s", load->section->name, path);
+        supercar_config_report(load->unknown_keys, &load->unknown, path);
+    }else if(err != ESP_OK){
+        ESP_LOGW(TAG, "Invalid value for %s member %s", load->section->name, path);
+        supercar_config_report(load->invalid_keys, &load->invalid, path);
+    }
+    return ESP_OK;
+}
+
+void supercar_config_load_begin(supercar_config_load_t* load, const supercar_section_t* section, supercar_t* car){
+    load->section = section;
+    load->unknown = 0;
+    load->invalid = 0;
+    section->stage(&load->staging, car);
+    load->current = load->staging;
+    supercar_json_parser_init(&load->parser, supercar_config_load_field, load);
+}
+
+esp_err_t supercar_config_load_feed(supercar_config_load_t* load, const char* data, size_t len){
+    return supercar_json_parser_feed(&load->parser, data, len);
+}
+
+esp_err_t supercar_config_load_end(supercar_config_load_t* load){
+    esp_err_t err = supercar_json_parser_finish(&load->parser);
+    if(err != ESP_OK){
+        ESP_LOGW(TAG, "Could not parse %s at byte %u: %s", load->section->name, load->parser.offset, esp_err_to_name(err));
+    }else if(load->section->validate){
+        load->section->validate(load);
+    }
+    return err;
+}
+
+void supercar_config_load_apply(supercar_config_load_t* load, supercar_t* car){
+    supercar_apply_config(car, load->section->apply, &load->staging);
+}
+
+static void supercar_config_add_keys(supercar_json_t* node, const char* name, const char keys[SUPERCAR_CONFIG_MAX_REPORTED][SUPERCAR_JSON_MAX_PATH], uint32_t count){
+    supercar_json_begin_array(node, name);
+    for(uint32_t i = 0; i < count && i < SUPERCAR_CONFIG_MAX_REPORTED; i++){
+        supercar_json_string(node, NULL, keys[i]);
+    }
+    supercar_json_end_array(node);
+}
+
+void supercar_config_load_serialize(supercar_json_t* node, const supercar_config_load_t* load){
+    supercar_config_add_keys(node, "unknown", load->unknown_keys, load->unknown);
+    supercar_config_add_keys(node, "invalid", load->invalid_keys, load->invalid);
+}
+
+typedef void (*supercar_apply_t)(supercar_t* car, void (*apply)(const void*, supercar_t*), const void* staging);
+
+/* At boot, before the control task runs, the next section is staged over the published values */
+static void supercar_apply_now(supercar_t* car, void (*apply)(const void*, supercar_t*), const void* staging){
+    apply(staging, car);
+    supercar_snapshot_publish(car);
+}
+
+size_t supercar_section_encode(const supercar_section_t* section, const supercar_staging_t* staging, uint8_t* buf, size_t size){
+    supercar_record_header_t header = { .magic = SUPERCAR_RECORD_MAGIC, .version = section->version };
+    if(size < sizeof(header)){
+        return 0;
+    }
+    supercar_record_t record = { .data = buf + sizeof(header), .size = size - sizeof(header) };
+    section->encode(&record, staging);
+    if(record.overflow){
+        return 0;
+    }
+    header.length = record.offset;
+    header.crc = esp_crc32_le(0, record.data, record.offset);
+    memcpy(buf, &header, sizeof(header));
+    return sizeof(header) + record.offset;
+}
+
+esp_err_t supercar_section_decode(const supercar_section_t* section, const uint8_t* buf, size_t len, supercar_staging_t* staging){
+    supercar_record_header_t header;
+    if(len < sizeof(header)){
+        return ESP_ERR_INVALID_VERSION;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if(header.magic != SUPERCAR_RECORD_MAGIC || header.length != len - sizeof(header)){
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if(esp_crc32_le(0, buf + sizeof(header), header.length) != header.crc){
+        return ESP_ERR_INVALID_CRC;
+    }
+    if(header.version > section->version){
+        ESP_LOGW(TAG, "%s record version %u is newer than %u, only the known fields are read", section->name, header.version, section->version);
+    }
+    supercar_record_t record = { .data = (uint8_t*) buf + sizeof(header), .size = header.length };
+    section->decode(&record, staging, header.version);
+    return ESP_OK;
+}
+
+static supercar_section_load_t* supercar_section_load_stats(const supercar_section_t* section){
+    for(size_t i = 0; i < supercar_sections_count; i++){
+        if(supercar_sections[i] == section){
+            return &section_loads[i];
+        }
+    }
+    return NULL;
+}
+
+/* Speeds and thresholds of a main config saved before the driver profiles, for the default profile */
+static supercar_profile_t config_legacy;
+static bool config_legacy_found;
+
+static void supercar_config_legacy_field(const char* name, double number){
+    if(!config_legacy_found){
+        supercar_profile_t profiles[SUPERCAR_PROFILE_MAX];
+        supercar_profiles_stage(profiles);
+        config_legacy = profiles[SUPERCAR_PROFILE_DEFAULT];
+    }
+    // Bounds of the profile field, the main fields that are not in a profile are not found
+    supercar_json_value_t value = { .type = SUPERCAR_JSON_NUMBER, .number = number };
+    if(supercar_fields_stage(&supercar_profile_fields, &config_legacy, name, &value) == ESP_OK){
+        config_legacy_found = true;
+    }
+}
+
+/* Reads a copy of the record, the fields are decoded from the original */
+static void supercar_config_legacy_record(supercar_record_t record){
+    for(int i = 0; i < supercar_main_fields.count && !record.overflow; i++){
+        const supercar_field_t* field = &supercar_main_fields.fields[i];
+        if(field->type == SUPERCAR_FIELD_FLOAT){
+            float ignored;
+            supercar_record_get_float(&record, &ignored);
+            continue;
+        }
+        int value = 0;
+        supercar_record_get_int(&record, &value);
+        // The firmwares with profiles wrote 0 in the retired fields of their version 1 records
+        if(field->retired && value != 0 && !record.overflow){
+            supercar_config_legacy_field(field->name, value);
+        }
+    }
+}
+
+static esp_err_t supercar_config_legacy_json(void* ctx, const char* path, const supercar_json_value_t* value){
+    if(value->type == SUPERCAR_JSON_NUMBER){
+        supercar_config_legacy_field(path, value->number);
+    }
+    return ESP_OK;
+}
+
+/* Before the profiles are read, a profiles record saved since then still wins */
+static void supercar_config_migrate(supercar_t* car){
+    supercar_staging_t staging;
+    supercar_profiles_stage(staging.profiles);
+    staging.profiles[SUPERCAR_PROFILE_DEFAULT] = config_legacy;
+    config_legacy_found = false;
+    supercar_apply_now(car, supercar_profiles_section.apply, &staging);
+    ESP_LOGI(TAG, "Moved the speeds and thresholds of the main config to the %s profile", supercar_profile_name(SUPERCAR_PROFILE_DEFAULT));
+    // Saved once, the main record is written again as version 2 so it is not migrated twice
+    supercar_section_save(car, &supercar_profiles_section);
+    supercar_section_save(car, &supercar_config_section);
+}
+
+/* A record may come from another firmware, it goes through the checks of the REST documents too */
+static esp_err_t supercar_section_check(supercar_t* car, const supercar_section_t* section, const supercar_staging_t* staging){
+    if(section->validate == NULL){
+        return ESP_OK;
+    }
+    supercar_config_load_t* load = malloc(sizeof(supercar_config_load_t));
+    if(load == NULL){
+        return ESP_ERR_NO_MEM;
+    }
+    load->section = section;
+    load->unknown = 0;
+    load->invalid = 0;
+    section->stage(&load->current, car);
+    load->staging = *staging;
+    section->validate(load);
+    esp_err_t err = load->invalid ? ESP_ERR_INVALID_ARG : ESP_OK;
+    free(load);
+    return err;
+}
+
+/* Written by the firmwares that saved the sections as JSON text, loaded through the REST parser */
+static esp_err_t supercar_nvs_read_json(supercar_t* car, const supercar_section_t* section, const char* config_json, size_t len, supercar_staging_t* staging){
+    supercar_config_load_t* load = malloc(sizeof(supercar_config_load_t));
+    if(load == NULL){
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Converting %s config : %.*s", section->name, (int) len, config_json);
+    if(section == &supercar_config_section){
+        // Its speeds and thresholds are unknown members of the main section now
+        supercar_json_parser_init(&load->parser, supercar_config_legacy_json, NULL);
+        if(supercar_json_parser_feed(&load->parser, config_json, len) != ESP_OK){
+            config_legacy_found = false;
+        }
+    }
+    supercar_config_load_begin(load, section, car);
+    esp_err_t err = supercar_config_load_feed(load, config_json, len);
+    if(err == ESP_OK){
+        err = supercar_config_load_end(load);
+    }
+    if(err == ESP_OK){
+        *staging = load->staging;
+    }
+    free(load);
+    return err;
+}
+
+static esp_err_t supercar_nvs_read(supercar_t* car, const supercar_section_t* section, supercar_apply_t apply){
+    ESP_LOGD(TAG, "Reading configuration");
+    int64_t start = esp_timer_get_time();
+    supercar_section_load_t* stats = supercar_section_load_stats(section);
     nvs_handle_t nvs_h;
     esp_err_t err;
 
@@ -112,88 +961,181 @@ static esp_err_t supercar_nvs_read(supercar_t* car, void (*deserialize)(cJSON*,
     if (err != ESP_OK) return err;
 
     size_t required_size = 0;  // value will default to 0, if not set yet in NVS
-    err = nvs_get_blob(nvs_h, name, NULL, &required_size);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
-    
-    // Read previously saved blob if available
-    char* config_json = malloc(required_size);
-    if (required_size > 0) {
-        err = nvs_get_blob(nvs_h, name, config_json, &required_size);
-        if (err != ESP_OK) {
-            free(config_json);
-            return err;
+    err = nvs_get_blob(nvs_h, section->name, NULL, &required_size);
+    if (err == ESP_ERR_NVS_NOT_FOUND || (err == ESP_OK && required_size == 0)) {
+        ESP_LOGI(TAG, "No %s config found", section->name);
+        nvs_close(nvs_h);
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        nvs_close(nvs_h);
+        return err;
+    }
+
+    uint8_t* blob = malloc(required_size);
+    supercar_staging_t* staging = malloc(sizeof(supercar_staging_t));
+    supercar_record_format_t format = SUPERCAR_RECORD_BINARY;
+    uint8_t version = 0;
+    if (blob == NULL || staging == NULL) {
+        err = ESP_ERR_NO_MEM;
+        goto done;
+    }
+    err = nvs_get_blob(nvs_h, section->name, blob, &required_size);
+    if (err != ESP_OK) goto done;
+
+    if (blob[0] == '{') {
+        format = SUPERCAR_RECORD_JSON;
+        err = supercar_nvs_read_json(car, section, (const char*) blob, required_size, staging);
+    } else {
+        section->stage(staging, car);
+        err = supercar_section_decode(section, blob, required_size, staging);
+        if (err == ESP_OK) {
+            err = supercar_section_check(car, section, staging);
         }
-        ESP_LOGI(TAG, "Read config : %s", config_json);
-        cJSON* cfg = cJSON_Parse(config_json);
-        if(cfg == NULL){
-            return ESP_FAIL;
+        if (err != ESP_OK) {
+            // A damaged or unusable record must not keep the car from starting
+            ESP_LOGE(TAG, "Ignoring %s record: %s", section->name, esp_err_to_name(err));
+            format = SUPERCAR_RECORD_CORRUPT;
+            err = ESP_OK;
+            goto done;
         }
-        deserialize(cfg, car);
-        cJSON_Delete(cfg);
-    }else{
-        ESP_LOGI(TAG, "No config found");
+        version = blob[1];
+    }
+    if (err == ESP_OK) {
+        apply(car, section->apply, staging);
     }
 
-    free(config_json);
-        // Close
+done:
     nvs_close(nvs_h);
-    return ESP_OK;
+    if (stats) {
+        stats->format = format;
+        stats->version = version;
+        stats->bytes = required_size;
+        stats->load_us = esp_timer_get_time() - start;
+    }
+    free(staging);
+    free(blob);
+    if (err == ESP_OK && format == SUPERCAR_RECORD_JSON) {
+        // Saved again once, in the format of this firmware
+        err = supercar_section_save(car, section);
+    }
+    return err;
 }
 
 esp_err_t supercar_config_read(supercar_t* car){
-    return supercar_nvs_read(car, supercar_deserialize_config, MAIN_CONFIG);
+    esp_err_t err = supercar_nvs_read(car, &supercar_config_section, supercar_apply_now);
+    if(config_legacy_found){
+        supercar_config_migrate(car);
+    }
+    return err;
 }
 
 esp_err_t supercar_propulsion_config_read(supercar_t* car){
-    return supercar_nvs_read(car, supercar_deserialize_propulsion_config, PROPULSION_CONFIG);
+    return supercar_nvs_read(car, &supercar_propulsion_section, supercar_apply_now);
 }
 
 esp_err_t supercar_steering_config_read(supercar_t* car){
-    return supercar_nvs_read(car, supercar_deserialize_steering_config, STEERING_CONFIG);
+    return supercar_nvs_read(car, &supercar_steering_section, supercar_apply_now);
 }
 
-esp_err_t supercar_nvs_save(supercar_t* car, void (*serialize)(cJSON*, supercar_t*), const char* name){
-    ESP_LOGD(TAG, "Saving configuration");
-    nvs_handle_t nvs_h;
-    esp_err_t err;
+esp_err_t supercar_tasks_config_read(supercar_t* car){
+    return supercar_nvs_read(car, &supercar_tasks_section, supercar_apply_now);
+}
 
-    err = nvs_open(STORAGE_NAMESPACE, NVS_READWRITE, &nvs_h);
-    if (err != ESP_OK) return err;
+esp_err_t supercar_arbiter_config_read(supercar_t* car){
+    return supercar_nvs_read(car, &supercar_arbiter_section, supercar_apply_now);
+}
 
-    size_t required_size = 0;  // value will default to 0, if not set yet in NVS
+esp_err_t supercar_profiles_config_read(supercar_t* car){
+    return supercar_nvs_read(car, &supercar_profiles_section, supercar_apply_now);
+}
 
-    cJSON* cfg = cJSON_CreateObject();
-    serialize(cfg, car);
-    char * config_json = cJSON_Print(cfg);
-    cJSON_Delete(cfg);
+size_t supercar_section_capture(supercar_t* car, const supercar_section_t* section, uint8_t* buf, size_t size){
+    supercar_staging_t staging;
+    section->stage(&staging, car);
+    return supercar_section_encode(section, &staging, buf, size);
+}
 
-    // Write value including previously saved blob if available
-    required_size = strlen(config_json);
-    
-    err = nvs_set_blob(nvs_h, "main", config_json, required_size);
-    free(config_json);
+esp_err_t supercar_section_restore(supercar_t* car, const supercar_section_t* section, const uint8_t* buf, size_t len){
+    int64_t start = esp_timer_get_time();
+    supercar_staging_t staging;
+    section->stage(&staging, car);
+    esp_err_t err = supercar_section_decode(section, buf, len, &staging);
+    if (err == ESP_OK) {
+        err = supercar_section_check(car, section, &staging);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    supercar_apply_now(car, section->apply, &staging);
+    supercar_section_load_t* stats = supercar_section_load_stats(section);
+    if (stats) {
+        stats->format = SUPERCAR_RECORD_RTC;
+        stats->version = buf[1];
+        stats->bytes = len;
+        stats->load_us = esp_timer_get_time() - start;
+    }
+    return ESP_OK;
+}
 
-    if (err != ESP_OK) return err;
+esp_err_t supercar_section_save(supercar_t* car, const supercar_section_t* section){
+    ESP_LOGD(TAG, "Saving configuration");
+    nvs_handle_t nvs_h;
+    esp_err_t err;
+
+    uint8_t record[SUPERCAR_RECORD_MAX];
+    size_t len = supercar_section_capture(car, section, record, sizeof(record));
+    if (len == 0) return ESP_ERR_INVALID_SIZE;
 
-    // Commit
-    err = nvs_commit(nvs_h);
+    err = nvs_open(STORAGE_NAMESPACE, NVS_READWRITE, &nvs_h);
     if (err != ESP_OK) return err;
 
-    // Close
+    err = nvs_set_blob(nvs_h, section->name, record, len);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_h);
+    }
     nvs_close(nvs_h);
-    return ESP_OK;
+    return err;
+}
+
+void supercar_serialize_config_records(supercar_json_t* node, supercar_t* car){
+    static const char* format_names[] = { "none", "binary", "json", "corrupt", "rtc" };
+    uint32_t total_us = 0;
+    for(size_t i = 0; i < supercar_sections_count; i++){
+        const supercar_section_load_t* load = &section_loads[i];
+        supercar_json_begin_object(node, supercar_sections[i]->name);
+        supercar_json_string(node, "format", format_names[load->format]);
+        supercar_json_int(node, "version", load->version);
+        supercar_json_int(node, "bytes", load->bytes);
+        supercar_json_int(node, "load_us", load->load_us);
+        supercar_json_end_object(node);
+        total_us += load->load_us;
+    }
+    supercar_json_int(node, "load_us", total_us);
 }
 
 esp_err_t supercar_config_save(supercar_t* car){
-    return supercar_nvs_save(car, supercar_serialize_config, MAIN_CONFIG);
+    return supercar_section_save(car, &supercar_config_section);
 }
 
 esp_err_t supercar_propulsion_config_save(supercar_t* car){
-    return supercar_nvs_save(car, supercar_serialize_propulsion_config, PROPULSION_CONFIG);
+    return supercar_section_save(car, &supercar_propulsion_section);
 }
 
 esp_err_t supercar_steering_config_save(supercar_t* car){
-    return supercar_nvs_save(car, supercar_serialize_steering_config, STEERING_CONFIG);
+    return supercar_section_save(car, &supercar_steering_section);
+}
+
+esp_err_t supercar_tasks_config_save(supercar_t* car){
+    return supercar_section_save(car, &supercar_tasks_section);
+}
+
+esp_err_t supercar_arbiter_config_save(supercar_t* car){
+    return supercar_section_save(car, &supercar_arbiter_section);
+}
+
+esp_err_t supercar_profiles_config_save(supercar_t* car){
+    return supercar_section_save(car, &supercar_profiles_section);
 }
 
 
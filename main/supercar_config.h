@@ -3,32 +3,217 @@
 
 #include "esp_system.h"
 #include "supercar_main.h"
-#include "cjson.h"
+#include "supercar_json.h"
+#include "supercar_tasks.h"
+#include "supercar_arbiter.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void supercar_serialize_motor_config(cJSON* cfg, supercar_motor_control_t* mctl);
+#define SUPERCAR_CONFIG_MAX_REPORTED 4
+#define SUPERCAR_RECORD_MAGIC 0xC5          // Never '{', the JSON text of older firmwares is told apart
+#define SUPERCAR_RECORD_MAX 256
 
-void supercar_serialize_config(cJSON* cfg, supercar_t* car);
+/* Header of a section record in NVS, followed by its little endian fields */
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;                        // Layout of the fields, the newer versions only append some
+    uint16_t length;                        // Bytes after the header
+    uint32_t crc;                           // CRC32 of the bytes after the header
+} supercar_record_header_t;
 
+/* Fields of a record being written or read */
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t offset;
+    bool overflow;                          // Written past the buffer, or read past the end of the record
+} supercar_record_t;
+
+#define SUPERCAR_FIELD_SLOTS 16             // Power of two, at least twice the fields of the largest table
+
+typedef enum {
+    SUPERCAR_FIELD_INT,
+    SUPERCAR_FIELD_FLOAT,
+} supercar_field_type_t;
+
+/* Entry of supercar_config.def */
+typedef struct {
+    const char* name;                       // JSON member
+    supercar_field_type_t type;
+    uint16_t offset;                        // In the structure of the section
+    double min;
+    double max;
+    const char* units;
+    const char* title;                      // Label of the web UI forms
+    bool retired;                           // Only kept for its place in the records
+} supercar_field_t;
+
+/* Fields of a section with their index by name hash */
+typedef struct {
+    const supercar_field_t* fields;
+    uint8_t count;
+    uint8_t slots[SUPERCAR_FIELD_SLOTS];    // 1 + index of the field, 0 for a free slot
+    uint32_t hashes[SUPERCAR_FIELD_SLOTS];  // Hash of the name of the field in each used slot
+} supercar_field_table_t;
+
+/* Values of one section, staged from JSON before the control task applies them */
+typedef union {
+    supercar_config_t cfg;
+    supercar_motor_config_t motor;
+    supercar_task_placement_t tasks[SUPERCAR_TASK_MAX];
+    supercar_arbiter_rule_t arbiter[SUPERCAR_SOURCE_MAX];
+    supercar_profile_t profiles[SUPERCAR_PROFILE_MAX];
+} supercar_staging_t;
+
+typedef struct supercar_config_load supercar_config_load_t;
+
+/* A configuration section, as exposed by the REST API in JSON and saved in NVS as a binary record */
+typedef struct {
+    const char* name;                   // NVS key
+    uint8_t version;                    // Record layout written by this firmware
+    void (*stage)(supercar_staging_t* staging, supercar_t* car);
+    esp_err_t (*stage_field)(supercar_staging_t* staging, const char* path, const supercar_json_value_t* value);
+    void (*apply)(const void* staging, supercar_t* car);
+    void (*serialize)(supercar_json_t* node, supercar_t* car);
+    void (*encode)(supercar_record_t* record, const supercar_staging_t* staging);
+    /* Fields missing from an older record keep their staged value, those of a newer one are ignored */
+    void (*decode)(supercar_record_t* record, supercar_staging_t* staging, uint8_t version);
+    /* Optional checks across members of a parsed document, those that fail them keep their current value */
+    void (*validate)(supercar_config_load_t* load);
+    /* Field table the members, record and schema are generated from, NULL for the hand written sections */
+    const supercar_field_table_t* fields;
+} supercar_section_t;
+
+typedef enum {
+    SUPERCAR_RECORD_NONE,               // Nothing saved, the defaults are used
+    SUPERCAR_RECORD_BINARY,
+    SUPERCAR_RECORD_JSON,               // Saved by an older firmware, converted on load
+    SUPERCAR_RECORD_CORRUPT,            // Bad header or CRC, the defaults are used
+    SUPERCAR_RECORD_RTC,                // Restored from the RTC memory copy after a warm reset, NVS not read
+} supercar_record_format_t;
+
+/* How a section was loaded at boot */
+typedef struct {
+    supercar_record_format_t format;
+    uint8_t version;
+    uint16_t bytes;
+    uint32_t load_us;                   // NVS read, decoding and applying
+} supercar_section_load_t;
+
+extern const supercar_section_t supercar_config_section;
+extern const supercar_section_t supercar_propulsion_section;
+extern const supercar_section_t supercar_steering_section;
+extern const supercar_section_t supercar_tasks_section;
+extern const supercar_section_t supercar_arbiter_section;
+extern const supercar_section_t supercar_profiles_section;
+extern const supercar_section_t* const supercar_sections[];
+extern const size_t supercar_sections_count;
+
+/* JSON document being loaded into a section, with the members that were left out */
+struct supercar_config_load {
+    const supercar_section_t* section;
+    supercar_staging_t staging;
+    supercar_staging_t current;         // Values before the document
+    supercar_json_parser_t parser;
+    uint32_t unknown;                   // Members the section does not have
+    uint32_t invalid;                   // Members with a value of the wrong type or out of bounds
+    char unknown_keys[SUPERCAR_CONFIG_MAX_REPORTED][SUPERCAR_JSON_MAX_PATH];
+    char invalid_keys[SUPERCAR_CONFIG_MAX_REPORTED][SUPERCAR_JSON_MAX_PATH];
+};
+
+/**
+ * @brief Start loading a document, the members it does not set keep their current value
+ */
+void supercar_config_load_begin(supercar_config_load_t* load, const supercar_section_t* section, supercar_t* car);
+esp_err_t supercar_config_load_feed(supercar_config_load_t* load, const char* data, size_t len);
+esp_err_t supercar_config_load_end(supercar_config_load_t* load);
+
+/**
+ * @brief Hand the staged values to the control task and wait for them to be applied
+ */
+void supercar_config_load_apply(supercar_config_load_t* load, supercar_t* car);
+
+/**
+ * @brief The unknown and invalid members, the first SUPERCAR_CONFIG_MAX_REPORTED of each
+ */
+void supercar_config_load_serialize(supercar_json_t* node, const supercar_config_load_t* load);
+
+esp_err_t supercar_section_save(supercar_t* car, const supercar_section_t* section);
+
+/**
+ * @brief Encode the current values of a section as a record, from any task
+ *
+ * @return Size of the record, 0 if it does not fit
+ */
+size_t supercar_section_capture(supercar_t* car, const supercar_section_t* section, uint8_t* buf, size_t size);
+
+/**
+ * @brief Apply a record kept in RAM, at boot before the control task runs
+ * Values that fail the checks of the section return ESP_ERR_INVALID_ARG, nothing is applied
+ */
+esp_err_t supercar_section_restore(supercar_t* car, const supercar_section_t* section, const uint8_t* buf, size_t len);
+
+/**
+ * @brief Write the staged values as a record with its header
+ *
+ * @return Size of the record, 0 if it does not fit
+ */
+size_t supercar_section_encode(const supercar_section_t* section, const supercar_staging_t* staging, uint8_t* buf, size_t size);
+
+/**
+ * @brief Check a record and update the staged values with its fields
+ *
+ * @return ESP_ERR_INVALID_VERSION for a bad header, ESP_ERR_INVALID_CRC for a damaged record
+ */
+esp_err_t supercar_section_decode(const supercar_section_t* section, const uint8_t* buf, size_t len, supercar_staging_t* staging);
+
+/**
+ * @brief Format, size and load time of each section at boot
+ */
+void supercar_serialize_config_records(supercar_json_t* node, supercar_t* car);
+
+
+/**
+ * @brief Index the field tables, before any section is loaded
+ */
+void supercar_config_init(void);
+
+/**
+ * @brief JSON schema of the sections generated from supercar_config.def, with the bounds, units and labels
+ */
+void supercar_serialize_config_schema(supercar_json_t* node, supercar_t* car);
+
+/**
+ * @brief Read and apply a saved section, at boot before the control task runs
+ */
 esp_err_t supercar_config_read(supercar_t* car);
 esp_err_t supercar_propulsion_config_read(supercar_t* car);
 esp_err_t supercar_steering_config_read(supercar_t* car);
+/**
+ * @brief Read the task placement overrides, before any of the tasks is created
+ */
+esp_err_t supercar_tasks_config_read(supercar_t* car);
+esp_err_t supercar_arbiter_config_read(supercar_t* car);
+/**
+ * @brief Preload the driver profiles, before the control task runs
+ */
+esp_err_t supercar_profiles_config_read(supercar_t* car);
 esp_err_t supercar_config_save(supercar_t* car);
 esp_err_t supercar_propulsion_config_save(supercar_t* car);
 esp_err_t supercar_steering_config_save(supercar_t* car);
+esp_err_t supercar_tasks_config_save(supercar_t* car);
+esp_err_t supercar_arbiter_config_save(supercar_t* car);
+esp_err_t supercar_profiles_config_save(supercar_t* car);
 
-void supercar_serialize_motor_config(cJSON* cfg, supercar_motor_control_t* mctl);
-void supercar_deserialize_motor_config(cJSON* cfg, supercar_motor_control_t* mctl);
-void supercar_serialize_config(cJSON* cfg, supercar_t* car);
-void supercar_deserialize_config(cJSON* cfg, supercar_t* car);
-
-void supercar_serialize_propulsion_config(cJSON* node, supercar_t* car);
-void supercar_deserialize_propulsion_config(cJSON* node, supercar_t* car);
-void supercar_serialize_steering_config(cJSON* node, supercar_t* car);
-void supercar_deserialize_steering_config(cJSON* node, supercar_t* car);
+void supercar_serialize_motor_config(supercar_json_t* cfg, const supercar_motor_config_t* mcfg);
+void supercar_serialize_config_values(supercar_json_t* cfg, const supercar_config_t* values);
+void supercar_serialize_config(supercar_json_t* cfg, supercar_t* car);
+void supercar_serialize_propulsion_config(supercar_json_t* node, supercar_t* car);
+void supercar_serialize_steering_config(supercar_json_t* node, supercar_t* car);
+void supercar_serialize_arbiter(supercar_json_t* node, supercar_t* car);
+void supercar_serialize_profiles(supercar_json_t* node, supercar_t* car);
 
 #ifdef __cplusplus
 }
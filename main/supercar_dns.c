@@ -0,0 +1,181 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "supercar_tasks.h"
+#include "supercar_dns.h"
+
+static const char* TAG = "DNS";
+
+#define DNS_PORT 53
+#define DNS_MAX_LEN 512
+#define DNS_ANSWER_LEN 16               // Name pointer, type, class, TTL, length and address
+#define DNS_TTL 60
+#define DNS_POLL_MS 1000                // The task checks for a stop request this often
+
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_RA 0x0080
+#define DNS_TYPE_A 1
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+
+typedef struct {
+    uint32_t queries;
+    uint32_t answers;               // Queries answered with the address of the car
+    uint32_t empty;                 // Other record types, answered without a record
+    uint32_t dropped;               // Malformed or not a standard query
+} dns_stats_t;
+
+static volatile bool dns_running;
+static uint32_t dns_ip;
+static dns_stats_t dns_stats;
+static portMUX_TYPE dns_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint16_t dns_get16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void dns_put16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+}
+
+/* Turn the query in buf into its answer, in place, and return its length, 0 to drop it */
+static int supercar_dns_answer(uint8_t* buf, int len, int size)
+{
+    if (len < 12) {
+        return 0;
+    }
+    uint16_t flags = dns_get16(buf + 2);
+    // A standard query for a single name
+    if ((flags & DNS_FLAG_QR) || ((flags >> 11) & 0xf) != 0 || dns_get16(buf + 4) != 1) {
+        return 0;
+    }
+    int offset = 12;
+    while (offset < len && buf[offset] != 0) {
+        if (buf[offset] & 0xc0) {
+            // Compression cannot occur in the first name of a query
+            return 0;
+        }
+        offset += buf[offset] + 1;
+    }
+    offset++;
+    if (offset + 4 > len) {
+        return 0;
+    }
+    uint16_t type = dns_get16(buf + offset);
+    uint16_t class = dns_get16(buf + offset + 2);
+    offset += 4;
+
+    // The question only, the additional records of the query (EDNS) are dropped
+    dns_put16(buf + 2, DNS_FLAG_QR | (flags & DNS_FLAG_RD) | DNS_FLAG_RA);
+    dns_put16(buf + 6, 0);
+    dns_put16(buf + 8, 0);
+    dns_put16(buf + 10, 0);
+    if ((type != DNS_TYPE_A && type != DNS_TYPE_ANY) || class != DNS_CLASS_IN || offset + DNS_ANSWER_LEN > size) {
+        // No such record, the phones ask again for an IPv4 address
+        portENTER_CRITICAL(&dns_lock);
+        dns_stats.empty++;
+        portEXIT_CRITICAL(&dns_lock);
+        return offset;
+    }
+    uint8_t* answer = buf + offset;
+    dns_put16(answer, 0xc00c);              // Pointer to the name of the question
+    dns_put16(answer + 2, DNS_TYPE_A);
+    dns_put16(answer + 4, DNS_CLASS_IN);
+    dns_put16(answer + 6, DNS_TTL >> 16);
+    dns_put16(answer + 8, DNS_TTL & 0xffff);
+    dns_put16(answer + 10, 4);
+    memcpy(answer + 12, &dns_ip, 4);
+    dns_put16(buf + 6, 1);
+    portENTER_CRITICAL(&dns_lock);
+    dns_stats.answers++;
+    portEXIT_CRITICAL(&dns_lock);
+    return offset + DNS_ANSWER_LEN;
+}
+
+static void supercar_dns_thread(void* arg)
+{
+    int sock = (int) (intptr_t) arg;
+    uint8_t buf[DNS_MAX_LEN];
+    while (dns_running) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr*) &from, &from_len);
+        if (len < 0) {
+            // Timed out, to check dns_running
+            continue;
+        }
+        portENTER_CRITICAL(&dns_lock);
+        dns_stats.queries++;
+        portEXIT_CRITICAL(&dns_lock);
+        int reply = supercar_dns_answer(buf, len, sizeof(buf));
+        if (reply == 0) {
+            portENTER_CRITICAL(&dns_lock);
+            dns_stats.dropped++;
+            portEXIT_CRITICAL(&dns_lock);
+            continue;
+        }
+        sendto(sock, buf, reply, 0, (struct sockaddr*) &from, from_len);
+    }
+    close(sock);
+    ESP_LOGI(TAG, "Stopped");
+    supercar_task_exit(SUPERCAR_TASK_DNS);
+}
+
+esp_err_t supercar_dns_start(uint32_t ip)
+{
+    // A previous server may still be waiting for its last timeout
+    for (int i = 0; supercar_task_get(SUPERCAR_TASK_DNS)->handle != NULL; i++) {
+        if (i * 100 > 2 * DNS_POLL_MS) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        return ESP_FAIL;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(DNS_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct timeval timeout = { .tv_sec = DNS_POLL_MS / 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "Could not bind port %d", DNS_PORT);
+        close(sock);
+        return ESP_FAIL;
+    }
+    dns_ip = ip;
+    dns_running = true;
+    if (supercar_task_create(SUPERCAR_TASK_DNS, supercar_dns_thread, (void*) (intptr_t) sock, NULL) != pdPASS) {
+        dns_running = false;
+        close(sock);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Answering every name with the car address");
+    return ESP_OK;
+}
+
+void supercar_dns_stop(void)
+{
+    dns_running = false;
+}
+
+void supercar_dns_serialize(supercar_json_t* node)
+{
+    portENTER_CRITICAL(&dns_lock);
+    dns_stats_t stats = dns_stats;
+    portEXIT_CRITICAL(&dns_lock);
+    supercar_json_bool(node, "running", dns_running);
+    supercar_json_int(node, "queries", stats.queries);
+    supercar_json_int(node, "answers", stats.answers);
+    supercar_json_int(node, "empty", stats.empty);
+    supercar_json_int(node, "dropped", stats.dropped);
+}
@@ -0,0 +1,27 @@
+#ifndef _SUPERCAR_DNS_H_
+#define _SUPERCAR_DNS_H_
+
+#include <stdint.h>
+#include "esp_system.h"
+#include "supercar_json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Answer every DNS query with the address of the car, for the captive portal
+ *
+ * @param ip Address of the access point, network byte order
+ */
+esp_err_t supercar_dns_start(uint32_t ip);
+
+void supercar_dns_stop(void);
+
+void supercar_dns_serialize(supercar_json_t* node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
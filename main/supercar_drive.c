@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "supercar_arbiter.h"
+#include "supercar_drive.h"
+
+static const char* TAG = "DRIVE";
+
+typedef struct {
+    int owner;                          // Socket of the driving client, -1 when nobody drives
+    uint16_t seq;
+    int8_t throttle;                    // Last command forwarded to the control task
+    int8_t steer;
+    int64_t last_command;
+    uint32_t commands;
+    uint32_t forwarded;
+    uint32_t dropped;                   // The control task was behind, the next command makes up for it
+    uint32_t stale;
+    uint32_t busy;
+    uint32_t takeovers;                 // Owners that went silent for the deadman window and lost the car
+    uint32_t invalid;
+    uint32_t max_gap_us;                // Longest wait between two commands of the same client
+} drive_state_t;
+
+static supercar_t* drive_car;
+static drive_state_t drive = { .owner = -1 };
+static portMUX_TYPE drive_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Same report as a gamepad would send, triggers for the throttle and dpad for the steering */
+static void drive_event(int8_t throttle, int8_t steer, int64_t timestamp, gamepad_input_event_t* ev)
+{
+    *ev = (gamepad_input_event_t){
+        .report = {0},
+        .type = ESP_HIDH_INPUT_EVENT,
+        .timestamp = timestamp,
+        .source = REMOTE_SOURCE_WEB
+    };
+    if (throttle > 0) {
+        ev->report.rt = throttle * 1023 / 100;
+    } else if (throttle < 0) {
+        ev->report.lt = -throttle * 1023 / 100;
+    }
+    if (steer <= -SUPERCAR_DRIVE_STEER_DEADZONE) {
+        ev->report.dpad = DPAD_LEFT;
+    } else if (steer >= SUPERCAR_DRIVE_STEER_DEADZONE) {
+        ev->report.dpad = DPAD_RIGHT;
+    }
+}
+
+static supercar_drive_status_t drive_command(int fd, const supercar_drive_command_t* cmd)
+{
+    int64_t now = esp_timer_get_time();
+    int deadman_ms = supercar_arbiter_timeout_ms(SUPERCAR_SOURCE_WEB);
+    int64_t deadman_us = (deadman_ms > 0 ? deadman_ms : CONFIG_SUPERCAR_DRIVE_DEADMAN_MS) * 1000LL;
+    if (cmd->type != SUPERCAR_DRIVE_COMMAND || cmd->throttle < -100 || cmd->throttle > 100
+        || cmd->steer < -100 || cmd->steer > 100) {
+        portENTER_CRITICAL(&drive_lock);
+        drive.invalid++;
+        portEXIT_CRITICAL(&drive_lock);
+        return SUPERCAR_DRIVE_INVALID;
+    }
+
+    portENTER_CRITICAL(&drive_lock);
+    drive.commands++;
+    int released = -1;
+    if (drive.owner >= 0 && drive.owner != fd && now - drive.last_command > deadman_us) {
+        // A backgrounded tab keeps its socket open, its silence releases the car like a close would
+        released = drive.owner;
+        drive.owner = -1;
+        drive.last_command = 0;
+        drive.takeovers++;
+    }
+    if (drive.owner < 0) {
+        drive.owner = fd;
+        drive.seq = cmd->seq - 1;
+    }
+    if (drive.owner != fd) {
+        drive.busy++;
+        portEXIT_CRITICAL(&drive_lock);
+        return SUPERCAR_DRIVE_BUSY;
+    }
+    // Serial number arithmetic, the sequence wraps around
+    if ((int16_t)(cmd->seq - drive.seq) <= 0) {
+        drive.stale++;
+        portEXIT_CRITICAL(&drive_lock);
+        return SUPERCAR_DRIVE_STALE;
+    }
+    if (drive.last_command && now - drive.last_command > drive.max_gap_us) {
+        drive.max_gap_us = now - drive.last_command;
+    }
+    drive.seq = cmd->seq;
+    drive.last_command = now;
+    drive.throttle = cmd->throttle;
+    drive.steer = cmd->steer;
+    portEXIT_CRITICAL(&drive_lock);
+    if (released >= 0) {
+        ESP_LOGI(TAG, "Client %d went silent, client %d drives", released, fd);
+    }
+
+    /* Every command is forwarded, it refreshes the intents before the arbiter times them out */
+    gamepad_input_event_t ev;
+    drive_event(cmd->throttle, cmd->steer, now, &ev);
+    bool queued = xQueueSend(drive_car->remote_events, &ev, 0) == pdTRUE;
+    portENTER_CRITICAL(&drive_lock);
+    if (queued) {
+        drive.forwarded++;
+    } else {
+        drive.dropped++;
+    }
+    portEXIT_CRITICAL(&drive_lock);
+    return SUPERCAR_DRIVE_OK;
+}
+
+esp_err_t supercar_drive_ws_handler(httpd_req_t* req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    if (req->method == HTTP_GET) {
+        ESP_LOGI(TAG, "Client %d connected", fd);
+        return ESP_OK;
+    }
+
+    supercar_drive_command_t cmd;
+    httpd_ws_frame_t frame = { .type = HTTPD_WS_TYPE_BINARY };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK)
+        return err;
+    if (frame.type != HTTPD_WS_TYPE_BINARY || frame.len != sizeof(cmd))
+        return ESP_ERR_INVALID_SIZE;
+    frame.payload = (uint8_t*)&cmd;
+    err = httpd_ws_recv_frame(req, &frame, sizeof(cmd));
+    if (err != ESP_OK)
+        return err;
+
+    supercar_drive_ack_t ack = {
+        .type = SUPERCAR_DRIVE_ACK,
+        .status = drive_command(fd, &cmd),
+        .seq = cmd.seq,
+        .deadman_ms = supercar_arbiter_timeout_ms(SUPERCAR_SOURCE_WEB),
+        .sent = cmd.sent
+    };
+    httpd_ws_frame_t reply = {
+        .type = HTTPD_WS_TYPE_BINARY,
+        .final = true,
+        .payload = (uint8_t*)&ack,
+        .len = sizeof(ack)
+    };
+    return httpd_ws_send_frame(req, &reply);
+}
+
+void supercar_drive_session_closed(int sockfd)
+{
+    portENTER_CRITICAL(&drive_lock);
+    bool owner = drive.owner == sockfd;
+    if (owner) {
+        drive.owner = -1;
+        drive.last_command = 0;
+    }
+    portEXIT_CRITICAL(&drive_lock);
+    if (owner) {
+        // Released right away rather than at the end of the timeout, which still applies if the queue is full
+        gamepad_input_event_t ev;
+        drive_event(0, 0, esp_timer_get_time(), &ev);
+        xQueueSend(drive_car->remote_events, &ev, 0);
+    }
+}
+
+void supercar_drive_init(supercar_t* car)
+{
+    drive_car = car;
+}
+
+void supercar_drive_serialize(supercar_json_t* node, supercar_t* car)
+{
+    portENTER_CRITICAL(&drive_lock);
+    drive_state_t state = drive;
+    portEXIT_CRITICAL(&drive_lock);
+    supercar_json_int(node, "owner", state.owner);
+    supercar_json_int(node, "deadman_ms", supercar_arbiter_timeout_ms(SUPERCAR_SOURCE_WEB));
+    supercar_json_int(node, "throttle", state.throttle);
+    supercar_json_int(node, "steer", state.steer);
+    supercar_json_int(node, "commands", state.commands);
+    supercar_json_int(node, "forwarded", state.forwarded);
+    supercar_json_int(node, "dropped", state.dropped);
+    supercar_json_int(node, "stale", state.stale);
+    supercar_json_int(node, "busy", state.busy);
+    supercar_json_int(node, "takeovers", state.takeovers);
+    supercar_json_int(node, "invalid", state.invalid);
+    supercar_json_int(node, "max_gap_us", state.max_gap_us);
+}
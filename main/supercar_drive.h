@@ -0,0 +1,66 @@
+#ifndef _SUPERCAR_DRIVE_H_
+#define _SUPERCAR_DRIVE_H_
+
+#include "esp_system.h"
+#include "esp_http_server.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+#include "esp_hid_host.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUPERCAR_DRIVE_STEER_DEADZONE 30    // Steering is on or off, the stick must go past this
+
+/* Binary frames of /ws/drive, little endian */
+typedef enum {
+    SUPERCAR_DRIVE_COMMAND = 1,
+    SUPERCAR_DRIVE_ACK = 2,
+} supercar_drive_frame_type_t;
+
+typedef enum {
+    SUPERCAR_DRIVE_OK,
+    SUPERCAR_DRIVE_STALE,                   // Not newer than the previous command, dropped
+    SUPERCAR_DRIVE_BUSY,                    // Another client is driving
+    SUPERCAR_DRIVE_INVALID,
+} supercar_drive_status_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;                           // SUPERCAR_DRIVE_COMMAND
+    uint8_t flags;
+    uint16_t seq;                           // Incremented by the client for each command
+    int8_t throttle;                        // -100 (backward) to 100 (forward)
+    int8_t steer;                           // -100 (left) to 100 (right)
+    uint16_t reserved;
+    uint32_t sent;                          // Client clock, echoed in the ack for the round trip time
+} supercar_drive_command_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;                           // SUPERCAR_DRIVE_ACK
+    uint8_t status;                         // supercar_drive_status_t
+    uint16_t seq;
+    uint16_t deadman_ms;                    // Timeout of the web intents, the client must send more often than this
+    uint16_t reserved;
+    uint32_t sent;
+} supercar_drive_ack_t;
+
+/**
+ * @brief WebSocket handler, one client drives at a time and gets an ack for each command
+ */
+esp_err_t supercar_drive_ws_handler(httpd_req_t* req);
+
+/**
+ * @brief To be called when a session closes, the controls are released if it was driving
+ */
+void supercar_drive_session_closed(int sockfd);
+
+void supercar_drive_init(supercar_t* car);
+
+void supercar_drive_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
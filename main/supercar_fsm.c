@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include "esp_log.h"
+#include "supercar_main.h"
+#include "supercar_fsm.h"
+
+static const char* TAG = "FSM";
+
+typedef void (*supercar_fsm_action_t)(supercar_t* car, float value);
+
+typedef struct {
+    supercar_state_t next;
+    supercar_fsm_action_t action;
+    bool defined;
+} supercar_transition_t;
+
+static void supercar_fsm_start(supercar_t* car, float value){
+    supercar_start(car, supercar_get_running(car));
+}
+
+static void supercar_fsm_throttle(supercar_t* car, float value){
+    supercar_throttle(car, value);
+}
+
+static void supercar_fsm_stop(supercar_t* car, float value){
+    supercar_stop(car);
+}
+
+static void supercar_fsm_reverse(supercar_t* car, float value){
+    supercar_reverse(car);
+}
+
+static void supercar_fsm_emergency_stop(supercar_t* car, float value){
+    ESP_LOGD(TAG, "Supercar emergency stop");
+    supercar_stop(car);
+    ESP_LOGD(TAG, "Supercar emergency reverse");
+    supercar_reverse(car);
+}
+
+static void supercar_fsm_enter_local(supercar_t* car, float value){
+    supercar_stop(car);
+    // The physical switch is authoritative again
+    supercar_read_mode(car);
+}
+
+/* Generated from supercar_fsm.def */
+static const supercar_transition_t supercar_transitions[SUPERCAR_STATE_MAX][SUPERCAR_FSM_EVENT_MAX] = {
+#define SUPERCAR_TRANSITION(from, event, to, act) \
+    [SUPERCAR_STATE_##from][SUPERCAR_FSM_##event] = { .next = SUPERCAR_STATE_##to, .action = act, .defined = true },
+#include "supercar_fsm.def"
+};
+
+static const supercar_control_type_t supercar_state_control_types[SUPERCAR_STATE_MAX] = {
+#define SUPERCAR_STATE(name, control_type, running) [SUPERCAR_STATE_##name] = control_type,
+#include "supercar_fsm.def"
+};
+
+static const supercar_direction_t supercar_state_directions[SUPERCAR_STATE_MAX] = {
+#define SUPERCAR_STATE(name, control_type, running) [SUPERCAR_STATE_##name] = running,
+#include "supercar_fsm.def"
+};
+
+static const char* supercar_state_names[SUPERCAR_STATE_MAX] = {
+#define SUPERCAR_STATE(name, control_type, running) [SUPERCAR_STATE_##name] = #name,
+#include "supercar_fsm.def"
+};
+
+static const char* supercar_event_names[SUPERCAR_FSM_EVENT_MAX] = {
+#define SUPERCAR_EVENT(name) [SUPERCAR_FSM_##name] = #name,
+#include "supercar_fsm.def"
+};
+
+void supercar_dispatch(supercar_t* car, supercar_fsm_event_t event, float value){
+    const supercar_transition_t* transition = &supercar_transitions[car->state][event];
+    if(!transition->defined)
+        return;
+    if(transition->next != car->state){
+        ESP_LOGD(TAG, "%s --%s--> %s", supercar_state_names[car->state], supercar_event_names[event], supercar_state_names[transition->next]);
+    }
+    car->state = transition->next;
+    if(transition->action)
+        transition->action(car, value);
+}
+
+supercar_control_type_t supercar_get_control_type(supercar_t* car){
+    return supercar_state_control_types[car->state];
+}
+
+supercar_direction_t supercar_get_running(supercar_t* car){
+    return supercar_state_directions[car->state];
+}
+
+const char* supercar_get_state_name(supercar_t* car){
+    return supercar_state_names[car->state];
+}
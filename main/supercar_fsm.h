@@ -0,0 +1,24 @@
+#ifndef _SUPERCAR_FSM_H_
+#define _SUPERCAR_FSM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+#define SUPERCAR_STATE(name, control_type, running) SUPERCAR_STATE_##name,
+#include "supercar_fsm.def"
+    SUPERCAR_STATE_MAX
+} supercar_state_t;
+
+typedef enum {
+#define SUPERCAR_EVENT(name) SUPERCAR_FSM_##name,
+#include "supercar_fsm.def"
+    SUPERCAR_FSM_EVENT_MAX
+} supercar_fsm_event_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,567 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "supercar_gamepad.h"
+
+#define HID_PAGE_GENERIC_DESKTOP 0x01
+#define HID_PAGE_SIMULATION      0x02
+#define HID_PAGE_BUTTON          0x09
+
+#define HID_USAGE_X              0x30
+#define HID_USAGE_Y              0x31
+#define HID_USAGE_Z              0x32
+#define HID_USAGE_RX             0x33
+#define HID_USAGE_RY             0x34
+#define HID_USAGE_RZ             0x35
+#define HID_USAGE_HAT_SWITCH     0x39
+#define HID_USAGE_ACCELERATOR    0xC4
+#define HID_USAGE_BRAKE          0xC5
+
+#define HID_ITEM_MAIN   0
+#define HID_ITEM_GLOBAL 1
+#define HID_ITEM_LOCAL  2
+
+#define HID_MAIN_INPUT          0x8
+#define HID_GLOBAL_USAGE_PAGE   0x0
+#define HID_GLOBAL_LOGICAL_MIN  0x1
+#define HID_GLOBAL_LOGICAL_MAX  0x2
+#define HID_GLOBAL_REPORT_SIZE  0x7
+#define HID_GLOBAL_REPORT_ID    0x8
+#define HID_GLOBAL_REPORT_COUNT 0x9
+#define HID_GLOBAL_PUSH         0xA
+#define HID_GLOBAL_POP          0xB
+#define HID_LOCAL_USAGE         0x0
+#define HID_LOCAL_USAGE_MIN     0x1
+#define HID_LOCAL_USAGE_MAX     0x2
+
+#define HID_INPUT_CONSTANT (1 << 0)
+#define HID_INPUT_VARIABLE (1 << 1)
+
+#define PARSER_MAX_USAGES 16
+#define PARSER_MAX_REPORTS 8
+#define PARSER_STACK_DEPTH 4
+
+#define STICK_RANGE 65535
+#define TRIGGER_RANGE 1023
+#define DPAD_RANGE (DPAD_UP_LEFT - DPAD_UP)
+
+#define XBOX_VENDOR_ID 0x045E
+
+static const char* TAG = "gamepad";
+
+/* Button numbering of the Xbox One S firmware over BT classic */
+#define XBOX_BT_BUTTONS { GAMEPAD_BUTTON_A, GAMEPAD_BUTTON_B, GAMEPAD_BUTTON_X, GAMEPAD_BUTTON_Y, \
+    GAMEPAD_BUTTON_LB, GAMEPAD_BUTTON_RB, GAMEPAD_BUTTON_SELECT, GAMEPAD_BUTTON_MENU, GAMEPAD_BUTTON_LS, GAMEPAD_BUTTON_RS }
+
+/* Button numbering of the Xbox One/Series firmware 5 over BLE, with holes left from the Android layout */
+#define XBOX_BLE_BUTTONS { GAMEPAD_BUTTON_A, GAMEPAD_BUTTON_B, 0, GAMEPAD_BUTTON_X, GAMEPAD_BUTTON_Y, 0, \
+    GAMEPAD_BUTTON_LB, GAMEPAD_BUTTON_RB, 0, 0, GAMEPAD_BUTTON_SELECT, GAMEPAD_BUTTON_MENU, 0, GAMEPAD_BUTTON_LS, GAMEPAD_BUTTON_RS }
+
+#define FIELD(offset, size, tgt, min, max, range) \
+    { .bit_offset = offset, .bit_size = size, .target = tgt, .logical_min = min, .logical_max = max, .scale = (uint32_t)(((uint64_t)(range) << 16) / ((max) - (min))) }
+#define BUTTONS(offset, count) \
+    { .bit_offset = offset, .bit_size = count, .target = GAMEPAD_TARGET_BUTTONS, .logical_min = 0, .logical_max = 1, .scale = 0 }
+
+/* Both Xbox firmwares share the same report 1 layout, only the length and the buttons differ */
+#define XBOX_LAYOUT(length, num_buttons) { \
+    .map_index = 0, .report_id = 1, .min_length = length, .num_fields = 8, .fields = { \
+        FIELD(0, 16, GAMEPAD_TARGET_LX, 0, 65535, STICK_RANGE), \
+        FIELD(16, 16, GAMEPAD_TARGET_LY, 0, 65535, STICK_RANGE), \
+        FIELD(32, 16, GAMEPAD_TARGET_RX, 0, 65535, STICK_RANGE), \
+        FIELD(48, 16, GAMEPAD_TARGET_RY, 0, 65535, STICK_RANGE), \
+        FIELD(64, 10, GAMEPAD_TARGET_LT, 0, 1023, TRIGGER_RANGE), \
+        FIELD(80, 10, GAMEPAD_TARGET_RT, 0, 1023, TRIGGER_RANGE), \
+        FIELD(96, 4, GAMEPAD_TARGET_DPAD, 1, 8, DPAD_RANGE), \
+        BUTTONS(104, num_buttons) } }
+
+static const gamepad_profile_t gamepad_profiles[] = {
+    {
+        .name = "Xbox One S (BT)",
+        .vendor_id = XBOX_VENDOR_ID,
+        .transport = ESP_HID_TRANSPORT_BT,
+        .button_map = XBOX_BT_BUTTONS,
+        .layout = XBOX_LAYOUT(15, 10)
+    },
+    {
+        .name = "Xbox One/Series (BLE)",
+        .vendor_id = XBOX_VENDOR_ID,
+        .transport = ESP_HID_TRANSPORT_BLE,
+        .button_map = XBOX_BLE_BUTTONS,
+        .layout = XBOX_LAYOUT(16, 15)
+    },
+    {
+        .name = "Generic gamepad (BT)",
+        .vendor_id = 0,
+        .transport = ESP_HID_TRANSPORT_BT,
+        .button_map = XBOX_BT_BUTTONS
+    },
+    {
+        .name = "Generic gamepad (BLE)",
+        .vendor_id = 0,
+        .transport = ESP_HID_TRANSPORT_BLE,
+        .button_map = XBOX_BT_BUTTONS
+    }
+};
+
+typedef struct {
+    esp_hidh_dev_t* dev;
+    const gamepad_profile_t* profile;
+    uint8_t num_layouts;
+    gamepad_layout_t layouts[GAMEPAD_MAX_LAYOUTS];
+} gamepad_device_t;
+
+static gamepad_device_t gamepad_devices[GAMEPAD_MAX_DEVICES];
+
+/* Descriptor parser state */
+typedef struct {
+    uint16_t usage_page;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint8_t report_size;
+    uint8_t report_count;
+    uint8_t report_id;
+} hid_globals_t;
+
+typedef struct {
+    uint32_t usages[PARSER_MAX_USAGES];     // Usage page in the high half
+    uint8_t num_usages;
+    uint32_t usage_min;
+    uint32_t usage_max;
+} hid_locals_t;
+
+typedef struct {
+    uint8_t report_id;
+    uint16_t bit_offset;
+} hid_report_offset_t;
+
+typedef struct {
+    uint32_t usage;
+    uint16_t bit_offset;
+    uint8_t bit_size;
+    uint8_t report_id;
+    int32_t logical_min;
+    int32_t logical_max;
+} hid_candidate_t;
+
+typedef struct {
+    hid_candidate_t candidates[GAMEPAD_MAX_LAYOUTS * GAMEPAD_MAX_FIELDS];
+    uint8_t num_candidates;
+    hid_report_offset_t offsets[PARSER_MAX_REPORTS];
+    uint8_t num_offsets;
+    bool simulation_triggers;
+} hid_parser_t;
+
+static int32_t hid_item_value(const uint8_t* data, uint8_t size, bool is_signed){
+    uint32_t value = 0;
+    for(int i = 0; i < size; i++){
+        value |= (uint32_t) data[i] << (8 * i);
+    }
+    if(is_signed && size && size < 4 && (value & (1u << (8 * size - 1)))){
+        value |= ~0u << (8 * size);
+    }
+    return (int32_t) value;
+}
+
+static uint16_t* hid_report_offset(hid_parser_t* parser, uint8_t report_id){
+    for(int i = 0; i < parser->num_offsets; i++){
+        if(parser->offsets[i].report_id == report_id)
+            return &parser->offsets[i].bit_offset;
+    }
+    if(parser->num_offsets == PARSER_MAX_REPORTS)
+        return NULL;
+    hid_report_offset_t* offset = &parser->offsets[parser->num_offsets++];
+    offset->report_id = report_id;
+    offset->bit_offset = 0;
+    return &offset->bit_offset;
+}
+
+static bool hid_usage_is_gamepad(uint32_t usage){
+    uint16_t page = usage >> 16;
+    uint16_t id = usage & 0xFFFF;
+    switch(page){
+    case HID_PAGE_GENERIC_DESKTOP:
+        return id >= HID_USAGE_X && id <= HID_USAGE_HAT_SWITCH && id != 0x36 && id != 0x37 && id != 0x38;
+    case HID_PAGE_SIMULATION:
+        return id == HID_USAGE_ACCELERATOR || id == HID_USAGE_BRAKE;
+    case HID_PAGE_BUTTON:
+        return id >= 1 && id <= GAMEPAD_MAX_BUTTONS;
+    default:
+        return false;
+    }
+}
+
+static void hid_parse_input(hid_parser_t* parser, hid_globals_t* globals, hid_locals_t* locals, uint32_t flags){
+    uint16_t* offset = hid_report_offset(parser, globals->report_id);
+    if(!offset)
+        return;
+    if(!(flags & HID_INPUT_CONSTANT) && (flags & HID_INPUT_VARIABLE)){
+        for(int i = 0; i < globals->report_count; i++){
+            uint32_t usage;
+            if(i < locals->num_usages){
+                usage = locals->usages[i];
+            }else if(locals->usage_max){
+                usage = locals->usage_min + (i - locals->num_usages);
+                if(usage > locals->usage_max)
+                    usage = locals->usage_max;
+            }else if(locals->num_usages){
+                usage = locals->usages[locals->num_usages - 1];
+            }else{
+                break;
+            }
+            if(!(usage >> 16))
+                usage |= (uint32_t) globals->usage_page << 16;
+            if(!hid_usage_is_gamepad(usage) || parser->num_candidates == sizeof(parser->candidates) / sizeof(parser->candidates[0]))
+                continue;
+            if((usage >> 16) == HID_PAGE_SIMULATION)
+                parser->simulation_triggers = true;
+            parser->candidates[parser->num_candidates++] = (hid_candidate_t){
+                .usage = usage,
+                .bit_offset = *offset + i * globals->report_size,
+                .bit_size = globals->report_size,
+                .report_id = globals->report_id,
+                .logical_min = globals->logical_min,
+                .logical_max = globals->logical_max
+            };
+        }
+    }
+    // Constants are padding and arrays are not used by gamepads, only skip their bits
+    *offset += globals->report_size * globals->report_count;
+}
+
+static void hid_parse_report_map(hid_parser_t* parser, const uint8_t* map, size_t len){
+    hid_globals_t globals = {0};
+    hid_globals_t stack[PARSER_STACK_DEPTH];
+    int depth = 0;
+    hid_locals_t locals = {0};
+
+    size_t i = 0;
+    while(i < len){
+        uint8_t prefix = map[i++];
+        if(prefix == 0xFE){
+            // Long item, never used by gamepads
+            if(i + 1 >= len)
+                break;
+            i += 2 + map[i];
+            continue;
+        }
+        uint8_t size = prefix & 0x3;
+        if(size == 3)
+            size = 4;
+        uint8_t type = (prefix >> 2) & 0x3;
+        uint8_t tag = prefix >> 4;
+        if(i + size > len)
+            break;
+        const uint8_t* data = &map[i];
+        i += size;
+
+        switch(type){
+        case HID_ITEM_MAIN:
+            if(tag == HID_MAIN_INPUT)
+                hid_parse_input(parser, &globals, &locals, hid_item_value(data, size, false));
+            memset(&locals, 0, sizeof(locals));
+            break;
+        case HID_ITEM_GLOBAL:
+            switch(tag){
+            case HID_GLOBAL_USAGE_PAGE:
+                globals.usage_page = hid_item_value(data, size, false);
+                break;
+            case HID_GLOBAL_LOGICAL_MIN:
+                globals.logical_min = hid_item_value(data, size, true);
+                break;
+            case HID_GLOBAL_LOGICAL_MAX:
+                globals.logical_max = hid_item_value(data, size, true);
+                // Many descriptors encode an unsigned maximum on too few bytes
+                if(globals.logical_min >= 0 && globals.logical_max < 0)
+                    globals.logical_max = hid_item_value(data, size, false);
+                break;
+            case HID_GLOBAL_REPORT_SIZE:
+                globals.report_size = hid_item_value(data, size, false);
+                break;
+            case HID_GLOBAL_REPORT_ID:
+                globals.report_id = hid_item_value(data, size, false);
+                break;
+            case HID_GLOBAL_REPORT_COUNT:
+                globals.report_count = hid_item_value(data, size, false);
+                break;
+            case HID_GLOBAL_PUSH:
+                if(depth < PARSER_STACK_DEPTH)
+                    stack[depth++] = globals;
+                break;
+            case HID_GLOBAL_POP:
+                if(depth > 0)
+                    globals = stack[--depth];
+                break;
+            }
+            break;
+        case HID_ITEM_LOCAL: {
+            uint32_t usage = hid_item_value(data, size, false);
+            if(size < 4)
+                usage |= (uint32_t) globals.usage_page << 16;
+            if(tag == HID_LOCAL_USAGE && locals.num_usages < PARSER_MAX_USAGES)
+                locals.usages[locals.num_usages++] = usage;
+            else if(tag == HID_LOCAL_USAGE_MIN)
+                locals.usage_min = usage;
+            else if(tag == HID_LOCAL_USAGE_MAX)
+                locals.usage_max = usage;
+            break;
+        }
+        }
+    }
+}
+
+static gamepad_target_t gamepad_target_of(hid_parser_t* parser, uint32_t usage){
+    uint16_t page = usage >> 16;
+    uint16_t id = usage & 0xFFFF;
+    if(page == HID_PAGE_BUTTON)
+        return GAMEPAD_TARGET_BUTTONS;
+    if(page == HID_PAGE_SIMULATION)
+        return id == HID_USAGE_ACCELERATOR ? GAMEPAD_TARGET_RT : GAMEPAD_TARGET_LT;
+    switch(id){
+    case HID_USAGE_X:
+        return GAMEPAD_TARGET_LX;
+    case HID_USAGE_Y:
+        return GAMEPAD_TARGET_LY;
+    case HID_USAGE_HAT_SWITCH:
+        return GAMEPAD_TARGET_DPAD;
+    case HID_USAGE_RX:
+        return GAMEPAD_TARGET_RX;
+    case HID_USAGE_RY:
+        return GAMEPAD_TARGET_RY;
+    // Z/Rz are the right stick when the triggers come from the simulation page, the triggers otherwise
+    case HID_USAGE_Z:
+        return parser->simulation_triggers ? GAMEPAD_TARGET_RX : GAMEPAD_TARGET_LT;
+    case HID_USAGE_RZ:
+        return parser->simulation_triggers ? GAMEPAD_TARGET_RY : GAMEPAD_TARGET_RT;
+    default:
+        return GAMEPAD_TARGET_NONE;
+    }
+}
+
+static uint32_t gamepad_target_range(gamepad_target_t target){
+    switch(target){
+    case GAMEPAD_TARGET_LT:
+    case GAMEPAD_TARGET_RT:
+        return TRIGGER_RANGE;
+    case GAMEPAD_TARGET_DPAD:
+        return DPAD_RANGE;
+    default:
+        return STICK_RANGE;
+    }
+}
+
+static gamepad_layout_t* gamepad_layout_get(gamepad_device_t* device, uint8_t map_index, uint8_t report_id){
+    for(int i = 0; i < device->num_layouts; i++){
+        if(device->layouts[i].map_index == map_index && device->layouts[i].report_id == report_id)
+            return &device->layouts[i];
+    }
+    if(device->num_layouts == GAMEPAD_MAX_LAYOUTS)
+        return NULL;
+    gamepad_layout_t* layout = &device->layouts[device->num_layouts++];
+    memset(layout, 0, sizeof(*layout));
+    layout->map_index = map_index;
+    layout->report_id = report_id;
+    return layout;
+}
+
+static void gamepad_compile(gamepad_device_t* device, hid_parser_t* parser, uint8_t map_index){
+    for(int i = 0; i < parser->num_candidates; i++){
+        hid_candidate_t* candidate = &parser->candidates[i];
+        gamepad_target_t target = gamepad_target_of(parser, candidate->usage);
+        if(target == GAMEPAD_TARGET_NONE || candidate->bit_size == 0 || candidate->bit_size > 32)
+            continue;
+        gamepad_layout_t* layout = gamepad_layout_get(device, map_index, candidate->report_id);
+        if(!layout)
+            continue;
+        gamepad_field_t* last = layout->num_fields ? &layout->fields[layout->num_fields - 1] : NULL;
+        gamepad_field_t* field = NULL;
+        if(target == GAMEPAD_TARGET_BUTTONS){
+            int button = (candidate->usage & 0xFFFF) - 1;
+            if(candidate->bit_size != 1)
+                continue;
+            // Merge consecutive one bit buttons in a single field
+            if(last && last->target == GAMEPAD_TARGET_BUTTONS && last->bit_size < 32
+                && last->bit_offset + last->bit_size == candidate->bit_offset
+                && last->logical_min + last->bit_size == button){
+                field = last;
+                field->bit_size++;
+            }else if(layout->num_fields < GAMEPAD_MAX_FIELDS){
+                field = &layout->fields[layout->num_fields++];
+                *field = (gamepad_field_t){
+                    .bit_offset = candidate->bit_offset,
+                    .bit_size = 1,
+                    .target = GAMEPAD_TARGET_BUTTONS,
+                    .logical_min = button,
+                    .logical_max = 1
+                };
+            }
+        }else if(layout->num_fields < GAMEPAD_MAX_FIELDS && candidate->logical_max > candidate->logical_min){
+            field = &layout->fields[layout->num_fields++];
+            *field = (gamepad_field_t){
+                .bit_offset = candidate->bit_offset,
+                .bit_size = candidate->bit_size,
+                .target = target,
+                .logical_min = candidate->logical_min,
+                .logical_max = candidate->logical_max,
+                .scale = ((uint64_t) gamepad_target_range(target) << 16) / (uint32_t)(candidate->logical_max - candidate->logical_min)
+            };
+        }
+        if(!field)
+            continue;
+        uint8_t length = (field->bit_offset + field->bit_size + 7) / 8;
+        if(length > layout->min_length)
+            layout->min_length = length;
+    }
+}
+
+static const gamepad_profile_t* gamepad_profile_find(esp_hidh_dev_t* dev){
+    uint16_t vendor_id = esp_hidh_dev_vendor_id_get(dev);
+    esp_hid_transport_t transport = esp_hidh_dev_transport_get(dev);
+    for(int i = 0; i < sizeof(gamepad_profiles) / sizeof(gamepad_profiles[0]); i++){
+        const gamepad_profile_t* profile = &gamepad_profiles[i];
+        if(profile->transport == transport && (!profile->vendor_id || profile->vendor_id == vendor_id))
+            return profile;
+    }
+    return NULL;
+}
+
+static gamepad_device_t* gamepad_device_find(esp_hidh_dev_t* dev){
+    for(int i = 0; i < GAMEPAD_MAX_DEVICES; i++){
+        if(gamepad_devices[i].dev == dev)
+            return &gamepad_devices[i];
+    }
+    return NULL;
+}
+
+esp_err_t gamepad_open(esp_hidh_dev_t* dev){
+    gamepad_device_t* device = gamepad_device_find(dev);
+    if(!device)
+        device = gamepad_device_find(NULL);
+    if(!device){
+        ESP_LOGE(TAG, "Too many gamepads");
+        return ESP_ERR_NO_MEM;
+    }
+    memset(device, 0, sizeof(*device));
+
+    const gamepad_profile_t* profile = gamepad_profile_find(dev);
+    if(!profile){
+        ESP_LOGW(TAG, "No profile for transport %d", esp_hidh_dev_transport_get(dev));
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    size_t num_maps = 0;
+    esp_hid_raw_report_map_t* maps = NULL;
+    if(esp_hidh_dev_report_maps_get(dev, &num_maps, &maps) == ESP_OK){
+        hid_parser_t* parser = malloc(sizeof(hid_parser_t));
+        if(!parser)
+            return ESP_ERR_NO_MEM;
+        for(int i = 0; i < num_maps; i++){
+            memset(parser, 0, sizeof(*parser));
+            hid_parse_report_map(parser, maps[i].data, maps[i].len);
+            gamepad_compile(device, parser, i);
+        }
+        free(parser);
+    }
+
+    if(!device->num_layouts){
+        if(!profile->layout.num_fields){
+            ESP_LOGW(TAG, "No gamepad report found and no built-in layout for %s", profile->name);
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        ESP_LOGI(TAG, "Report map unusable, falling back to the built-in %s layout", profile->name);
+        device->layouts[0] = profile->layout;
+        device->num_layouts = 1;
+    }
+    device->dev = dev;
+    device->profile = profile;
+
+    for(int i = 0; i < device->num_layouts; i++){
+        gamepad_layout_t* layout = &device->layouts[i];
+        ESP_LOGI(TAG, "%s map %d report %d: %d fields, %d bytes", profile->name, layout->map_index, layout->report_id, layout->num_fields, layout->min_length);
+        for(int f = 0; f < layout->num_fields; f++){
+            gamepad_field_t* field = &layout->fields[f];
+            ESP_LOGD(TAG, "  target %d @%d:%d [%d, %d]", field->target, field->bit_offset, field->bit_size, field->logical_min, field->logical_max);
+        }
+    }
+    return ESP_OK;
+}
+
+void gamepad_close(esp_hidh_dev_t* dev){
+    gamepad_device_t* device = gamepad_device_find(dev);
+    if(device)
+        memset(device, 0, sizeof(*device));
+}
+
+static inline uint32_t gamepad_extract(const uint8_t* data, uint16_t bit_offset, uint8_t bit_size){
+    const uint8_t* p = &data[bit_offset >> 3];
+    uint8_t shift = bit_offset & 7;
+    int bytes = (shift + bit_size + 7) >> 3;
+    uint64_t raw = 0;
+    for(int i = 0; i < bytes; i++){
+        raw |= (uint64_t) p[i] << (8 * i);
+    }
+    raw >>= shift;
+    return (uint32_t) raw & (bit_size == 32 ? 0xFFFFFFFFu : ((1u << bit_size) - 1));
+}
+
+bool gamepad_decode(esp_hidh_dev_t* dev, uint8_t map_index, uint8_t report_id, const uint8_t* data, size_t length, gamepad_state_t* state){
+    gamepad_device_t* device = gamepad_device_find(dev);
+    if(!device)
+        return false;
+    const gamepad_layout_t* layout = NULL;
+    for(int i = 0; i < device->num_layouts; i++){
+        if(device->layouts[i].map_index == map_index && device->layouts[i].report_id == report_id){
+            layout = &device->layouts[i];
+            break;
+        }
+    }
+    if(!layout || length < layout->min_length)
+        return false;
+
+    memset(state, 0, sizeof(*state));
+    for(int i = 0; i < layout->num_fields; i++){
+        const gamepad_field_t* field = &layout->fields[i];
+        uint32_t raw = gamepad_extract(data, field->bit_offset, field->bit_size);
+        if(field->target == GAMEPAD_TARGET_BUTTONS){
+            while(raw){
+                int bit = __builtin_ctz(raw);
+                int button = field->logical_min + bit;
+                if(button < GAMEPAD_MAX_BUTTONS)
+                    state->buttons |= device->profile->button_map[button];
+                raw &= raw - 1;
+            }
+            continue;
+        }
+        int32_t value = (int32_t) raw;
+        if(field->logical_min < 0 && field->bit_size < 32 && (raw & (1u << (field->bit_size - 1))))
+            value |= ~0u << field->bit_size;
+        if(value < field->logical_min || value > field->logical_max){
+            // Out of range is the null state of hat switches
+            continue;
+        }
+        uint32_t normalized = ((uint64_t)(value - field->logical_min) * field->scale) >> 16;
+        switch(field->target){
+        case GAMEPAD_TARGET_LX:
+            state->lx = (int32_t) normalized - 32768;
+            break;
+        case GAMEPAD_TARGET_LY:
+            state->ly = (int32_t) normalized - 32768;
+            break;
+        case GAMEPAD_TARGET_RX:
+            state->rx = (int32_t) normalized - 32768;
+            break;
+        case GAMEPAD_TARGET_RY:
+            state->ry = (int32_t) normalized - 32768;
+            break;
+        case GAMEPAD_TARGET_LT:
+            state->lt = normalized;
+            break;
+        case GAMEPAD_TARGET_RT:
+            state->rt = normalized;
+            break;
+        case GAMEPAD_TARGET_DPAD:
+            state->dpad = DPAD_UP + normalized;
+            break;
+        }
+    }
+    return true;
+}
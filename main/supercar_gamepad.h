@@ -0,0 +1,112 @@
+#ifndef _SUPERCAR_GAMEPAD_H_
+#define _SUPERCAR_GAMEPAD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_hidh.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GAMEPAD_MAX_DEVICES 2
+#define GAMEPAD_MAX_LAYOUTS 4
+#define GAMEPAD_MAX_FIELDS 12
+#define GAMEPAD_MAX_BUTTONS 16
+
+typedef enum {
+   DPAD_NONE = 0,
+   DPAD_UP,
+   DPAD_UP_RIGHT,
+   DPAD_RIGHT,
+   DPAD_DOWN_RIGHT,
+   DPAD_DOWN,
+   DPAD_DOWN_LEFT,
+   DPAD_LEFT,
+   DPAD_UP_LEFT
+} dpad_input_t;
+
+typedef enum {
+   GAMEPAD_BUTTON_A      = 1 << 0,
+   GAMEPAD_BUTTON_B      = 1 << 1,
+   GAMEPAD_BUTTON_X      = 1 << 2,
+   GAMEPAD_BUTTON_Y      = 1 << 3,
+   GAMEPAD_BUTTON_LB     = 1 << 4,
+   GAMEPAD_BUTTON_RB     = 1 << 5,
+   GAMEPAD_BUTTON_SELECT = 1 << 6,
+   GAMEPAD_BUTTON_MENU   = 1 << 7,
+   GAMEPAD_BUTTON_LS     = 1 << 8,
+   GAMEPAD_BUTTON_RS     = 1 << 9
+} gamepad_button_t;
+
+/* Normalized gamepad state, whatever the controller */
+typedef struct {
+   int16_t lx;                // Sticks, centered on 0
+   int16_t ly;
+   int16_t rx;
+   int16_t ry;
+   uint16_t lt;               // Triggers, 0 to 1023
+   uint16_t rt;
+   uint8_t dpad;              // dpad_input_t
+   uint16_t buttons;          // gamepad_button_t bitmask
+} gamepad_state_t;
+
+typedef enum {
+   GAMEPAD_TARGET_NONE = 0,
+   GAMEPAD_TARGET_LX,
+   GAMEPAD_TARGET_LY,
+   GAMEPAD_TARGET_RX,
+   GAMEPAD_TARGET_RY,
+   GAMEPAD_TARGET_LT,
+   GAMEPAD_TARGET_RT,
+   GAMEPAD_TARGET_DPAD,
+   GAMEPAD_TARGET_BUTTONS
+} gamepad_target_t;
+
+/* One value to extract from an input report */
+typedef struct {
+   uint16_t bit_offset;
+   uint8_t bit_size;
+   uint8_t target;            // gamepad_target_t
+   int32_t logical_min;       // First HID button index for GAMEPAD_TARGET_BUTTONS
+   int32_t logical_max;
+   uint32_t scale;            // Q16 factor from the logical range to the normalized range
+} gamepad_field_t;
+
+/* Extraction table of one input report */
+typedef struct {
+   uint8_t map_index;
+   uint8_t report_id;
+   uint8_t min_length;        // Reports shorter than this are ignored
+   uint8_t num_fields;
+   gamepad_field_t fields[GAMEPAD_MAX_FIELDS];
+} gamepad_layout_t;
+
+typedef struct {
+   const char* name;
+   uint16_t vendor_id;                        // 0 matches any vendor
+   esp_hid_transport_t transport;
+   uint16_t button_map[GAMEPAD_MAX_BUTTONS];  // HID button n + 1 -> gamepad_button_t
+   gamepad_layout_t layout;                   // Used when the report map cannot be parsed
+} gamepad_profile_t;
+
+/**
+ * @brief Parse the report map of a newly opened device and compile its extraction tables
+ */
+esp_err_t gamepad_open(esp_hidh_dev_t* dev);
+
+void gamepad_close(esp_hidh_dev_t* dev);
+
+/**
+ * @brief Decode an input report with the extraction table of its device
+ *
+ * @return false if the report does not carry gamepad data
+ */
+bool gamepad_decode(esp_hidh_dev_t* dev, uint8_t map_index, uint8_t report_id, const uint8_t* data, size_t length, gamepad_state_t* state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "supercar_coex.h"
+#include "supercar_tasks.h"
+#include "supercar_http.h"
+
+static const char* TAG = "supercar_http";
+
+#define HTTP_CONNS CONFIG_SUPERCAR_HTTP_BUFFERS
+
+/* Buffer of a connection and the response the sender task writes from it */
+typedef struct {
+    char buf[SUPERCAR_HTTP_BUFSIZE];
+    int refs;                       // 0 when free, the session and a pending response hold one each
+    bool sending;
+    bool close_pending;             // The session closed while sending, the sender closes the socket
+    int sockfd;
+    httpd_handle_t hd;
+    size_t header_len;
+    size_t header_sent;
+    const char* data;               // Mapped body, NULL when read from fd
+    int fd;
+    size_t size;
+    size_t sent;
+    size_t chunk_len;               // Part of the file in buf
+    size_t chunk_sent;
+    int64_t start;
+} http_conn_t;
+
+typedef struct {
+    uint32_t in_use;
+    uint32_t max_in_use;
+    uint32_t exhausted;             // Requests served from the shared buffer because the pool was empty
+    uint32_t async_sends;
+    uint32_t async_failed;
+    uint64_t async_bytes;
+    uint32_t max_async_us;
+    uint32_t active;
+    uint32_t max_active;            // Most responses sent at the same time
+} http_stats_t;
+
+static http_conn_t http_conns[HTTP_CONNS];
+static http_stats_t http_stats;
+static portMUX_TYPE http_lock = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t http_queue;
+
+static void supercar_http_unref(http_conn_t* conn)
+{
+    portENTER_CRITICAL(&http_lock);
+    if (--conn->refs == 0) {
+        http_stats.in_use--;
+    }
+    portEXIT_CRITICAL(&http_lock);
+}
+
+/* Session context free function, the buffer only goes back to the pool once the sender is done with it */
+static void supercar_http_conn_free(void* ctx)
+{
+    supercar_http_unref(ctx);
+}
+
+char* supercar_http_buffer(httpd_req_t* req)
+{
+    http_conn_t* conn = req->sess_ctx;
+    if (conn) {
+        return conn->buf;
+    }
+    portENTER_CRITICAL(&http_lock);
+    for (int i = 0; i < HTTP_CONNS; i++) {
+        if (http_conns[i].refs == 0) {
+            conn = &http_conns[i];
+            conn->refs = 1;
+            conn->sending = false;
+            conn->close_pending = false;
+            if (++http_stats.in_use > http_stats.max_in_use) {
+                http_stats.max_in_use = http_stats.in_use;
+            }
+            break;
+        }
+    }
+    if (!conn) {
+        http_stats.exhausted++;
+    }
+    portEXIT_CRITICAL(&http_lock);
+    if (!conn) {
+        return NULL;
+    }
+    conn->sockfd = httpd_req_to_sockfd(req);
+    req->sess_ctx = conn;
+    req->free_ctx = supercar_http_conn_free;
+    return conn->buf;
+}
+
+esp_err_t supercar_http_send_async(httpd_req_t* req, size_t header_len, const void* data, size_t size, int fd)
+{
+    http_conn_t* conn = req->sess_ctx;
+    if (!conn || header_len >= SUPERCAR_HTTP_BUFSIZE) {
+        return ESP_ERR_NO_MEM;
+    }
+    conn->hd = req->handle;
+    conn->header_len = header_len;
+    conn->header_sent = 0;
+    conn->data = data;
+    conn->fd = fd;
+    conn->size = size;
+    conn->sent = 0;
+    conn->chunk_len = 0;
+    conn->chunk_sent = 0;
+    conn->start = esp_timer_get_time();
+    portENTER_CRITICAL(&http_lock);
+    conn->refs++;
+    conn->sending = true;
+    portEXIT_CRITICAL(&http_lock);
+    /* One response per connection at most, the queue always has room */
+    xQueueSend(http_queue, &conn, portMAX_DELAY);
+    return ESP_OK;
+}
+
+bool supercar_http_session_closed(int sockfd)
+{
+    bool sending = false;
+    portENTER_CRITICAL(&http_lock);
+    for (int i = 0; i < HTTP_CONNS; i++) {
+        http_conn_t* conn = &http_conns[i];
+        if (conn->refs > 0 && conn->sending && conn->sockfd == sockfd) {
+            conn->close_pending = true;
+            sending = true;
+        }
+    }
+    portEXIT_CRITICAL(&http_lock);
+    return !sending;
+}
+
+/* Send the next part of the response, > 0 while there is more, 0 once complete and < 0 on error.
+   Nothing is sent while the driving budget is spent, wait_us tells when it comes back */
+static int supercar_http_step(http_conn_t* conn, uint32_t* wait_us)
+{
+    portENTER_CRITICAL(&http_lock);
+    bool closed = conn->close_pending;
+    portEXIT_CRITICAL(&http_lock);
+    if (closed) {
+        /* The session is gone (client close or LRU purge), httpd_socket_send would not send anything */
+        return -1;
+    }
+
+    const char* chunk;
+    size_t len;
+    bool body = true;
+    if (conn->header_sent < conn->header_len) {
+        chunk = conn->buf + conn->header_sent;
+        len = conn->header_len - conn->header_sent;
+        body = false;
+    } else if (conn->data) {
+        if (conn->sent == conn->size) {
+            return 0;
+        }
+        chunk = conn->data + conn->sent;
+        len = MIN(conn->size - conn->sent, SUPERCAR_HTTP_BUFSIZE);
+    } else {
+        if (conn->chunk_sent == conn->chunk_len) {
+            ssize_t read_bytes = read(conn->fd, conn->buf, SUPERCAR_HTTP_BUFSIZE);
+            if (read_bytes <= 0) {
+                return read_bytes < 0 ? -1 : 0;
+            }
+            conn->chunk_len = read_bytes;
+            conn->chunk_sent = 0;
+        }
+        chunk = conn->buf + conn->chunk_sent;
+        len = conn->chunk_len - conn->chunk_sent;
+    }
+
+    uint32_t wait = supercar_coex_http_reserve(len);
+    if (wait) {
+        *wait_us = wait;
+        return 1;
+    }
+    int ret = httpd_socket_send(conn->hd, conn->sockfd, chunk, len, 0);
+    if (ret <= 0 || ret > (int) len) {
+        /* Gone or stalled for the whole send timeout, the response is dropped.
+           Without a session the result is a positive esp_err_t, not a byte count */
+        return -1;
+    }
+    if (!body) {
+        conn->header_sent += ret;
+    } else {
+        conn->sent += ret;
+        if (!conn->data) {
+            conn->chunk_sent += ret;
+        }
+    }
+    return 1;
+}
+
+static void supercar_http_finish(http_conn_t* conn, bool ok)
+{
+    if (conn->fd >= 0) {
+        close(conn->fd);
+    }
+    supercar_coex_http_done();
+    uint32_t elapsed = esp_timer_get_time() - conn->start;
+
+    portENTER_CRITICAL(&http_lock);
+    conn->sending = false;
+    bool close_pending = conn->close_pending;
+    http_stats.active--;
+    if (ok) {
+        http_stats.async_sends++;
+        http_stats.async_bytes += conn->sent;
+        if (elapsed > http_stats.max_async_us) {
+            http_stats.max_async_us = elapsed;
+        }
+    } else {
+        http_stats.async_failed++;
+    }
+    portEXIT_CRITICAL(&http_lock);
+
+    if (close_pending) {
+        close(conn->sockfd);
+    } else if (!ok) {
+        /* The client got a truncated body, it must not reuse the connection */
+        httpd_sess_trigger_close(conn->hd, conn->sockfd);
+    }
+    supercar_http_unref(conn);
+}
+
+/* Writes the large responses, one buffer of each in turn so the downloads share the link */
+static void supercar_http_thread(void* arg)
+{
+    http_conn_t* active[HTTP_CONNS];
+    int count = 0;
+    TickType_t wait = 0;
+    while (1) {
+        http_conn_t* conn;
+        /* Only block when there is nothing left to send, or until the driving budget comes back */
+        TickType_t timeout = count == 0 ? portMAX_DELAY : wait;
+        while (xQueueReceive(http_queue, &conn, timeout) == pdTRUE) {
+            timeout = 0;
+            active[count++] = conn;
+            portENTER_CRITICAL(&http_lock);
+            if (++http_stats.active > http_stats.max_active) {
+                http_stats.max_active = http_stats.active;
+            }
+            portEXIT_CRITICAL(&http_lock);
+        }
+        uint32_t wait_us = 0;
+        for (int i = 0; i < count;) {
+            int ret = supercar_http_step(active[i], &wait_us);
+            if (ret > 0) {
+                i++;
+                continue;
+            }
+            supercar_http_finish(active[i], ret == 0);
+            active[i] = active[--count];
+        }
+        wait = wait_us ? MAX(pdMS_TO_TICKS(wait_us / 1000), 1) : 0;
+    }
+}
+
+esp_err_t supercar_http_start(void)
+{
+    http_queue = xQueueCreate(HTTP_CONNS, sizeof(http_conn_t*));
+    if (http_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (supercar_task_create(SUPERCAR_TASK_HTTP_SEND, supercar_http_thread, NULL, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Could not start the sender task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void supercar_http_serialize(supercar_json_t* node)
+{
+    portENTER_CRITICAL(&http_lock);
+    http_stats_t stats = http_stats;
+    portEXIT_CRITICAL(&http_lock);
+    supercar_json_int(node, "buffers", HTTP_CONNS);
+    supercar_json_int(node, "buffer_size", SUPERCAR_HTTP_BUFSIZE);
+    supercar_json_int(node, "in_use", stats.in_use);
+    supercar_json_int(node, "max_in_use", stats.max_in_use);
+    supercar_json_int(node, "exhausted", stats.exhausted);
+    supercar_json_int(node, "async_sends", stats.async_sends);
+    supercar_json_int(node, "async_failed", stats.async_failed);
+    supercar_json_int(node, "async_bytes", stats.async_bytes);
+    supercar_json_int(node, "max_async_us", stats.max_async_us);
+    supercar_json_int(node, "max_concurrent", stats.max_active);
+}
@@ -0,0 +1,50 @@
+#ifndef _SUPERCAR_HTTP_H_
+#define _SUPERCAR_HTTP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_http_server.h"
+#include "supercar_json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUPERCAR_HTTP_BUFSIZE CONFIG_SUPERCAR_HTTP_BUFFER_SIZE
+
+/**
+ * @brief Buffer of the connection of the request, taken from the pool on its first use and kept until it closes
+ *
+ * @return NULL when every buffer of the pool is in use
+ */
+char* supercar_http_buffer(httpd_req_t* req);
+
+/**
+ * @brief Hand the response over to the sender task, the handler returns without sending anything
+ *
+ * The status line and headers must already be in the connection buffer. The body is either the mapped data,
+ * or the file which is read through the connection buffer and closed once sent.
+ *
+ * @return ESP_ERR_NO_MEM without connection buffer, the caller has to answer by itself
+ */
+esp_err_t supercar_http_send_async(httpd_req_t* req, size_t header_len, const void* data, size_t size, int fd);
+
+/**
+ * @brief Called from the session close callback
+ *
+ * @return false while the sender task still writes on the socket, it then closes it itself
+ */
+bool supercar_http_session_closed(int sockfd);
+
+/**
+ * @brief Start the sender task
+ */
+esp_err_t supercar_http_start(void);
+
+void supercar_http_serialize(supercar_json_t* node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
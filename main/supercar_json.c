@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "supercar_json.h"
+
+void supercar_json_init(supercar_json_t* json, char* buf, size_t size, supercar_json_flush_t flush, void* ctx)
+{
+    memset(json, 0, sizeof(*json));
+    json->buf = buf;
+    // Room for the terminating NUL when the document stays in the buffer
+    json->size = flush ? size : size - 1;
+    json->flush = flush;
+    json->ctx = ctx;
+    json->first[0] = true;
+    buf[0] = '\0';
+}
+
+static void supercar_json_write(supercar_json_t* json, const char* data, size_t len)
+{
+    while (len && json->err == ESP_OK) {
+        size_t room = json->size - json->len;
+        if (!room) {
+            if (!json->flush) {
+                json->err = ESP_ERR_NO_MEM;
+                return;
+            }
+            json->err = json->flush(json->ctx, json->buf, json->len);
+            json->len = 0;
+            continue;
+        }
+        size_t n = len < room ? len : room;
+        memcpy(json->buf + json->len, data, n);
+        json->len += n;
+        json->total += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void supercar_json_char(supercar_json_t* json, char c)
+{
+    supercar_json_write(json, &c, 1);
+}
+
+static void supercar_json_quoted(supercar_json_t* json, const char* value)
+{
+    supercar_json_char(json, '"');
+    const char* run = value;
+    for (const char* p = value; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        supercar_json_write(json, run, p - run);
+        char escaped[7];
+        switch (c) {
+        case '"':  strcpy(escaped, "\\\""); break;
+        case '\\': strcpy(escaped, "\\\\"); break;
+        case '\n': strcpy(escaped, "\\n"); break;
+        case '\r': strcpy(escaped, "\\r"); break;
+        case '\t': strcpy(escaped, "\\t"); break;
+        default:   snprintf(escaped, sizeof(escaped), "\\u%04x", c); break;
+        }
+        supercar_json_write(json, escaped, strlen(escaped));
+        run = p + 1;
+    }
+    supercar_json_write(json, run, strlen(run));
+    supercar_json_char(json, '"');
+}
+
+void supercar_json_select(supercar_json_t* json, const supercar_json_fields_t* fields)
+{
+    json->fields = fields && fields->count ? fields : NULL;
+}
+
+/* Leaves the path of the member in json->path */
+bool supercar_json_wants(supercar_json_t* json, const char* key)
+{
+    if (json->skip)
+        return false;
+    if (!json->fields)
+        return true;
+    size_t len = json->bases[json->depth];
+    if (key) {
+        if (len && len + 1 < sizeof(json->path))
+            json->path[len++] = '.';
+        len += strlcpy(json->path + len, key, sizeof(json->path) - len);
+        if (len >= sizeof(json->path))
+            len = sizeof(json->path) - 1;
+    }
+    json->path[len] = '\0';
+    json->path_len = len;
+    if (len == 0)
+        return true;
+    for (int i = 0; i < json->fields->count; i++) {
+        const char* field = json->fields->paths[i];
+        size_t n = strlen(field);
+        size_t common = n < len ? n : len;
+        if (strncmp(field, json->path, common))
+            continue;
+        // Same member, one of its parents or one of its children
+        if (n == len || (n < len && json->path[n] == '.') || (n > len && field[len] == '.'))
+            return true;
+    }
+    return false;
+}
+
+esp_err_t supercar_json_fields_parse(supercar_json_fields_t* fields, char* list)
+{
+    fields->count = 0;
+    char* save;
+    for (char* path = strtok_r(list, ",", &save); path; path = strtok_r(NULL, ",", &save)) {
+        if (fields->count == SUPERCAR_JSON_MAX_FIELDS)
+            return ESP_ERR_INVALID_SIZE;
+        fields->paths[fields->count++] = path;
+    }
+    return ESP_OK;
+}
+
+/* Separator and key of the next member, false if the member is not selected */
+static bool supercar_json_key(supercar_json_t* json, const char* key)
+{
+    if (!supercar_json_wants(json, key))
+        return false;
+    if (!json->first[json->depth])
+        supercar_json_char(json, ',');
+    json->first[json->depth] = false;
+    if (key) {
+        supercar_json_quoted(json, key);
+        supercar_json_char(json, ':');
+    }
+    return true;
+}
+
+static void supercar_json_open(supercar_json_t* json, const char* key, char c)
+{
+    if (!supercar_json_key(json, key)) {
+        json->skip++;
+        return;
+    }
+    supercar_json_char(json, c);
+    if (json->depth + 1 >= SUPERCAR_JSON_MAX_DEPTH) {
+        json->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    json->first[++json->depth] = true;
+    json->bases[json->depth] = json->path_len;
+}
+
+static void supercar_json_close(supercar_json_t* json, char c)
+{
+    if (json->skip) {
+        json->skip--;
+        return;
+    }
+    supercar_json_char(json, c);
+    if (json->depth > 0)
+        json->depth--;
+}
+
+void supercar_json_begin_object(supercar_json_t* json, const char* key)
+{
+    supercar_json_open(json, key, '{');
+}
+
+void supercar_json_end_object(supercar_json_t* json)
+{
+    supercar_json_close(json, '}');
+}
+
+void supercar_json_begin_array(supercar_json_t* json, const char* key)
+{
+    supercar_json_open(json, key, '[');
+}
+
+void supercar_json_end_array(supercar_json_t* json)
+{
+    supercar_json_close(json, ']');
+}
+
+void supercar_json_int(supercar_json_t* json, const char* key, int64_t value)
+{
+    if (!supercar_json_key(json, key))
+        return;
+    char digits[21];
+    char* p = digits + sizeof(digits);
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        *--p = '-';
+    supercar_json_write(json, p, digits + sizeof(digits) - p);
+}
+
+void supercar_json_number(supercar_json_t* json, const char* key, double value)
+{
+    // Only in range may the value be converted, NaN or 1e300 as int64_t is undefined
+    if (isfinite(value) && fabs(value) < 1e15 && value == (int64_t)value) {
+        supercar_json_int(json, key, (int64_t)value);
+        return;
+    }
+    if (!supercar_json_key(json, key))
+        return;
+    if (!isfinite(value)) {
+        // Same as cJSON
+        supercar_json_write(json, "null", 4);
+        return;
+    }
+    char number[24];
+    int len = snprintf(number, sizeof(number), "%.7g", value);
+    supercar_json_write(json, number, len);
+}
+
+void supercar_json_bool(supercar_json_t* json, const char* key, bool value)
+{
+    if (!supercar_json_key(json, key))
+        return;
+    if (value)
+        supercar_json_write(json, "true", 4);
+    else
+        supercar_json_write(json, "false", 5);
+}
+
+void supercar_json_string(supercar_json_t* json, const char* key, const char* value)
+{
+    if (!supercar_json_key(json, key))
+        return;
+    if (value)
+        supercar_json_quoted(json, value);
+    else
+        supercar_json_write(json, "null", 4);
+}
+
+esp_err_t supercar_json_finish(supercar_json_t* json)
+{
+    if (json->err == ESP_OK && json->flush && json->len) {
+        json->err = json->flush(json->ctx, json->buf, json->len);
+        json->len = 0;
+    }
+    if (!json->flush)
+        json->buf[json->len] = '\0';
+    return json->err;
+}
+
+enum {
+    EXPECT_VALUE,
+    EXPECT_VALUE_OR_END,        // After '['
+    EXPECT_KEY,
+    EXPECT_KEY_OR_END,          // After '{'
+    EXPECT_COLON,
+    EXPECT_COMMA_OR_END,
+    EXPECT_NOTHING,             // The root value is complete
+};
+
+enum {
+    LEX_NONE,
+    LEX_STRING,
+    LEX_ESCAPE,
+    LEX_UNICODE,
+    LEX_NUMBER,
+    LEX_LITERAL,
+};
+
+void supercar_json_parser_init(supercar_json_parser_t* parser, supercar_json_field_t field, void* ctx)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->field = field;
+    parser->ctx = ctx;
+    parser->expect = EXPECT_VALUE;
+    parser->lex = LEX_NONE;
+}
+
+static esp_err_t supercar_json_token_add(supercar_json_parser_t* parser, char c)
+{
+    if (parser->token_len + 1 >= sizeof(parser->token))
+        return ESP_ERR_INVALID_SIZE;
+    parser->token[parser->token_len++] = c;
+    return ESP_OK;
+}
+
+static void supercar_json_token_start(supercar_json_parser_t* parser, uint8_t lex)
+{
+    parser->lex = lex;
+    parser->token_len = 0;
+}
+
+static void supercar_json_after_value(supercar_json_parser_t* parser)
+{
+    parser->expect = parser->depth ? EXPECT_COMMA_OR_END : EXPECT_NOTHING;
+}
+
+static esp_err_t supercar_json_scalar(supercar_json_parser_t* parser, const supercar_json_value_t* value)
+{
+    supercar_json_after_value(parser);
+    return parser->field(parser->ctx, parser->path, value);
+}
+
+/* The member name replaces the previous one at the end of the path */
+static esp_err_t supercar_json_member(supercar_json_parser_t* parser)
+{
+    size_t base = parser->bases[parser->depth - 1];
+    size_t sep = base ? 1 : 0;
+    if (base + sep + parser->token_len >= sizeof(parser->path))
+        return ESP_ERR_INVALID_SIZE;
+    parser->path_len = base;
+    if (sep)
+        parser->path[parser->path_len++] = '.';
+    memcpy(parser->path + parser->path_len, parser->token, parser->token_len);
+    parser->path_len += parser->token_len;
+    parser->path[parser->path_len] = '\0';
+    parser->expect = EXPECT_COLON;
+    return ESP_OK;
+}
+
+static esp_err_t supercar_json_enter(supercar_json_parser_t* parser, char c)
+{
+    if (parser->depth >= SUPERCAR_JSON_MAX_DEPTH)
+        return ESP_ERR_INVALID_SIZE;
+    parser->containers[parser->depth] = c;
+    parser->bases[parser->depth] = parser->path_len;
+    parser->depth++;
+    parser->expect = c == '{' ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+    return ESP_OK;
+}
+
+static esp_err_t supercar_json_leave(supercar_json_parser_t* parser, char c)
+{
+    if (parser->containers[parser->depth - 1] != (c == '}' ? '{' : '['))
+        return ESP_ERR_INVALID_ARG;
+    parser->depth--;
+    parser->path_len = parser->bases[parser->depth];
+    parser->path[parser->path_len] = '\0';
+    supercar_json_after_value(parser);
+    return ESP_OK;
+}
+
+static esp_err_t supercar_json_string_end(supercar_json_parser_t* parser)
+{
+    parser->lex = LEX_NONE;
+    parser->token[parser->token_len] = '\0';
+    if (parser->key)
+        return supercar_json_member(parser);
+    supercar_json_value_t value = { .type = SUPERCAR_JSON_STRING, .string = parser->token };
+    return supercar_json_scalar(parser, &value);
+}
+
+static esp_err_t supercar_json_number_end(supercar_json_parser_t* parser)
+{
+    parser->lex = LEX_NONE;
+    parser->token[parser->token_len] = '\0';
+    char* end;
+    supercar_json_value_t value = { .type = SUPERCAR_JSON_NUMBER, .number = strtod(parser->token, &end) };
+    if (end != parser->token + parser->token_len)
+        return ESP_ERR_INVALID_ARG;
+    return supercar_json_scalar(parser, &value);
+}
+
+static esp_err_t supercar_json_literal_end(supercar_json_parser_t* parser)
+{
+    parser->lex = LEX_NONE;
+    parser->token[parser->token_len] = '\0';
+    supercar_json_value_t value = { .type = SUPERCAR_JSON_NULL };
+    if (!strcmp(parser->token, "true") || !strcmp(parser->token, "false")) {
+        value.type = SUPERCAR_JSON_BOOL;
+        value.boolean = parser->token[0] == 't';
+    } else if (strcmp(parser->token, "null")) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return supercar_json_scalar(parser, &value);
+}
+
+/* UTF-8 encoding of a \u escape, surrogate pairs are kept as two code points */
+static esp_err_t supercar_json_unicode_end(supercar_json_parser_t* parser)
+{
+    uint32_t cp = parser->unicode;
+    esp_err_t err;
+    parser->lex = LEX_STRING;
+    if (cp < 0x80)
+        return supercar_json_token_add(parser, cp);
+    if (cp < 0x800) {
+        err = supercar_json_token_add(parser, 0xc0 | (cp >> 6));
+    } else {
+        err = supercar_json_token_add(parser, 0xe0 | (cp >> 12));
+        if (err == ESP_OK)
+            err = supercar_json_token_add(parser, 0x80 | ((cp >> 6) & 0x3f));
+    }
+    if (err == ESP_OK)
+        err = supercar_json_token_add(parser, 0x80 | (cp & 0x3f));
+    return err;
+}
+
+static esp_err_t supercar_json_escape(supercar_json_parser_t* parser, char c)
+{
+    static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+    parser->lex = LEX_STRING;
+    if (c == 'u') {
+        parser->lex = LEX_UNICODE;
+        parser->unicode = 0;
+        parser->unicode_digits = 0;
+        return ESP_OK;
+    }
+    for (const char* e = escapes; *e; e += 2) {
+        if (*e == c)
+            return supercar_json_token_add(parser, e[1]);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t supercar_json_hex(supercar_json_parser_t* parser, char c)
+{
+    int digit;
+    if (c >= '0' && c <= '9')
+        digit = c - '0';
+    else if (c >= 'a' && c <= 'f')
+        digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+        digit = c - 'A' + 10;
+    else
+        return ESP_ERR_INVALID_ARG;
+    parser->unicode = parser->unicode << 4 | digit;
+    if (++parser->unicode_digits == 4)
+        return supercar_json_unicode_end(parser);
+    return ESP_OK;
+}
+
+/* Between tokens */
+static esp_err_t supercar_json_structure(supercar_json_parser_t* parser, char c)
+{
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        return ESP_OK;
+
+    switch (parser->expect) {
+    case EXPECT_VALUE_OR_END:
+        if (c == ']')
+            return supercar_json_leave(parser, c);
+        // fall through
+    case EXPECT_VALUE:
+        if (c == '{' || c == '[')
+            return supercar_json_enter(parser, c);
+        if (c == '"') {
+            parser->key = false;
+            supercar_json_token_start(parser, LEX_STRING);
+            return ESP_OK;
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            supercar_json_token_start(parser, LEX_NUMBER);
+            return supercar_json_token_add(parser, c);
+        }
+        if (c == 't' || c == 'f' || c == 'n') {
+            supercar_json_token_start(parser, LEX_LITERAL);
+            return supercar_json_token_add(parser, c);
+        }
+        return ESP_ERR_INVALID_ARG;
+    case EXPECT_KEY_OR_END:
+        if (c == '}')
+            return supercar_json_leave(parser, c);
+        // fall through
+    case EXPECT_KEY:
+        if (c != '"')
+            return ESP_ERR_INVALID_ARG;
+        parser->key = true;
+        supercar_json_token_start(parser, LEX_STRING);
+        return ESP_OK;
+    case EXPECT_COLON:
+        if (c != ':')
+            return ESP_ERR_INVALID_ARG;
+        parser->expect = EXPECT_VALUE;
+        return ESP_OK;
+    case EXPECT_COMMA_OR_END:
+        if (c == '}' || c == ']')
+            return supercar_json_leave(parser, c);
+        if (c != ',')
+            return ESP_ERR_INVALID_ARG;
+        parser->expect = parser->containers[parser->depth - 1] == '{' ? EXPECT_KEY : EXPECT_VALUE;
+        return ESP_OK;
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+esp_err_t supercar_json_parser_feed(supercar_json_parser_t* parser, const char* data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && parser->err == ESP_OK) {
+        char c = data[i];
+        switch (parser->lex) {
+        case LEX_STRING:
+            if (c == '"')
+                parser->err = supercar_json_string_end(parser);
+            else if (c == '\\')
+                parser->lex = LEX_ESCAPE;
+            else if ((unsigned char)c < 0x20)
+                parser->err = ESP_ERR_INVALID_ARG;
+            else
+                parser->err = supercar_json_token_add(parser, c);
+            break;
+        case LEX_ESCAPE:
+            parser->err = supercar_json_escape(parser, c);
+            break;
+        case LEX_UNICODE:
+            parser->err = supercar_json_hex(parser, c);
+            break;
+        case LEX_NUMBER:
+            if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                parser->err = supercar_json_token_add(parser, c);
+                break;
+            }
+            // The character after the number is read again as structure
+            parser->err = supercar_json_number_end(parser);
+            continue;
+        case LEX_LITERAL:
+            if (c >= 'a' && c <= 'z') {
+                parser->err = supercar_json_token_add(parser, c);
+                break;
+            }
+            parser->err = supercar_json_literal_end(parser);
+            continue;
+        default:
+            parser->err = supercar_json_structure(parser, c);
+            break;
+        }
+        if (parser->err == ESP_OK)
+            i++;
+    }
+    parser->offset += i;
+    return parser->err;
+}
+
+esp_err_t supercar_json_parser_finish(supercar_json_parser_t* parser)
+{
+    if (parser->err != ESP_OK)
+        return parser->err;
+    if (parser->lex == LEX_NUMBER)
+        parser->err = supercar_json_number_end(parser);
+    else if (parser->lex == LEX_LITERAL)
+        parser->err = supercar_json_literal_end(parser);
+    if (parser->err == ESP_OK && (parser->lex != LEX_NONE || parser->expect != EXPECT_NOTHING))
+        parser->err = ESP_ERR_INVALID_STATE;
+    return parser->err;
+}
+
+bool supercar_json_get_int(const supercar_json_value_t* value, int min, int max, int* number)
+{
+    // Checked on the double, converting one out of the int range is undefined
+    if (value->type != SUPERCAR_JSON_NUMBER || !(value->number >= min && value->number <= max)
+        || value->number != floor(value->number))
+        return false;
+    *number = (int) value->number;
+    return true;
+}
@@ -0,0 +1,154 @@
+#ifndef _SUPERCAR_JSON_H_
+#define _SUPERCAR_JSON_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUPERCAR_JSON_MAX_DEPTH 8
+#define SUPERCAR_JSON_MAX_PATH 64
+#define SUPERCAR_JSON_MAX_TOKEN 64
+#define SUPERCAR_JSON_MAX_FIELDS 8
+
+/**
+ * @brief Called with the buffered output when the buffer is full and when the document is finished
+ */
+typedef esp_err_t (*supercar_json_flush_t)(void* ctx, const char* data, size_t len);
+
+/* Dotted member paths to keep in a document, the members above and below them are kept too */
+typedef struct {
+    int count;
+    const char* paths[SUPERCAR_JSON_MAX_FIELDS];
+} supercar_json_fields_t;
+
+/* Streaming JSON writer, compact output straight into a caller provided buffer */
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t len;
+    supercar_json_flush_t flush;        // NULL to write the whole document in the buffer
+    void* ctx;
+    size_t total;                       // Bytes written so far, flushed ones included
+    int depth;
+    bool first[SUPERCAR_JSON_MAX_DEPTH];
+    esp_err_t err;                      // First error, the rest of the document is dropped
+    const supercar_json_fields_t* fields;   // NULL for the whole document
+    int skip;                           // Depth inside a container left out of the selection
+    char path[SUPERCAR_JSON_MAX_PATH];
+    size_t path_len;
+    uint8_t bases[SUPERCAR_JSON_MAX_DEPTH];
+} supercar_json_t;
+
+/**
+ * @brief Start a document
+ *
+ * Without flush callback the output is NUL terminated and ESP_ERR_NO_MEM is reported if it does not fit.
+ */
+void supercar_json_init(supercar_json_t* json, char* buf, size_t size, supercar_json_flush_t flush, void* ctx);
+
+/**
+ * @brief Only write the selected members from now on
+ */
+void supercar_json_select(supercar_json_t* json, const supercar_json_fields_t* fields);
+
+/**
+ * @brief Whether the member would be written, for the serializers to skip the work on the others
+ */
+bool supercar_json_wants(supercar_json_t* json, const char* key);
+
+/**
+ * @brief Split a comma separated list of dotted paths, in place
+ *
+ * @return ESP_ERR_INVALID_SIZE if there are more than SUPERCAR_JSON_MAX_FIELDS paths
+ */
+esp_err_t supercar_json_fields_parse(supercar_json_fields_t* fields, char* list);
+
+/* key is NULL for the root and for array elements */
+void supercar_json_begin_object(supercar_json_t* json, const char* key);
+void supercar_json_end_object(supercar_json_t* json);
+void supercar_json_begin_array(supercar_json_t* json, const char* key);
+void supercar_json_end_array(supercar_json_t* json);
+
+void supercar_json_int(supercar_json_t* json, const char* key, int64_t value);
+void supercar_json_number(supercar_json_t* json, const char* key, double value);
+void supercar_json_bool(supercar_json_t* json, const char* key, bool value);
+void supercar_json_string(supercar_json_t* json, const char* key, const char* value);
+
+/**
+ * @brief Flush what is left in the buffer
+ *
+ * @return the first error met while writing
+ */
+esp_err_t supercar_json_finish(supercar_json_t* json);
+
+typedef enum {
+    SUPERCAR_JSON_NULL,
+    SUPERCAR_JSON_BOOL,
+    SUPERCAR_JSON_NUMBER,
+    SUPERCAR_JSON_STRING,
+} supercar_json_type_t;
+
+typedef struct {
+    supercar_json_type_t type;
+    bool boolean;
+    double number;
+    const char* string;
+} supercar_json_value_t;
+
+/**
+ * @brief Called by the parser for every scalar, path is the dotted list of member names ("hid_task.priority")
+ *
+ * An error stops the parser.
+ */
+typedef esp_err_t (*supercar_json_field_t)(void* ctx, const char* path, const supercar_json_value_t* value);
+
+/* Incremental JSON parser, fed with the body as it arrives and never holding more than one token */
+typedef struct {
+    supercar_json_field_t field;
+    void* ctx;
+    uint8_t expect;
+    uint8_t lex;
+    bool key;                               // The string being read is a member name
+    int depth;
+    char containers[SUPERCAR_JSON_MAX_DEPTH];
+    uint8_t bases[SUPERCAR_JSON_MAX_DEPTH]; // Path length of each open container
+    char path[SUPERCAR_JSON_MAX_PATH];
+    size_t path_len;
+    char token[SUPERCAR_JSON_MAX_TOKEN];
+    size_t token_len;
+    uint32_t unicode;
+    int unicode_digits;
+    size_t offset;                          // Bytes consumed, points at the faulty one after an error
+    esp_err_t err;
+} supercar_json_parser_t;
+
+void supercar_json_parser_init(supercar_json_parser_t* parser, supercar_json_field_t field, void* ctx);
+
+/**
+ * @brief Parse the next part of the document, the parts can be cut anywhere
+ *
+ * @return ESP_ERR_INVALID_ARG on a syntax error, ESP_ERR_INVALID_SIZE if a name, a string or the nesting
+ *         goes over the parser limits, or the error returned by the field callback
+ */
+esp_err_t supercar_json_parser_feed(supercar_json_parser_t* parser, const char* data, size_t len);
+
+/**
+ * @brief End of the document, ESP_ERR_INVALID_STATE if it is incomplete
+ */
+esp_err_t supercar_json_parser_finish(supercar_json_parser_t* parser);
+
+/**
+ * @brief Get a parsed number as an int, false for another type, a fraction or a value out of [min, max]
+ */
+bool supercar_json_get_int(const supercar_json_value_t* value, int min, int max, int* number);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -14,12 +14,14 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "driver/mcpwm.h"
 
@@ -31,6 +33,16 @@
 #include "math.h"
 #include "supercar_sensor.h"
 #include "supercar_config.h"
+#include "supercar_coex.h"
+#include "supercar_sched.h"
+#include "supercar_snapshot.h"
+#include "supercar_drive.h"
+#include "supercar_arbiter.h"
+#include "supercar_boot.h"
+#include "supercar_rtc.h"
+#include "supercar_persist.h"
+#include "supercar_wifi.h"
+#include "nvs_flash.h"
 
 #ifndef min
 #define min(a,b) (((a) < (b)) ? (a) : (b))
@@ -40,7 +52,7 @@
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 #endif
 
-#define DEBOUNCE(var, val) (old_xbox.var != xbox.var && xbox.var == val)
+#define PRESSED(button) (!(old_gamepad.buttons & (button)) && (gamepad.buttons & (button)))
 
 static supercar_t supercar;
 
@@ -49,33 +61,39 @@ const char* STEERING_MOTOR_NAME = "STEERING";
 
 static const char* TAG = "CAR";
 
+#define EVENT_SET_LENGTH 64
+// Bounds the time spent in the input slot of each frame, the rest waits for the next frame
+#define INPUT_EVENTS_PER_FRAME 4
+
+static supercar_event_stats_t event_stats[SUPERCAR_EVENT_MAX];
+static supercar_frame_stats_t frame_stats;
+static portMUX_TYPE event_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
 static void supercar_increase_max_speed(supercar_t* car){
-    supercar_set_max_speed(car, car->cfg.max_speed + car->cfg.delta_speed);
+    supercar_set_max_speed(car, car->max_speed + car->profile->delta_speed);
 }
 
 static void supercar_decrease_max_speed(supercar_t* car){
-    supercar_set_max_speed(car, car->cfg.max_speed - car->cfg.delta_speed);
+    supercar_set_max_speed(car, car->max_speed - car->profile->delta_speed);
 }
 
-static void supercar_read_mode(supercar_t* car){
-    supercar_set_mode(car, gpio_get_level(car->cfg.mode_input_pin) ? MOTION : SWAY);
+static void supercar_cycle_profile(supercar_t* car, int step){
+    supercar_select_profile(car, (car->profile_id + SUPERCAR_PROFILE_MAX + step) % SUPERCAR_PROFILE_MAX);
 }
 
-static void supercar_set_control_type(supercar_t* car, supercar_control_type_t control_type){
-    supercar.control_type = control_type;
-    if(control_type == LOCAL)
-        supercar_read_mode(car);
+void supercar_read_mode(supercar_t* car){
+    supercar_set_mode(car, gpio_get_level(car->cfg.mode_input_pin) ? MOTION : SWAY);
 }
 
 static void supercar_toggle_control_type(supercar_t* car){
-    supercar_set_control_type(car, car->control_type == LOCAL ? REMOTE : LOCAL);
-    ESP_LOGI(TAG, "Toggling control mode to %s", supercar.control_type == LOCAL ?  "LOCAL" : "REMOTE");
+    supercar_dispatch(car, SUPERCAR_FSM_TOGGLE_CONTROL, 0);
+    ESP_LOGI(TAG, "Toggling control mode to %s", supercar_get_control_type(car) == LOCAL ?  "LOCAL" : "REMOTE");
 }
 
 static void supercar_apply_mode(supercar_t* car){
     supercar_mode_t current_mode = supercar_get_mode(car);
     ESP_LOGD(TAG, "Applying mode: %s", current_mode == SWAY ? "SWAY" : "MOTION");
-    gpio_set_level(car->cfg.mode_output_pin, current_mode == SWAY ? 0 : 1);
+    car->frame.mode_level = current_mode == SWAY ? 0 : 1;
     car->applied_mode = current_mode;
 }
 
@@ -92,167 +110,382 @@ static void supercar_check_mode(supercar_t* car){
     }
 }
 
-static void supercar_remote_input_thread(void *arg)
+/* Source events of supercar_arbiter.def */
+typedef struct {
+    supercar_fsm_event_t forward;
+    supercar_fsm_event_t backward;
+    supercar_fsm_event_t release;
+} supercar_source_events_t;
+
+static const supercar_source_events_t supercar_source_events[SUPERCAR_SOURCE_MAX] = {
+#define SUPERCAR_SOURCE(id, name, priority, timeout_ms, fwd, bwd, rel) \
+    [SUPERCAR_SOURCE_##id] = { .forward = SUPERCAR_FSM_##fwd, .backward = SUPERCAR_FSM_##bwd, .release = SUPERCAR_FSM_##rel },
+#include "supercar_arbiter.def"
+};
+
+static int supercar_dpad_steer(uint8_t dpad)
 {
-    xbox_input_event_t old_ev = {0};
-    xbox_input_event_t ev;
-
-    while (1) {
-        if (xQueueReceive(supercar.remote_events, &ev, 1000/portTICK_PERIOD_MS)) {
-            if(ev.type != ESP_HIDH_INPUT_EVENT)
-                continue;
-
-            xSemaphoreTake(supercar.mutex, portMAX_DELAY);
-            supercar_check_mode(&supercar);
-            if(ev.type == ESP_HIDH_CLOSE_EVENT){
-                ESP_LOGI(TAG, "Gamepad disconnected, stopping car…");
-                supercar_turn(&supercar, STEER_NONE);
-                supercar_stop(&supercar);
-                supercar_set_mode(&supercar, LOCAL);
-                xSemaphoreGive(supercar.mutex);
-                continue;
-            }
+    switch(dpad){
+    case DPAD_LEFT: case DPAD_UP_LEFT: case DPAD_DOWN_LEFT:
+        return -1;
+    case DPAD_RIGHT: case DPAD_UP_RIGHT: case DPAD_DOWN_RIGHT:
+        return 1;
+    default:
+        return 0;
+    }
+}
 
-            xbox_input_report_t xbox = ev.report;
-            xbox_input_report_t old_xbox = old_ev.report;
-                
-            if(DEBOUNCE(y, 1)){
-                supercar_toggle_control_type(&supercar);
-            }
-            if(DEBOUNCE(b, 1)){
-                supercar_reverse(&supercar);
-            }
-            if(DEBOUNCE(a, 1)){
-                supercar_reverse_mode(&supercar);
-            }
-            if(xbox.lt || xbox.rt){
-                supercar.control_type = REMOTE;
-                if(xbox.lt){
-                    supercar_throttle(&supercar, -xbox.lt / 1023.0f * 100.0f);
-                }
-                if(xbox.rt){
-                    supercar_throttle(&supercar, xbox.rt / 1023.0f * 100.0f);
-                }
-            }
+static void supercar_handle_remote_event(gamepad_input_event_t* ev)
+{
+    // Per source, the button edges of the gamepad are not mixed up with the web commands
+    static gamepad_input_event_t old_events[REMOTE_SOURCE_MAX] = {0};
+    remote_source_t remote = ev->source < REMOTE_SOURCE_MAX ? ev->source : REMOTE_SOURCE_GAMEPAD;
+    gamepad_input_event_t* old_ev = &old_events[remote];
+    supercar_source_t source = remote == REMOTE_SOURCE_WEB ? SUPERCAR_SOURCE_WEB : SUPERCAR_SOURCE_GAMEPAD;
+
+    if(ev->type == ESP_HIDH_CLOSE_EVENT){
+        ESP_LOGI(TAG, "Gamepad disconnected, stopping car…");
+        supercar_arbiter_release(source, SUPERCAR_AXIS_THROTTLE);
+        supercar_arbiter_release(source, SUPERCAR_AXIS_STEER);
+        supercar_dispatch(&supercar, SUPERCAR_FSM_GAMEPAD_LOST, 0);
+        memset(old_ev, 0, sizeof(*old_ev));
+        return;
+    }
+    if(ev->type != ESP_HIDH_INPUT_EVENT)
+        return;
 
-            if(DEBOUNCE(dpad, DPAD_LEFT)){
-                supercar_turn(&supercar, STEER_LEFT);
-            }
+    supercar_check_mode(&supercar);
 
-            if(DEBOUNCE(dpad, DPAD_RIGHT)){
-                supercar_turn(&supercar, STEER_RIGHT);
-            }
+    gamepad_state_t gamepad = ev->report;
+    gamepad_state_t old_gamepad = old_ev->report;
+        
+    if(PRESSED(GAMEPAD_BUTTON_Y)){
+        supercar_toggle_control_type(&supercar);
+    }
+    if(PRESSED(GAMEPAD_BUTTON_B)){
+        supercar_dispatch(&supercar, SUPERCAR_FSM_REVERSE, 0);
+    }
+    if(PRESSED(GAMEPAD_BUTTON_A)){
+        supercar_reverse_mode(&supercar);
+    }
+    // With select held, the bumpers go through the driver profiles instead of the speeds
+    bool select = gamepad.buttons & GAMEPAD_BUTTON_SELECT;
+    if(PRESSED(GAMEPAD_BUTTON_LB)){
+        if(select)
+            supercar_cycle_profile(&supercar, -1);
+        else
+            supercar_decrease_max_speed(&supercar);
+    }
+    if(PRESSED(GAMEPAD_BUTTON_RB)){
+        if(select)
+            supercar_cycle_profile(&supercar, 1);
+        else
+            supercar_increase_max_speed(&supercar);
+    }
 
-            if(DEBOUNCE(lb, 1)){
-                supercar_decrease_max_speed(&supercar);
-            }
+    /* The axes go through the arbiter, which decides who drives the car at the next tick */
+    if(gamepad.lt || gamepad.rt){
+        // Right trigger wins when both are pressed
+        float speed = gamepad.rt ? gamepad.rt / 1023.0f * 100.0f : -gamepad.lt / 1023.0f * 100.0f;
+        supercar_arbiter_set(source, SUPERCAR_AXIS_THROTTLE, speed, ev->timestamp);
+    }else{
+        supercar_arbiter_release(source, SUPERCAR_AXIS_THROTTLE);
+    }
+    int steer = supercar_dpad_steer(gamepad.dpad);
+    if(steer){
+        supercar_arbiter_set(source, SUPERCAR_AXIS_STEER, steer, ev->timestamp);
+    }else{
+        supercar_arbiter_release(source, SUPERCAR_AXIS_STEER);
+    }
+    *old_ev = *ev;
+}
 
-            if(DEBOUNCE(rb, 1)){
-                supercar_increase_max_speed(&supercar);
-            }
+static void supercar_handle_pedal_event(button_event_t* ev)
+{
+    supercar_check_mode(&supercar);
+    /* Accelerator, the arbiter ignores it under remote control */
+    if (ev->pin == GPIO_ACCELERATOR_FWD_IN || ev->pin == GPIO_ACCELERATOR_BWD_IN) {
+        if(ev->event == BUTTON_DOWN){
+            supercar_direction_t direction = ev->pin == GPIO_ACCELERATOR_FWD_IN ? 
+            (supercar.reverse_direction ? DIRECTION_BACKWARD : DIRECTION_FORWARD) : (supercar.reverse_direction ? DIRECTION_FORWARD : DIRECTION_BACKWARD);
+            // All or nothing, the speed is the configured maximum
+            supercar_arbiter_set(SUPERCAR_SOURCE_PEDAL, SUPERCAR_AXIS_THROTTLE, direction == DIRECTION_FORWARD ? 100 : -100, esp_timer_get_time());
+        }
+        if(ev->event == BUTTON_UP){
+            supercar_arbiter_release(SUPERCAR_SOURCE_PEDAL, SUPERCAR_AXIS_THROTTLE);
+        }
+    }
 
-            if(xbox.dpad == DPAD_NONE && supercar.steering != STEER_NONE){
-                supercar_turn(&supercar, STEER_NONE);
-            }
+    if(supercar_get_control_type(&supercar) == LOCAL){
 
-            if(!xbox.lt && !xbox.rt && supercar.control_type == REMOTE){
-                //supercar.control_type = LOCAL;
-                supercar_stop(&supercar);
+        if(ev->pin == GPIO_MODE_SELECTOR_IN){
+            if(ev->event == BUTTON_DOWN){
+                // Sway
+                supercar_set_mode(&supercar, SWAY);
+            }
+            if(ev->event == BUTTON_UP){
+                supercar_set_mode(&supercar, MOTION);
             }
-            old_ev = ev;
-            xSemaphoreGive(supercar.mutex);
         }
     }
 }
 
-static void supercar_input_thread(void *arg)
+static void supercar_handle_distance_event(distance_sensor_report_t* ev)
 {
-    button_event_t ev;
-    while (1) {
-        if (xQueueReceive(supercar.button_events, &ev, 1000/portTICK_PERIOD_MS)) {
-            xSemaphoreTake(supercar.mutex, portMAX_DELAY);
-            supercar_check_mode(&supercar);
-            /* Accelerator */
-            if(supercar.control_type == LOCAL){
-                if (ev.pin == GPIO_ACCELERATOR_FWD_IN || ev.pin == GPIO_ACCELERATOR_BWD_IN) {
-                    if(ev.event == BUTTON_DOWN){
-                        supercar_direction_t direction = ev.pin == GPIO_ACCELERATOR_FWD_IN ? 
-                        (supercar.reverse_direction ? DIRECTION_BACKWARD : DIRECTION_FORWARD) : (supercar.reverse_direction ? DIRECTION_FORWARD : DIRECTION_BACKWARD);
-                        supercar_start(&supercar, direction);
-                    }
-                    if(ev.event == BUTTON_UP){
-                        supercar_stop(&supercar);
-                    }
-                }
-            
-
-                if(ev.pin == GPIO_MODE_SELECTOR_IN){
-                    if(ev.event == BUTTON_DOWN){
-                        // Sway
-                        supercar_set_mode(&supercar, SWAY);
-                    }
-                    if(ev.event == BUTTON_UP){
-                        supercar_set_mode(&supercar, MOTION);
-                    }
-                }
-            }
-            xSemaphoreGive(supercar.mutex);
-        }
+    supercar.distance = (supercar_distance_sensor_t){
+        .back_left = ev->d.distance,
+        .back_right = ev->c.distance,
+        .front_left = ev->a.distance,
+        .front_right = ev->b.distance
+    };
+}
+
+/* Towards an obstacle the throttle is held at 0, the car may still move away from it */
+static void supercar_check_obstacle(supercar_t* car, int64_t now)
+{
+    bool front = min(car->distance.front_left, car->distance.front_right) <= car->profile->distance_threshold_forward;
+    bool back = min(car->distance.back_left, car->distance.back_right) <= car->profile->distance_threshold_backward;
+    if(!front && !back){
+        supercar_arbiter_release(SUPERCAR_SOURCE_SAFETY, SUPERCAR_AXIS_THROTTLE);
+        return;
     }
+    supercar_arbiter_limit(SUPERCAR_SOURCE_SAFETY, SUPERCAR_AXIS_THROTTLE, back ? 0 : -100, front ? 0 : 100, now);
 }
 
-static void supercar_distance_sensor_thread(void *arg)
+static void supercar_arbitrate_throttle(supercar_t* car, const supercar_arbiter_output_t* out)
 {
-    distance_sensor_report_t ev;
-    while (1) {
-        if (xQueueReceive(supercar.distance_events, &ev, 1000/portTICK_PERIOD_MS)) {
-            xSemaphoreTake(supercar.mutex, portMAX_DELAY);
-            
-            supercar.distance = (supercar_distance_sensor_t){
-                .back_left = ev.d.distance,
-                .back_right = ev.c.distance,
-                .front_left = ev.a.distance,
-                .front_right = ev.b.distance
-            };
-
-            if(supercar.running == DIRECTION_NONE || supercar.control_type != LOCAL){
-                xSemaphoreGive(supercar.mutex);
-                continue;
-            }
+    const supercar_source_events_t* events = out->owner < SUPERCAR_SOURCE_MAX ? &supercar_source_events[out->owner] : NULL;
+    // A stop goes first, the car must not wait for the previous owner to be released
+    if(events && out->value == 0){
+        supercar_dispatch(car, events->release, 0);
+    }
+    if(out->previous != out->owner && out->previous < SUPERCAR_SOURCE_MAX){
+        supercar_dispatch(car, supercar_source_events[out->previous].release, 0);
+    }
+    if(events && out->value != 0){
+        supercar_dispatch(car, out->value > 0 ? events->forward : events->backward, out->value);
+    }
+}
 
-            uint8_t distance;
-            if(supercar.running == DIRECTION_FORWARD){
-                distance = min(supercar.distance.front_left, supercar.distance.front_right);
-            }else{
-                distance = min(supercar.distance.back_left, supercar.distance.back_right);
-            }
-            if(distance <= supercar.cfg.distance_threshold_forward){
-                ESP_LOGD(TAG, "Supercar emergency stop");
-                supercar_stop(&supercar);
-                ESP_LOGD(TAG, "Supercar emergency reverse");
-                supercar_reverse(&supercar);
-            }
+static void supercar_arbitrate_steering(supercar_t* car, const supercar_arbiter_output_t* out)
+{
+    supercar_turn(car, out->value < 0 ? STEER_LEFT : (out->value > 0 ? STEER_RIGHT : STEER_NONE));
+}
 
-            xSemaphoreGive(supercar.mutex);
-        }
+static void supercar_handle_config_event(supercar_config_event_t* ev)
+{
+    ev->apply(ev->staging, &supercar);
+}
+
+static void supercar_record_event(supercar_event_class_t event_class, int64_t queued, int64_t start)
+{
+    int64_t end = esp_timer_get_time();
+    uint32_t wait = start - queued;
+    uint32_t process = end - start;
+    supercar_event_stats_t* stats = &event_stats[event_class];
+    portENTER_CRITICAL(&event_stats_lock);
+    stats->count++;
+    stats->wait_total_us += wait;
+    stats->process_total_us += process;
+    if(wait > stats->wait_max_us)
+        stats->wait_max_us = wait;
+    if(process > stats->process_max_us)
+        stats->process_max_us = process;
+    portEXIT_CRITICAL(&event_stats_lock);
+}
+
+/**
+ * @brief Take the most important pending event and process it
+ *
+ * Each event queued in a member queue puts one token in the set, so one token taken from the set
+ * always matches one pending event, even if it is not in the queue the token points to.
+ */
+static void supercar_dispatch_event(int64_t woken)
+{
+    distance_sensor_report_t distance;
+    button_event_t button;
+    gamepad_input_event_t remote;
+    supercar_config_event_t config;
+
+    int64_t start = esp_timer_get_time();
+    if (xQueueReceive(supercar.distance_events, &distance, 0)) {
+        supercar_handle_distance_event(&distance);
+        supercar_commit(&supercar);
+        supercar_record_event(SUPERCAR_EVENT_SAFETY, distance.timestamp, start);
+    } else if (xQueueReceive(supercar.button_events, &button, 0)) {
+        supercar_handle_pedal_event(&button);
+        supercar_commit(&supercar);
+        // The button component does not timestamp its events, the wake up time is the closest we have
+        supercar_record_event(SUPERCAR_EVENT_PEDAL, woken, start);
+    } else if (xQueueReceive(supercar.remote_events, &remote, 0)) {
+        supercar_handle_remote_event(&remote);
+        supercar_commit(&supercar);
+        supercar_record_event(SUPERCAR_EVENT_REMOTE, remote.timestamp, start);
+    } else if (xQueueReceive(supercar.config_events, &config, 0)) {
+        supercar_handle_config_event(&config);
+        supercar_commit(&supercar);
+        // The caller reads the new values back from the snapshot, typically to save them
+        supercar_snapshot_publish(&supercar);
+        xTaskNotifyGive(config.caller);
+        supercar_record_event(SUPERCAR_EVENT_CONFIG, config.timestamp, start);
     }
 }
 
+/* Scheduler slots, they all run in the scheduler task which owns the car state */
+
+static void supercar_slot_input(void* arg)
+{
+    int64_t woken = esp_timer_get_time();
+    for (int i = 0; i < INPUT_EVENTS_PER_FRAME && xQueueSelectFromSet(supercar.event_set, 0); i++) {
+        supercar_dispatch_event(woken);
+    }
+}
+
+static void supercar_slot_safety(void* arg)
+{
+    supercar_check_obstacle(&supercar, esp_timer_get_time());
+}
+
+static void supercar_slot_arbitrate(void* arg)
+{
+    // The pedal is locked out while the parent has taken over
+    supercar_arbiter_enable(SUPERCAR_SOURCE_PEDAL, supercar_get_control_type(&supercar) == LOCAL);
+    supercar_arbiter_resolve(esp_timer_get_time());
+
+    const supercar_arbiter_output_t* throttle = supercar_arbiter_output(SUPERCAR_AXIS_THROTTLE);
+    const supercar_arbiter_output_t* steer = supercar_arbiter_output(SUPERCAR_AXIS_STEER);
+    if(throttle->changed){
+        supercar_arbitrate_throttle(&supercar, throttle);
+    }
+    if(steer->changed){
+        supercar_arbitrate_steering(&supercar, steer);
+    }
+    if(throttle->changed || steer->changed){
+        supercar_commit(&supercar);
+    }
+}
+
+static void supercar_slot_ramp(void* arg)
+{
+    brushed_motor_ramp(&supercar.propulsion_motor_ctrl, CONFIG_SUPERCAR_SCHED_PERIOD_US, supercar.profile->acceleration / 100.0f);
+    brushed_motor_ramp(&supercar.steering_motor_ctrl, CONFIG_SUPERCAR_SCHED_PERIOD_US, 1.0f);
+}
+
+static void supercar_slot_actuation(void* arg)
+{
+    brushed_motor_actuate(&supercar.propulsion_motor_ctrl);
+    brushed_motor_actuate(&supercar.steering_motor_ctrl);
+}
+
+static void supercar_slot_publish(void* arg)
+{
+    supercar_snapshot_publish(&supercar);
+}
+
+static const supercar_slot_t supercar_slots[] = {
+    { .name = "input",     .run = supercar_slot_input,     .budget_us = 400 },
+    { .name = "safety",    .run = supercar_slot_safety,    .budget_us = 50 },
+    { .name = "arbitrate", .run = supercar_slot_arbitrate, .budget_us = 50 },
+    { .name = "ramp",      .run = supercar_slot_ramp,      .budget_us = 50 },
+    { .name = "actuation", .run = supercar_slot_actuation, .budget_us = 100 },
+    { .name = "publish",   .run = supercar_slot_publish,   .budget_us = 50 },
+};
+
+void supercar_apply_config(supercar_t* car, void (*apply)(const void*, supercar_t*), const void* staging)
+{
+    supercar_config_event_t ev = {
+        .apply = apply,
+        .staging = staging,
+        .caller = xTaskGetCurrentTaskHandle(),
+        .timestamp = esp_timer_get_time()
+    };
+    xQueueSend(car->config_events, &ev, portMAX_DELAY);
+    // The control task owns the car state, wait for it to be done with the request
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+static void supercar_apply_profile(const void* staging, supercar_t* car)
+{
+    supercar_select_profile(car, *(const supercar_profile_id_t*) staging);
+}
+
+esp_err_t supercar_request_profile(supercar_t* car, const char* name)
+{
+    supercar_profile_id_t id = supercar_profile_find(name, strlen(name));
+    if(id == SUPERCAR_PROFILE_MAX){
+        return ESP_ERR_NOT_FOUND;
+    }
+    supercar_apply_config(car, supercar_apply_profile, &id);
+    return ESP_OK;
+}
+
+void supercar_get_event_stats(supercar_event_stats_t stats[SUPERCAR_EVENT_MAX])
+{
+    portENTER_CRITICAL(&event_stats_lock);
+    memcpy(stats, event_stats, sizeof(event_stats));
+    portEXIT_CRITICAL(&event_stats_lock);
+}
+
+static bool supercar_frame_equal(const supercar_frame_t* a, const supercar_frame_t* b)
+{
+    return a->propulsion == b->propulsion && a->propulsion_run == b->propulsion_run
+        && a->steering == b->steering && a->steering_run == b->steering_run
+        && a->mode_level == b->mode_level && a->power_level == b->power_level;
+}
+
+void supercar_commit(supercar_t* car)
+{
+    supercar_frame_t* frame = &car->frame;
+    supercar_frame_t* committed = &car->committed;
+    if(supercar_frame_equal(frame, committed)){
+        // Whatever happened while handling the event cancelled out
+        portENTER_CRITICAL(&event_stats_lock);
+        frame_stats.elided++;
+        portEXIT_CRITICAL(&event_stats_lock);
+        return;
+    }
+    if(frame->propulsion != committed->propulsion || frame->propulsion_run != committed->propulsion_run
+        || frame->steering != committed->steering || frame->steering_run != committed->steering_run){
+        brushed_motor_target_t targets[] = {
+            { .motor = &car->propulsion_motor_ctrl, .speed = frame->propulsion, .run = frame->propulsion_run },
+            { .motor = &car->steering_motor_ctrl, .speed = frame->steering, .run = frame->steering_run }
+        };
+        brushed_motor_publish(targets, sizeof(targets) / sizeof(targets[0]));
+    }
+    if(frame->mode_level != committed->mode_level){
+        gpio_set_level(car->cfg.mode_output_pin, frame->mode_level);
+    }
+    if(frame->power_level != committed->power_level){
+        gpio_set_level(car->cfg.power_output_pin, frame->power_level);
+    }
+    if(frame->propulsion_run != committed->propulsion_run){
+        supercar_coex_set_moving(frame->propulsion_run);
+    }
+    *committed = *frame;
+    portENTER_CRITICAL(&event_stats_lock);
+    frame_stats.committed++;
+    portEXIT_CRITICAL(&event_stats_lock);
+}
+
+void supercar_get_frame_stats(supercar_frame_stats_t* stats)
+{
+    portENTER_CRITICAL(&event_stats_lock);
+    *stats = frame_stats;
+    portEXIT_CRITICAL(&event_stats_lock);
+}
+
 void supercar_init(supercar_t* car){
     ESP_LOGD(TAG, "Car initializing");
     car->power = false;
-    car->control_type = LOCAL;
-    car->control_type = MOTION;
+    car->state = SUPERCAR_STATE_LOCAL_IDLE;
+    car->mode = MOTION;
     car->steering = STEER_NONE;
     car->propulsion_motor_ctrl.name = PROPULSION_MOTOR_NAME;
     car->steering_motor_ctrl.name = STEERING_MOTOR_NAME;
-    car->cfg.max_speed = 50;
-    car->cfg.delta_speed = 10;
     car->cfg.mode_input_pin = GPIO_MODE_SELECTOR_IN;
     car->cfg.mode_output_pin = GPIO_MODE_SELECTOR_OUT;
     car->cfg.power_output_pin = GPIO_POWER_OUT;
-    car->cfg.distance_threshold_backward = 4;
-    car->cfg.distance_threshold_forward = 4;
+    car->cfg.wifi_mode = SUPERCAR_WIFI_DEFAULT_MODE;
     car->distance.back_left = 25;
     car->distance.front_left = 25;
     car->distance.back_right = 25;
@@ -260,8 +493,14 @@ void supercar_init(supercar_t* car){
     
     car->reverse_direction = false;
     car->reverse_mode = false;
-    car->running = DIRECTION_NONE;
-    car->mutex = xSemaphoreCreateMutex();
+    supercar_profiles_init();
+    car->profile_id = SUPERCAR_PROFILE_DEFAULT;
+    car->profile = supercar_profile_get(car->profile_id);
+    car->max_speed = car->profile->max_speed;
+    supercar_arbiter_init();
+    // Matches the state the outputs are configured in, the first commit writes the relays
+    car->frame = (supercar_frame_t){ .mode_level = -1, .power_level = -1 };
+    car->committed = car->frame;
 
     brushed_motor_init(&car->propulsion_motor_ctrl, MCPWM_TIMER_0, MCPWM0A, GPIO_PWM_PROPULSION_OUT, GPIO_DIR_PROPULSION_OUT);
     brushed_motor_init(&car->steering_motor_ctrl, MCPWM_TIMER_1, MCPWM1A, GPIO_PWM_STEERING_OUT, GPIO_DIR_STEERING_OUT);
@@ -270,9 +509,24 @@ void supercar_init(supercar_t* car){
     car->steering_motor_ctrl.cfg.acceleration = 4.0f;
 
     car->button_events = pulled_button_init(PIN_BIT(GPIO_ACCELERATOR_FWD_IN) | PIN_BIT(GPIO_ACCELERATOR_BWD_IN) | PIN_BIT(GPIO_MODE_SELECTOR_IN), GPIO_PULLUP_ONLY);
-    car->remote_events = xQueueCreate(10, sizeof(xbox_input_event_t));
+    car->remote_events = xQueueCreate(10, sizeof(gamepad_input_event_t));
     car->distance_events = xQueueCreate(10, sizeof(distance_sensor_report_t));
+    car->config_events = xQueueCreate(4, sizeof(supercar_config_event_t));
+
+    car->event_set = xQueueCreateSet(EVENT_SET_LENGTH);
+    xQueueAddToSet(car->distance_events, car->event_set);
+    xQueueAddToSet(car->remote_events, car->event_set);
+    xQueueAddToSet(car->config_events, car->event_set);
+    if(xQueueAddToSet(car->button_events, car->event_set) != pdPASS){
+        ESP_LOGE(TAG, "Could not add the pedal events to the event set");
+    }
+    // The saved sections are staged over the published defaults
+    supercar_snapshot_publish(car);
+}
 
+void supercar_setup(supercar_t* car){
+    ESP_LOGD(TAG, "Car setting up");
+    // With the pins of the saved configuration
     gpio_config_t config_output = {
         .intr_type = GPIO_INTR_DISABLE,
         .mode = GPIO_MODE_DEF_OUTPUT,
@@ -280,11 +534,7 @@ void supercar_init(supercar_t* car){
         .pull_up_en = 1,
         .pull_down_en = 0
     };
-    gpio_config(&config_output);    
-}
-
-void supercar_setup(supercar_t* car){
-    ESP_LOGD(TAG, "Car setting up");
+    gpio_config(&config_output);
     brushed_motor_setup(&car->propulsion_motor_ctrl);
     brushed_motor_setup(&car->steering_motor_ctrl);
 
@@ -292,15 +542,17 @@ void supercar_setup(supercar_t* car){
     supercar_apply_mode(car);
 
     supercar_power(car, true);
+    supercar_commit(car);
+    supercar_snapshot_publish(car);
 }
 
 void supercar_power(supercar_t* car, bool power){
-    gpio_set_level(car->cfg.power_output_pin, !power);
+    car->frame.power_level = !power;
     car->power = power;
 }
 
 void supercar_toggle_mode(supercar_t* car){
-    if(car->running != DIRECTION_NONE){
+    if(supercar_get_running(car) != DIRECTION_NONE){
         supercar_stop(car);
     }
     supercar_set_mode(car, car->mode == SWAY ? MOTION : SWAY);
@@ -315,24 +567,20 @@ void supercar_reverse_mode(supercar_t* car){
 void supercar_reverse(supercar_t* car){
     ESP_LOGD(TAG, "Car toggling direction");
     car->reverse_direction = !car->reverse_direction;
-    supercar_motor_control_t* propulsion = &(car->propulsion_motor_ctrl);
-    if(propulsion->start_flag){
+    if(car->frame.propulsion_run){
         ESP_LOGD(TAG, "Applying opposite thrust...");
-        brushed_motor_set_speed(propulsion, -propulsion->expt);
+        car->frame.propulsion = -car->frame.propulsion;
     }
 }
 
 void supercar_turn(supercar_t* car, supercar_steer_t turn){
-    supercar_motor_control_t* steering = &car->steering_motor_ctrl;
-    
     car->steering = turn;
     if(turn == STEER_NONE){
-        brushed_motor_set_speed(steering, 0);
-        brushed_motor_stop(steering);
+        car->frame.steering = 0;
+        car->frame.steering_run = false;
     }else{
-        float steering_speed = turn == STEER_RIGHT ? STEERING_SPEED : -STEERING_SPEED;
-        brushed_motor_set_speed(steering, steering_speed);
-        brushed_motor_start(steering);
+        car->frame.steering = turn == STEER_RIGHT ? STEERING_SPEED : -STEERING_SPEED;
+        car->frame.steering_run = true;
     }
 }
 
@@ -349,43 +597,134 @@ void supercar_set_mode(supercar_t* car, supercar_mode_t mode){
 }
 
 void supercar_throttle(supercar_t* car, float speed){
-    supercar_motor_control_t* propulsion = &car->propulsion_motor_ctrl;
-    brushed_motor_set_speed(propulsion, speed);
+    car->frame.propulsion = speed;
     if(speed != 0){
         ESP_LOGD(TAG, "Car running");
-        car->running = speed > 0 ? DIRECTION_FORWARD : DIRECTION_BACKWARD;
-        brushed_motor_start(propulsion);
+        car->frame.propulsion_run = true;
     }
 }
 
 void supercar_start(supercar_t* car, supercar_direction_t direction){
     ESP_LOGD(TAG, "Car starting up...");
-    int speed = car->cfg.max_speed;
+    int speed = car->max_speed;
     supercar_throttle(car, direction == DIRECTION_FORWARD ? speed : -speed);
 }
 
 void supercar_stop(supercar_t* car){ 
-    supercar_motor_control_t* propulsion = &car->propulsion_motor_ctrl;
-    if(car->running != DIRECTION_NONE){
+    if(car->frame.propulsion_run){
         ESP_LOGD(TAG, "Car stopping");
-        car->running = DIRECTION_NONE;
-        brushed_motor_stop(propulsion);
+        car->frame.propulsion = 0;
+        car->frame.propulsion_run = false;
     }
 }
 
 
 void supercar_set_max_speed(supercar_t* car, int max_speed){
-    int old_max_speed = car->cfg.max_speed;
-    car->cfg.max_speed = max(car->cfg.delta_speed, min(max_speed, 100));
-    ESP_LOGD(TAG, "Car setting up new max speed : %d -> %d", old_max_speed, car->cfg.max_speed);
-    if(car->running != DIRECTION_NONE){
-        int new_speed = car->cfg.max_speed;
-        if(car->running == DIRECTION_BACKWARD)
+    int old_max_speed = car->max_speed;
+    // Never above the maximum of the profile
+    car->max_speed = min(max(car->profile->delta_speed, max_speed), car->profile->max_speed);
+    ESP_LOGD(TAG, "Car setting up new max speed : %d -> %d", old_max_speed, car->max_speed);
+    supercar_rtc_set_profile(car->profile_id, car->max_speed);
+    supercar_direction_t running = supercar_get_running(car);
+    if(running != DIRECTION_NONE){
+        int new_speed = car->max_speed;
+        if(running == DIRECTION_BACKWARD)
             new_speed = -new_speed;
         supercar_throttle(car, new_speed);
     }
 }
 
+void supercar_select_profile(supercar_t* car, supercar_profile_id_t id){
+    car->profile_id = id;
+    car->profile = supercar_profile_get(id);
+    ESP_LOGI(TAG, "Driving with the %s profile", supercar_profile_name(id));
+    // The speed lowered with the gamepad starts again from the maximum of the profile
+    supercar_set_max_speed(car, car->profile->max_speed);
+}
+
+enum {
+    BOOT_STORAGE,
+    BOOT_CONFIG,
+    BOOT_CONTROL,
+    BOOT_SENSOR,
+    BOOT_GAMEPAD,
+    BOOT_PERSIST,
+    BOOT_NETWORK,
+    BOOT_WWW,
+    BOOT_HTTP,
+};
+
+#define BOOT_AFTER(stage) (1u << BOOT_##stage)
+
+static esp_err_t supercar_boot_storage(supercar_t* car)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    return ret;
+}
+
+/* Every section is applied before the control task runs, a failed read keeps the defaults */
+static esp_err_t supercar_boot_config(supercar_t* car)
+{
+    // After a warm reset the values in use before it are back without waiting for the flash
+    if (supercar_rtc_restore(car) == ESP_OK) {
+        return ESP_OK;
+    }
+    esp_err_t err = supercar_boot_wait(BOOT_AFTER(STORAGE));
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Task placement overrides must be known before the first task is created
+    supercar_tasks_config_read(car);
+    supercar_config_read(car);
+    supercar_propulsion_config_read(car);
+    supercar_steering_config_read(car);
+    supercar_arbiter_config_read(car);
+    // Loaded once, a switch only swaps the profile pointer
+    supercar_profiles_config_read(car);
+    // Kept for a warm reset
+    supercar_rtc_capture_all(car);
+    supercar_rtc_set_profile(car->profile_id, car->max_speed);
+    return ESP_OK;
+}
+
+static esp_err_t supercar_boot_control(supercar_t* car)
+{
+    supercar_setup(car);
+    /* Time triggered control loop, it owns the car state */
+    return supercar_sched_start(supercar_slots, sizeof(supercar_slots) / sizeof(supercar_slots[0]), CONFIG_SUPERCAR_SCHED_PERIOD_US);
+}
+
+static esp_err_t supercar_boot_sensor(supercar_t* car)
+{
+    init_distance_sensor_rx(car);
+    return ESP_OK;
+}
+
+static esp_err_t supercar_boot_gamepad(supercar_t* car)
+{
+    supercar_coex_init();
+    init_hid_host(car);
+    supercar_drive_init(car);
+    return ESP_OK;
+}
+
+/* The pedals drive once the control stage is done, the network comes up in the background */
+static const supercar_boot_stage_t supercar_boot_stages[] = {
+    [BOOT_STORAGE] = { .name = "storage", .run = supercar_boot_storage },
+    [BOOT_CONFIG]  = { .name = "config",  .run = supercar_boot_config },
+    [BOOT_CONTROL] = { .name = "control", .run = supercar_boot_control, .after = BOOT_AFTER(CONFIG), .milestone = "drive" },
+    [BOOT_SENSOR]  = { .name = "sensor",  .run = supercar_boot_sensor,  .after = BOOT_AFTER(CONTROL) },
+    [BOOT_GAMEPAD] = { .name = "gamepad", .run = supercar_boot_gamepad, .after = BOOT_AFTER(CONTROL) | BOOT_AFTER(STORAGE), .milestone = "gamepad" },
+    [BOOT_PERSIST] = { .name = "persist", .run = supercar_persist_start, .after = BOOT_AFTER(CONFIG) | BOOT_AFTER(STORAGE) },
+    [BOOT_NETWORK] = { .name = "network", .run = supercar_network_start, .after = BOOT_AFTER(STORAGE) | BOOT_AFTER(CONFIG) },
+    [BOOT_WWW]     = { .name = "www",     .run = supercar_www_start },
+    [BOOT_HTTP]    = { .name = "http",    .run = supercar_web_start,
+                       .after = BOOT_AFTER(CONFIG) | BOOT_AFTER(NETWORK) | BOOT_AFTER(WWW), .milestone = "web" },
+};
 
 /**
  * @brief The main entry of this example
@@ -393,21 +732,11 @@ void supercar_set_max_speed(supercar_t* car, int max_speed){
 void app_main(void)
 {
     printf("Super car starting...\n");
-    /* Initialize peripherals and modules */
-    supercar_init(&supercar);
-    supercar_setup(&supercar);
 
-   
-    
-    /* Motor expectation wave generate thread */
-    xTaskCreatePinnedToCore(supercar_input_thread, "supercar_input_thread", 4096, NULL, 5, NULL, 0);
-    xTaskCreatePinnedToCore(supercar_remote_input_thread, "supercar_remote_input_thread", 4096, NULL, 5, NULL, 0);
-    xTaskCreatePinnedToCore(supercar_distance_sensor_thread, "supercar_distance_sensor_thread", 4096, NULL, 5, NULL, 0);
-
-    init_hid_host(&supercar);
-
-    init_distance_sensor_rx(&supercar);
+    /* No flash access, the stages read the configuration */
+    supercar_rtc_init();
+    supercar_config_init();
+    supercar_init(&supercar);
 
-    start_rest_main(&supercar);
-    ESP_ERROR_CHECK(supercar_config_read(&supercar));
-}
\ No newline at end of file
+    ESP_ERROR_CHECK(supercar_boot_run(supercar_boot_stages, sizeof(supercar_boot_stages) / sizeof(supercar_boot_stages[0]), &supercar));
+}
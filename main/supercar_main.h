@@ -12,8 +12,11 @@
 #define _SUPERCAR_MAIN_H_
  
 #include "supercar_motor.h"
+#include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "supercar_sensor.h"
+#include "supercar_fsm.h"
+#include "supercar_profile.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -69,40 +72,80 @@ typedef struct {
     uint8_t back_right;
 } supercar_distance_sensor_t;
 
+/* Event classes handled by the control task, by decreasing priority */
+typedef enum {
+    SUPERCAR_EVENT_SAFETY,
+    SUPERCAR_EVENT_PEDAL,
+    SUPERCAR_EVENT_REMOTE,
+    SUPERCAR_EVENT_CONFIG,
+    SUPERCAR_EVENT_MAX
+} supercar_event_class_t;
+
 typedef struct {
-        int max_speed;
-        int delta_speed;
-        int mode_input_pin;
-        int mode_output_pin;
-        int power_output_pin;
-        int distance_threshold_forward;
-        int distance_threshold_backward;
-} supercar_config_t;
+    uint32_t count;
+    uint64_t wait_total_us;         // Time spent in the queue
+    uint32_t wait_max_us;
+    uint64_t process_total_us;      // Time spent handling the event
+    uint32_t process_max_us;
+} supercar_event_stats_t;
+
+typedef struct supercar supercar_t;
 
 typedef struct {
+    void (*apply)(const void*, supercar_t*);
+    const void* staging;            // Owned by the caller, which waits for the event to be handled
+    TaskHandle_t caller;
+    int64_t timestamp;
+} supercar_config_event_t;
+
+/* Everything the control task drives, built while handling one event and committed at once */
+typedef struct {
+    float propulsion;               // Propulsion target duty cycle (100~-100)
+    bool propulsion_run;
+    float steering;                 // Steering target duty cycle (100~-100)
+    bool steering_run;
+    int mode_level;                 // Mode selector relay output level
+    int power_level;                // Power relay output level
+} supercar_frame_t;
+
+typedef struct {
+    uint32_t committed;             // Frames published to the outputs
+    uint32_t elided;                // Events whose frame left the outputs unchanged
+} supercar_frame_stats_t;
+
+/* Generated from supercar_config.def */
+typedef struct {
+#define SUPERCAR_MAIN_FIELD(name, type, min, max, units, title) SUPERCAR_FIELD_CTYPE_##type name;
+#include "supercar_config.def"
+} supercar_config_t;
+
+struct supercar {
     bool power;
     supercar_motor_control_t propulsion_motor_ctrl;
     supercar_motor_control_t steering_motor_ctrl;
     supercar_mode_t mode;
     supercar_mode_t applied_mode;
-    supercar_control_type_t control_type;
+    supercar_state_t state;             // Control type and motion, only changed by supercar_dispatch
     supercar_steer_t steering;
     bool reverse_direction;
     bool reverse_mode;
-    supercar_direction_t running;
     supercar_distance_sensor_t distance;
-
-
-    SemaphoreHandle_t mutex;
+    supercar_frame_t frame;             // Pending outputs of the event being handled
+    supercar_frame_t committed;         // Outputs as last published
+    supercar_profile_id_t profile_id;
+    const supercar_profile_t* profile;  // Driver settings, switched by swapping the pointer
+    int max_speed;                      // Pedal speed, the profile maximum lowered with the gamepad
 
     /* Handles */
     QueueHandle_t button_events;
     QueueHandle_t remote_events;
     QueueHandle_t distance_events;
+    QueueHandle_t config_events;
+    QueueSetHandle_t event_set;
 
     supercar_config_t cfg;
 
-} supercar_t;
+};
 
 void supercar_init(supercar_t* car);
 
@@ -116,6 +159,20 @@ void supercar_stop(supercar_t* car);
 
 void supercar_set_max_speed(supercar_t* car, int max_speed);
 
+/**
+ * @brief Drive with another profile, from the control task
+ *
+ * Nothing is read from NVS or parsed, the car points to the profile preloaded in RAM.
+ */
+void supercar_select_profile(supercar_t* car, supercar_profile_id_t id);
+
+/**
+ * @brief Have the control task switch the profile, from any task
+ *
+ * @return ESP_ERR_NOT_FOUND for an unknown profile name
+ */
+esp_err_t supercar_request_profile(supercar_t* car, const char* name);
+
 void supercar_toggle_mode(supercar_t* car);
 
 void supercar_reverse_mode(supercar_t* car);
@@ -130,7 +187,41 @@ void supercar_set_mode(supercar_t* car, supercar_mode_t mode);
 
 void supercar_throttle(supercar_t* car, float speed);
 
-extern void start_rest_main(supercar_t* car);
+void supercar_read_mode(supercar_t* car);
+
+/**
+ * @brief Feed an event to the control state machine
+ *
+ * @param value Signed speed for the throttle events, ignored otherwise
+ */
+void supercar_dispatch(supercar_t* car, supercar_fsm_event_t event, float value);
+
+supercar_control_type_t supercar_get_control_type(supercar_t* car);
+
+supercar_direction_t supercar_get_running(supercar_t* car);
+
+const char* supercar_get_state_name(supercar_t* car);
+
+/**
+ * @brief Have the control task apply a configuration change and wait for it
+ */
+void supercar_apply_config(supercar_t* car, void (*apply)(const void*, supercar_t*), const void* staging);
+
+void supercar_get_event_stats(supercar_event_stats_t stats[SUPERCAR_EVENT_MAX]);
+
+/**
+ * @brief Publish the pending frame to the motors and relays, if it changed anything
+ */
+void supercar_commit(supercar_t* car);
+
+void supercar_get_frame_stats(supercar_frame_stats_t* stats);
+
+/**
+ * @brief Boot stages of esp_rest_main.c, the network one blocks until the station has an address
+ */
+extern esp_err_t supercar_network_start(supercar_t* car);
+extern esp_err_t supercar_www_start(supercar_t* car);
+extern esp_err_t supercar_web_start(supercar_t* car);
 
 extern void init_distance_sensor_rx(supercar_t* car);
 
@@ -4,6 +4,8 @@
 #include "freertos/semphr.h"
 #include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
 #include "driver/mcpwm.h"
 #include "supercar_motor.h"
 #include "math.h"
@@ -14,13 +16,19 @@
 
 static const char* TAG = "MOTOR";
 
+/* Guards the targets of all motors so that a frame is published atomically */
+static portMUX_TYPE actuation_lock = portMUX_INITIALIZER_UNLOCKED;
+
 void brushed_motor_init(supercar_motor_control_t* motor_ctrl, mcpwm_timer_t pwm_timer, mcpwm_io_signals_t pwm_signal, int pwm_pin, int direction_pin){
     ESP_LOGD(TAG, "Initializing motor [%s]", motor_ctrl->name);
     motor_ctrl->duty_cycle = 0;
+    motor_ctrl->next_duty = 0;
+    motor_ctrl->elapsed_us = 0;
     motor_ctrl->expt = 0;
     motor_ctrl->direction = MOTOR_RIGHT;
     motor_ctrl->start_flag = false;
     motor_ctrl->start_time = -1;
+    motor_ctrl->ready = false;
    
     motor_ctrl->cfg.acceleration = 1.0f;
     motor_ctrl->cfg.ctrl_period = 10;
@@ -30,7 +38,6 @@ void brushed_motor_init(supercar_motor_control_t* motor_ctrl, mcpwm_timer_t pwm_
     motor_ctrl->cfg.pwm_signal = pwm_signal;
     motor_ctrl->cfg.pwm_pin = pwm_pin;
     motor_ctrl->cfg.direction_pin = direction_pin;
-    motor_ctrl->mutex = xSemaphoreCreateMutex();
 }
 
 
@@ -56,48 +63,121 @@ static void brushed_motor_set_duty(supercar_motor_control_t* motor_ctrl, float d
 static void brushed_motor_set_direction(supercar_motor_control_t* motor_ctrl, motor_direction_t direction){
     ESP_LOGD(TAG, "Direction [%s] : %s", motor_ctrl->name, direction == MOTOR_RIGHT ? "RIGHT" : "LEFT");
     motor_ctrl->direction = direction;
-    gpio_set_level(motor_ctrl->cfg.direction_pin, direction);
+    gpio_set_level(motor_ctrl->programmed.direction_pin, direction);
 }
 
-/**
- * @brief Motor control thread
- *
- * @param arg Information pointer transmitted by task creating function
- */
-static void brushed_motor_ctrl_thread(void *arg){
-    supercar_motor_control_t* motor = (supercar_motor_control_t*)arg;
-    ESP_LOGD(TAG, "Initializing motor [%s]", motor->name);
-    while (1) {
-        xSemaphoreTake(motor->mutex, portMAX_DELAY);
-        if(motor->expt != motor->duty_cycle){
-            float delta = motor->expt - motor->duty_cycle;
-            float acc = motor->cfg.acceleration;
-            float new_duty = motor->duty_cycle;
-            if(fabs(delta) > acc){
-                if(delta > 0)
-                    new_duty += acc;
-                else 
-                    new_duty -= acc;
-            }else{
-                new_duty = motor->expt;
-            }
-            ESP_LOGV(TAG, "Duty cycle [%s] expt %f : %f -> %f", motor->name, motor->expt, motor->duty_cycle, new_duty);
-            motor_direction_t new_direction = new_duty > 0 ? MOTOR_RIGHT : MOTOR_LEFT;
-
-            if(new_direction != motor->direction){
-                brushed_motor_set_direction(motor, new_direction);
-            }
-
-            brushed_motor_set_duty(motor, new_duty);
+void brushed_motor_ramp(supercar_motor_control_t* motor, uint32_t period_us, float scale){
+    motor->elapsed_us += period_us;
+    if(motor->elapsed_us < motor->cfg.ctrl_period * 1000){
+        return;
+    }
+    motor->elapsed_us -= motor->cfg.ctrl_period * 1000;
+
+    portENTER_CRITICAL(&actuation_lock);
+    float expt = motor->expt;
+    if(motor->start_flag){
+        motor->start_time += motor->cfg.ctrl_period; 
+    }
+    portEXIT_CRITICAL(&actuation_lock);
+    if(brushed_motor_reconfiguring(motor)){
+        // Held at rest until brushed_motor_actuate has reprogrammed it
+        expt = 0;
+    }
+    if(expt != motor->next_duty){
+        float delta = expt - motor->next_duty;
+        float acc = motor->cfg.acceleration * scale;
+        float new_duty = motor->next_duty;
+        if(fabs(delta) > acc){
+            if(delta > 0)
+                new_duty += acc;
+            else 
+                new_duty -= acc;
+        }else{
+            new_duty = expt;
         }
-        if(motor->start_flag){
-            motor->start_time += motor->cfg.ctrl_period; 
+        ESP_LOGV(TAG, "Duty cycle [%s] expt %f : %f -> %f", motor->name, expt, motor->next_duty, new_duty);
+        motor->next_duty = new_duty;
+    }
+}
+
+static void brushed_motor_setup_output(int pin){
+    gpio_config_t config_output = {
+        .intr_type = GPIO_INTR_DISABLE,
+        .mode = GPIO_MODE_DEF_OUTPUT,
+        .pin_bit_mask = (1ULL<<pin),
+        .pull_up_en = 0,
+        .pull_down_en = 1
+    };
+    gpio_config(&config_output);
+    gpio_set_level(pin, 0);
+}
+
+/* The motor is at rest, its PWM output is low */
+static void brushed_motor_reprogram(supercar_motor_control_t* motor){
+    int64_t start = esp_timer_get_time();
+    supercar_motor_config_t* old = &motor->programmed;
+    const supercar_motor_config_t* cfg = &motor->cfg;
+    if(cfg->pwm_freq != old->pwm_freq){
+        mcpwm_set_frequency(cfg->pwm_unit, cfg->pwm_timer, cfg->pwm_freq);
+    }
+    if(cfg->pwm_pin != old->pwm_pin){
+        // Back to a plain low output, a floating input of the driver could start the motor
+        brushed_motor_setup_output(old->pwm_pin);
+        mcpwm_gpio_init(cfg->pwm_unit, cfg->pwm_signal, cfg->pwm_pin);
+    }
+    if(cfg->direction_pin != old->direction_pin){
+        gpio_set_level(old->direction_pin, 0);
+        brushed_motor_setup_output(cfg->direction_pin);
+        gpio_set_level(cfg->direction_pin, motor->direction);
+    }
+    mcpwm_set_signal_low(cfg->pwm_unit, cfg->pwm_timer, MCPWM_OPR_A);
+    *old = *cfg;
+
+    int64_t end = esp_timer_get_time();
+    brushed_motor_reconfig_stats_t* stats = &motor->reconfig;
+    stats->count++;
+    stats->ramp_us = start - motor->reconfig_start;
+    stats->reprogram_us = end - start;
+    stats->downtime_us = end - motor->reconfig_start;
+    if(stats->downtime_us > stats->max_downtime_us){
+        stats->max_downtime_us = stats->downtime_us;
+    }
+    ESP_LOGI(TAG, "Motor [%s] reconfigured: %d Hz, PWM pin %d, direction pin %d, down for %u us",
+        motor->name, cfg->pwm_freq, cfg->pwm_pin, cfg->direction_pin, stats->downtime_us);
+}
+
+void brushed_motor_actuate(supercar_motor_control_t* motor){
+    if(motor->next_duty != motor->duty_cycle){
+        motor_direction_t new_direction = motor->next_duty > 0 ? MOTOR_RIGHT : MOTOR_LEFT;
+        if(new_direction != motor->direction){
+            brushed_motor_set_direction(motor, new_direction);
         }
-        xSemaphoreGive(motor->mutex);
-        vTaskDelay(motor->cfg.ctrl_period / portTICK_PERIOD_MS);
+        brushed_motor_set_duty(motor, motor->next_duty);
+    }
+    if(motor->duty_cycle == 0 && brushed_motor_reconfiguring(motor)){
+        brushed_motor_reprogram(motor);
     }
 }
 
+bool brushed_motor_reconfiguring(const supercar_motor_control_t* motor){
+    return motor->ready && (motor->programmed.pwm_freq != motor->cfg.pwm_freq
+        || motor->programmed.pwm_pin != motor->cfg.pwm_pin
+        || motor->programmed.direction_pin != motor->cfg.direction_pin);
+}
+
+void brushed_motor_configure(supercar_motor_control_t* motor, const supercar_motor_config_t* cfg){
+    bool pending = brushed_motor_reconfiguring(motor);
+    // The MCPWM unit, timer and signal are fixed by the wiring of the board
+    motor->cfg.acceleration = cfg->acceleration;
+    motor->cfg.ctrl_period = cfg->ctrl_period;
+    motor->cfg.pwm_freq = cfg->pwm_freq;
+    motor->cfg.pwm_pin = cfg->pwm_pin;
+    motor->cfg.direction_pin = cfg->direction_pin;
+    if(!pending && brushed_motor_reconfiguring(motor)){
+        motor->reconfig_start = esp_timer_get_time();
+        ESP_LOGI(TAG, "Motor [%s] ramping down to be reconfigured", motor->name);
+    }
+}
 
 void brushed_motor_setup(supercar_motor_control_t* motor_ctrl){
     ESP_LOGD(TAG, "Setting up motor [%s]", motor_ctrl->name);
@@ -111,44 +191,23 @@ void brushed_motor_setup(supercar_motor_control_t* motor_ctrl){
     mcpwm_init(motor_ctrl->cfg.pwm_unit, motor_ctrl->cfg.pwm_timer, &pwm_config);    //Configure PWMxA & PWMxB with above settings
     mcpwm_gpio_init(motor_ctrl->cfg.pwm_unit, motor_ctrl->cfg.pwm_signal , motor_ctrl->cfg.pwm_pin);
     /** GPIO config for direction */
-    gpio_config_t config_output = {
-        .intr_type = GPIO_INTR_DISABLE,
-        .mode = GPIO_MODE_DEF_OUTPUT,
-        .pin_bit_mask = ((1ULL<<motor_ctrl->cfg.direction_pin)),
-        .pull_up_en = 0,
-        .pull_down_en = 1
-    };
-    gpio_config(&config_output);
-    gpio_set_level(motor_ctrl->cfg.direction_pin, 0);
-    /* Motor control thread */
-    xTaskCreatePinnedToCore(brushed_motor_ctrl_thread, "mcpwm_brushed_motor_ctrl_thread", 4096, motor_ctrl, 3, NULL, 1);
-}
-
-void brushed_motor_set_speed(supercar_motor_control_t* mc, float speed){
-    ESP_LOGD(TAG, "Motor set speed [%s] : %f", mc->name, speed);
-    mc->expt = speed;
+    brushed_motor_setup_output(motor_ctrl->cfg.direction_pin);
+    motor_ctrl->programmed = motor_ctrl->cfg;
+    motor_ctrl->ready = true;
 }
 
-/**
- * @brief start motor
- *
- * @param mc supercar_motor_control_t pointer
- */
-void brushed_motor_start(supercar_motor_control_t *mc){
-    ESP_LOGD(TAG, "Motor start [%s]", mc->name);
-    mc->start_time = 0;
-    mc->start_flag = true;
-}
-
-/**
- * @brief stop motor
- *
- * @param mc supercar_motor_control_t pointer
- */
-void brushed_motor_stop(supercar_motor_control_t *mc){
-    ESP_LOGD(TAG, "Motor stop [%s]", mc->name);
-    mc->expt = 0;
-    mc->start_time = 0;
-    mc->start_flag = false;
+void brushed_motor_publish(const brushed_motor_target_t* targets, int count){
+    portENTER_CRITICAL(&actuation_lock);
+    for(int i = 0; i < count; i++){
+        supercar_motor_control_t* mc = targets[i].motor;
+        if(targets[i].run != mc->start_flag){
+            mc->start_time = 0;
+        }
+        mc->expt = targets[i].run ? targets[i].speed : 0;
+        mc->start_flag = targets[i].run;
+    }
+    portEXIT_CRITICAL(&actuation_lock);
+    for(int i = 0; i < count; i++){
+        ESP_LOGD(TAG, "Motor target [%s] : %f %s", targets[i].motor->name, targets[i].speed, targets[i].run ? "started" : "stopped");
+    }
 }
-
@@ -14,27 +14,46 @@ typedef enum {
     MOTOR_LEFT
 } motor_direction_t;
 
+typedef struct {
+    float acceleration;         // Maximum delta per control period
+    int ctrl_period;            // Control period (ms), a multiple of the scheduler major frame
+    int pwm_freq;               // MCPWM output frequency
+    /* MCPWM Configuration */
+    mcpwm_unit_t pwm_unit;
+    mcpwm_timer_t pwm_timer;
+    mcpwm_io_signals_t pwm_signal;
+    int pwm_pin;
+    int direction_pin;
+} supercar_motor_config_t;
+
+#define BRUSHED_MOTOR_MIN_PWM_FREQ 100
+#define BRUSHED_MOTOR_MAX_PWM_FREQ 50000
+
+/* Live changes of the frequency and pins */
+typedef struct {
+    uint32_t count;
+    uint32_t ramp_us;                        // Last one, from the request to the motor at rest
+    uint32_t reprogram_us;                   // Last one, MCPWM and GPIO reprogramming
+    uint32_t downtime_us;                    // Last one, from the request to the motor following its target again
+    uint32_t max_downtime_us;
+} brushed_motor_reconfig_stats_t;
+
 typedef struct {
     /* Status */
     unsigned int start_time;                    // Seconds count
     bool start_flag;                         // Motor start flag
-    float duty_cycle;
+    float duty_cycle;                        // Duty cycle applied to the MCPWM
+    float next_duty;                         // Duty cycle computed by the ramp, applied by brushed_motor_actuate
+    uint32_t elapsed_us;                     // Time since the last ramp step
     motor_direction_t direction;
     float expt;
-    SemaphoreHandle_t mutex;
     const char* name;
     /* Configurations */
-    struct {
-        float acceleration;         // Maximum delta per control period
-        int ctrl_period;            // Control period
-        int pwm_freq;               // MCPWM output frequency
-        /* MCPWM Configuration */
-        mcpwm_unit_t pwm_unit;
-        mcpwm_timer_t pwm_timer;
-        mcpwm_io_signals_t pwm_signal;
-        int pwm_pin;
-        int direction_pin;
-    } cfg;                                   // Configurations that should be initialized for this example
+    supercar_motor_config_t cfg;             // Configurations that should be initialized for this example
+    supercar_motor_config_t programmed;      // Frequency and pins the MCPWM and GPIO are set up with
+    bool ready;                              // Set up by brushed_motor_setup
+    int64_t reconfig_start;                  // Time of the pending change of frequency or pins
+    brushed_motor_reconfig_stats_t reconfig;
 } supercar_motor_control_t;
 
 
@@ -42,21 +61,48 @@ void brushed_motor_init(supercar_motor_control_t* motor_ctrl, mcpwm_timer_t pwm_
 
 void brushed_motor_setup(supercar_motor_control_t* motor_ctrl);
 
-void brushed_motor_set_speed(supercar_motor_control_t* motor_ctrl, float speed);
+/**
+ * @brief Change the configuration of a running motor, from the control task
+ *
+ * The acceleration and control period apply at once. A new frequency or new pins ramp the motor down
+ * to zero, brushed_motor_actuate then reprograms the MCPWM and GPIO and the motor ramps back to its target.
+ * The pins must have been checked against the other users first.
+ */
+void brushed_motor_configure(supercar_motor_control_t* motor_ctrl, const supercar_motor_config_t* cfg);
 
 /**
- * @brief start motor
+ * @brief Whether a change of frequency or pins is waiting for the motor to be at rest
+ */
+bool brushed_motor_reconfiguring(const supercar_motor_control_t* motor_ctrl);
+
+/**
+ * @brief Ramp the duty cycle toward the target, one acceleration step per control period
+ *
+ * @param period_us Time elapsed since the previous call
+ * @param scale Share of the configured acceleration to use, 1 for all of it
+ */
+void brushed_motor_ramp(supercar_motor_control_t* motor_ctrl, uint32_t period_us, float scale);
+
+/**
+ * @brief Write the duty cycle computed by the ramp to the direction pin and the MCPWM
  *
- * @param mc supercar_motor_control_t pointer
+ * Reprograms the motor once at rest if its frequency or pins changed.
  */
-void brushed_motor_start(supercar_motor_control_t *mc);
+void brushed_motor_actuate(supercar_motor_control_t* motor_ctrl);
+
+/* Target of one motor in an actuation frame */
+typedef struct {
+    supercar_motor_control_t* motor;
+    float speed;                // Expected duty cycle (100~-100)
+    bool run;                   // Motor start flag, the speed is ignored when false
+} brushed_motor_target_t;
 
 /**
- * @brief stop motor
+ * @brief Publish the targets of several motors at once
  *
- * @param mc supercar_motor_control_t pointer
+ * The ramp never sees a partial update, all motors switch to their new target on the same control period.
  */
-void brushed_motor_stop(supercar_motor_control_t *mc);
+void brushed_motor_publish(const brushed_motor_target_t* targets, int count);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,194 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "supercar_sched.h"
+#include "supercar_snapshot.h"
+#include "supercar_tasks.h"
+#include "supercar_persist.h"
+
+static const char* TAG = "PERSIST";
+
+#define PERSIST_POLL_MS 100
+#define PERSIST_SETTLE_US (CONFIG_SUPERCAR_PERSIST_SETTLE_MS * 1000LL)
+#define PERSIST_MAX_DELAY_US (CONFIG_SUPERCAR_PERSIST_MAX_DELAY_MS * 1000LL)
+
+typedef struct {
+    uint32_t marks;
+    uint32_t coalesced;             // Marks of a section that was already dirty
+    uint32_t writes;
+    uint32_t failures;
+    uint32_t deferred;              // Times the car was moving when the changes had settled
+    uint32_t forced;                // Writes done while moving, after the maximum delay
+    uint32_t write_us;
+    uint32_t max_write_us;
+} persist_stats_t;
+
+static supercar_t* persist_car;
+static TaskHandle_t persist_task;
+static uint32_t persist_dirty;      // One bit per entry of supercar_sections
+static int64_t persist_first_mark;
+static int64_t persist_last_mark;
+static bool persist_waiting;        // Settled but moving, counted once
+static persist_stats_t persist_stats;
+static portMUX_TYPE persist_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void supercar_persist_mark(const supercar_section_t* section)
+{
+    int64_t now = esp_timer_get_time();
+    for (size_t i = 0; i < supercar_sections_count; i++) {
+        if (supercar_sections[i] != section) {
+            continue;
+        }
+        portENTER_CRITICAL(&persist_lock);
+        if (!persist_dirty) {
+            persist_first_mark = now;
+        }
+        if (persist_dirty & (1u << i)) {
+            persist_stats.coalesced++;
+        }
+        persist_dirty |= (1u << i);
+        persist_last_mark = now;
+        persist_stats.marks++;
+        portEXIT_CRITICAL(&persist_lock);
+        if (persist_task) {
+            xTaskNotifyGive(persist_task);
+        }
+        return;
+    }
+    ESP_LOGE(TAG, "Unknown section %s", section->name);
+}
+
+static bool supercar_persist_stationary(void)
+{
+    supercar_snapshot_t snapshot;
+    supercar_snapshot_read(&snapshot);
+    return snapshot.running == DIRECTION_NONE && snapshot.propulsion.duty_cycle == 0
+        && snapshot.steering_motor.duty_cycle == 0;
+}
+
+static void supercar_persist_write(uint32_t dirty)
+{
+    for (size_t i = 0; i < supercar_sections_count; i++) {
+        if (!(dirty & (1u << i))) {
+            continue;
+        }
+        const supercar_section_t* section = supercar_sections[i];
+        int64_t start = esp_timer_get_time();
+        // The control loop frames delayed by the write are charged to it
+        supercar_sched_flash_begin();
+        esp_err_t err = supercar_section_save(persist_car, section);
+        supercar_sched_flash_end();
+        uint32_t elapsed = esp_timer_get_time() - start;
+
+        portENTER_CRITICAL(&persist_lock);
+        if (err == ESP_OK) {
+            persist_stats.writes++;
+            persist_stats.write_us += elapsed;
+            if (elapsed > persist_stats.max_write_us) {
+                persist_stats.max_write_us = elapsed;
+            }
+        } else {
+            // Tried again with the next batch
+            persist_stats.failures++;
+            persist_dirty |= (1u << i);
+        }
+        portEXIT_CRITICAL(&persist_lock);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Could not save %s: %s", section->name, esp_err_to_name(err));
+        } else {
+            ESP_LOGI(TAG, "Saved %s in %u us", section->name, elapsed);
+        }
+    }
+}
+
+static void supercar_persist_thread(void* arg)
+{
+    while (1) {
+        portENTER_CRITICAL(&persist_lock);
+        bool pending = persist_dirty != 0;
+        portEXIT_CRITICAL(&persist_lock);
+        ulTaskNotifyTake(pdTRUE, pending ? pdMS_TO_TICKS(PERSIST_POLL_MS) : portMAX_DELAY);
+
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&persist_lock);
+        uint32_t dirty = persist_dirty;
+        bool settled = now - persist_last_mark >= PERSIST_SETTLE_US;
+        bool overdue = now - persist_first_mark >= PERSIST_MAX_DELAY_US;
+        portEXIT_CRITICAL(&persist_lock);
+        if (!dirty || !settled) {
+            continue;
+        }
+
+        bool stationary = supercar_persist_stationary();
+        if (!stationary && !overdue) {
+            portENTER_CRITICAL(&persist_lock);
+            if (!persist_waiting) {
+                persist_stats.deferred++;
+                persist_waiting = true;
+            }
+            portEXIT_CRITICAL(&persist_lock);
+            continue;
+        }
+
+        portENTER_CRITICAL(&persist_lock);
+        dirty = persist_dirty;
+        persist_dirty = 0;
+        persist_waiting = false;
+        if (!stationary) {
+            persist_stats.forced++;
+        }
+        portEXIT_CRITICAL(&persist_lock);
+        supercar_persist_write(dirty);
+
+        portENTER_CRITICAL(&persist_lock);
+        if (persist_dirty) {
+            // Failed writes, and changes made while writing, wait for a new delay
+            persist_first_mark = persist_last_mark = esp_timer_get_time();
+        }
+        portEXIT_CRITICAL(&persist_lock);
+    }
+}
+
+esp_err_t supercar_persist_start(supercar_t* car)
+{
+    persist_car = car;
+    if (supercar_task_create(SUPERCAR_TASK_PERSIST, supercar_persist_thread, NULL, &persist_task) != pdPASS) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void supercar_persist_serialize(supercar_json_t* node, supercar_t* car)
+{
+    portENTER_CRITICAL(&persist_lock);
+    persist_stats_t stats = persist_stats;
+    uint32_t dirty = persist_dirty;
+    portEXIT_CRITICAL(&persist_lock);
+    supercar_sched_stats_t sched;
+    supercar_sched_get_stats(&sched);
+
+    supercar_json_begin_array(node, "dirty");
+    for (size_t i = 0; i < supercar_sections_count; i++) {
+        if (dirty & (1u << i)) {
+            supercar_json_string(node, NULL, supercar_sections[i]->name);
+        }
+    }
+    supercar_json_end_array(node);
+    supercar_json_int(node, "settle_ms", CONFIG_SUPERCAR_PERSIST_SETTLE_MS);
+    supercar_json_int(node, "max_delay_ms", CONFIG_SUPERCAR_PERSIST_MAX_DELAY_MS);
+    supercar_json_int(node, "marks", stats.marks);
+    supercar_json_int(node, "coalesced", stats.coalesced);
+    supercar_json_int(node, "writes", stats.writes);
+    supercar_json_int(node, "failures", stats.failures);
+    supercar_json_int(node, "deferred", stats.deferred);
+    supercar_json_int(node, "forced", stats.forced);
+    supercar_json_int(node, "write_avg_us", stats.writes ? stats.write_us / stats.writes : 0);
+    supercar_json_int(node, "write_max_us", stats.max_write_us);
+    supercar_json_begin_object(node, "control_stall");
+    supercar_json_int(node, "frames", sched.flash_frames);
+    supercar_json_int(node, "total_us", sched.flash_stall_us);
+    supercar_json_int(node, "max_us", sched.flash_stall_max_us);
+    supercar_json_end_object(node);
+}
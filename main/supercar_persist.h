@@ -0,0 +1,33 @@
+#ifndef _SUPERCAR_PERSIST_H_
+#define _SUPERCAR_PERSIST_H_
+
+#include "esp_system.h"
+#include "supercar_json.h"
+#include "supercar_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start the task saving the sections marked dirty
+ *
+ * Flash writes stall both cores, the task waits for the car to be stationary and for the changes
+ * to settle before it writes, or for the maximum delay.
+ */
+esp_err_t supercar_persist_start(supercar_t* car);
+
+/**
+ * @brief Have the current values of a section saved, from any task
+ *
+ * Repeated changes of the same section before it is written are saved once.
+ */
+void supercar_persist_mark(const supercar_section_t* section);
+
+void supercar_persist_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
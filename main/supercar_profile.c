@@ -0,0 +1,64 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "supercar_profile.h"
+
+static const char* TAG = "PROFILE";
+
+static const char* profile_names[SUPERCAR_PROFILE_MAX] = {
+#define SUPERCAR_PROFILE(id, name, max_speed, delta_speed, acceleration, threshold_forward, threshold_backward) [SUPERCAR_PROFILE_##id] = name,
+#include "supercar_profile.def"
+};
+
+static const supercar_profile_t profile_defaults[SUPERCAR_PROFILE_MAX] = {
+#define SUPERCAR_PROFILE(id, name, ...) [SUPERCAR_PROFILE_##id] = { __VA_ARGS__ },
+#include "supercar_profile.def"
+};
+
+/* Written by the control task only, the other tasks copy them under the lock */
+static supercar_profile_t profiles[SUPERCAR_PROFILE_MAX];
+static portMUX_TYPE profile_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void supercar_profiles_init(void)
+{
+    memcpy(profiles, profile_defaults, sizeof(profiles));
+}
+
+const supercar_profile_t* supercar_profile_get(supercar_profile_id_t id)
+{
+    return &profiles[id];
+}
+
+const char* supercar_profile_name(supercar_profile_id_t id)
+{
+    return id < SUPERCAR_PROFILE_MAX ? profile_names[id] : "none";
+}
+
+supercar_profile_id_t supercar_profile_find(const char* name, size_t len)
+{
+    for (int id = 0; id < SUPERCAR_PROFILE_MAX; id++) {
+        if (strlen(profile_names[id]) == len && !strncmp(profile_names[id], name, len)) {
+            return id;
+        }
+    }
+    return SUPERCAR_PROFILE_MAX;
+}
+
+void supercar_profiles_stage(supercar_profile_t staged[SUPERCAR_PROFILE_MAX])
+{
+    portENTER_CRITICAL(&profile_lock);
+    memcpy(staged, profiles, sizeof(profiles));
+    portEXIT_CRITICAL(&profile_lock);
+}
+
+void supercar_profiles_apply(const supercar_profile_t staged[SUPERCAR_PROFILE_MAX])
+{
+    portENTER_CRITICAL(&profile_lock);
+    memcpy(profiles, staged, sizeof(profiles));
+    portEXIT_CRITICAL(&profile_lock);
+    for (int id = 0; id < SUPERCAR_PROFILE_MAX; id++) {
+        ESP_LOGI(TAG, "%s: max speed %d, increment %d, acceleration %d%%, thresholds %d/%d", profile_names[id],
+            profiles[id].max_speed, profiles[id].delta_speed, profiles[id].acceleration,
+            profiles[id].distance_threshold_forward, profiles[id].distance_threshold_backward);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef _SUPERCAR_PROFILE_H_
+#define _SUPERCAR_PROFILE_H_
+
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+#define SUPERCAR_PROFILE(id, name, max_speed, delta_speed, acceleration, threshold_forward, threshold_backward) SUPERCAR_PROFILE_##id,
+#include "supercar_profile.def"
+    SUPERCAR_PROFILE_MAX
+} supercar_profile_id_t;
+
+#define SUPERCAR_PROFILE_DEFAULT SUPERCAR_PROFILE_KID
+
+/* Settings of one driver, generated from supercar_config.def */
+typedef struct {
+#define SUPERCAR_PROFILE_FIELD(name, type, min, max, units, title) SUPERCAR_FIELD_CTYPE_##type name;
+#include "supercar_config.def"
+} supercar_profile_t;
+
+/**
+ * @brief Load the default values, before the saved ones are read
+ */
+void supercar_profiles_init(void);
+
+/**
+ * @brief Profile in RAM, for the control task, the pointer stays valid when the values change
+ */
+const supercar_profile_t* supercar_profile_get(supercar_profile_id_t id);
+
+const char* supercar_profile_name(supercar_profile_id_t id);
+
+/**
+ * @return SUPERCAR_PROFILE_MAX for an unknown name
+ */
+supercar_profile_id_t supercar_profile_find(const char* name, size_t len);
+
+/**
+ * @brief Copy the values of every profile, from any task
+ */
+void supercar_profiles_stage(supercar_profile_t staged[SUPERCAR_PROFILE_MAX]);
+
+/**
+ * @brief Replace the values, from the control task
+ */
+void supercar_profiles_apply(const supercar_profile_t staged[SUPERCAR_PROFILE_MAX]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
+#include "supercar_main.h"
+#include "supercar_rtc.h"
+
+static const char* TAG = "RTC";
+
+#define RTC_SHADOW_VERSION 1
+#define RTC_STABLE_US (10 * 1000000LL)      // Running that long ends a series of warm restarts
+
+/* Survives the resets that keep the chip powered, protected by a CRC of all the members before it */
+typedef struct {
+    uint32_t magic;                         // Layout of this firmware
+    uint32_t boot_count;                    // Since the last cold boot
+    uint32_t warm_streak;                   // Warm restarts without running RTC_STABLE_US in between
+    int32_t profile;
+    int32_t max_speed;
+    bool has_controller;
+    supercar_rtc_controller_t controller;
+    uint16_t lengths[SUPERCAR_RTC_MAX_SECTIONS];
+    uint8_t records[SUPERCAR_RTC_MAX_SECTIONS][SUPERCAR_RTC_RECORD_MAX];
+    uint32_t crc;
+} rtc_shadow_t;
+
+#define RTC_SHADOW_MAGIC ((0x5343u << 16) | (RTC_SHADOW_VERSION << 12) | sizeof(rtc_shadow_t))
+
+_Static_assert(sizeof(rtc_shadow_t) < (1 << 12), "The size of the RTC shadow is part of its magic");
+
+static RTC_NOINIT_ATTR rtc_shadow_t rtc_shadow;
+static esp_reset_reason_t rtc_reason;
+static bool rtc_warm;
+static bool rtc_restored;
+static int64_t rtc_controller_us;
+static esp_timer_handle_t rtc_stable_timer;
+static portMUX_TYPE rtc_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t supercar_rtc_crc(void)
+{
+    return esp_crc32_le(0, (const uint8_t*) &rtc_shadow, offsetof(rtc_shadow_t, crc));
+}
+
+/* Called with the lock held */
+static void supercar_rtc_seal(void)
+{
+    rtc_shadow.crc = supercar_rtc_crc();
+}
+
+static bool supercar_rtc_warm_reason(esp_reset_reason_t reason)
+{
+    switch (reason) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+    case ESP_RST_DEEPSLEEP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void supercar_rtc_stable(void* arg)
+{
+    portENTER_CRITICAL(&rtc_lock);
+    rtc_shadow.warm_streak = 0;
+    supercar_rtc_seal();
+    portEXIT_CRITICAL(&rtc_lock);
+}
+
+void supercar_rtc_init(void)
+{
+    rtc_reason = esp_reset_reason();
+    bool valid = rtc_shadow.magic == RTC_SHADOW_MAGIC && rtc_shadow.crc == supercar_rtc_crc();
+    rtc_warm = valid && supercar_rtc_warm_reason(rtc_reason);
+    if (rtc_warm && rtc_shadow.warm_streak >= CONFIG_SUPERCAR_RTC_MAX_WARM_RESTARTS) {
+        // The values kept across the resets may be what makes the car reset
+        ESP_LOGW(TAG, "%u warm restarts in a row, starting from NVS", rtc_shadow.warm_streak);
+        rtc_warm = false;
+    }
+    if (!rtc_warm) {
+        uint32_t boot_count = valid ? rtc_shadow.boot_count : 0;
+        memset(&rtc_shadow, 0, sizeof(rtc_shadow));
+        rtc_shadow.magic = RTC_SHADOW_MAGIC;
+        rtc_shadow.boot_count = boot_count;
+        rtc_shadow.profile = SUPERCAR_PROFILE_DEFAULT;
+    } else {
+        rtc_shadow.warm_streak++;
+    }
+    rtc_shadow.boot_count++;
+    supercar_rtc_seal();
+    ESP_LOGI(TAG, "Boot %u, reset reason %d, %s", rtc_shadow.boot_count, rtc_reason, rtc_warm ? "warm" : "cold");
+
+    const esp_timer_create_args_t args = { .callback = supercar_rtc_stable, .name = "rtc_stable" };
+    if (rtc_warm && esp_timer_create(&args, &rtc_stable_timer) == ESP_OK) {
+        esp_timer_start_once(rtc_stable_timer, RTC_STABLE_US);
+    }
+}
+
+bool supercar_rtc_warm(void)
+{
+    return rtc_warm;
+}
+
+esp_err_t supercar_rtc_restore(supercar_t* car)
+{
+    if (!rtc_warm) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    // Only this task touches the shadow until the other stages start
+    for (size_t i = 0; i < supercar_sections_count && i < SUPERCAR_RTC_MAX_SECTIONS; i++) {
+        if (rtc_shadow.lengths[i] == 0) {
+            continue;
+        }
+        esp_err_t err = supercar_section_restore(car, supercar_sections[i], rtc_shadow.records[i], rtc_shadow.lengths[i]);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Could not restore %s: %s", supercar_sections[i]->name, esp_err_to_name(err));
+        }
+    }
+    if (rtc_shadow.profile >= 0 && rtc_shadow.profile < SUPERCAR_PROFILE_MAX) {
+        supercar_select_profile(car, rtc_shadow.profile);
+        supercar_set_max_speed(car, rtc_shadow.max_speed);
+    }
+    rtc_restored = true;
+    return ESP_OK;
+}
+
+void supercar_rtc_capture(supercar_t* car, const supercar_section_t* section)
+{
+    uint8_t record[SUPERCAR_RTC_RECORD_MAX];
+    for (size_t i = 0; i < supercar_sections_count && i < SUPERCAR_RTC_MAX_SECTIONS; i++) {
+        if (supercar_sections[i] != section) {
+            continue;
+        }
+        size_t len = supercar_section_capture(car, section, record, sizeof(record));
+        if (len == 0) {
+            ESP_LOGE(TAG, "%s does not fit in RTC memory", section->name);
+        }
+        portENTER_CRITICAL(&rtc_lock);
+        memcpy(rtc_shadow.records[i], record, len);
+        rtc_shadow.lengths[i] = len;
+        supercar_rtc_seal();
+        portEXIT_CRITICAL(&rtc_lock);
+        return;
+    }
+}
+
+void supercar_rtc_capture_all(supercar_t* car)
+{
+    for (size_t i = 0; i < supercar_sections_count; i++) {
+        supercar_rtc_capture(car, supercar_sections[i]);
+    }
+}
+
+void supercar_rtc_set_profile(supercar_profile_id_t profile, int max_speed)
+{
+    portENTER_CRITICAL(&rtc_lock);
+    rtc_shadow.profile = profile;
+    rtc_shadow.max_speed = max_speed;
+    supercar_rtc_seal();
+    portEXIT_CRITICAL(&rtc_lock);
+}
+
+void supercar_rtc_set_controller(const supercar_rtc_controller_t* controller)
+{
+    portENTER_CRITICAL(&rtc_lock);
+    rtc_shadow.controller = *controller;
+    rtc_shadow.has_controller = true;
+    supercar_rtc_seal();
+    portEXIT_CRITICAL(&rtc_lock);
+}
+
+bool supercar_rtc_get_controller(supercar_rtc_controller_t* controller)
+{
+    portENTER_CRITICAL(&rtc_lock);
+    bool known = rtc_shadow.has_controller;
+    *controller = rtc_shadow.controller;
+    portEXIT_CRITICAL(&rtc_lock);
+    return known;
+}
+
+void supercar_rtc_controller_opened(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&rtc_lock);
+    if (rtc_controller_us == 0) {
+        rtc_controller_us = now;
+    }
+    portEXIT_CRITICAL(&rtc_lock);
+}
+
+void supercar_rtc_serialize(supercar_json_t* node, supercar_t* car)
+{
+    // Not the records, the copy is on the stack of the web server
+    portENTER_CRITICAL(&rtc_lock);
+    uint32_t boot_count = rtc_shadow.boot_count;
+    uint32_t warm_streak = rtc_shadow.warm_streak;
+    supercar_profile_id_t profile = rtc_shadow.profile;
+    bool has_controller = rtc_shadow.has_controller;
+    supercar_rtc_controller_t controller = rtc_shadow.controller;
+    uint16_t lengths[SUPERCAR_RTC_MAX_SECTIONS];
+    memcpy(lengths, rtc_shadow.lengths, sizeof(lengths));
+    int64_t controller_us = rtc_controller_us;
+    portEXIT_CRITICAL(&rtc_lock);
+
+    supercar_json_int(node, "reset_reason", rtc_reason);
+    supercar_json_bool(node, "warm", rtc_warm);
+    supercar_json_bool(node, "restored", rtc_restored);
+    supercar_json_int(node, "boot_count", boot_count);
+    supercar_json_int(node, "warm_streak", warm_streak);
+    supercar_json_int(node, "bytes", sizeof(rtc_shadow_t));
+    supercar_json_begin_array(node, "sections");
+    for (size_t i = 0; i < supercar_sections_count && i < SUPERCAR_RTC_MAX_SECTIONS; i++) {
+        if (lengths[i]) {
+            supercar_json_string(node, NULL, supercar_sections[i]->name);
+        }
+    }
+    supercar_json_end_array(node);
+    supercar_json_string(node, "profile", supercar_profile_name(profile));
+    if (has_controller) {
+        char bda[18];
+        snprintf(bda, sizeof(bda), "%02x:%02x:%02x:%02x:%02x:%02x", controller.bda[0], controller.bda[1],
+            controller.bda[2], controller.bda[3], controller.bda[4], controller.bda[5]);
+        supercar_json_string(node, "controller", bda);
+    }
+    // Time to drive is the drive milestone of the boot timeline, this one includes the gamepad connection
+    if (controller_us) {
+        supercar_json_int(node, "controller_us", controller_us);
+    }
+}
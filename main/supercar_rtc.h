@@ -0,0 +1,71 @@
+#ifndef _SUPERCAR_RTC_H_
+#define _SUPERCAR_RTC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_system.h"
+#include "supercar_json.h"
+#include "supercar_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUPERCAR_RTC_MAX_SECTIONS 8
+#define SUPERCAR_RTC_RECORD_MAX 176         // Largest record of a section, the tasks one
+
+/* Last gamepad that connected */
+typedef struct {
+    uint8_t bda[6];
+    uint8_t transport;                      // esp_hid_transport_t
+    uint8_t addr_type;                      // esp_ble_addr_type_t, BLE only
+} supercar_rtc_controller_t;
+
+/**
+ * @brief Check the copy kept in RTC memory and count the boot, first thing at start up
+ *
+ * The copy is only trusted after a watchdog, panic, brownout or software reset, and at most
+ * CONFIG_SUPERCAR_RTC_MAX_WARM_RESTARTS times in a row.
+ */
+void supercar_rtc_init(void);
+
+bool supercar_rtc_warm(void);
+
+/**
+ * @brief Apply the sections, profile and speed in use before a warm reset, without reading NVS
+ *
+ * @return ESP_ERR_NOT_FOUND after a cold boot
+ */
+esp_err_t supercar_rtc_restore(supercar_t* car);
+
+/**
+ * @brief Copy the current values of a section, from any task, once they are applied
+ */
+void supercar_rtc_capture(supercar_t* car, const supercar_section_t* section);
+
+void supercar_rtc_capture_all(supercar_t* car);
+
+/**
+ * @brief Copy the active profile and speed limit, from the control task
+ */
+void supercar_rtc_set_profile(supercar_profile_id_t profile, int max_speed);
+
+void supercar_rtc_set_controller(const supercar_rtc_controller_t* controller);
+
+/**
+ * @return false when no gamepad connected since the last cold boot
+ */
+bool supercar_rtc_get_controller(supercar_rtc_controller_t* controller);
+
+/**
+ * @brief Record the first connection of the gamepad since boot
+ */
+void supercar_rtc_controller_opened(void);
+
+void supercar_rtc_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
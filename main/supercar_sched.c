@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "supercar_sched.h"
+#include "supercar_tasks.h"
+
+static const char* TAG = "SCHED";
+
+static const supercar_slot_t* sched_slots;
+static int sched_num_slots;
+static TaskHandle_t sched_task;
+static esp_timer_handle_t sched_timer;
+static volatile int64_t sched_released;
+static volatile int64_t sched_flash_start;      // Last flash write, 0 before the first one
+static volatile int64_t sched_flash_end;        // 0 while writing
+
+static supercar_sched_stats_t sched_stats;
+static portMUX_TYPE sched_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void supercar_sched_tick(void* arg)
+{
+    sched_released = esp_timer_get_time();
+    xTaskNotifyGive(sched_task);
+}
+
+static void supercar_sched_frame(uint32_t pending)
+{
+    uint32_t elapsed[SUPERCAR_SCHED_MAX_SLOTS];
+    int64_t frame_start = esp_timer_get_time();
+    uint32_t latency = frame_start - sched_released;
+    int64_t slot_start = frame_start;
+    for (int i = 0; i < sched_num_slots; i++) {
+        sched_slots[i].run(sched_slots[i].arg);
+        int64_t slot_end = esp_timer_get_time();
+        elapsed[i] = slot_end - slot_start;
+        slot_start = slot_end;
+    }
+    uint32_t frame_time = slot_start - frame_start;
+    // The frame answers the first of the pending ticks, a flash write overlapping the wait delayed it
+    uint32_t delay = latency + (pending - 1) * sched_stats.period_us;
+    int64_t flash_start = sched_flash_start;
+    int64_t flash_end = sched_flash_end;
+    bool flash = flash_start && flash_start < frame_start && (flash_end == 0 || flash_end > frame_start - delay);
+
+    portENTER_CRITICAL(&sched_stats_lock);
+    if (flash) {
+        sched_stats.flash_frames++;
+        sched_stats.flash_stall_us += delay;
+        if (delay > sched_stats.flash_stall_max_us)
+            sched_stats.flash_stall_max_us = delay;
+    }
+    sched_stats.frames++;
+    // The tick count piles up while a frame runs late
+    sched_stats.missed += pending - 1;
+    sched_stats.latency_total_us += latency;
+    if (latency > sched_stats.latency_max_us)
+        sched_stats.latency_max_us = latency;
+    if (frame_time > sched_stats.period_us)
+        sched_stats.overruns++;
+    if (frame_time > sched_stats.wcet_us)
+        sched_stats.wcet_us = frame_time;
+    for (int i = 0; i < sched_num_slots; i++) {
+        supercar_slot_stats_t* slot = &sched_stats.slots[i];
+        slot->runs++;
+        slot->total_us += elapsed[i];
+        if (elapsed[i] > sched_slots[i].budget_us)
+            slot->overruns++;
+        if (elapsed[i] > slot->wcet_us)
+            slot->wcet_us = elapsed[i];
+    }
+    portEXIT_CRITICAL(&sched_stats_lock);
+}
+
+static void supercar_sched_thread(void* arg)
+{
+    while (1) {
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (pending) {
+            supercar_sched_frame(pending);
+        }
+    }
+}
+
+esp_err_t supercar_sched_start(const supercar_slot_t* slots, int num_slots, uint32_t period_us)
+{
+    if (num_slots > SUPERCAR_SCHED_MAX_SLOTS) {
+        ESP_LOGE(TAG, "Too many slots: %d", num_slots);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t budget = 0;
+    for (int i = 0; i < num_slots; i++) {
+        budget += slots[i].budget_us;
+        sched_stats.slots[i].name = slots[i].name;
+    }
+    if (budget > period_us) {
+        ESP_LOGW(TAG, "Slot budgets (%u us) exceed the major frame (%u us)", budget, period_us);
+    }
+    sched_slots = slots;
+    sched_num_slots = num_slots;
+    sched_stats.period_us = period_us;
+    sched_stats.num_slots = num_slots;
+
+    // The timer notifies the task, it is never started without it
+    if (supercar_task_create(SUPERCAR_TASK_SCHED, supercar_sched_thread, NULL, &sched_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = supercar_sched_tick,
+        .name = "supercar_sched"
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &sched_timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(TAG, "Running %d slots every %u us", num_slots, period_us);
+    return esp_timer_start_periodic(sched_timer, period_us);
+}
+
+void supercar_sched_get_stats(supercar_sched_stats_t* stats)
+{
+    portENTER_CRITICAL(&sched_stats_lock);
+    *stats = sched_stats;
+    portEXIT_CRITICAL(&sched_stats_lock);
+}
+
+void supercar_sched_reset_stats(void)
+{
+    portENTER_CRITICAL(&sched_stats_lock);
+    sched_stats.frames = 0;
+    sched_stats.overruns = 0;
+    sched_stats.missed = 0;
+    sched_stats.wcet_us = 0;
+    sched_stats.latency_total_us = 0;
+    sched_stats.latency_max_us = 0;
+    sched_stats.flash_frames = 0;
+    sched_stats.flash_stall_us = 0;
+    sched_stats.flash_stall_max_us = 0;
+    for (int i = 0; i < sched_stats.num_slots; i++) {
+        supercar_slot_stats_t* slot = &sched_stats.slots[i];
+        slot->runs = 0;
+        slot->overruns = 0;
+        slot->wcet_us = 0;
+        slot->total_us = 0;
+    }
+    portEXIT_CRITICAL(&sched_stats_lock);
+}
+
+void supercar_sched_flash_begin(void)
+{
+    sched_flash_end = 0;
+    sched_flash_start = esp_timer_get_time();
+}
+
+void supercar_sched_flash_end(void)
+{
+    sched_flash_end = esp_timer_get_time();
+}
+
+void supercar_sched_serialize(supercar_json_t* node, supercar_t* car)
+{
+    supercar_sched_stats_t stats;
+    supercar_sched_get_stats(&stats);
+    supercar_json_int(node, "period_us", stats.period_us);
+    supercar_json_int(node, "frames", stats.frames);
+    supercar_json_int(node, "overruns", stats.overruns);
+    supercar_json_int(node, "missed", stats.missed);
+    supercar_json_int(node, "wcet_us", stats.wcet_us);
+    supercar_json_int(node, "latency_avg_us", stats.frames ? stats.latency_total_us / stats.frames : 0);
+    supercar_json_int(node, "latency_max_us", stats.latency_max_us);
+    supercar_json_int(node, "flash_frames", stats.flash_frames);
+    supercar_json_int(node, "flash_stall_us", stats.flash_stall_us);
+    supercar_json_int(node, "flash_stall_max_us", stats.flash_stall_max_us);
+    supercar_json_begin_array(node, "slots");
+    for (int i = 0; i < stats.num_slots; i++) {
+        supercar_slot_stats_t* slot = &stats.slots[i];
+        supercar_json_begin_object(node, NULL);
+        supercar_json_string(node, "name", slot->name);
+        supercar_json_int(node, "budget_us", sched_slots[i].budget_us);
+        supercar_json_int(node, "runs", slot->runs);
+        supercar_json_int(node, "overruns", slot->overruns);
+        supercar_json_int(node, "wcet_us", slot->wcet_us);
+        supercar_json_int(node, "avg_us", slot->runs ? slot->total_us / slot->runs : 0);
+        supercar_json_end_object(node);
+    }
+    supercar_json_end_array(node);
+}
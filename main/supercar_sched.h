@@ -0,0 +1,69 @@
+#ifndef _SUPERCAR_SCHED_H_
+#define _SUPERCAR_SCHED_H_
+
+#include "esp_system.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUPERCAR_SCHED_MAX_SLOTS 8
+
+/* One stage of the major frame, slots run in declaration order */
+typedef struct {
+    const char* name;
+    void (*run)(void* arg);
+    void* arg;
+    uint32_t budget_us;                 // Execution time allowed to the slot in each frame
+} supercar_slot_t;
+
+typedef struct {
+    const char* name;
+    uint32_t runs;
+    uint32_t overruns;                  // Runs longer than the slot budget
+    uint32_t wcet_us;                   // Worst case execution time
+    uint64_t total_us;
+} supercar_slot_stats_t;
+
+typedef struct {
+    uint32_t period_us;
+    uint32_t frames;
+    uint32_t overruns;                  // Frames whose slots did not fit in the period
+    uint32_t missed;                    // Frames skipped because the previous one was still running
+    uint32_t wcet_us;                   // Worst case execution time of a whole frame
+    uint64_t latency_total_us;          // Delay between the timer tick and the start of the frame
+    uint32_t latency_max_us;
+    uint32_t flash_frames;              // Frames released while a flash write held the cores
+    uint64_t flash_stall_us;            // Their delay, from the first tick they answer to their start
+    uint32_t flash_stall_max_us;
+    int num_slots;
+    supercar_slot_stats_t slots[SUPERCAR_SCHED_MAX_SLOTS];
+} supercar_sched_stats_t;
+
+/**
+ * @brief Start running the slots at a fixed rate
+ *
+ * @param slots Slot table, it must outlive the scheduler
+ * @param period_us Major frame period
+ */
+esp_err_t supercar_sched_start(const supercar_slot_t* slots, int num_slots, uint32_t period_us);
+
+void supercar_sched_get_stats(supercar_sched_stats_t* stats);
+
+void supercar_sched_reset_stats(void);
+
+/**
+ * @brief Bracket a flash write, the frames it delays are counted apart
+ */
+void supercar_sched_flash_begin(void);
+void supercar_sched_flash_end(void);
+
+void supercar_sched_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,8 +9,10 @@
 
 #include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/rmt.h"
 #include "supercar_sensor.h"
+#include "supercar_tasks.h"
 #include "freertos/semphr.h"
 
 static const char* TAG = "sensor";
@@ -65,6 +67,7 @@ static void sensor_rx_task(void *arg)
                 current++;
             }
 
+            report.timestamp = esp_timer_get_time();
             xQueueSend(supercar->distance_events, &report, 100 / portTICK_PERIOD_MS);
             if(!(s++ % 8))
                 ESP_LOGD(TAG, "Distance report %d %d %d %d", array[0].distance, array[1].distance, array[2].distance, array[3].distance);
@@ -81,5 +84,5 @@ static void sensor_rx_task(void *arg)
 
 void init_distance_sensor_rx(supercar_t* car)
 {
-    xTaskCreatePinnedToCore(sensor_rx_task, "sensor_rx_task", 2048, car, 10, NULL, 1);
+    supercar_task_create(SUPERCAR_TASK_SENSOR, sensor_rx_task, car, NULL);
 }
@@ -16,6 +16,7 @@ typedef struct {
     sensor_distance_t b;
     sensor_distance_t c;
     sensor_distance_t d;
+    int64_t timestamp;
 } distance_sensor_report_t;
 
 
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "supercar_snapshot.h"
+
+/* Readers give the CPU back after this many attempts, in case they preempted the writer */
+#define SNAPSHOT_SPIN_LIMIT 16
+
+/* Seqlock: the sequence is odd while the writer copies the state */
+static supercar_snapshot_t snapshot;
+static uint32_t snapshot_seq;
+
+/* Writer side copy, to detect changes without reading the shared one */
+static supercar_snapshot_t snapshot_last;
+
+static uint32_t snapshot_published;
+static uint32_t snapshot_reads;
+static uint32_t snapshot_retries;
+
+static void supercar_snapshot_motor(supercar_motor_snapshot_t* snap, supercar_motor_control_t* motor)
+{
+    snap->start_time = motor->start_time;
+    snap->start_flag = motor->start_flag;
+    snap->duty_cycle = motor->duty_cycle;
+    snap->expt = motor->expt;
+    snap->direction = motor->direction;
+    snap->cfg = motor->cfg;
+    snap->reconfiguring = brushed_motor_reconfiguring(motor);
+    snap->reconfig = motor->reconfig;
+}
+
+void supercar_snapshot_publish(supercar_t* car)
+{
+    supercar_snapshot_t next;
+    // Padding included, so that memcmp only sees real changes
+    memset(&next, 0, sizeof(next));
+    next.state = car->state;
+    next.state_name = supercar_get_state_name(car);
+    next.control_type = supercar_get_control_type(car);
+    next.running = supercar_get_running(car);
+    next.mode = supercar_get_mode(car);
+    next.applied_mode = car->applied_mode;
+    next.steering = car->steering;
+    next.power = car->power;
+    next.reverse_direction = car->reverse_direction;
+    next.reverse_mode = car->reverse_mode;
+    next.distance = car->distance;
+    next.cfg = car->cfg;
+    next.profile = car->profile_id;
+    next.max_speed = car->max_speed;
+    supercar_snapshot_motor(&next.propulsion, &car->propulsion_motor_ctrl);
+    supercar_snapshot_motor(&next.steering_motor, &car->steering_motor_ctrl);
+
+    next.version = snapshot_last.version;
+    next.timestamp = snapshot_last.timestamp;
+    if (snapshot_published && !memcmp(&next, &snapshot_last, sizeof(next))) {
+        return;
+    }
+    next.version++;
+    next.timestamp = esp_timer_get_time();
+    memcpy(&snapshot_last, &next, sizeof(snapshot_last));
+
+    uint32_t seq = snapshot_seq;
+    __atomic_store_n(&snapshot_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&snapshot, &next, sizeof(snapshot));
+    __atomic_store_n(&snapshot_seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&snapshot_published, 1, __ATOMIC_RELAXED);
+}
+
+void supercar_snapshot_read(supercar_snapshot_t* out)
+{
+    uint32_t begin, end;
+    int attempts = 0;
+    while (1) {
+        begin = __atomic_load_n(&snapshot_seq, __ATOMIC_ACQUIRE);
+        if (!(begin & 1)) {
+            memcpy(out, &snapshot, sizeof(*out));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            end = __atomic_load_n(&snapshot_seq, __ATOMIC_RELAXED);
+            if (begin == end)
+                break;
+        }
+        __atomic_add_fetch(&snapshot_retries, 1, __ATOMIC_RELAXED);
+        if (++attempts % SNAPSHOT_SPIN_LIMIT == 0)
+            vTaskDelay(1);
+    }
+    __atomic_add_fetch(&snapshot_reads, 1, __ATOMIC_RELAXED);
+}
+
+uint32_t supercar_snapshot_version(void)
+{
+    supercar_snapshot_t current;
+    supercar_snapshot_read(&current);
+    return current.version;
+}
+
+void supercar_snapshot_get_stats(supercar_snapshot_stats_t* stats)
+{
+    stats->published = __atomic_load_n(&snapshot_published, __ATOMIC_RELAXED);
+    stats->reads = __atomic_load_n(&snapshot_reads, __ATOMIC_RELAXED);
+    stats->retries = __atomic_load_n(&snapshot_retries, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,70 @@
+#ifndef _SUPERCAR_SNAPSHOT_H_
+#define _SUPERCAR_SNAPSHOT_H_
+
+#include "esp_system.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t start_time;
+    bool start_flag;
+    float duty_cycle;
+    float expt;
+    motor_direction_t direction;
+    supercar_motor_config_t cfg;
+    bool reconfiguring;                     // Ramping down to apply a new frequency or new pins
+    brushed_motor_reconfig_stats_t reconfig;
+} supercar_motor_snapshot_t;
+
+/* Copy of the car state for the readers outside of the control task */
+typedef struct {
+    uint32_t version;                       // Incremented on every published change
+    int64_t timestamp;                      // Time of the change
+    supercar_state_t state;
+    const char* state_name;
+    supercar_control_type_t control_type;
+    supercar_direction_t running;
+    supercar_mode_t mode;                   // Mode with reverse_mode applied
+    supercar_mode_t applied_mode;
+    supercar_steer_t steering;
+    bool power;
+    bool reverse_direction;
+    bool reverse_mode;
+    supercar_distance_sensor_t distance;
+    supercar_config_t cfg;
+    supercar_profile_id_t profile;
+    int max_speed;                          // Pedal speed, at most that of the profile
+    supercar_motor_snapshot_t propulsion;
+    supercar_motor_snapshot_t steering_motor;
+} supercar_snapshot_t;
+
+typedef struct {
+    uint32_t published;
+    uint32_t reads;
+    uint32_t retries;                       // Reads that overlapped a publication and were done again
+} supercar_snapshot_stats_t;
+
+/**
+ * @brief Publish the car state if it changed since the last call, never blocks
+ *
+ * Only the control task may call it.
+ */
+void supercar_snapshot_publish(supercar_t* car);
+
+/**
+ * @brief Copy the last published state, from any task, without taking a lock
+ */
+void supercar_snapshot_read(supercar_snapshot_t* snapshot);
+
+uint32_t supercar_snapshot_version(void);
+
+void supercar_snapshot_get_stats(supercar_snapshot_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "supercar_tasks.h"
+
+static const char* TAG = "TASKS";
+
+/* Generated from supercar_tasks.def */
+static supercar_task_t supercar_tasks[SUPERCAR_TASK_MAX] = {
+#define SUPERCAR_TASK(id, task_name, task_core, task_priority, task_stack) \
+    [SUPERCAR_TASK_##id] = { .name = task_name, .core = task_core, .priority = task_priority, .stack = task_stack },
+#include "supercar_tasks.def"
+};
+
+const supercar_task_t* supercar_task_get(supercar_task_id_t id)
+{
+    return &supercar_tasks[id];
+}
+
+BaseType_t supercar_task_create(supercar_task_id_t id, TaskFunction_t fn, void* arg, TaskHandle_t* handle)
+{
+    supercar_task_t* task = &supercar_tasks[id];
+    BaseType_t core = task->core < 0 ? tskNO_AFFINITY : task->core;
+    ESP_LOGI(TAG, "Starting %s on core %d, priority %d, stack %u", task->name, task->core, task->priority, task->stack);
+    BaseType_t ret = xTaskCreatePinnedToCore(fn, task->name, task->stack, arg, task->priority, &task->handle, core);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Could not start %s", task->name);
+        task->handle = NULL;
+    }
+    if (handle) {
+        *handle = task->handle;
+    }
+    return ret;
+}
+
+void supercar_task_exit(supercar_task_id_t id)
+{
+    supercar_tasks[id].handle = NULL;
+    vTaskDelete(NULL);
+}
+
+void supercar_serialize_tasks(supercar_json_t* node, supercar_t* car)
+{
+    for (int i = 0; i < SUPERCAR_TASK_MAX; i++) {
+        supercar_task_t* task = &supercar_tasks[i];
+        supercar_json_begin_object(node, task->name);
+        supercar_json_int(node, "core", task->core);
+        supercar_json_int(node, "priority", task->priority);
+        supercar_json_int(node, "stack", task->stack);
+        if (task->handle) {
+            supercar_json_int(node, "stack_free", uxTaskGetStackHighWaterMark(task->handle));
+        }
+        supercar_json_end_object(node);
+    }
+}
+
+void supercar_tasks_stage(supercar_task_placement_t placement[SUPERCAR_TASK_MAX])
+{
+    for (int i = 0; i < SUPERCAR_TASK_MAX; i++) {
+        placement[i].core = supercar_tasks[i].core;
+        placement[i].priority = supercar_tasks[i].priority;
+        placement[i].stack = supercar_tasks[i].stack;
+    }
+}
+
+bool supercar_task_placement_valid(const supercar_task_placement_t* placement)
+{
+    return placement->core >= -1 && placement->core < portNUM_PROCESSORS
+        && placement->priority > 0 && placement->priority < configMAX_PRIORITIES
+        && placement->stack >= SUPERCAR_TASK_MIN_STACK && placement->stack <= SUPERCAR_TASK_MAX_STACK;
+}
+
+esp_err_t supercar_tasks_stage_field(supercar_task_placement_t placement[SUPERCAR_TASK_MAX], const char* path, const supercar_json_value_t* value)
+{
+    const char* member = strrchr(path, '.');
+    if (member == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t name_len = member++ - path;
+    for (int i = 0; i < SUPERCAR_TASK_MAX; i++) {
+        if (strlen(supercar_tasks[i].name) != name_len || strncmp(supercar_tasks[i].name, path, name_len)) {
+            continue;
+        }
+        int number;
+        if (!strcmp(member, "core")) {
+            if (!supercar_json_get_int(value, -1, portNUM_PROCESSORS - 1, &number)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            placement[i].core = number;
+        } else if (!strcmp(member, "priority")) {
+            if (!supercar_json_get_int(value, 1, configMAX_PRIORITIES - 1, &number)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            placement[i].priority = number;
+        } else if (!strcmp(member, "stack")) {
+            if (!supercar_json_get_int(value, SUPERCAR_TASK_MIN_STACK, SUPERCAR_TASK_MAX_STACK, &number)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            placement[i].stack = number;
+        } else if (!strcmp(member, "stack_free")) {
+            // Reported by GET, sent back as is by clients editing the document
+            return ESP_OK;
+        } else {
+            return ESP_ERR_NOT_FOUND;
+        }
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+void supercar_tasks_apply(const supercar_task_placement_t placement[SUPERCAR_TASK_MAX])
+{
+    for (int i = 0; i < SUPERCAR_TASK_MAX; i++) {
+        supercar_task_t* task = &supercar_tasks[i];
+        task->core = placement[i].core;
+        task->stack = placement[i].stack;
+        if (placement[i].priority != task->priority) {
+            task->priority = placement[i].priority;
+            if (task->handle) {
+                vTaskPrioritySet(task->handle, task->priority);
+            }
+        }
+        ESP_LOGI(TAG, "%s: core %d, priority %d, stack %u", task->name, task->core, task->priority, task->stack);
+    }
+}
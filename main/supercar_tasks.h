@@ -0,0 +1,77 @@
+#ifndef _SUPERCAR_TASKS_H_
+#define _SUPERCAR_TASKS_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+#define SUPERCAR_TASK(id, name, core, priority, stack) SUPERCAR_TASK_##id,
+#include "supercar_tasks.def"
+    SUPERCAR_TASK_MAX
+} supercar_task_id_t;
+
+typedef struct {
+    const char* name;
+    int core;                       // -1 for no affinity
+    int priority;
+    uint32_t stack;
+    TaskHandle_t handle;            // Set once the task is created, NULL for tasks created by IDF components
+} supercar_task_t;
+
+/* Placement of one task, as staged from a request before it is applied */
+typedef struct {
+    int core;
+    int priority;
+    uint32_t stack;
+} supercar_task_placement_t;
+
+#define SUPERCAR_TASK_MIN_STACK 2048
+#define SUPERCAR_TASK_MAX_STACK CONFIG_SUPERCAR_TASK_MAX_STACK
+
+const supercar_task_t* supercar_task_get(supercar_task_id_t id);
+
+/**
+ * @brief Create a task with the placement of its table entry
+ */
+BaseType_t supercar_task_create(supercar_task_id_t id, TaskFunction_t fn, void* arg, TaskHandle_t* handle);
+
+/**
+ * @brief Delete the calling task, to be used by tasks that end instead of vTaskDelete
+ */
+void supercar_task_exit(supercar_task_id_t id);
+
+void supercar_serialize_tasks(supercar_json_t* node, supercar_t* car);
+
+/**
+ * @brief Current placement of every task
+ */
+void supercar_tasks_stage(supercar_task_placement_t placement[SUPERCAR_TASK_MAX]);
+
+/**
+ * @brief The placement is in the bounds the stage accepts, for the records read from NVS or RTC memory
+ */
+bool supercar_task_placement_valid(const supercar_task_placement_t* placement);
+
+/**
+ * @brief Stage one "<task name>.<core|priority|stack>" member
+ *
+ * @return ESP_ERR_NOT_FOUND for an unknown task or member, ESP_ERR_INVALID_ARG for a value out of bounds
+ */
+esp_err_t supercar_tasks_stage_field(supercar_task_placement_t placement[SUPERCAR_TASK_MAX], const char* path, const supercar_json_value_t* value);
+
+/**
+ * @brief Update the task table, priorities of running tasks change immediately, core and stack on next boot
+ */
+void supercar_tasks_apply(const supercar_task_placement_t placement[SUPERCAR_TASK_MAX]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
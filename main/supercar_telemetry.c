@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "supercar_telemetry.h"
+#include "supercar_snapshot.h"
+#include "supercar_tasks.h"
+#include "supercar_json.h"
+#include "cJSON.h"
+
+static const char* TAG = "TELEMETRY";
+
+#define TELEMETRY_FRAME_SIZE 512
+
+typedef struct {
+    int fd;                             // -1 when the slot is free
+    uint32_t generation;                // Tells a reused slot from the session a frame was built for
+    uint32_t period_us;
+    int64_t attached;
+    int64_t last_sent;
+    bool in_flight;                     // A frame is queued to the server task, the next one waits
+    bool synced;                        // The client got a full state, deltas can follow
+    supercar_snapshot_t last;           // State the client has
+    uint32_t frames;
+    uint32_t bytes;
+    uint64_t build_us;                  // Time spent in the telemetry task
+    uint64_t send_us;                   // Time spent in the server task
+} telemetry_client_t;
+
+typedef struct {
+    int index;
+    uint32_t generation;
+    int fd;
+    size_t len;
+    char payload[TELEMETRY_FRAME_SIZE];
+} telemetry_frame_t;
+
+static httpd_handle_t telemetry_server;
+static telemetry_client_t telemetry_clients[TELEMETRY_MAX_CLIENTS];
+static portMUX_TYPE telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* telemetry_mode_name(supercar_mode_t mode)
+{
+    return mode == MOTION ? "MOTION" : "SWAY";
+}
+
+static const char* telemetry_direction_name(supercar_direction_t running)
+{
+    return running == DIRECTION_NONE ? "NONE" : (running == DIRECTION_FORWARD ? "FORWARD" : "BACKWARD");
+}
+
+static const char* telemetry_steer_name(supercar_steer_t steering)
+{
+    return steering == STEER_NONE ? "NONE" : (steering == STEER_LEFT ? "LEFT" : "RIGHT");
+}
+
+static void telemetry_motor_delta(supercar_json_t* w, const char* key, const supercar_motor_snapshot_t* next,
+    const supercar_motor_snapshot_t* prev, bool full)
+{
+    if (!full && next->start_time == prev->start_time && next->start_flag == prev->start_flag
+        && next->duty_cycle == prev->duty_cycle && next->expt == prev->expt && next->direction == prev->direction) {
+        return;
+    }
+    supercar_json_begin_object(w, key);
+    supercar_json_number(w, "start_time", next->start_time);
+    supercar_json_bool(w, "start_flag", next->start_flag);
+    supercar_json_number(w, "duty_cycle", next->duty_cycle);
+    supercar_json_string(w, "direction", next->direction == MOTOR_LEFT ? "LEFT" : "RIGHT");
+    supercar_json_number(w, "expt", next->expt);
+    supercar_json_end_object(w);
+}
+
+/* Same names as /api/supercar, only the members that changed since the previous frame */
+static size_t telemetry_build_delta(char* buf, size_t size, const supercar_snapshot_t* next, const supercar_snapshot_t* prev, bool full)
+{
+    supercar_json_t w;
+    supercar_json_init(&w, buf, size, NULL, NULL);
+    supercar_json_begin_object(&w, NULL);
+    supercar_json_number(&w, "version", next->version);
+    if (full)
+        supercar_json_bool(&w, "full", true);
+    if (full || next->power != prev->power)
+        supercar_json_bool(&w, "power", next->power);
+    if (full || next->mode != prev->mode)
+        supercar_json_string(&w, "mode", telemetry_mode_name(next->mode));
+    if (full || next->applied_mode != prev->applied_mode)
+        supercar_json_string(&w, "applied_mode", telemetry_mode_name(next->applied_mode));
+    if (full || next->state != prev->state) {
+        supercar_json_string(&w, "state", next->state_name);
+        supercar_json_string(&w, "control_type", next->control_type == LOCAL ? "LOCAL" : "REMOTE");
+        supercar_json_string(&w, "running", telemetry_direction_name(next->running));
+    }
+    if (full || next->steering != prev->steering)
+        supercar_json_string(&w, "steering", telemetry_steer_name(next->steering));
+    if (full || next->reverse_direction != prev->reverse_direction)
+        supercar_json_bool(&w, "reverse_direction", next->reverse_direction);
+    if (full || next->reverse_mode != prev->reverse_mode)
+        supercar_json_bool(&w, "reverse_mode", next->reverse_mode);
+    if (full || memcmp(&next->distance, &prev->distance, sizeof(next->distance))) {
+        supercar_json_begin_object(&w, "distance");
+        supercar_json_number(&w, "front_left", next->distance.front_left);
+        supercar_json_number(&w, "front_right", next->distance.front_right);
+        supercar_json_number(&w, "back_left", next->distance.back_left);
+        supercar_json_number(&w, "back_right", next->distance.back_right);
+        supercar_json_end_object(&w);
+    }
+    telemetry_motor_delta(&w, "propulsion_motor_ctrl", &next->propulsion, &prev->propulsion, full);
+    telemetry_motor_delta(&w, "steering_motor_ctrl", &next->steering_motor, &prev->steering_motor, full);
+    supercar_json_end_object(&w);
+    if (supercar_json_finish(&w) != ESP_OK)
+        ESP_LOGW(TAG, "Delta truncated");
+    return w.len;
+}
+
+/* Runs in the server task, the only one writing to the sockets */
+static void telemetry_send(void* arg)
+{
+    telemetry_frame_t* frame = arg;
+    int64_t start = esp_timer_get_time();
+    httpd_ws_frame_t ws_frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t*)frame->payload,
+        .len = frame->len
+    };
+    esp_err_t err = httpd_ws_send_frame_async(telemetry_server, frame->fd, &ws_frame);
+    uint32_t elapsed = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&telemetry_lock);
+    telemetry_client_t* client = &telemetry_clients[frame->index];
+    if (client->generation == frame->generation && client->fd == frame->fd) {
+        client->in_flight = false;
+        client->send_us += elapsed;
+        if (err == ESP_OK) {
+            client->frames++;
+            client->bytes += frame->len;
+        }
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Could not send to %d: %s", frame->fd, esp_err_to_name(err));
+    }
+    free(frame);
+}
+
+static void telemetry_push(int index, const supercar_snapshot_t* snap, int64_t now)
+{
+    telemetry_client_t* client = &telemetry_clients[index];
+
+    portENTER_CRITICAL(&telemetry_lock);
+    bool due = client->fd >= 0 && !client->in_flight && now - client->last_sent >= client->period_us
+        && (!client->synced || client->last.version != snap->version);
+    int fd = client->fd;
+    uint32_t generation = client->generation;
+    bool full = !client->synced;
+    portEXIT_CRITICAL(&telemetry_lock);
+    if (!due)
+        return;
+
+    telemetry_frame_t* frame = malloc(sizeof(telemetry_frame_t));
+    if (!frame)
+        return;
+    // Only this task writes the last state, no need to hold the lock while building
+    frame->len = telemetry_build_delta(frame->payload, sizeof(frame->payload), snap, &client->last, full);
+    frame->index = index;
+    frame->generation = generation;
+    frame->fd = fd;
+    uint32_t elapsed = esp_timer_get_time() - now;
+
+    portENTER_CRITICAL(&telemetry_lock);
+    bool queued = false;
+    if (client->generation == generation) {
+        client->last = *snap;
+        client->synced = true;
+        client->last_sent = now;
+        client->build_us += elapsed;
+        client->in_flight = true;
+        queued = true;
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+
+    if (!queued || httpd_queue_work(telemetry_server, telemetry_send, frame) != ESP_OK) {
+        free(frame);
+        portENTER_CRITICAL(&telemetry_lock);
+        if (client->generation == generation)
+            client->in_flight = false;
+        portEXIT_CRITICAL(&telemetry_lock);
+    }
+}
+
+static void telemetry_thread(void* arg)
+{
+    supercar_snapshot_t snap;
+    while (1) {
+        vTaskDelay(1);
+        supercar_snapshot_read(&snap);
+        int64_t now = esp_timer_get_time();
+        for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+            telemetry_push(i, &snap, now);
+        }
+    }
+}
+
+static void telemetry_attach(int fd)
+{
+    portENTER_CRITICAL(&telemetry_lock);
+    int free_slot = -1;
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        if (telemetry_clients[i].fd == fd) {
+            portEXIT_CRITICAL(&telemetry_lock);
+            return;
+        }
+        if (telemetry_clients[i].fd < 0 && free_slot < 0)
+            free_slot = i;
+    }
+    if (free_slot >= 0) {
+        telemetry_client_t* client = &telemetry_clients[free_slot];
+        uint32_t generation = client->generation + 1;
+        memset(client, 0, sizeof(*client));
+        client->fd = fd;
+        client->generation = generation;
+        client->period_us = 1000000 / TELEMETRY_DEFAULT_RATE;
+        client->attached = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+    if (free_slot < 0) {
+        ESP_LOGW(TAG, "No room for telemetry client %d", fd);
+    }
+}
+
+static void telemetry_set_rate(int fd, int rate)
+{
+    if (rate < 1)
+        rate = 1;
+    if (rate > TELEMETRY_MAX_RATE)
+        rate = TELEMETRY_MAX_RATE;
+    portENTER_CRITICAL(&telemetry_lock);
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        if (telemetry_clients[i].fd == fd)
+            telemetry_clients[i].period_us = 1000000 / rate;
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+}
+
+esp_err_t supercar_telemetry_ws_handler(httpd_req_t* req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    if (req->method == HTTP_GET) {
+        ESP_LOGI(TAG, "Client %d connected", fd);
+        telemetry_attach(fd);
+        return ESP_OK;
+    }
+
+    uint8_t buf[64];
+    httpd_ws_frame_t frame = { .type = HTTPD_WS_TYPE_TEXT };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK)
+        return err;
+    if (frame.len >= sizeof(buf))
+        return ESP_ERR_INVALID_SIZE;
+    frame.payload = buf;
+    err = httpd_ws_recv_frame(req, &frame, frame.len);
+    if (err != ESP_OK)
+        return err;
+    buf[frame.len] = '\0';
+
+    cJSON* msg = cJSON_Parse((const char*)buf);
+    cJSON* rate = cJSON_GetObjectItem(msg, "rate");
+    if (cJSON_IsNumber(rate)) {
+        telemetry_set_rate(fd, rate->valueint);
+    }
+    cJSON_Delete(msg);
+    return ESP_OK;
+}
+
+void supercar_telemetry_session_closed(int sockfd)
+{
+    portENTER_CRITICAL(&telemetry_lock);
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        if (telemetry_clients[i].fd == sockfd) {
+            telemetry_clients[i].fd = -1;
+            telemetry_clients[i].generation++;
+        }
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+}
+
+esp_err_t supercar_telemetry_start(httpd_handle_t server)
+{
+    telemetry_server = server;
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        telemetry_clients[i].fd = -1;
+    }
+    if (supercar_task_create(SUPERCAR_TASK_TELEMETRY, telemetry_thread, NULL, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void supercar_telemetry_serialize(supercar_json_t* node, supercar_t* car)
+{
+    telemetry_client_t clients[TELEMETRY_MAX_CLIENTS];
+    portENTER_CRITICAL(&telemetry_lock);
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        // The last state is left out, it is large and not needed here
+        clients[i].fd = telemetry_clients[i].fd;
+        clients[i].period_us = telemetry_clients[i].period_us;
+        clients[i].attached = telemetry_clients[i].attached;
+        clients[i].frames = telemetry_clients[i].frames;
+        clients[i].bytes = telemetry_clients[i].bytes;
+        clients[i].build_us = telemetry_clients[i].build_us;
+        clients[i].send_us = telemetry_clients[i].send_us;
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+
+    int64_t now = esp_timer_get_time();
+    supercar_json_begin_array(node, "clients");
+    for (int i = 0; i < TELEMETRY_MAX_CLIENTS; i++) {
+        telemetry_client_t* client = &clients[i];
+        if (client->fd < 0)
+            continue;
+        uint64_t connected_us = now - client->attached;
+        uint64_t cpu_us = client->build_us + client->send_us;
+        supercar_json_begin_object(node, NULL);
+        supercar_json_int(node, "fd", client->fd);
+        supercar_json_int(node, "rate", 1000000 / client->period_us);
+        supercar_json_int(node, "frames", client->frames);
+        supercar_json_int(node, "bytes", client->bytes);
+        supercar_json_int(node, "build_avg_us", client->frames ? client->build_us / client->frames : 0);
+        supercar_json_int(node, "send_avg_us", client->frames ? client->send_us / client->frames : 0);
+        // Share of one core spent on this client
+        supercar_json_number(node, "cpu_percent", connected_us ? cpu_us * 100.0 / connected_us : 0);
+        supercar_json_end_object(node);
+    }
+    supercar_json_end_array(node);
+}
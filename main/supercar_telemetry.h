@@ -0,0 +1,41 @@
+#ifndef _SUPERCAR_TELEMETRY_H_
+#define _SUPERCAR_TELEMETRY_H_
+
+#include "esp_system.h"
+#include "esp_http_server.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_MAX_CLIENTS 4
+#define TELEMETRY_DEFAULT_RATE 10          // Hz
+#define TELEMETRY_MAX_RATE 50
+
+/**
+ * @brief Start pushing state deltas to the WebSocket clients of this server
+ */
+esp_err_t supercar_telemetry_start(httpd_handle_t server);
+
+/**
+ * @brief WebSocket handler, the client picks its rate by sending {"rate": <Hz>}
+ */
+esp_err_t supercar_telemetry_ws_handler(httpd_req_t* req);
+
+/**
+ * @brief To be called when a session closes, whether it was a telemetry client or not
+ */
+void supercar_telemetry_session_closed(int sockfd);
+
+/**
+ * @brief Per client rate, traffic and CPU time spent building and sending the deltas
+ */
+void supercar_telemetry_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "supercar_dns.h"
+#include "supercar_tasks.h"
+#include "supercar_wifi.h"
+
+static const char* TAG = "WIFI";
+
+#define WIFI_SWITCH_DELAY_MS 500        // Lets the answer to the request asking for the switch go out
+#define WIFI_GOT_IP (1 << 0)
+
+static const char* wifi_mode_names[SUPERCAR_WIFI_MODE_MAX] = { "station", "ap" };
+
+static supercar_wifi_mode_t wifi_mode = SUPERCAR_WIFI_DEFAULT_MODE;     // Running, or starting
+static supercar_wifi_mode_t wifi_pending = SUPERCAR_WIFI_DEFAULT_MODE;  // Last one asked for
+static bool wifi_started;
+static bool wifi_switching;             // Starting or switching, the requests only update wifi_pending
+static bool wifi_fallback;              // The network could not be joined, the access point runs instead
+static uint32_t wifi_switches;
+static uint32_t wifi_switch_us;         // Duration of the last switch, until the new mode is up
+static esp_netif_t* wifi_ap_netif;      // Created once, kept across switches
+static esp_netif_t* wifi_sta_netif;
+static EventGroupHandle_t wifi_events;
+static char wifi_portal_url[24];
+static portMUX_TYPE wifi_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_err_t supercar_wifi_start_ap(void)
+{
+    if (wifi_ap_netif == NULL) {
+        wifi_ap_netif = esp_netif_create_default_wifi_ap();
+    }
+    wifi_init_config_t init = WIFI_INIT_CONFIG_DEFAULT();
+    esp_err_t err = esp_wifi_init(&init);
+    if (err != ESP_OK) {
+        return err;
+    }
+    wifi_config_t config = {
+        .ap = {
+            .ssid = CONFIG_SUPERCAR_AP_SSID,
+            .ssid_len = strlen(CONFIG_SUPERCAR_AP_SSID),
+            .password = CONFIG_SUPERCAR_AP_PASSWORD,
+            .channel = CONFIG_SUPERCAR_AP_CHANNEL,
+            .authmode = strlen(CONFIG_SUPERCAR_AP_PASSWORD) ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN,
+            .max_connection = CONFIG_SUPERCAR_AP_MAX_CLIENTS,
+            .beacon_interval = CONFIG_SUPERCAR_AP_BEACON_INTERVAL,
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+            .dtim_period = CONFIG_SUPERCAR_AP_DTIM_PERIOD,
+#endif
+        },
+    };
+    err = esp_wifi_set_mode(WIFI_MODE_AP);
+    if (err == ESP_OK) {
+        err = esp_wifi_set_config(WIFI_IF_AP, &config);
+    }
+    if (err == ESP_OK) {
+        err = esp_wifi_start();
+    }
+    if (err != ESP_OK) {
+        esp_wifi_deinit();
+        return err;
+    }
+    esp_netif_ip_info_t ip;
+    esp_netif_get_ip_info(wifi_ap_netif, &ip);
+    snprintf(wifi_portal_url, sizeof(wifi_portal_url), "http://" IPSTR "/", IP2STR(&ip.ip));
+    ESP_LOGI(TAG, "Access point %s on channel %d, web UI at %s", CONFIG_SUPERCAR_AP_SSID, CONFIG_SUPERCAR_AP_CHANNEL, wifi_portal_url);
+    // Every name resolves to the car, the phone shows the web UI as the sign in page of the network
+    return supercar_dns_start(ip.ip.addr);
+}
+
+static void supercar_wifi_stop_ap(void)
+{
+    supercar_dns_stop();
+    esp_wifi_stop();
+    esp_wifi_deinit();
+}
+
+static void supercar_wifi_sta_event(void* arg, esp_event_base_t base, int32_t id, void* data)
+{
+    if (base == IP_EVENT) {
+        xEventGroupSetBits(wifi_events, WIFI_GOT_IP);
+    } else if (id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (id == WIFI_EVENT_STA_DISCONNECTED) {
+        // Out of range or the router restarted, try again
+        xEventGroupClearBits(wifi_events, WIFI_GOT_IP);
+        esp_wifi_connect();
+    }
+}
+
+static void supercar_wifi_stop_sta(void)
+{
+    esp_event_handler_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, supercar_wifi_sta_event);
+    esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, supercar_wifi_sta_event);
+    esp_wifi_stop();
+    esp_wifi_deinit();
+}
+
+/* Join the network of the example configuration, ESP_ERR_TIMEOUT when it gave no address in time */
+static esp_err_t supercar_wifi_start_sta(void)
+{
+    if (wifi_sta_netif == NULL) {
+        wifi_sta_netif = esp_netif_create_default_wifi_sta();
+        wifi_events = xEventGroupCreate();
+    }
+    xEventGroupClearBits(wifi_events, WIFI_GOT_IP);
+    wifi_init_config_t init = WIFI_INIT_CONFIG_DEFAULT();
+    esp_err_t err = esp_wifi_init(&init);
+    if (err != ESP_OK) {
+        return err;
+    }
+    esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, supercar_wifi_sta_event, NULL);
+    esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, supercar_wifi_sta_event, NULL);
+    wifi_config_t config = {
+        .sta = {
+            .ssid = CONFIG_EXAMPLE_WIFI_SSID,
+            .password = CONFIG_EXAMPLE_WIFI_PASSWORD,
+        },
+    };
+    err = esp_wifi_set_mode(WIFI_MODE_STA);
+    if (err == ESP_OK) {
+        err = esp_wifi_set_config(WIFI_IF_STA, &config);
+    }
+    if (err == ESP_OK) {
+        err = esp_wifi_start();
+    }
+    if (err != ESP_OK) {
+        supercar_wifi_stop_sta();
+        return err;
+    }
+    ESP_LOGI(TAG, "Joining %s", CONFIG_EXAMPLE_WIFI_SSID);
+    TickType_t timeout = CONFIG_SUPERCAR_WIFI_STA_TIMEOUT ? pdMS_TO_TICKS(CONFIG_SUPERCAR_WIFI_STA_TIMEOUT * 1000) : portMAX_DELAY;
+    if (!(xEventGroupWaitBits(wifi_events, WIFI_GOT_IP, pdFALSE, pdTRUE, timeout) & WIFI_GOT_IP)) {
+        supercar_wifi_stop_sta();
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t supercar_wifi_up(supercar_wifi_mode_t mode)
+{
+    if (mode == SUPERCAR_WIFI_AP) {
+        return supercar_wifi_start_ap();
+    }
+    esp_err_t err = supercar_wifi_start_sta();
+    bool fallback = err == ESP_ERR_TIMEOUT;
+    portENTER_CRITICAL(&wifi_lock);
+    wifi_fallback = fallback;
+    if (fallback) {
+        // Until a reboot or another request, the saved mode is kept
+        wifi_mode = wifi_pending = SUPERCAR_WIFI_AP;
+    }
+    portEXIT_CRITICAL(&wifi_lock);
+    if (!fallback) {
+        return err;
+    }
+    // Away from the network the car would be out of reach on every boot
+    ESP_LOGW(TAG, "No address from %s after %d s, starting the access point", CONFIG_EXAMPLE_WIFI_SSID, CONFIG_SUPERCAR_WIFI_STA_TIMEOUT);
+    return supercar_wifi_start_ap();
+}
+
+static void supercar_wifi_down(supercar_wifi_mode_t mode)
+{
+    if (mode == SUPERCAR_WIFI_AP) {
+        supercar_wifi_stop_ap();
+    } else {
+        supercar_wifi_stop_sta();
+    }
+}
+
+static void supercar_wifi_switch_thread(void* arg)
+{
+    vTaskDelay(pdMS_TO_TICKS(WIFI_SWITCH_DELAY_MS));
+    while (1) {
+        portENTER_CRITICAL(&wifi_lock);
+        supercar_wifi_mode_t from = wifi_mode;
+        supercar_wifi_mode_t to = wifi_pending;
+        if (from == to) {
+            wifi_switching = false;
+        } else {
+            wifi_mode = to;
+        }
+        portEXIT_CRITICAL(&wifi_lock);
+        if (from == to) {
+            break;
+        }
+
+        ESP_LOGI(TAG, "Switching from %s to %s", wifi_mode_names[from], wifi_mode_names[to]);
+        int64_t start = esp_timer_get_time();
+        supercar_wifi_down(from);
+        esp_err_t err = supercar_wifi_up(to);
+        uint32_t elapsed = esp_timer_get_time() - start;
+        portENTER_CRITICAL(&wifi_lock);
+        wifi_switches++;
+        wifi_switch_us = elapsed;
+        portEXIT_CRITICAL(&wifi_lock);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Could not start %s: %s", wifi_mode_names[to], esp_err_to_name(err));
+        }
+    }
+    supercar_task_exit(SUPERCAR_TASK_WIFI);
+}
+
+/* Called from the control task too, the switch runs below it so the car keeps driving */
+static void supercar_wifi_start_switch(void)
+{
+    if (supercar_task_create(SUPERCAR_TASK_WIFI, supercar_wifi_switch_thread, NULL, NULL) != pdPASS) {
+        portENTER_CRITICAL(&wifi_lock);
+        wifi_switching = false;
+        portEXIT_CRITICAL(&wifi_lock);
+    }
+}
+
+esp_err_t supercar_wifi_start(supercar_wifi_mode_t mode)
+{
+    portENTER_CRITICAL(&wifi_lock);
+    wifi_mode = wifi_pending = mode;
+    wifi_switching = true;
+    portEXIT_CRITICAL(&wifi_lock);
+
+    esp_err_t err = supercar_wifi_up(mode);
+
+    portENTER_CRITICAL(&wifi_lock);
+    wifi_started = true;
+    bool again = wifi_pending != wifi_mode;
+    wifi_switching = again;
+    portEXIT_CRITICAL(&wifi_lock);
+    if (again) {
+        // Asked for while this one was starting
+        supercar_wifi_start_switch();
+    }
+    return err;
+}
+
+void supercar_wifi_request_mode(supercar_wifi_mode_t mode)
+{
+    if (mode >= SUPERCAR_WIFI_MODE_MAX) {
+        return;
+    }
+    portENTER_CRITICAL(&wifi_lock);
+    wifi_pending = mode;
+    if (mode == SUPERCAR_WIFI_AP) {
+        // Asked for, no longer a fallback
+        wifi_fallback = false;
+    }
+    bool spawn = wifi_started && !wifi_switching && mode != wifi_mode;
+    if (spawn) {
+        wifi_switching = true;
+    } else if (!wifi_started) {
+        wifi_mode = mode;
+    }
+    portEXIT_CRITICAL(&wifi_lock);
+    if (spawn) {
+        supercar_wifi_start_switch();
+    }
+}
+
+bool supercar_wifi_captive(void)
+{
+    portENTER_CRITICAL(&wifi_lock);
+    bool captive = wifi_started && !wifi_switching && wifi_mode == SUPERCAR_WIFI_AP;
+    portEXIT_CRITICAL(&wifi_lock);
+    return captive;
+}
+
+const char* supercar_wifi_portal_url(void)
+{
+    return wifi_portal_url;
+}
+
+void supercar_wifi_serialize(supercar_json_t* node, supercar_t* car)
+{
+    portENTER_CRITICAL(&wifi_lock);
+    supercar_wifi_mode_t mode = wifi_mode;
+    supercar_wifi_mode_t pending = wifi_pending;
+    bool switching = wifi_switching;
+    bool fallback = wifi_fallback;
+    uint32_t switches = wifi_switches;
+    uint32_t switch_us = wifi_switch_us;
+    portEXIT_CRITICAL(&wifi_lock);
+
+    supercar_json_string(node, "mode", wifi_mode_names[mode]);
+    supercar_json_bool(node, "switching", switching);
+    supercar_json_bool(node, "fallback", fallback);
+    if (switching) {
+        supercar_json_string(node, "pending", wifi_mode_names[pending]);
+    }
+    supercar_json_int(node, "switches", switches);
+    supercar_json_int(node, "switch_us", switch_us);
+    if (switching) {
+        return;
+    }
+    esp_netif_ip_info_t ip = {0};
+    char address[16];
+    if (mode == SUPERCAR_WIFI_AP) {
+        wifi_sta_list_t clients = {0};
+        esp_wifi_ap_get_sta_list(&clients);
+        esp_netif_get_ip_info(wifi_ap_netif, &ip);
+        supercar_json_string(node, "ssid", CONFIG_SUPERCAR_AP_SSID);
+        supercar_json_int(node, "channel", CONFIG_SUPERCAR_AP_CHANNEL);
+        supercar_json_int(node, "beacon_interval_tu", CONFIG_SUPERCAR_AP_BEACON_INTERVAL);
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+        supercar_json_int(node, "dtim_period", CONFIG_SUPERCAR_AP_DTIM_PERIOD);
+#endif
+        supercar_json_int(node, "clients", clients.num);
+        supercar_json_begin_object(node, "dns");
+        supercar_dns_serialize(node);
+        supercar_json_end_object(node);
+    } else {
+        wifi_ap_record_t ap = {0};
+        if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+            supercar_json_string(node, "ssid", (const char*) ap.ssid);
+            supercar_json_int(node, "channel", ap.primary);
+            supercar_json_int(node, "rssi", ap.rssi);
+        }
+        esp_netif_get_ip_info(wifi_sta_netif, &ip);
+    }
+    snprintf(address, sizeof(address), IPSTR, IP2STR(&ip.ip));
+    supercar_json_string(node, "ip", address);
+}
@@ -0,0 +1,53 @@
+#ifndef _SUPERCAR_WIFI_H_
+#define _SUPERCAR_WIFI_H_
+
+#include <stdbool.h>
+#include "esp_system.h"
+#include "supercar_json.h"
+#include "supercar_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    SUPERCAR_WIFI_STATION,              // Joins the network of menuconfig, through the router
+    SUPERCAR_WIFI_AP,                   // Access point with a captive portal, the phone connects to the car
+    SUPERCAR_WIFI_MODE_MAX
+} supercar_wifi_mode_t;
+
+#if CONFIG_SUPERCAR_WIFI_MODE_AP
+#define SUPERCAR_WIFI_DEFAULT_MODE SUPERCAR_WIFI_AP
+#else
+#define SUPERCAR_WIFI_DEFAULT_MODE SUPERCAR_WIFI_STATION
+#endif
+
+/**
+ * @brief Bring the Wi-Fi up in a mode, a station blocks until it has an address
+ */
+esp_err_t supercar_wifi_start(supercar_wifi_mode_t mode);
+
+/**
+ * @brief Switch to another mode, from any task, without blocking
+ *
+ * Before supercar_wifi_start, only the mode it starts in is changed.
+ */
+void supercar_wifi_request_mode(supercar_wifi_mode_t mode);
+
+/**
+ * @brief The access point runs, the unknown pages are redirected to the web UI
+ */
+bool supercar_wifi_captive(void);
+
+/**
+ * @brief Address of the web UI in access point mode
+ */
+const char* supercar_wifi_portal_url(void);
+
+void supercar_wifi_serialize(supercar_json_t* node, supercar_t* car);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "supercar_www.h"
+
+static const char* TAG = "supercar_www";
+
+#define WWW_MAGIC "SCWW"
+#define WWW_VERSION 1
+
+/* Layout written by tools/pack_www.py, all offsets from the start of the partition */
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t count;
+    uint32_t size;
+} www_header_t;
+
+typedef struct {
+    uint32_t path;
+    uint32_t data;
+    uint32_t size;
+    uint32_t gz_data;
+    uint32_t gz_size;
+    uint32_t crc;
+} www_entry_t;
+
+static const uint8_t* www_base;
+static const www_entry_t* www_entries;
+static uint16_t www_count;
+
+static bool supercar_www_entry_valid(const www_entry_t* entry, uint32_t size)
+{
+    return entry->path < size && memchr(www_base + entry->path, '\0', size - entry->path) != NULL
+        && entry->data <= size && entry->size <= size - entry->data
+        && entry->gz_data <= size && entry->gz_size <= size - entry->gz_data;
+}
+
+esp_err_t supercar_www_mount(void)
+{
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SUPERCAR_WWW_PARTITION);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No %s partition", SUPERCAR_WWW_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    www_header_t header;
+    esp_err_t err = esp_partition_read(partition, 0, &header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (memcmp(header.magic, WWW_MAGIC, sizeof(header.magic)) != 0 || header.version != WWW_VERSION
+        || header.size > partition->size || sizeof(header) + (size_t)header.count * sizeof(www_entry_t) > header.size) {
+        ESP_LOGE(TAG, "The %s partition holds no archive, run tools/pack_www.py", SUPERCAR_WWW_PARTITION);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    /* Mapped for good, the responses are sent straight from there */
+    const void* base;
+    spi_flash_mmap_handle_t handle;
+    err = esp_partition_mmap(partition, 0, header.size, SPI_FLASH_MMAP_DATA, &base, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map the archive (%s)", esp_err_to_name(err));
+        return err;
+    }
+    www_base = base;
+    const www_entry_t* entries = (const www_entry_t*)(www_base + sizeof(header));
+    for (int i = 0; i < header.count; i++) {
+        if (!supercar_www_entry_valid(&entries[i], header.size)) {
+            ESP_LOGE(TAG, "Entry %d of the archive is out of bounds", i);
+            spi_flash_munmap(handle);
+            www_base = NULL;
+            return ESP_ERR_INVALID_VERSION;
+        }
+    }
+    www_entries = entries;
+    www_count = header.count;
+    ESP_LOGI(TAG, "%u files, %u bytes mapped", header.count, header.size);
+    return ESP_OK;
+}
+
+bool supercar_www_find(const char* path, supercar_www_file_t* file)
+{
+    int low = 0;
+    int high = www_count - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        const www_entry_t* entry = &www_entries[middle];
+        int cmp = strcmp(path, (const char*)www_base + entry->path);
+        if (cmp < 0) {
+            high = middle - 1;
+        } else if (cmp > 0) {
+            low = middle + 1;
+        } else {
+            file->path = (const char*)www_base + entry->path;
+            file->data = www_base + entry->data;
+            file->size = entry->size;
+            file->gz_data = entry->gz_size ? www_base + entry->gz_data : NULL;
+            file->gz_size = entry->gz_size;
+            file->crc = entry->crc;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,43 @@
+#ifndef _SUPERCAR_WWW_H_
+#define _SUPERCAR_WWW_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SUPERCAR_WWW_PARTITION "www"
+
+/* A file of the web UI, pointing into the mapped partition */
+typedef struct {
+    const char* path;
+    const void* data;
+    size_t size;
+    const void* gz_data;            // NULL when the build did not compress it
+    size_t gz_size;
+    uint32_t crc;                   // CRC32 of data, for the ETag
+} supercar_www_file_t;
+
+/**
+ * @brief Map the archive written by tools/pack_www.py, nothing is copied to RAM
+ *
+ * @return ESP_ERR_NOT_FOUND without www partition, ESP_ERR_INVALID_VERSION if it does not hold a valid archive
+ */
+esp_err_t supercar_www_mount(void);
+
+/**
+ * @brief Binary search of the path index
+ *
+ * @return false if the archive has no such file
+ */
+bool supercar_www_find(const char* path, supercar_www_file_t* file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _DRIVER_GPIO_H_
+#define _DRIVER_GPIO_H_
+
+/* Masks of the ESP32, 24 and 28 to 31 are not bonded, 34 to 39 are inputs only */
+#define SOC_GPIO_VALID_GPIO_MASK (0xFFFFFFFFFFULL & ~((1ULL << 24) | (0xfULL << 28)))
+#define SOC_GPIO_VALID_OUTPUT_GPIO_MASK (SOC_GPIO_VALID_GPIO_MASK & ~(0x3fULL << 34))
+
+#define GPIO_IS_VALID_GPIO(gpio_num) ((gpio_num) >= 0 && (gpio_num) < 64 && ((SOC_GPIO_VALID_GPIO_MASK >> (gpio_num)) & 1))
+#define GPIO_IS_VALID_OUTPUT_GPIO(gpio_num) ((gpio_num) >= 0 && (gpio_num) < 64 && ((SOC_GPIO_VALID_OUTPUT_GPIO_MASK >> (gpio_num)) & 1))
+
+#endif
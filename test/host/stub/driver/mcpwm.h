@@ -0,0 +1,22 @@
+#ifndef _DRIVER_MCPWM_H_
+#define _DRIVER_MCPWM_H_
+
+typedef enum {
+    MCPWM_UNIT_0,
+    MCPWM_UNIT_1
+} mcpwm_unit_t;
+
+typedef enum {
+    MCPWM_TIMER_0,
+    MCPWM_TIMER_1,
+    MCPWM_TIMER_2
+} mcpwm_timer_t;
+
+typedef enum {
+    MCPWM0A,
+    MCPWM0B,
+    MCPWM1A,
+    MCPWM1B
+} mcpwm_io_signals_t;
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _ESP_CRC_H_
+#define _ESP_CRC_H_
+
+#include <stdint.h>
+
+uint32_t esp_crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _FREERTOS_SEMPHR_H_
+#define _FREERTOS_SEMPHR_H_
+
+#include "freertos/FreeRTOS.h"
+
+#endif
@@ -0,0 +1,11 @@
+/* Forced into every host build, for what newlib has and glibc does not */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stddef.h>
+#include "sdkconfig.h"
+
+size_t strlcpy(char* dst, const char* src, size_t size);
+
+#endif
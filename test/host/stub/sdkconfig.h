@@ -0,0 +1,44 @@
+/* Defaults of main/Kconfig.projbuild used by the sources built for the host tests */
+
+#ifndef _SDKCONFIG_H_
+#define _SDKCONFIG_H_
+
+#define CONFIG_SUPERCAR_TASK_MAX_STACK 16384
+#define CONFIG_SUPERCAR_TASK_SCHED_CORE 1
+#define CONFIG_SUPERCAR_TASK_SCHED_PRIORITY 12
+#define CONFIG_SUPERCAR_TASK_SCHED_STACK 4096
+#define CONFIG_SUPERCAR_TASK_SENSOR_CORE 1
+#define CONFIG_SUPERCAR_TASK_SENSOR_PRIORITY 10
+#define CONFIG_SUPERCAR_TASK_SENSOR_STACK 2048
+#define CONFIG_SUPERCAR_TASK_HID_CORE -1
+#define CONFIG_SUPERCAR_TASK_HID_PRIORITY 2
+#define CONFIG_SUPERCAR_TASK_HID_STACK 6144
+#define CONFIG_SUPERCAR_TASK_HTTPD_CORE 0
+#define CONFIG_SUPERCAR_TASK_HTTPD_PRIORITY 5
+#define CONFIG_SUPERCAR_TASK_HTTPD_STACK 4096
+#define CONFIG_SUPERCAR_TASK_TELEMETRY_CORE 0
+#define CONFIG_SUPERCAR_TASK_TELEMETRY_PRIORITY 3
+#define CONFIG_SUPERCAR_TASK_TELEMETRY_STACK 4096
+#define CONFIG_SUPERCAR_TASK_HTTP_SEND_CORE 0
+#define CONFIG_SUPERCAR_TASK_HTTP_SEND_PRIORITY 4
+#define CONFIG_SUPERCAR_TASK_HTTP_SEND_STACK 3072
+#define CONFIG_SUPERCAR_TASK_PERSIST_CORE -1
+#define CONFIG_SUPERCAR_TASK_PERSIST_PRIORITY 2
+#define CONFIG_SUPERCAR_TASK_PERSIST_STACK 3072
+#define CONFIG_SUPERCAR_TASK_DNS_CORE -1
+#define CONFIG_SUPERCAR_TASK_DNS_PRIORITY 2
+#define CONFIG_SUPERCAR_TASK_DNS_STACK 3072
+#define CONFIG_SUPERCAR_TASK_WIFI_CORE -1
+#define CONFIG_SUPERCAR_TASK_WIFI_PRIORITY 2
+#define CONFIG_SUPERCAR_TASK_WIFI_STACK 4096
+#define CONFIG_SUPERCAR_ARBITER_GAMEPAD_PRIORITY 30
+#define CONFIG_SUPERCAR_ARBITER_WEB_PRIORITY 20
+#define CONFIG_SUPERCAR_ARBITER_SAFETY_PRIORITY 10
+#define CONFIG_SUPERCAR_ARBITER_PEDAL_PRIORITY 0
+#define CONFIG_SUPERCAR_DRIVE_DEADMAN_MS 300
+#define CONFIG_SUPERCAR_SCHED_PERIOD_US 1000
+#define CONFIG_SUPERCAR_RTC_MAX_WARM_RESTARTS 3
+#define CONFIG_SUPERCAR_HTTP_BUFFER_SIZE 4096
+#define CONFIG_SUPERCAR_WIFI_MODE_STATION 1
+
+#endif
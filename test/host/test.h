@@ -0,0 +1,22 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+/* Checks go on after a failure, main returns the count */
+extern int test_failures;
+
+#define TEST_CHECK(cond, format, ...) do { \
+        if (!(cond)) { \
+            test_failures++; \
+            fprintf(stderr, "%s:%d: %s: " format "\n", __FILE__, __LINE__, #cond, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define TEST_RUN(test) do { \
+        int before = test_failures; \
+        test(); \
+        printf("%s %s\n", test_failures == before ? "PASS" : "FAIL", #test); \
+    } while (0)
+
+#endif
@@ -0,0 +1,324 @@
+/* Binary records of the configuration sections and the JSON documents loaded into them, from supercar_config.c */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_crc.h"
+#include "supercar_config.h"
+#include "supercar_snapshot.h"
+#include "supercar_wifi.h"
+#include "test.h"
+
+int test_failures;
+
+/* Parts of the firmware the sections apply their values to, not called by the tests */
+void brushed_motor_configure(supercar_motor_control_t* motor_ctrl, const supercar_motor_config_t* cfg)
+{
+}
+
+void supercar_apply_config(supercar_t* car, void (*apply)(const void*, supercar_t*), const void* staging)
+{
+}
+
+void supercar_select_profile(supercar_t* car, supercar_profile_id_t id)
+{
+}
+
+void supercar_snapshot_publish(supercar_t* car)
+{
+}
+
+/* Values in use, as the sections see them */
+static supercar_snapshot_t snapshot;
+
+void supercar_snapshot_read(supercar_snapshot_t* copy)
+{
+    *copy = snapshot;
+}
+
+void supercar_wifi_request_mode(supercar_wifi_mode_t mode)
+{
+}
+
+static supercar_staging_t stage(const supercar_section_t* section)
+{
+    supercar_staging_t staging;
+    memset(&staging, 0, sizeof(staging));
+    section->stage(&staging, NULL);
+    return staging;
+}
+
+/* After editing the fields of a record, as another firmware would have written it */
+static void reseal(uint8_t* buf, size_t len)
+{
+    supercar_record_header_t header;
+    memcpy(&header, buf, sizeof(header));
+    header.length = len - sizeof(header);
+    header.crc = esp_crc32_le(0, buf + sizeof(header), header.length);
+    memcpy(buf, &header, sizeof(header));
+}
+
+static int32_t record_int(const uint8_t* buf, size_t index)
+{
+    int32_t value;
+    memcpy(&value, buf + sizeof(supercar_record_header_t) + 4 * index, sizeof(value));
+    return value;
+}
+
+static void set_record_int(uint8_t* buf, size_t index, int32_t value)
+{
+    memcpy(buf + sizeof(supercar_record_header_t) + 4 * index, &value, sizeof(value));
+}
+
+static void test_record_tasks(void)
+{
+    supercar_staging_t defaults = stage(&supercar_tasks_section);
+    supercar_staging_t saved = defaults;
+    saved.tasks[SUPERCAR_TASK_HID].core = 1;
+    saved.tasks[SUPERCAR_TASK_HID].priority = 7;
+    saved.tasks[SUPERCAR_TASK_HTTPD].stack = 8192;
+
+    uint8_t buf[SUPERCAR_RECORD_MAX];
+    size_t len = supercar_section_encode(&supercar_tasks_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(len == sizeof(supercar_record_header_t) + 4 + 16 * SUPERCAR_TASK_MAX, "%zu bytes", len);
+    supercar_staging_t loaded = defaults;
+    TEST_CHECK(supercar_section_decode(&supercar_tasks_section, buf, len, &loaded) == ESP_OK, "");
+    TEST_CHECK(!memcmp(loaded.tasks, saved.tasks, sizeof(saved.tasks)), "");
+}
+
+/* The CRC of a record from another firmware is good, its out of range entries are still left out */
+static void test_record_tasks_invalid(void)
+{
+    supercar_staging_t defaults = stage(&supercar_tasks_section);
+    supercar_staging_t saved = defaults;
+    saved.tasks[SUPERCAR_TASK_SCHED].priority = configMAX_PRIORITIES;
+    saved.tasks[SUPERCAR_TASK_SENSOR].priority = 0;
+    saved.tasks[SUPERCAR_TASK_HID].core = portNUM_PROCESSORS;
+    saved.tasks[SUPERCAR_TASK_HTTPD].stack = SUPERCAR_TASK_MIN_STACK - 1;
+    saved.tasks[SUPERCAR_TASK_DNS].stack = SUPERCAR_TASK_MAX_STACK + 1;
+    saved.tasks[SUPERCAR_TASK_TELEMETRY].priority = 4;
+
+    uint8_t buf[SUPERCAR_RECORD_MAX];
+    size_t len = supercar_section_encode(&supercar_tasks_section, &saved, buf, sizeof(buf));
+    // A stack that reads back as a negative int
+    set_record_int(buf, 1 + 4 * SUPERCAR_TASK_PERSIST + 3, -4096);
+    reseal(buf, len);
+
+    supercar_staging_t loaded = defaults;
+    TEST_CHECK(supercar_section_decode(&supercar_tasks_section, buf, len, &loaded) == ESP_OK, "");
+    TEST_CHECK(!memcmp(&loaded.tasks[SUPERCAR_TASK_SCHED], &defaults.tasks[SUPERCAR_TASK_SCHED], sizeof(supercar_task_placement_t)), "");
+    TEST_CHECK(!memcmp(&loaded.tasks[SUPERCAR_TASK_SENSOR], &defaults.tasks[SUPERCAR_TASK_SENSOR], sizeof(supercar_task_placement_t)), "");
+    TEST_CHECK(!memcmp(&loaded.tasks[SUPERCAR_TASK_HID], &defaults.tasks[SUPERCAR_TASK_HID], sizeof(supercar_task_placement_t)), "");
+    TEST_CHECK(!memcmp(&loaded.tasks[SUPERCAR_TASK_HTTPD], &defaults.tasks[SUPERCAR_TASK_HTTPD], sizeof(supercar_task_placement_t)), "");
+    TEST_CHECK(!memcmp(&loaded.tasks[SUPERCAR_TASK_PERSIST], &defaults.tasks[SUPERCAR_TASK_PERSIST], sizeof(supercar_task_placement_t)), "");
+    TEST_CHECK(!memcmp(&loaded.tasks[SUPERCAR_TASK_DNS], &defaults.tasks[SUPERCAR_TASK_DNS], sizeof(supercar_task_placement_t)), "");
+    TEST_CHECK(loaded.tasks[SUPERCAR_TASK_TELEMETRY].priority == 4, "%d", loaded.tasks[SUPERCAR_TASK_TELEMETRY].priority);
+}
+
+/* The entries are found by the key of their name, whatever their order, the unknown ones are skipped */
+static void test_record_tasks_keys(void)
+{
+    supercar_staging_t defaults = stage(&supercar_tasks_section);
+    supercar_staging_t saved = defaults;
+    saved.tasks[SUPERCAR_TASK_SCHED].priority = 13;
+    saved.tasks[SUPERCAR_TASK_SENSOR].priority = 11;
+
+    uint8_t buf[SUPERCAR_RECORD_MAX];
+    size_t len = supercar_section_encode(&supercar_tasks_section, &saved, buf, sizeof(buf));
+    // Swap the first two entries, then rename the third to a task this firmware does not have
+    for (int i = 0; i < 4; i++) {
+        int32_t first = record_int(buf, 1 + i);
+        set_record_int(buf, 1 + i, record_int(buf, 5 + i));
+        set_record_int(buf, 5 + i, first);
+    }
+    set_record_int(buf, 1 + 4 * SUPERCAR_TASK_HID, 0x12345678);
+    set_record_int(buf, 1 + 4 * SUPERCAR_TASK_HID + 2, 9);
+    reseal(buf, len);
+
+    supercar_staging_t loaded = defaults;
+    TEST_CHECK(supercar_section_decode(&supercar_tasks_section, buf, len, &loaded) == ESP_OK, "");
+    TEST_CHECK(loaded.tasks[SUPERCAR_TASK_SCHED].priority == 13, "%d", loaded.tasks[SUPERCAR_TASK_SCHED].priority);
+    TEST_CHECK(loaded.tasks[SUPERCAR_TASK_SENSOR].priority == 11, "%d", loaded.tasks[SUPERCAR_TASK_SENSOR].priority);
+    TEST_CHECK(loaded.tasks[SUPERCAR_TASK_HID].priority == defaults.tasks[SUPERCAR_TASK_HID].priority, "%d", loaded.tasks[SUPERCAR_TASK_HID].priority);
+}
+
+static void test_record_arbiter(void)
+{
+    supercar_staging_t defaults = stage(&supercar_arbiter_section);
+    supercar_staging_t saved = defaults;
+    saved.arbiter[SUPERCAR_SOURCE_WEB].priority = 40;
+    saved.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms = 500;
+    saved.arbiter[SUPERCAR_SOURCE_GAMEPAD].priority = SUPERCAR_ARBITER_MAX_PRIORITY + 1;
+    saved.arbiter[SUPERCAR_SOURCE_PEDAL].timeout_ms = -1;
+    saved.arbiter[SUPERCAR_SOURCE_SAFETY].timeout_ms = SUPERCAR_ARBITER_MAX_TIMEOUT_MS + 1;
+
+    uint8_t buf[SUPERCAR_RECORD_MAX];
+    size_t len = supercar_section_encode(&supercar_arbiter_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(len == sizeof(supercar_record_header_t) + 4 + 12 * SUPERCAR_SOURCE_MAX, "%zu bytes", len);
+    supercar_staging_t loaded = defaults;
+    TEST_CHECK(supercar_section_decode(&supercar_arbiter_section, buf, len, &loaded) == ESP_OK, "");
+    TEST_CHECK(loaded.arbiter[SUPERCAR_SOURCE_WEB].priority == 40 && loaded.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms == 500, "");
+    for (int source = 0; source < SUPERCAR_SOURCE_WEB; source++) {
+        TEST_CHECK(!memcmp(&loaded.arbiter[source], &defaults.arbiter[source], sizeof(supercar_arbiter_rule_t)),
+            "%s", supercar_arbiter_source_name(source));
+    }
+    saved.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms = 0;
+    len = supercar_section_encode(&supercar_arbiter_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(supercar_section_decode(&supercar_arbiter_section, buf, len, &loaded) == ESP_OK, "");
+    TEST_CHECK(loaded.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms == 500, "%d", loaded.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms);
+}
+
+/* Motor records are generated from the field table, the values out of its bounds keep the staged ones */
+static void test_record_fields(void)
+{
+    supercar_staging_t defaults;
+    memset(&defaults, 0, sizeof(defaults));
+    defaults.motor = (supercar_motor_config_t) { .acceleration = 1, .ctrl_period = 10, .pwm_freq = 1000, .pwm_pin = 21, .direction_pin = 17 };
+    supercar_staging_t saved = defaults;
+    saved.motor.acceleration = 2.5f;
+    saved.motor.ctrl_period = 20;
+    saved.motor.pwm_pin = 40;
+
+    uint8_t buf[SUPERCAR_RECORD_MAX];
+    size_t len = supercar_section_encode(&supercar_propulsion_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(len == sizeof(supercar_record_header_t) + 4 * 5, "%zu bytes", len);
+    supercar_staging_t loaded = defaults;
+    TEST_CHECK(supercar_section_decode(&supercar_propulsion_section, buf, len, &loaded) == ESP_OK, "");
+    TEST_CHECK(loaded.motor.acceleration == 2.5f, "%g", loaded.motor.acceleration);
+    TEST_CHECK(loaded.motor.ctrl_period == 20, "%d", loaded.motor.ctrl_period);
+    TEST_CHECK(loaded.motor.pwm_pin == 21, "%d", loaded.motor.pwm_pin);
+
+    // A record of an older version has less fields, the missing ones keep their value
+    len -= 4;
+    reseal(buf, len);
+    loaded = defaults;
+    TEST_CHECK(supercar_section_decode(&supercar_propulsion_section, buf, len, &loaded) == ESP_OK, "");
+    TEST_CHECK(loaded.motor.ctrl_period == 20 && loaded.motor.direction_pin == 17, "");
+}
+
+static void test_record_header(void)
+{
+    supercar_staging_t saved = stage(&supercar_arbiter_section);
+    uint8_t buf[SUPERCAR_RECORD_MAX];
+    size_t len = supercar_section_encode(&supercar_arbiter_section, &saved, buf, sizeof(buf));
+    supercar_staging_t loaded;
+
+    TEST_CHECK(supercar_section_encode(&supercar_arbiter_section, &saved, buf, len - 1) == 0, "");
+    TEST_CHECK(supercar_section_encode(&supercar_arbiter_section, &saved, buf, 4) == 0, "");
+    len = supercar_section_encode(&supercar_arbiter_section, &saved, buf, sizeof(buf));
+
+    TEST_CHECK(supercar_section_decode(&supercar_arbiter_section, buf, len - 1, &loaded) == ESP_ERR_INVALID_VERSION, "");
+    TEST_CHECK(supercar_section_decode(&supercar_arbiter_section, buf, 3, &loaded) == ESP_ERR_INVALID_VERSION, "");
+    buf[0] = '{';
+    TEST_CHECK(supercar_section_decode(&supercar_arbiter_section, buf, len, &loaded) == ESP_ERR_INVALID_VERSION, "");
+    buf[0] = SUPERCAR_RECORD_MAGIC;
+    buf[len - 1] ^= 1;
+    TEST_CHECK(supercar_section_decode(&supercar_arbiter_section, buf, len, &loaded) == ESP_ERR_INVALID_CRC, "");
+    buf[len - 1] ^= 1;
+    // A newer record is read, its appended fields are ignored
+    buf[1] = supercar_arbiter_section.version + 1;
+    loaded = saved;
+    TEST_CHECK(supercar_section_decode(&supercar_arbiter_section, buf, len, &loaded) == ESP_OK, "");
+}
+
+/* A record is checked like a document, a pin that is reserved or taken fails the whole record */
+static void test_record_checks(void)
+{
+    static supercar_t car;
+    const supercar_motor_config_t propulsion = { .acceleration = 1, .ctrl_period = 10, .pwm_freq = 1000, .pwm_pin = 21, .direction_pin = 17 };
+    const supercar_motor_config_t steering = { .acceleration = 1, .ctrl_period = 10, .pwm_freq = 1000, .pwm_pin = 19, .direction_pin = 18 };
+    snapshot.propulsion.cfg = propulsion;
+    snapshot.steering_motor.cfg = steering;
+    snapshot.cfg.mode_input_pin = 13;
+    snapshot.cfg.mode_output_pin = 4;
+    snapshot.cfg.power_output_pin = 0;
+
+    supercar_staging_t saved;
+    uint8_t buf[SUPERCAR_RECORD_MAX];
+    size_t len;
+    saved.motor = propulsion;
+    saved.motor.pwm_pin = 25;
+    len = supercar_section_encode(&supercar_propulsion_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(supercar_section_restore(&car, &supercar_propulsion_section, buf, len) == ESP_OK, "");
+
+    // Within the bounds of the field table, but the flash
+    saved.motor.pwm_pin = 6;
+    len = supercar_section_encode(&supercar_propulsion_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(supercar_section_restore(&car, &supercar_propulsion_section, buf, len) == ESP_ERR_INVALID_ARG, "");
+
+    // The pin of the other motor
+    saved.motor.pwm_pin = steering.direction_pin;
+    len = supercar_section_encode(&supercar_propulsion_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(supercar_section_restore(&car, &supercar_propulsion_section, buf, len) == ESP_ERR_INVALID_ARG, "");
+
+    saved.cfg = snapshot.cfg;
+    saved.cfg.power_output_pin = 1;
+    len = supercar_section_encode(&supercar_config_section, &saved, buf, sizeof(buf));
+    TEST_CHECK(supercar_section_restore(&car, &supercar_config_section, buf, len) == ESP_ERR_INVALID_ARG, "");
+    memset(&snapshot, 0, sizeof(snapshot));
+}
+
+static esp_err_t load(supercar_config_load_t* config, const supercar_section_t* section, const char* doc)
+{
+    supercar_config_load_begin(config, section, NULL);
+    esp_err_t err = supercar_config_load_feed(config, doc, strlen(doc));
+    if (err == ESP_OK)
+        err = supercar_config_load_end(config);
+    return err;
+}
+
+/* The members with a fraction or out of the int range are reported invalid and keep their value */
+static void test_load_tasks(void)
+{
+    static supercar_config_load_t config;
+    supercar_staging_t defaults = stage(&supercar_tasks_section);
+    TEST_CHECK(load(&config, &supercar_tasks_section,
+        "{\"hid_task\":{\"core\":1,\"priority\":6.5,\"stack\":1e300},\"httpd\":{\"priority\":-1e300,\"stack\":8192},"
+        "\"supercar_dns\":{\"core\":\"1\"},\"supercar_wifi\":{\"stack\":65536},\"nope\":{\"core\":0}}") == ESP_OK, "");
+    TEST_CHECK(config.staging.tasks[SUPERCAR_TASK_HID].core == 1, "");
+    TEST_CHECK(config.staging.tasks[SUPERCAR_TASK_HID].priority == defaults.tasks[SUPERCAR_TASK_HID].priority, "");
+    TEST_CHECK(config.staging.tasks[SUPERCAR_TASK_HID].stack == defaults.tasks[SUPERCAR_TASK_HID].stack, "");
+    TEST_CHECK(config.staging.tasks[SUPERCAR_TASK_HTTPD].priority == defaults.tasks[SUPERCAR_TASK_HTTPD].priority, "");
+    TEST_CHECK(config.staging.tasks[SUPERCAR_TASK_HTTPD].stack == 8192, "");
+    TEST_CHECK(config.staging.tasks[SUPERCAR_TASK_DNS].core == defaults.tasks[SUPERCAR_TASK_DNS].core, "");
+    TEST_CHECK(config.staging.tasks[SUPERCAR_TASK_WIFI].stack == defaults.tasks[SUPERCAR_TASK_WIFI].stack, "");
+    TEST_CHECK(config.invalid == 5, "%u invalid", (unsigned) config.invalid);
+    TEST_CHECK(config.unknown == 1 && !strcmp(config.unknown_keys[0], "nope.core"), "%u unknown", (unsigned) config.unknown);
+}
+
+static void test_load_arbiter(void)
+{
+    static supercar_config_load_t config;
+    supercar_staging_t defaults = stage(&supercar_arbiter_section);
+    TEST_CHECK(load(&config, &supercar_arbiter_section,
+        "{\"web\":{\"priority\":50,\"timeout_ms\":2.5},\"gamepad\":{\"priority\":1e12,\"timeout_ms\":100}}") == ESP_OK, "");
+    TEST_CHECK(config.staging.arbiter[SUPERCAR_SOURCE_WEB].priority == 50, "");
+    TEST_CHECK(config.staging.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms == defaults.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms, "");
+    TEST_CHECK(config.staging.arbiter[SUPERCAR_SOURCE_GAMEPAD].priority == defaults.arbiter[SUPERCAR_SOURCE_GAMEPAD].priority, "");
+    TEST_CHECK(config.staging.arbiter[SUPERCAR_SOURCE_GAMEPAD].timeout_ms == 100, "");
+    TEST_CHECK(config.invalid == 2, "%u invalid", (unsigned) config.invalid);
+
+    // The web joystick keeps its deadman, the sources without one may wait for their release
+    TEST_CHECK(load(&config, &supercar_arbiter_section,
+        "{\"web\":{\"timeout_ms\":0},\"pedal\":{\"timeout_ms\":0},\"gamepad\":{\"timeout_ms\":20}}") == ESP_OK, "");
+    TEST_CHECK(config.staging.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms == defaults.arbiter[SUPERCAR_SOURCE_WEB].timeout_ms, "");
+    TEST_CHECK(config.staging.arbiter[SUPERCAR_SOURCE_PEDAL].timeout_ms == 0, "");
+    TEST_CHECK(config.staging.arbiter[SUPERCAR_SOURCE_GAMEPAD].timeout_ms == 20, "");
+    TEST_CHECK(config.invalid == 1, "%u invalid", (unsigned) config.invalid);
+}
+
+int main(void)
+{
+    supercar_config_init();
+    supercar_profiles_init();
+    supercar_arbiter_init();
+    TEST_RUN(test_record_tasks);
+    TEST_RUN(test_record_tasks_invalid);
+    TEST_RUN(test_record_tasks_keys);
+    TEST_RUN(test_record_arbiter);
+    TEST_RUN(test_record_fields);
+    TEST_RUN(test_record_header);
+    TEST_RUN(test_record_checks);
+    TEST_RUN(test_load_tasks);
+    TEST_RUN(test_load_arbiter);
+    return test_failures != 0;
+}
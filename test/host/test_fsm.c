@@ -0,0 +1,162 @@
+/* Every state and event of supercar_fsm.def through supercar_dispatch, checked against the table itself */
+
+#include <stdio.h>
+#include <string.h>
+#include "supercar_main.h"
+#include "test.h"
+
+int test_failures;
+
+/* Calls of the car functions made by the actions */
+static char trace[128];
+
+static void trace_add(const char* call)
+{
+    if (trace[0]) {
+        strlcpy(trace + strlen(trace), " ", sizeof(trace) - strlen(trace));
+    }
+    strlcpy(trace + strlen(trace), call, sizeof(trace) - strlen(trace));
+}
+
+void supercar_start(supercar_t* car, supercar_direction_t direction)
+{
+    trace_add(direction == DIRECTION_FORWARD ? "start(forward)" : direction == DIRECTION_BACKWARD ? "start(backward)" : "start(none)");
+}
+
+void supercar_throttle(supercar_t* car, float speed)
+{
+    char call[32];
+    snprintf(call, sizeof(call), "throttle(%g)", speed);
+    trace_add(call);
+}
+
+void supercar_stop(supercar_t* car)
+{
+    trace_add("stop");
+}
+
+void supercar_reverse(supercar_t* car)
+{
+    trace_add("reverse");
+}
+
+void supercar_read_mode(supercar_t* car)
+{
+    trace_add("read_mode");
+}
+
+typedef struct {
+    supercar_state_t next;
+    const char* action;                 // Name in the table, NULL for a pair that is not listed
+} expected_transition_t;
+
+static expected_transition_t expected[SUPERCAR_STATE_MAX][SUPERCAR_FSM_EVENT_MAX] = {
+#define SUPERCAR_TRANSITION(from, event, to, act) \
+    [SUPERCAR_STATE_##from][SUPERCAR_FSM_##event] = { .next = SUPERCAR_STATE_##to, .action = #act },
+#include "supercar_fsm.def"
+};
+
+static const supercar_control_type_t expected_control_types[SUPERCAR_STATE_MAX] = {
+#define SUPERCAR_STATE(name, control_type, running) [SUPERCAR_STATE_##name] = control_type,
+#include "supercar_fsm.def"
+};
+
+static const supercar_direction_t expected_directions[SUPERCAR_STATE_MAX] = {
+#define SUPERCAR_STATE(name, control_type, running) [SUPERCAR_STATE_##name] = running,
+#include "supercar_fsm.def"
+};
+
+static const char* state_names[SUPERCAR_STATE_MAX] = {
+#define SUPERCAR_STATE(name, control_type, running) [SUPERCAR_STATE_##name] = #name,
+#include "supercar_fsm.def"
+};
+
+static const char* event_names[SUPERCAR_FSM_EVENT_MAX] = {
+#define SUPERCAR_EVENT(name) [SUPERCAR_FSM_##name] = #name,
+#include "supercar_fsm.def"
+};
+
+#define TEST_VALUE 42.5f
+
+/* What each action of supercar_fsm.c calls, a new action has to be added here */
+static const char* expected_calls(const char* action, supercar_state_t next)
+{
+    if (!strcmp(action, "NULL")) {
+        return "";
+    } else if (!strcmp(action, "supercar_fsm_start")) {
+        return expected_directions[next] == DIRECTION_FORWARD ? "start(forward)" : "start(backward)";
+    } else if (!strcmp(action, "supercar_fsm_throttle")) {
+        return "throttle(42.5)";
+    } else if (!strcmp(action, "supercar_fsm_stop")) {
+        return "stop";
+    } else if (!strcmp(action, "supercar_fsm_reverse")) {
+        return "reverse";
+    } else if (!strcmp(action, "supercar_fsm_emergency_stop")) {
+        return "stop reverse";
+    } else if (!strcmp(action, "supercar_fsm_enter_local")) {
+        return "stop read_mode";
+    }
+    return NULL;
+}
+
+static void test_fsm_states(void)
+{
+    supercar_t car;
+    memset(&car, 0, sizeof(car));
+    for (int state = 0; state < SUPERCAR_STATE_MAX; state++) {
+        car.state = state;
+        TEST_CHECK(supercar_get_control_type(&car) == expected_control_types[state], "%s", state_names[state]);
+        TEST_CHECK(supercar_get_running(&car) == expected_directions[state], "%s", state_names[state]);
+        TEST_CHECK(!strcmp(supercar_get_state_name(&car), state_names[state]), "%s", state_names[state]);
+    }
+}
+
+static void test_fsm_transitions(void)
+{
+    supercar_t car;
+    memset(&car, 0, sizeof(car));
+    for (int state = 0; state < SUPERCAR_STATE_MAX; state++) {
+        for (int event = 0; event < SUPERCAR_FSM_EVENT_MAX; event++) {
+            const expected_transition_t* transition = &expected[state][event];
+            // The pairs left out of the table change nothing
+            supercar_state_t next = transition->action ? transition->next : state;
+            const char* calls = transition->action ? expected_calls(transition->action, next) : "";
+            TEST_CHECK(calls != NULL, "unknown action %s", transition->action);
+            if (calls == NULL) {
+                continue;
+            }
+            car.state = state;
+            trace[0] = '\0';
+            supercar_dispatch(&car, event, TEST_VALUE);
+            TEST_CHECK(car.state == next, "%s --%s--> %s instead of %s",
+                state_names[state], event_names[event], state_names[car.state], state_names[next]);
+            TEST_CHECK(!strcmp(trace, calls), "%s --%s--> called \"%s\" instead of \"%s\"",
+                state_names[state], event_names[event], trace, calls);
+        }
+    }
+}
+
+/* Whatever the state, a lost gamepad or an obstacle never leaves the car running */
+static void test_fsm_safety(void)
+{
+    supercar_t car;
+    memset(&car, 0, sizeof(car));
+    for (int state = 0; state < SUPERCAR_STATE_MAX; state++) {
+        car.state = state;
+        supercar_dispatch(&car, SUPERCAR_FSM_GAMEPAD_LOST, 0);
+        TEST_CHECK(expected_control_types[state] == LOCAL || supercar_get_control_type(&car) == LOCAL,
+            "%s keeps the remote control", state_names[state]);
+        car.state = state;
+        supercar_dispatch(&car, SUPERCAR_FSM_OBSTACLE, 0);
+        TEST_CHECK(expected_control_types[state] == REMOTE || supercar_get_running(&car) == DIRECTION_NONE,
+            "%s keeps running", state_names[state]);
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(test_fsm_states);
+    TEST_RUN(test_fsm_transitions);
+    TEST_RUN(test_fsm_safety);
+    return test_failures != 0;
+}
@@ -0,0 +1,307 @@
+/* Streaming JSON writer and parser of supercar_json.c */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "supercar_json.h"
+#include "test.h"
+
+int test_failures;
+
+static void write_document(supercar_json_t* json)
+{
+    supercar_json_begin_object(json, NULL);
+    supercar_json_int(json, "count", 3);
+    supercar_json_begin_object(json, "motor");
+    supercar_json_bool(json, "enabled", true);
+    supercar_json_string(json, "name", "a \"b\"\n");
+    supercar_json_end_object(json);
+    supercar_json_begin_array(json, "pins");
+    supercar_json_int(json, NULL, 4);
+    supercar_json_int(json, NULL, 5);
+    supercar_json_end_array(json);
+    supercar_json_end_object(json);
+}
+
+static void test_json_write(void)
+{
+    char buf[128];
+    supercar_json_t json;
+    supercar_json_init(&json, buf, sizeof(buf), NULL, NULL);
+    write_document(&json);
+    TEST_CHECK(supercar_json_finish(&json) == ESP_OK, "");
+    TEST_CHECK(!strcmp(buf, "{\"count\":3,\"motor\":{\"enabled\":true,\"name\":\"a \\\"b\\\"\\n\"},\"pins\":[4,5]}"), "%s", buf);
+
+    // Without flush a document larger than the buffer is an error
+    supercar_json_init(&json, buf, 16, NULL, NULL);
+    write_document(&json);
+    TEST_CHECK(supercar_json_finish(&json) == ESP_ERR_NO_MEM, "");
+}
+
+/* Whole numbers are written as integers, what JSON cannot carry as null */
+static void test_json_write_numbers(void)
+{
+    char buf[128];
+    supercar_json_t json;
+    supercar_json_init(&json, buf, sizeof(buf), NULL, NULL);
+    supercar_json_begin_array(&json, NULL);
+    supercar_json_number(&json, NULL, 3);
+    supercar_json_number(&json, NULL, -2.5);
+    supercar_json_number(&json, NULL, 1e300);
+    supercar_json_number(&json, NULL, -1e300);
+    supercar_json_number(&json, NULL, NAN);
+    supercar_json_number(&json, NULL, INFINITY);
+    supercar_json_number(&json, NULL, -INFINITY);
+    supercar_json_end_array(&json);
+    TEST_CHECK(supercar_json_finish(&json) == ESP_OK, "");
+    TEST_CHECK(!strcmp(buf, "[3,-2.5,1e+300,-1e+300,null,null,null]"), "%s", buf);
+}
+
+typedef struct {
+    char out[256];
+    size_t len;
+    int flushes;
+} flush_log_t;
+
+static esp_err_t log_flush(void* ctx, const char* data, size_t len)
+{
+    flush_log_t* flushed = ctx;
+    memcpy(flushed->out + flushed->len, data, len);
+    flushed->len += len;
+    flushed->out[flushed->len] = '\0';
+    flushed->flushes++;
+    return ESP_OK;
+}
+
+/* A buffer smaller than the document is flushed as often as needed, the output is the same */
+static void test_json_write_flush(void)
+{
+    char whole[128];
+    supercar_json_t json;
+    supercar_json_init(&json, whole, sizeof(whole), NULL, NULL);
+    write_document(&json);
+    supercar_json_finish(&json);
+
+    char buf[8];
+    flush_log_t flushed = {0};
+    supercar_json_init(&json, buf, sizeof(buf), log_flush, &flushed);
+    write_document(&json);
+    TEST_CHECK(supercar_json_finish(&json) == ESP_OK, "");
+    TEST_CHECK(!strcmp(flushed.out, whole), "%s", flushed.out);
+    TEST_CHECK(flushed.flushes > 1, "%d flushes", flushed.flushes);
+    TEST_CHECK(json.total == strlen(whole), "%zu bytes", json.total);
+}
+
+/* Scalars reported by the parser, as "path=value" separated by spaces */
+typedef struct {
+    char log[512];
+    int calls;
+    int fail_at;                        // Call that returns an error, 0 for none
+} fields_log_t;
+
+static esp_err_t log_field(void* ctx, const char* path, const supercar_json_value_t* value)
+{
+    fields_log_t* fields = ctx;
+    char entry[128];
+    if (++fields->calls == fields->fail_at)
+        return ESP_ERR_NOT_FOUND;
+    switch (value->type) {
+    case SUPERCAR_JSON_NULL:
+        snprintf(entry, sizeof(entry), "%s=null", path);
+        break;
+    case SUPERCAR_JSON_BOOL:
+        snprintf(entry, sizeof(entry), "%s=%s", path, value->boolean ? "true" : "false");
+        break;
+    case SUPERCAR_JSON_NUMBER:
+        snprintf(entry, sizeof(entry), "%s=%g", path, value->number);
+        break;
+    case SUPERCAR_JSON_STRING:
+        snprintf(entry, sizeof(entry), "%s='%s'", path, value->string);
+        break;
+    }
+    if (fields->log[0])
+        strlcpy(fields->log + strlen(fields->log), " ", sizeof(fields->log) - strlen(fields->log));
+    strlcpy(fields->log + strlen(fields->log), entry, sizeof(fields->log) - strlen(fields->log));
+    return ESP_OK;
+}
+
+/* Whole document in chunks of at most chunk bytes, then the end */
+static esp_err_t parse(const char* doc, size_t chunk, fields_log_t* fields, size_t* offset)
+{
+    supercar_json_parser_t parser;
+    size_t len = strlen(doc);
+    esp_err_t err = ESP_OK;
+    supercar_json_parser_init(&parser, log_field, fields);
+    for (size_t i = 0; i < len && err == ESP_OK; i += chunk) {
+        err = supercar_json_parser_feed(&parser, doc + i, len - i < chunk ? len - i : chunk);
+    }
+    if (err == ESP_OK)
+        err = supercar_json_parser_finish(&parser);
+    if (offset)
+        *offset = parser.offset;
+    return err;
+}
+
+static const char* document =
+    "{ \"hid_task\": { \"core\": -1, \"priority\": 5 },\n"
+    "  \"name\": \"car \\\"one\\\" \\u00e9\", \"ratio\": 0.25e1, \"on\": true, \"off\": false, \"none\": null,\n"
+    "  \"pins\": [ 4, 5, { \"x\": 6 } ], \"empty\": {}, \"list\": [] }";
+
+static const char* expected_fields =
+    "hid_task.core=-1 hid_task.priority=5 name='car \"one\" \xc3\xa9' ratio=2.5 on=true off=false none=null "
+    "pins=4 pins=5 pins.x=6";
+
+static void test_json_parse(void)
+{
+    fields_log_t fields = {0};
+    TEST_CHECK(parse(document, strlen(document), &fields, NULL) == ESP_OK, "");
+    TEST_CHECK(!strcmp(fields.log, expected_fields), "%s", fields.log);
+}
+
+/* The body arrives in pieces cut anywhere, in the middle of a name, a number or an escape */
+static void test_json_parse_chunks(void)
+{
+    size_t len = strlen(document);
+    for (size_t chunk = 1; chunk < len; chunk++) {
+        fields_log_t fields = {0};
+        TEST_CHECK(parse(document, chunk, &fields, NULL) == ESP_OK, "chunks of %zu", chunk);
+        TEST_CHECK(!strcmp(fields.log, expected_fields), "chunks of %zu: %s", chunk, fields.log);
+    }
+    // A number at the very end is only complete with the finish
+    fields_log_t fields = {0};
+    TEST_CHECK(parse("12", 1, &fields, NULL) == ESP_OK, "");
+    TEST_CHECK(!strcmp(fields.log, "=12"), "%s", fields.log);
+}
+
+static void test_json_parse_errors(void)
+{
+    static const struct {
+        const char* doc;
+        esp_err_t err;
+        size_t offset;                  // Of the faulty byte
+    } cases[] = {
+        { "{\"a\" 1}", ESP_ERR_INVALID_ARG, 5 },
+        { "{\"a\":1,}", ESP_ERR_INVALID_ARG, 7 },
+        { "[1 2]", ESP_ERR_INVALID_ARG, 3 },
+        { "{\"a\":1]", ESP_ERR_INVALID_ARG, 6 },
+        { "{\"a\":tru}", ESP_ERR_INVALID_ARG, 8 },
+        { "{\"a\":1.2.3}", ESP_ERR_INVALID_ARG, 10 },
+        { "{\"a\":\"\\x\"}", ESP_ERR_INVALID_ARG, 7 },
+        { "{\"a\":\"\\u00g0\"}", ESP_ERR_INVALID_ARG, 10 },
+        { "{\"a\":\"\n\"}", ESP_ERR_INVALID_ARG, 6 },
+        { "{} {}", ESP_ERR_INVALID_ARG, 3 },
+        { "[[[[[[[[[1]]]]]]]]]", ESP_ERR_INVALID_SIZE, 8 },
+        { "{\"a\":1", ESP_ERR_INVALID_STATE, 6 },
+        { "{\"a\":\"b", ESP_ERR_INVALID_STATE, 7 },
+        { "", ESP_ERR_INVALID_STATE, 0 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        fields_log_t fields = {0};
+        size_t offset;
+        esp_err_t err = parse(cases[i].doc, strlen(cases[i].doc), &fields, &offset);
+        TEST_CHECK(err == cases[i].err, "%s: %s", cases[i].doc, esp_err_to_name(err));
+        TEST_CHECK(offset == cases[i].offset, "%s: offset %zu", cases[i].doc, offset);
+    }
+}
+
+static void test_json_parse_limits(void)
+{
+    char doc[256];
+    fields_log_t fields = {0};
+    // A string as long as the token buffer, with its NUL it does not fit
+    snprintf(doc, sizeof(doc), "{\"a\":\"%0*d\"}", SUPERCAR_JSON_MAX_TOKEN, 0);
+    TEST_CHECK(parse(doc, strlen(doc), &fields, NULL) == ESP_ERR_INVALID_SIZE, "");
+    snprintf(doc, sizeof(doc), "{\"a\":\"%0*d\"}", SUPERCAR_JSON_MAX_TOKEN - 1, 0);
+    TEST_CHECK(parse(doc, strlen(doc), &fields, NULL) == ESP_OK, "");
+    // A path longer than the path buffer
+    snprintf(doc, sizeof(doc), "{\"%0*d\":{\"%0*d\":1}}", SUPERCAR_JSON_MAX_PATH / 2, 0, SUPERCAR_JSON_MAX_PATH / 2, 0);
+    TEST_CHECK(parse(doc, strlen(doc), &fields, NULL) == ESP_ERR_INVALID_SIZE, "");
+}
+
+/* The error of a field stops the parser, the next fields are not reported */
+static void test_json_parse_field_error(void)
+{
+    fields_log_t fields = { .fail_at = 2 };
+    TEST_CHECK(parse("{\"a\":1,\"b\":2,\"c\":3}", 1, &fields, NULL) == ESP_ERR_NOT_FOUND, "");
+    TEST_CHECK(fields.calls == 2, "%d calls", fields.calls);
+    TEST_CHECK(!strcmp(fields.log, "a=1"), "%s", fields.log);
+}
+
+static void test_json_get_int(void)
+{
+    static const struct {
+        supercar_json_value_t value;
+        int min;
+        int max;
+        bool valid;
+        int number;
+    } cases[] = {
+        { { .type = SUPERCAR_JSON_NUMBER, .number = 5 }, 0, 10, true, 5 },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = 0 }, 0, 10, true, 0 },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = 10 }, 0, 10, true, 10 },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = -1 }, -1, 1, true, -1 },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = INT_MAX }, 0, INT_MAX, true, INT_MAX },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = 11 }, 0, 10, false },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = -1 }, 0, 10, false },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = 2.5 }, 0, 10, false },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = 1e300 }, 0, INT_MAX, false },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = -1e300 }, INT_MIN, 0, false },
+        { { .type = SUPERCAR_JSON_NUMBER, .number = (double) INT_MAX + 1 }, 0, INT_MAX, false },
+        { { .type = SUPERCAR_JSON_BOOL, .boolean = true }, 0, 10, false },
+        { { .type = SUPERCAR_JSON_STRING, .string = "5" }, 0, 10, false },
+        { { .type = SUPERCAR_JSON_NULL }, 0, 10, false },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int number = 12345;
+        bool valid = supercar_json_get_int(&cases[i].value, cases[i].min, cases[i].max, &number);
+        TEST_CHECK(valid == cases[i].valid, "case %zu", i);
+        TEST_CHECK(number == (valid ? cases[i].number : 12345), "case %zu: %d", i, number);
+    }
+}
+
+/* What the writer produces is read back */
+static void test_json_parse_written(void)
+{
+    char buf[128];
+    supercar_json_t json;
+    supercar_json_init(&json, buf, sizeof(buf), NULL, NULL);
+    write_document(&json);
+    TEST_CHECK(supercar_json_finish(&json) == ESP_OK, "");
+    fields_log_t fields = {0};
+    TEST_CHECK(parse(buf, strlen(buf), &fields, NULL) == ESP_OK, "");
+    TEST_CHECK(!strcmp(fields.log, "count=3 motor.enabled=true motor.name='a \"b\"\n' pins=4 pins=5"), "%s", fields.log);
+}
+
+static void test_json_select(void)
+{
+    char list[] = "motor.name,pins";
+    supercar_json_fields_t fields;
+    TEST_CHECK(supercar_json_fields_parse(&fields, list) == ESP_OK, "");
+    char buf[128];
+    supercar_json_t json;
+    supercar_json_init(&json, buf, sizeof(buf), NULL, NULL);
+    supercar_json_select(&json, &fields);
+    write_document(&json);
+    TEST_CHECK(supercar_json_finish(&json) == ESP_OK, "");
+    TEST_CHECK(!strcmp(buf, "{\"motor\":{\"name\":\"a \\\"b\\\"\\n\"},\"pins\":[4,5]}"), "%s", buf);
+
+    char many[] = "a,b,c,d,e,f,g,h,i";
+    TEST_CHECK(supercar_json_fields_parse(&fields, many) == ESP_ERR_INVALID_SIZE, "");
+}
+
+int main(void)
+{
+    TEST_RUN(test_json_write);
+    TEST_RUN(test_json_write_numbers);
+    TEST_RUN(test_json_write_flush);
+    TEST_RUN(test_json_parse);
+    TEST_RUN(test_json_parse_chunks);
+    TEST_RUN(test_json_parse_errors);
+    TEST_RUN(test_json_parse_limits);
+    TEST_RUN(test_json_parse_field_error);
+    TEST_RUN(test_json_parse_written);
+    TEST_RUN(test_json_get_int);
+    TEST_RUN(test_json_select);
+    return test_failures != 0;
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Check that the API keeps answering while the web UI bundles are downloaded.
+
+Polls an API endpoint alone, then while several clients download the largest asset of index.html in a loop,
+and prints the API latency of both runs.
+
+    tools/http_load.py 10.0.0.120 --downloads 4 --duration 10
+
+The runs are labelled with the Wi-Fi mode of the car, run it once in station mode through the router and once
+joined to the access point of the car to compare them:
+
+    tools/http_load.py 192.168.4.1
+"""
+
+import argparse
+import http.client
+import json
+import re
+import statistics
+import threading
+import time
+
+
+def get(host, path, headers=None):
+    conn = http.client.HTTPConnection(host, timeout=10)
+    try:
+        conn.request('GET', path, headers=headers or {})
+        response = conn.getresponse()
+        return response.status, response.read()
+    finally:
+        conn.close()
+
+
+def largest_asset(host):
+    _, index = get(host, '/')
+    paths = set(re.findall(rb'(?:src|href)="(/[^"]+)"', index))
+    sizes = {}
+    for path in paths:
+        status, body = get(host, path.decode(), {'Accept-Encoding': 'gzip'})
+        if status == 200:
+            sizes[path.decode()] = len(body)
+    return max(sizes, key=sizes.get)
+
+
+def wifi_mode(host):
+    status, body = get(host, '/api/supercar/network')
+    if status != 200:
+        return 'unknown mode'
+    return json.loads(body).get('mode', 'unknown mode')
+
+
+def poll_api(host, path, stop, latencies, errors):
+    conn = http.client.HTTPConnection(host, timeout=10)
+    while not stop.is_set():
+        start = time.monotonic()
+        try:
+            conn.request('GET', path)
+            response = conn.getresponse()
+            response.read()
+            if response.status == 200:
+                latencies.append(time.monotonic() - start)
+            else:
+                errors.append(response.status)
+        except (OSError, http.client.HTTPException) as e:
+            errors.append(type(e).__name__)
+            conn.close()
+            conn = http.client.HTTPConnection(host, timeout=10)
+    conn.close()
+
+
+def download(host, path, stop, done):
+    conn = http.client.HTTPConnection(host, timeout=30)
+    while not stop.is_set():
+        try:
+            conn.request('GET', path, headers={'Accept-Encoding': 'gzip', 'Cache-Control': 'no-cache'})
+            done.append(len(conn.getresponse().read()))
+        except (OSError, http.client.HTTPException):
+            conn.close()
+            conn = http.client.HTTPConnection(host, timeout=30)
+    conn.close()
+
+
+def run(host, api, asset, downloads, duration):
+    stop = threading.Event()
+    latencies, errors, done = [], [], []
+    threads = [threading.Thread(target=poll_api, args=(host, api, stop, latencies, errors))]
+    threads += [threading.Thread(target=download, args=(host, asset, stop, done)) for _ in range(downloads)]
+    for thread in threads:
+        thread.start()
+    time.sleep(duration)
+    stop.set()
+    for thread in threads:
+        thread.join()
+    return latencies, errors, done
+
+
+def report(name, latencies, errors, done, duration):
+    if not latencies:
+        print('{}: no API answer, {} errors'.format(name, len(errors)))
+        return
+    ms = sorted(1000 * latency for latency in latencies)
+    p95 = ms[min(len(ms) - 1, int(len(ms) * 0.95))]
+    print('{}: {} API requests, median {:.1f} ms, p95 {:.1f} ms, max {:.1f} ms, {} errors, {:.1f} KB/s downloaded'.format(
+        name, len(ms), statistics.median(ms), p95, ms[-1], len(errors), sum(done) / 1024 / duration))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('host', help='address of the car')
+    parser.add_argument('--api', default='/api/supercar', help='endpoint polled during the test')
+    parser.add_argument('--asset', help='file to download, the largest one of index.html by default')
+    parser.add_argument('--downloads', type=int, default=4, help='concurrent download clients')
+    parser.add_argument('--duration', type=float, default=10, help='seconds per run')
+    args = parser.parse_args()
+
+    asset = args.asset or largest_asset(args.host)
+    mode = wifi_mode(args.host)
+    print('Downloading {}, Wi-Fi {}'.format(asset, mode))
+    report('{}, API alone'.format(mode), *run(args.host, args.api, asset, 0, args.duration), args.duration)
+    report('{}, API with {} downloads'.format(mode, args.downloads),
+           *run(args.host, args.api, asset, args.downloads, args.duration), args.duration)
+    _, network = get(args.host, '/api/supercar/network')
+    print('Network: {}'.format(network.decode()))
+    _, stats = get(args.host, '/api/supercar/static')
+    print('Server: {}'.format(stats.decode()))
+
+
+if __name__ == '__main__':
+    main()
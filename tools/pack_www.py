@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Pack front/build into the read-only archive served from the www partition.
+
+Layout, little endian, read by main/supercar_www.c:
+
+    header   magic "SCWW", u16 version, u16 count, u32 size
+    entries  count x (u32 path, u32 data, u32 size, u32 gz_data, u32 gz_size, u32 crc), sorted by path
+    paths    NUL terminated, "/index.html"
+    data     4 byte aligned
+
+A "file.gz" written by the front build is stored as the gzip variant of "file" instead of an entry of its own.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b'SCWW'
+VERSION = 1
+HEADER = struct.Struct('<4sHHI')
+ENTRY = struct.Struct('<IIIIII')
+
+
+def collect(root):
+    files = {}
+    for folder, _, names in os.walk(root):
+        for name in names:
+            full = os.path.join(folder, name)
+            path = '/' + os.path.relpath(full, root).replace(os.sep, '/')
+            with open(full, 'rb') as f:
+                files[path] = f.read()
+    plain = {path: data for path, data in files.items() if not (path.endswith('.gz') and path[:-3] in files)}
+    gzipped = {path[:-3]: data for path, data in files.items() if path.endswith('.gz') and path[:-3] in files}
+    return plain, gzipped
+
+
+def align(blob):
+    blob.extend(b'\0' * (-len(blob) % 4))
+
+
+def pack(root):
+    plain, gzipped = collect(root)
+    # The firmware binary searches with strcmp, sort on the same bytes
+    paths = sorted(plain, key=lambda p: p.encode())
+    if len(paths) > 0xffff:
+        raise ValueError('too many files')
+
+    strings = bytearray()
+    path_offsets = []
+    base = HEADER.size + ENTRY.size * len(paths)
+    for path in paths:
+        path_offsets.append(base + len(strings))
+        strings.extend(path.encode() + b'\0')
+    align(strings)
+
+    data = bytearray()
+    entries = bytearray()
+    base += len(strings)
+    for path, path_offset in zip(paths, path_offsets):
+        content = plain[path]
+        offset = base + len(data)
+        data.extend(content)
+        align(data)
+        gz_offset, gz_size = 0, 0
+        if path in gzipped:
+            gz_offset, gz_size = base + len(data), len(gzipped[path])
+            data.extend(gzipped[path])
+            align(data)
+        entries.extend(ENTRY.pack(path_offset, offset, len(content), gz_offset, gz_size, zlib.crc32(content)))
+
+    size = base + len(data)
+    return HEADER.pack(MAGIC, VERSION, len(paths), size) + entries + strings + data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('source', help='front build folder')
+    parser.add_argument('output', help='archive to write')
+    parser.add_argument('--size', type=lambda x: int(x, 0), help='partition size, the archive must fit')
+    args = parser.parse_args()
+
+    archive = pack(args.source)
+    if args.size is not None and len(archive) > args.size:
+        sys.exit('{} bytes do not fit the {} bytes partition'.format(len(archive), args.size))
+    with open(args.output, 'wb') as f:
+        f.write(archive)
+    print('Packed {} into {} ({} bytes)'.format(args.source, args.output, len(archive)))
+
+
+if __name__ == '__main__':
+    main()